@@ -0,0 +1,210 @@
+#include "PixGainFit.hh"
+
+#include <cmath>
+#include <algorithm>
+
+#include "threadpool.h"
+
+using namespace std;
+
+namespace {
+  const int NPIX(4160);
+
+  // -- parameter limits and start values as in PixInitFunc::gpTanH() for the 0..260 ADC display range
+  const double P0LO(1.e-3), P0HI(2.e-3), P1LO(0.), P1HI(20.), P2LO(0.), P2HI(520.);
+
+  void clampPar(double *p) {
+    p[0] = max(P0LO, min(P0HI, p[0]));
+    p[1] = max(P1LO, min(P1HI, p[1]));
+    p[2] = max(P2LO, min(P2HI, p[2]));
+  }
+
+  // -- solve the 4x4 system a*x = b in place, returns false if singular
+  bool solve4(double a[4][4], double *b) {
+    for (int i = 0; i < 4; ++i) {
+      int piv = i;
+      for (int j = i+1; j < 4; ++j) if (fabs(a[j][i]) > fabs(a[piv][i])) piv = j;
+      if (fabs(a[piv][i]) < 1.e-300) return false;
+      if (piv != i) {
+	for (int k = 0; k < 4; ++k) swap(a[i][k], a[piv][k]);
+	swap(b[i], b[piv]);
+      }
+      for (int j = i+1; j < 4; ++j) {
+	double f = a[j][i]/a[i][i];
+	for (int k = i; k < 4; ++k) a[j][k] -= f*a[i][k];
+	b[j] -= f*b[i];
+      }
+    }
+    for (int i = 3; i >= 0; --i) {
+      for (int k = i+1; k < 4; ++k) b[i] -= a[i][k]*b[k];
+      b[i] /= a[i][i];
+    }
+    return true;
+  }
+
+  // -- every item fits one pixel, the results go into fixed slots
+  class gainFitJob: public pxar::threadJob {
+  public:
+    gainFitJob(PixGainFitter &fitter, PixGainData &data, vector<vector<gainPedestalParameters> > &par, vector<char> &status) :
+      fFitter(fitter), fData(data), fPar(par), fStatus(status) {}
+    void process(size_t item) {
+      unsigned int iroc = item/NPIX;
+      int ipx = item%NPIX;
+      if (0 == fData.nValid(iroc, ipx)) return;
+      fStatus[item] = fFitter.fitPixel(fData, iroc, ipx, fPar[iroc][ipx]) ? 1 : 2;
+    }
+  private:
+    PixGainFitter &fFitter;
+    PixGainData &fData;
+    vector<vector<gainPedestalParameters> > &fPar;
+    vector<char> &fStatus;
+  };
+}
+
+
+// ----------------------------------------------------------------------
+PixGainData::PixGainData(unsigned int nrocs, vector<double> vcal) : fNRocs(nrocs), fVcal(vcal) {
+  size_t n = static_cast<size_t>(nrocs)*NPIX*vcal.size();
+  fPh.resize(n, 0.);
+  fErr.resize(n, 0.);
+  fValid.resize(n, 0);
+}
+
+// ----------------------------------------------------------------------
+void PixGainData::fill(unsigned int iroc, int col, int row, unsigned int ipoint, double ph, double err) {
+  if (iroc >= fNRocs || col < 0 || col >= 52 || row < 0 || row >= 80 || ipoint >= fVcal.size()) return;
+  size_t i = index(iroc, col*80 + row, ipoint);
+  fPh[i] = ph;
+  fErr[i] = err;
+  fValid[i] = 1;
+}
+
+// ----------------------------------------------------------------------
+unsigned int PixGainData::nValid(unsigned int iroc, int ipx) {
+  unsigned int n(0);
+  size_t i0 = index(iroc, ipx, 0);
+  for (unsigned int i = 0; i < fVcal.size(); ++i) n += fValid[i0 + i];
+  return n;
+}
+
+
+// ----------------------------------------------------------------------
+PixGainFitter::PixGainFitter(unsigned int nthreads) : fNThreads(nthreads), fMaxChi2Ndf(100.) {
+}
+
+// ----------------------------------------------------------------------
+vector<pair<unsigned int, int> > PixGainFitter::fit(PixGainData &data, vector<vector<gainPedestalParameters> > &par) {
+  gainPedestalParameters a; a.p0 = a.p1 = a.p2 = a.p3 = 0.;
+  par.assign(data.getNRocs(), vector<gainPedestalParameters>(NPIX, a));
+
+  // -- 0: no data, 1: fit ok, 2: fit failed
+  vector<char> status(static_cast<size_t>(data.getNRocs())*NPIX, 0);
+  gainFitJob job(*this, data, par, status);
+  if (0 == fNThreads) {
+    pxar::threadPool::shared().run(job, status.size());
+  } else {
+    pxar::threadPool pool(fNThreads);
+    pool.run(job, status.size());
+  }
+
+  vector<pair<unsigned int, int> > failed;
+  for (size_t i = 0; i < status.size(); ++i) {
+    if (2 == status[i]) failed.push_back(make_pair(static_cast<unsigned int>(i/NPIX), static_cast<int>(i%NPIX)));
+  }
+  return failed;
+}
+
+// ----------------------------------------------------------------------
+double PixGainFitter::chi2(vector<double> &x, vector<double> &y, vector<double> &w, double *p) {
+  double c2(0.);
+  for (unsigned int i = 0; i < x.size(); ++i) {
+    double r = y[i] - (p[3] + p[2]*tanh(p[0]*x[i] - p[1]));
+    c2 += w[i]*r*r;
+  }
+  return c2;
+}
+
+// ----------------------------------------------------------------------
+bool PixGainFitter::fitPixel(PixGainData &data, unsigned int iroc, int ipx, gainPedestalParameters &par) {
+  vector<double> x, y, w;
+  double ymin(1.e30), ymax(-1.e30), xmid(0.);
+  for (unsigned int i = 0; i < data.getNPoints(); ++i) {
+    if (!data.valid(iroc, ipx, i)) continue;
+    double err = data.err(iroc, ipx, i);
+    x.push_back(data.vcal(i));
+    y.push_back(data.ph(iroc, ipx, i));
+    w.push_back(err > 0. ? 1./(err*err) : 1.);
+    ymin = min(ymin, y.back());
+    ymax = max(ymax, y.back());
+  }
+  if (x.size() < getMinPoints()) return false;
+
+  // -- second start point: centre the tanh on the measured PH range
+  for (unsigned int i = 0; i < x.size(); ++i) {
+    if (y[i] >= 0.5*(ymin + ymax)) {xmid = x[i]; break;}
+  }
+
+  double best[4] = {0., 0., 0., 0.};
+  double bestChi2(-1.);
+  for (int istart = 0; istart < 2; ++istart) {
+    double p[4];
+    if (0 == istart) {
+      p[0] = 1.4e-3; p[1] = 0.8; p[2] = 260.; p[3] = 0.;
+    } else {
+      p[0] = 1.4e-3; p[1] = p[0]*xmid; p[2] = 0.5*(ymax - ymin) + 1.; p[3] = 0.5*(ymax + ymin);
+    }
+    clampPar(p);
+
+    // -- Levenberg-Marquardt
+    double c2 = chi2(x, y, w, p);
+    double lambda(1.e-3);
+    for (int iter = 0; iter < 200 && lambda < 1.e8; ++iter) {
+      double jtj[4][4] = {{0.}}, jtr[4] = {0., 0., 0., 0.};
+      for (unsigned int i = 0; i < x.size(); ++i) {
+	double t = tanh(p[0]*x[i] - p[1]);
+	double d = p[2]*(1. - t*t);
+	double g[4] = {d*x[i], -d, t, 1.};
+	double r = y[i] - (p[3] + p[2]*t);
+	for (int k = 0; k < 4; ++k) {
+	  jtr[k] += w[i]*g[k]*r;
+	  for (int l = 0; l < 4; ++l) jtj[k][l] += w[i]*g[k]*g[l];
+	}
+      }
+
+      double a[4][4], step[4];
+      for (int k = 0; k < 4; ++k) {
+	for (int l = 0; l < 4; ++l) a[k][l] = jtj[k][l];
+	a[k][k] *= (1. + lambda);
+	if (a[k][k] == 0.) a[k][k] = lambda;
+	step[k] = jtr[k];
+      }
+      if (!solve4(a, step)) {lambda *= 10.; continue;}
+
+      double pn[4];
+      for (int k = 0; k < 4; ++k) pn[k] = p[k] + step[k];
+      clampPar(pn);
+      double c2n = chi2(x, y, w, pn);
+      if (c2n == c2n && c2n < c2) {
+	bool done = (c2 - c2n < 1.e-8*c2 + 1.e-12);
+	for (int k = 0; k < 4; ++k) p[k] = pn[k];
+	c2 = c2n;
+	lambda *= 0.1;
+	if (done) break;
+      } else {
+	lambda *= 10.;
+      }
+    }
+
+    if (c2 == c2 && (bestChi2 < 0. || c2 < bestChi2)) {
+      bestChi2 = c2;
+      for (int k = 0; k < 4; ++k) best[k] = p[k];
+    }
+    if (bestChi2 >= 0. && bestChi2/(x.size() - 4) <= fMaxChi2Ndf) break;
+  }
+
+  par.p0 = best[0];
+  par.p1 = best[1];
+  par.p2 = best[2];
+  par.p3 = best[3];
+  return (bestChi2 >= 0. && bestChi2/(x.size() - 4) <= fMaxChi2Ndf);
+}
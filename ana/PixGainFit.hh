@@ -0,0 +1,71 @@
+#ifndef PIXGAINFIT_H
+#define PIXGAINFIT_H
+
+#include "pxardllexport.h"
+
+#include <vector>
+#include <utility>
+
+#include "ConfigParameters.hh"
+
+// ----------------------------------------------------------------------
+/// Gain/pedestal samples (vcal, ph, err) of all pixels in one contiguous
+/// array. Pixels are addressed by ROC index and pixel index col*80+row,
+/// samples by the index of the calibration point. The vcal of a point is
+/// given in low range units.
+// ----------------------------------------------------------------------
+class DLLEXPORT PixGainData {
+public:
+  PixGainData(unsigned int nrocs, std::vector<double> vcal);
+
+  /// store the measured pulse height of one pixel for calibration point ipoint
+  void fill(unsigned int iroc, int col, int row, unsigned int ipoint, double ph, double err);
+
+  unsigned int getNRocs() {return fNRocs;}
+  unsigned int getNPoints() {return fVcal.size();}
+  double vcal(unsigned int ipoint) {return fVcal[ipoint];}
+  bool   valid(unsigned int iroc, int ipx, unsigned int ipoint) {return 0 != fValid[index(iroc, ipx, ipoint)];}
+  double ph(unsigned int iroc, int ipx, unsigned int ipoint) {return fPh[index(iroc, ipx, ipoint)];}
+  double err(unsigned int iroc, int ipx, unsigned int ipoint) {return fErr[index(iroc, ipx, ipoint)];}
+  /// number of calibration points measured for a pixel
+  unsigned int nValid(unsigned int iroc, int ipx);
+
+private:
+  size_t index(unsigned int iroc, int ipx, unsigned int ipoint) {return (static_cast<size_t>(iroc)*4160 + ipx)*fVcal.size() + ipoint;}
+
+  unsigned int         fNRocs;
+  std::vector<double>  fVcal;
+  std::vector<double>  fPh, fErr;
+  std::vector<char>    fValid;
+};
+
+// ----------------------------------------------------------------------
+/// Least-squares fit of ph = p3 + p2*tanh(p0*vcal - p1) to all pixels of a
+/// PixGainData set, spread over a pool of threads. The fits work on the
+/// plain arrays only (Levenberg-Marquardt with the parameter limits of
+/// PixInitFunc::gpTanH) and do not touch any ROOT object, so they are safe
+/// to run concurrently.
+// ----------------------------------------------------------------------
+class DLLEXPORT PixGainFitter {
+public:
+  /// nthreads = 0: the process-wide pxar::threadPool::shared()
+  PixGainFitter(unsigned int nthreads = 0);
+
+  /// fit all pixels with at least getMinPoints() samples; fills par[iroc][ipx]
+  /// and returns the (ROC index, pixel index) of all pixels whose fit failed
+  std::vector<std::pair<unsigned int, int> > fit(PixGainData &data, std::vector<std::vector<gainPedestalParameters> > &par);
+
+  /// fit a single pixel, returns false if the fit did not converge to a sensible result
+  bool fitPixel(PixGainData &data, unsigned int iroc, int ipx, gainPedestalParameters &par);
+
+  void setMaxChi2Ndf(double x) {fMaxChi2Ndf = x;}
+  unsigned int getMinPoints() {return 5;}
+
+private:
+  double chi2(std::vector<double> &x, std::vector<double> &y, std::vector<double> &w, double *p);
+
+  unsigned int fNThreads;
+  double       fMaxChi2Ndf;
+};
+
+#endif
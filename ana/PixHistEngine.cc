@@ -0,0 +1,411 @@
+#include "PixHistEngine.hh"
+
+#include <TH1.h>
+#include <TH2.h>
+#include <TProfile2D.h>
+#include <TArrayD.h>
+#include <TThread.h>
+#include <TCondition.h>
+
+#include <algorithm>
+
+#include "PHCalibration.hh"
+#include "PixTreeWriter.hh"
+#include "log.h"
+
+using namespace std;
+using namespace pxar;
+
+namespace {
+  const int NCOL(52), NROW(80);
+}
+
+// ----------------------------------------------------------------------
+PixHistData::PixHistData() : fNEvents(0), fNHits(0), fRocs(),
+  fPhBins(0), fQBins(0), fPhMin(0.), fPhMax(0.), fQMin(0.), fQMax(0.) {
+}
+
+// ----------------------------------------------------------------------
+PixHistData::PixHistData(unsigned int nrocs, int phBins, double phMin, double phMax, int qBins, double qMin, double qMax) :
+  fNEvents(0), fNHits(0), fRocs(nrocs),
+  fPhBins(phBins), fQBins(qBins), fPhMin(phMin), fPhMax(phMax), fQMin(qMin), fQMax(qMax) {
+  for (unsigned int i = 0; i < nrocs; ++i) {
+    PixHistRoc &r = fRocs[i];
+    r.hits.resize(NCOL*NROW, 0);
+    r.phSum.resize(NCOL*NROW, 0.);
+    r.phSum2.resize(NCOL*NROW, 0.);
+    r.qSum.resize(NCOL*NROW, 0.);
+    r.qSum2.resize(NCOL*NROW, 0.);
+    r.ph.resize(phBins+2, 0);
+    r.q.resize(qBins+2, 0);
+    r.dirty = false;
+  }
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fill(unsigned int idx, int col, int row, double ph, double q) {
+  if (idx >= fRocs.size() || col < 0 || col >= NCOL || row < 0 || row >= NROW) return;
+  PixHistRoc &r = fRocs[idx];
+  int ipx = col*NROW + row;
+  ++r.hits[ipx];
+  r.phSum[ipx]  += ph;
+  r.phSum2[ipx] += ph*ph;
+  r.qSum[ipx]   += q;
+  r.qSum2[ipx]  += q*q;
+  ++r.ph[spectrumBin(ph, fPhBins, fPhMin, fPhMax)];
+  ++r.q[spectrumBin(q, fQBins, fQMin, fQMax)];
+  r.dirty = true;
+  ++fNHits;
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::clear() {
+  for (unsigned int i = 0; i < fRocs.size(); ++i) {
+    PixHistRoc &r = fRocs[i];
+    if (!r.dirty) continue;
+    fill_n(r.hits.begin(), r.hits.size(), 0);
+    fill_n(r.phSum.begin(), r.phSum.size(), 0.);
+    fill_n(r.phSum2.begin(), r.phSum2.size(), 0.);
+    fill_n(r.qSum.begin(), r.qSum.size(), 0.);
+    fill_n(r.qSum2.begin(), r.qSum2.size(), 0.);
+    fill_n(r.ph.begin(), r.ph.size(), 0);
+    fill_n(r.q.begin(), r.q.size(), 0);
+    r.dirty = false;
+  }
+  fNEvents = 0;
+  fNHits = 0;
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::add(PixHistData &other) {
+  fNEvents += other.fNEvents;
+  fNHits += other.fNHits;
+  for (unsigned int i = 0; i < fRocs.size() && i < other.fRocs.size(); ++i) {
+    PixHistRoc &r = fRocs[i];
+    PixHistRoc &o = other.fRocs[i];
+    if (!o.dirty) continue;
+    for (unsigned int ipx = 0; ipx < r.hits.size(); ++ipx) {
+      if (0 == o.hits[ipx]) continue;
+      r.hits[ipx]   += o.hits[ipx];
+      r.phSum[ipx]  += o.phSum[ipx];
+      r.phSum2[ipx] += o.phSum2[ipx];
+      r.qSum[ipx]   += o.qSum[ipx];
+      r.qSum2[ipx]  += o.qSum2[ipx];
+    }
+    for (unsigned int ib = 0; ib < r.ph.size(); ++ib) r.ph[ib] += o.ph[ib];
+    for (unsigned int ib = 0; ib < r.q.size(); ++ib) r.q[ib] += o.q[ib];
+    r.dirty = true;
+  }
+}
+
+// ----------------------------------------------------------------------
+int PixHistData::spectrumBin(double x, int nbins, double xmin, double xmax) {
+  if (x < xmin) return 0;
+  if (x >= xmax) return nbins+1;
+  return 1 + static_cast<int>(nbins*(x - xmin)/(xmax - xmin));
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillHits(unsigned int idx, TH2D *h2) {
+  if (idx >= fRocs.size() || 0 == h2) return;
+  PixHistRoc &r = fRocs[idx];
+  h2->Reset();
+  double nhits(0.);
+  for (int ic = 0; ic < NCOL; ++ic) {
+    for (int ir = 0; ir < NROW; ++ir) {
+      uint32_t n = r.hits[ic*NROW + ir];
+      if (0 == n) continue;
+      h2->SetBinContent(ic+1, ir+1, n);
+      nhits += n;
+    }
+  }
+  h2->SetEntries(nhits);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillPhMap(unsigned int idx, TProfile2D *p2) {
+  if (idx >= fRocs.size()) return;
+  fillMap(fRocs[idx].hits, fRocs[idx].phSum, fRocs[idx].phSum2, p2);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillQMap(unsigned int idx, TProfile2D *p2) {
+  if (idx >= fRocs.size()) return;
+  fillMap(fRocs[idx].hits, fRocs[idx].qSum, fRocs[idx].qSum2, p2);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillMap(vector<uint32_t> &n, vector<double> &sum, vector<double> &sum2, TProfile2D *p2) {
+  if (0 == p2) return;
+  p2->Reset();
+  // -- a TProfile2D stores the sum of values in the bin content and the sum of squares in fSumw2
+  TArrayD *sumw2 = p2->GetSumw2();
+  double nhits(0.);
+  for (int ic = 0; ic < NCOL; ++ic) {
+    for (int ir = 0; ir < NROW; ++ir) {
+      int ipx = ic*NROW + ir;
+      if (0 == n[ipx]) continue;
+      int bin = p2->GetBin(ic+1, ir+1);
+      p2->SetBinEntries(bin, n[ipx]);
+      p2->SetBinContent(bin, sum[ipx]);
+      if (sumw2 && bin < sumw2->GetSize()) sumw2->fArray[bin] = sum2[ipx];
+      nhits += n[ipx];
+    }
+  }
+  p2->SetEntries(nhits);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillPh(unsigned int idx, TH1D *h1) {
+  if (idx >= fRocs.size()) return;
+  fillSpectrum(fRocs[idx].ph, h1);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillQ(unsigned int idx, TH1D *h1) {
+  if (idx >= fRocs.size()) return;
+  fillSpectrum(fRocs[idx].q, h1);
+}
+
+// ----------------------------------------------------------------------
+void PixHistData::fillSpectrum(vector<uint32_t> &n, TH1D *h1) {
+  if (0 == h1) return;
+  if (h1->GetNbinsX() + 2 != static_cast<int>(n.size())) {
+    LOG(logWARNING) << "PixHistData: binning of " << h1->GetName() << " does not match the online histogram";
+    return;
+  }
+  h1->Reset();
+  double nhits(0.);
+  for (unsigned int ib = 0; ib < n.size(); ++ib) {
+    h1->SetBinContent(ib, n[ib]);
+    nhits += n[ib];
+  }
+  h1->SetEntries(nhits);
+}
+
+
+// ----------------------------------------------------------------------
+PixHistShard::PixHistShard(PixHistEngine *engine) : fEngine(engine), fDiscard(false) {
+  fLocal   = engine->emptyData();
+  fPending = engine->emptyData();
+}
+
+// ----------------------------------------------------------------------
+void PixHistShard::fill(uint8_t rocId, int col, int row, double ph, double q) {
+  int idx = fEngine->getIdxFromId(rocId);
+  if (idx < 0) return;
+  fLocal.fill(idx, col, row, ph, q);
+}
+
+// ----------------------------------------------------------------------
+bool PixHistShard::publish() {
+  if (0 != fMutex.TryLock()) return false;
+  moveLocal();
+  fMutex.UnLock();
+  return true;
+}
+
+// ----------------------------------------------------------------------
+void PixHistShard::flush() {
+  fMutex.Lock();
+  moveLocal();
+  fMutex.UnLock();
+}
+
+// ----------------------------------------------------------------------
+void PixHistShard::moveLocal() {
+  // -- called with fMutex held
+  if (!fDiscard) fPending.add(fLocal);
+  fDiscard = false;
+  fLocal.clear();
+}
+
+
+// ----------------------------------------------------------------------
+PixHistEngine::PixHistEngine(vector<uint8_t> rocIds, int phBins, double phMin, double phMax,
+			     int qBins, double qMin, double qMax) :
+  fId2Idx(256, -1), fNRocs(rocIds.size()),
+  fPhBins(phBins), fQBins(qBins), fPhMin(phMin), fPhMax(phMax), fQMin(qMin), fQMax(qMax) {
+  for (unsigned int i = 0; i < rocIds.size(); ++i) fId2Idx[rocIds[i]] = i;
+  fTotal = emptyData();
+}
+
+// ----------------------------------------------------------------------
+PixHistEngine::PixHistEngine(vector<uint8_t> rocIds, TH1D *ph, TH1D *q) :
+  fId2Idx(256, -1), fNRocs(rocIds.size()),
+  fPhBins(ph->GetNbinsX()), fQBins(q->GetNbinsX()),
+  fPhMin(ph->GetXaxis()->GetXmin()), fPhMax(ph->GetXaxis()->GetXmax()),
+  fQMin(q->GetXaxis()->GetXmin()), fQMax(q->GetXaxis()->GetXmax()) {
+  for (unsigned int i = 0; i < rocIds.size(); ++i) fId2Idx[rocIds[i]] = i;
+  fTotal = emptyData();
+}
+
+// ----------------------------------------------------------------------
+PixHistEngine::~PixHistEngine() {
+  for (unsigned int i = 0; i < fShards.size(); ++i) delete fShards[i];
+  fShards.clear();
+}
+
+// ----------------------------------------------------------------------
+PixHistData PixHistEngine::emptyData() {
+  return PixHistData(fNRocs, fPhBins, fPhMin, fPhMax, fQBins, fQMin, fQMax);
+}
+
+// ----------------------------------------------------------------------
+PixHistShard* PixHistEngine::newShard() {
+  PixHistShard *s = new PixHistShard(this);
+  fMutex.Lock();
+  fShards.push_back(s);
+  fMutex.UnLock();
+  return s;
+}
+
+// ----------------------------------------------------------------------
+uint64_t PixHistEngine::snapshot(PixHistData &data) {
+  fMutex.Lock();
+  for (unsigned int i = 0; i < fShards.size(); ++i) {
+    fShards[i]->fMutex.Lock();
+    fTotal.add(fShards[i]->fPending);
+    fShards[i]->fPending.clear();
+    fShards[i]->fMutex.UnLock();
+  }
+  data = fTotal;
+  uint64_t nhits = fTotal.getNHits();
+  fMutex.UnLock();
+  return nhits;
+}
+
+// ----------------------------------------------------------------------
+void PixHistEngine::reset() {
+  fMutex.Lock();
+  for (unsigned int i = 0; i < fShards.size(); ++i) {
+    fShards[i]->fMutex.Lock();
+    fShards[i]->fPending.clear();
+    fShards[i]->fDiscard = true;
+    fShards[i]->fMutex.UnLock();
+  }
+  fTotal.clear();
+  fMutex.UnLock();
+}
+
+
+// ----------------------------------------------------------------------
+PixHistFiller::PixHistFiller(PixHistEngine *engine, PHCalibration *phcal, size_t maxEvents) :
+  fEngine(engine), fShard(engine->newShard()), fPhCal(phcal), fWriter(0), fMaxEvents(maxEvents),
+  fThread(0), fMutex(new TMutex()), fWork(0), fIdle(0),
+  fNQueued(0), fBusy(false), fStop(false), fNDropped(0) {
+  fWork = new TCondition(fMutex);
+  fIdle = new TCondition(fMutex);
+}
+
+// ----------------------------------------------------------------------
+PixHistFiller::~PixHistFiller() {
+  stop();
+  delete fIdle;
+  delete fWork;
+  delete fMutex;
+}
+
+// ----------------------------------------------------------------------
+void PixHistFiller::start() {
+  if (fThread) return;
+  fStop = false;
+  TThread::Initialize();
+  fThread = new TThread("histfiller", &PixHistFiller::run, this);
+  fThread->Run();
+}
+
+// ----------------------------------------------------------------------
+size_t PixHistFiller::push(vector<Event> &evts) {
+  size_t n = evts.size();
+  if (0 == n) return 0;
+
+  fMutex->Lock();
+  if (0 == fThread || fNQueued + n > fMaxEvents) {
+    if (0 == fNDropped) {
+      LOG(logWARNING) << "PixHistFiller: " << (fThread ? "queue full" : "filler not running") << ", dropping events";
+    }
+    fNDropped += n;
+    fMutex->UnLock();
+    // -- not histogrammed, but the tree writer may still take them
+    if (fWriter) fWriter->push(evts);
+    evts.clear();
+    return n;
+  }
+  // -- take over the events without copying them
+  fQueue.push_back(vector<Event>());
+  fQueue.back().swap(evts);
+  fNQueued += n;
+  fWork->Signal();
+  fMutex->UnLock();
+  return 0;
+}
+
+// ----------------------------------------------------------------------
+void PixHistFiller::drain() {
+  fMutex->Lock();
+  while (fThread && (!fQueue.empty() || fBusy)) fIdle->Wait();
+  fMutex->UnLock();
+}
+
+// ----------------------------------------------------------------------
+void PixHistFiller::stop() {
+  if (0 == fThread) return;
+
+  fMutex->Lock();
+  fStop = true;
+  fWork->Signal();
+  fMutex->UnLock();
+
+  fThread->Join();
+  delete fThread;
+  fThread = 0;
+}
+
+// ----------------------------------------------------------------------
+void* PixHistFiller::run(void *arg) {
+  static_cast<PixHistFiller*>(arg)->loop();
+  return 0;
+}
+
+// ----------------------------------------------------------------------
+void PixHistFiller::loop() {
+  vector<Event> batch;
+  fMutex->Lock();
+  while (true) {
+    while (fQueue.empty() && !fStop) fWork->Wait();
+    if (fQueue.empty()) break;
+
+    batch.swap(fQueue.front());
+    fQueue.pop_front();
+    fBusy = true;
+    fMutex->UnLock();
+
+    fill(batch);
+    // -- this thread may wait for a running snapshot, the readout does not
+    fShard->flush();
+    size_t n = batch.size();
+    // -- the tree writer takes over the batch, again without copying
+    if (fWriter) fWriter->push(batch);
+    batch.clear();
+
+    fMutex->Lock();
+    fNQueued -= n;
+    fBusy = false;
+    if (fQueue.empty()) fIdle->Broadcast();
+  }
+  fIdle->Broadcast();
+  fMutex->UnLock();
+}
+
+// ----------------------------------------------------------------------
+void PixHistFiller::fill(vector<Event> &evts) {
+  for (vector<Event>::iterator it = evts.begin(); it != evts.end(); ++it) {
+    fShard->fillEvent();
+    for (vector<pixel>::iterator px = it->pixels.begin(); px != it->pixels.end(); ++px) {
+      double ph = px->getValue();
+      double q = (fPhCal ? static_cast<uint16_t>(fPhCal->vcal(px->roc_id, px->column, px->row, ph)) : 0);
+      fShard->fill(px->roc_id, px->column, px->row, ph, q);
+    }
+  }
+}
@@ -0,0 +1,203 @@
+#ifndef PIXHISTENGINE_H
+#define PIXHISTENGINE_H
+
+#include "pxardllexport.h"
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+#include <TMutex.h>
+
+#include "api.h"
+
+class TH1D;
+class TH2D;
+class TProfile2D;
+class TThread;
+class TCondition;
+class PHCalibration;
+class PixTreeWriter;
+
+// ----------------------------------------------------------------------
+/// Online histograms of one ROC in plain arrays: 52x80 hit, PH-sum and
+/// charge-sum maps (with sums of squares for the profile errors) and 1D
+/// PH and charge spectra (bin 0 is the underflow, bin nbins+1 the overflow)
+// ----------------------------------------------------------------------
+struct DLLEXPORT PixHistRoc {
+  std::vector<uint32_t> hits;
+  std::vector<double>   phSum, phSum2;
+  std::vector<double>   qSum, qSum2;
+  std::vector<uint32_t> ph;
+  std::vector<uint32_t> q;
+  bool                  dirty;
+};
+
+// ----------------------------------------------------------------------
+/// Set of online histograms for all ROCs. This is what the filling shards
+/// accumulate and what PixHistEngine::snapshot() returns. The fillXXX()
+/// functions copy the content into booked ROOT histograms for display.
+// ----------------------------------------------------------------------
+class DLLEXPORT PixHistData {
+public:
+  PixHistData();
+  PixHistData(unsigned int nrocs, int phBins, double phMin, double phMax, int qBins, double qMin, double qMax);
+
+  void fill(unsigned int idx, int col, int row, double ph, double q);
+  void clear();
+  void add(PixHistData &other);
+
+  void fillHits(unsigned int idx, TH2D *h2);
+  void fillPhMap(unsigned int idx, TProfile2D *p2);
+  void fillQMap(unsigned int idx, TProfile2D *p2);
+  void fillPh(unsigned int idx, TH1D *h1);
+  void fillQ(unsigned int idx, TH1D *h1);
+
+  unsigned int getNRocs() {return fRocs.size();}
+  PixHistRoc&  getRoc(unsigned int idx) {return fRocs[idx];}
+  uint64_t     getNEvents() {return fNEvents;}
+  uint64_t     getNHits() {return fNHits;}
+
+  uint64_t fNEvents;
+  uint64_t fNHits;
+
+private:
+  int spectrumBin(double x, int nbins, double xmin, double xmax);
+  void fillMap(std::vector<uint32_t> &n, std::vector<double> &sum, std::vector<double> &sum2, TProfile2D *p2);
+  void fillSpectrum(std::vector<uint32_t> &n, TH1D *h1);
+
+  std::vector<PixHistRoc> fRocs;
+  int    fPhBins, fQBins;
+  double fPhMin, fPhMax, fQMin, fQMax;
+};
+
+class PixHistEngine;
+
+// ----------------------------------------------------------------------
+/// Filling handle of one thread. fill() only touches thread-local arrays.
+/// publish() hands the local content over to the engine without ever
+/// blocking: if a snapshot is being taken at that moment the data simply
+/// stays local until the next publish().
+// ----------------------------------------------------------------------
+class DLLEXPORT PixHistShard {
+public:
+  /// fill one pixel hit of the ROC with ID rocId
+  void fill(uint8_t rocId, int col, int row, double ph, double q);
+  /// count one event
+  void fillEvent() {++fLocal.fNEvents;}
+  /// hand the local content over to the engine, returns false if this has to be retried later
+  bool publish();
+  /// hand the local content over to the engine, waiting for a running snapshot if needed
+  void flush();
+
+private:
+  friend class PixHistEngine;
+  PixHistShard(PixHistEngine *engine);
+  ~PixHistShard() {}
+  void moveLocal();
+
+  PixHistEngine    *fEngine;
+  PixHistData       fLocal, fPending;
+  bool              fDiscard;
+  TMutex            fMutex;
+};
+
+// ----------------------------------------------------------------------
+/// Lightweight online histogramming for DAQ type tests.
+///
+/// - filling threads each get their own PixHistShard with newShard()
+///   and fill without any locking (see PixHistFiller for a filling thread)
+/// - the display side pulls merged copies with snapshot() and converts them
+///   to ROOT histograms only for drawing (see PixHistData::fillXXX())
+/// - the engine keeps accumulating until reset()
+// ----------------------------------------------------------------------
+class DLLEXPORT PixHistEngine {
+public:
+  PixHistEngine(std::vector<uint8_t> rocIds, int phBins = 256, double phMin = 0., double phMax = 256.,
+		int qBins = 200, double qMin = 0., double qMax = 1000.);
+  /// spectra with the binning of the booked ROOT histograms ph and q
+  PixHistEngine(std::vector<uint8_t> rocIds, TH1D *ph, TH1D *q);
+  ~PixHistEngine();
+
+  /// create a filling handle, owned by the engine; use one per filling thread
+  PixHistShard* newShard();
+  /// merge everything published so far and copy it into data; returns the total number of published hits
+  uint64_t snapshot(PixHistData &data);
+  /// clear all histograms; to be called while no filling is going on, content
+  /// still local to the shards is discarded at their next publish()
+  void reset();
+  /// index of the ROC with ID rocId, -1 if it is not known to the engine
+  int getIdxFromId(uint8_t rocId) {return fId2Idx[rocId];}
+  /// an empty data set with the binning of this engine
+  PixHistData emptyData();
+
+private:
+  std::vector<int>            fId2Idx;
+  unsigned int                fNRocs;
+  int                         fPhBins, fQBins;
+  double                      fPhMin, fPhMax, fQMin, fQMax;
+
+  std::vector<PixHistShard*>  fShards;
+  PixHistData                 fTotal;
+  TMutex                      fMutex;
+};
+
+// ----------------------------------------------------------------------
+/// Fills a PixHistEngine from DAQ events on its own thread, so the readout
+/// thread neither converts nor histograms anything.
+///
+/// - push() hands over complete event vectors (no copy) into a bounded
+///   queue and never blocks: if the queue is full, the events are dropped
+///   and counted
+/// - the filler thread converts the PH to charge (if a PHCalibration is
+///   given, else the charge is 0), fills its own shard and publishes it
+///   after every batch
+/// - with setTreeWriter(), every batch is then handed on to the tree writer
+///   (again without copying), so the readout pushes each batch only once
+/// - drain() waits until everything queued is visible in snapshot() (and
+///   handed on to the tree writer)
+// ----------------------------------------------------------------------
+class DLLEXPORT PixHistFiller {
+public:
+  /// at most maxEvents events are queued, everything beyond is dropped
+  PixHistFiller(PixHistEngine *engine, PHCalibration *phcal = 0, size_t maxEvents = 1000000);
+  /// stop() if still running
+  ~PixHistFiller();
+
+  /// hand the events on to writer after filling them; to be set before start()
+  void setTreeWriter(PixTreeWriter *writer) {fWriter = writer;}
+  /// start the filler thread
+  void start();
+  /// queue the events for filling, evts is empty afterwards; returns the number of events dropped
+  size_t push(std::vector<pxar::Event> &evts);
+  /// wait until all queued events are published to the engine
+  void drain();
+  /// drain and stop the filler thread
+  void stop();
+
+  bool     isRunning() {return 0 != fThread;}
+  uint64_t getNDropped() {return fNDropped;}
+
+private:
+  static void* run(void *arg);
+  void loop();
+  void fill(std::vector<pxar::Event> &evts);
+
+  PixHistEngine *fEngine;
+  PixHistShard  *fShard;
+  PHCalibration *fPhCal;
+  PixTreeWriter *fWriter;
+  size_t         fMaxEvents;
+
+  TThread       *fThread;
+  TMutex        *fMutex;
+  TCondition    *fWork, *fIdle;
+
+  // -- protected by fMutex
+  std::deque<std::vector<pxar::Event> > fQueue;
+  size_t         fNQueued;
+  bool           fBusy, fStop;
+  uint64_t       fNDropped;
+};
+
+#endif
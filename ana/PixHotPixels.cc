@@ -0,0 +1,154 @@
+#include "PixHotPixels.hh"
+
+#include <algorithm>
+
+#include "api.h"
+#include "log.h"
+#include "threadpool.h"
+
+using namespace std;
+using namespace pxar;
+
+namespace {
+  // -- every item analyzes one ROC, results go into the per-ROC slots
+  class hotPixelJob: public pxar::threadJob {
+  public:
+    hotPixelJob(PixHotPixels &engine) : fEngine(engine) {}
+    void process(size_t item) {fEngine.analyzeRoc(static_cast<unsigned int>(item));}
+  private:
+    PixHotPixels &fEngine;
+  };
+}
+
+
+// ----------------------------------------------------------------------
+PixHotPixels::PixHotPixels(vector<uint8_t> rocIds, unsigned int nthreads) :
+  fRocIds(rocIds), fId2Idx(256, -1),
+  fHits(rocIds.size()*NPIX, 0), fMask(rocIds.size()*NPIX, 0), fScratch(rocIds.size()*NPIX, 0),
+  fStat(rocIds.size()), fNSigma(5.), fRateFactor(3.), fMinHits(10), fPool(0) {
+  for (unsigned int i = 0; i < rocIds.size(); ++i) fId2Idx[rocIds[i]] = i;
+  PixHotPixelStat a = {0, 0, 0., 0, 0, 0};
+  fill_n(fStat.begin(), fStat.size(), a);
+  fPool = (0 == nthreads ? &pxar::threadPool::shared() : new pxar::threadPool(nthreads));
+}
+
+// ----------------------------------------------------------------------
+PixHotPixels::~PixHotPixels() {
+  if (fPool != &pxar::threadPool::shared()) delete fPool;
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::fill(Event &evt) {
+  for (vector<pixel>::iterator it = evt.pixels.begin(); it != evt.pixels.end(); ++it) {
+    fill(it->roc_id, it->column, it->row);
+  }
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::fill(uint8_t rocId, int col, int row) {
+  int idx = fId2Idx[rocId];
+  if (idx < 0 || col < 0 || col >= 52 || row < 0 || row >= 80) return;
+  ++fHits[idx*NPIX + col*80 + row];
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::add(unsigned int idx, const vector<uint32_t> &hits) {
+  if (idx >= fRocIds.size() || hits.size() < static_cast<size_t>(NPIX)) return;
+  uint32_t *h = &fHits[idx*NPIX];
+  for (int i = 0; i < NPIX; ++i) h[i] += hits[i];
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::reset() {
+  fill_n(fHits.begin(), fHits.size(), 0);
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::clearMasks() {
+  fill_n(fMask.begin(), fMask.size(), 0);
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::analyze() {
+  hotPixelJob job(*this);
+  fPool->run(job, fRocIds.size());
+}
+
+// ----------------------------------------------------------------------
+void PixHotPixels::analyzeRoc(unsigned int idx) {
+  const uint32_t *h = &fHits[idx*NPIX];
+  const uint8_t  *m = &fMask[idx*NPIX];
+  uint32_t *s = &fScratch[idx*NPIX];
+
+  // -- compact the unmasked counts, the branchless store keeps this a tight loop
+  uint32_t n(0);
+  uint64_t sum(0);
+  for (int i = 0; i < NPIX; ++i) {
+    s[n] = h[i];
+    uint32_t keep = (0 == m[i]);
+    sum += keep*h[i];
+    n += keep;
+  }
+
+  PixHotPixelStat &st = fStat[idx];
+  st.nPixels = n;
+  st.nHits   = sum;
+  st.mean    = (n > 0 ? static_cast<double>(sum)/n : 0.);
+  st.median  = 0;
+  st.mad     = 0;
+  if (n > 0) {
+    nth_element(s, s + n/2, s + n);
+    st.median = s[n/2];
+    for (uint32_t i = 0; i < n; ++i) s[i] = (s[i] > st.median ? s[i] - st.median : st.median - s[i]);
+    nth_element(s, s + n/2, s + n);
+    st.mad = s[n/2];
+  }
+
+  double cut = max(st.median + fNSigma*1.4826*st.mad, fRateFactor*st.median);
+  st.cut = max(fMinHits, static_cast<uint32_t>(cut));
+}
+
+// ----------------------------------------------------------------------
+vector<pair<uint8_t, uint8_t> > PixHotPixels::newHotPixels(unsigned int idx) {
+  vector<pair<uint8_t, uint8_t> > hot;
+  if (idx >= fRocIds.size()) return hot;
+  const uint32_t *h = &fHits[idx*NPIX];
+  uint8_t *m = &fMask[idx*NPIX];
+  uint32_t cut = fStat[idx].cut;
+  for (int i = 0; i < NPIX; ++i) {
+    if (h[i] > cut && 0 == m[i]) {
+      m[i] = 1;
+      hot.push_back(make_pair(static_cast<uint8_t>(i/80), static_cast<uint8_t>(i%80)));
+    }
+  }
+  return hot;
+}
+
+// ----------------------------------------------------------------------
+int PixHotPixels::maskHotPixels(dut *apiDut, bool untest) {
+  analyze();
+  int cnt(0);
+  for (unsigned int i = 0; i < fRocIds.size(); ++i) {
+    vector<pair<uint8_t, uint8_t> > hot = newHotPixels(i);
+    PixHotPixelStat &st = fStat[i];
+    LOG(logDEBUG) << "ROC " << static_cast<int>(fRocIds[i]) << " hits/pixel mean = " << st.mean
+		  << " median = " << st.median << " MAD = " << st.mad << " cut = " << st.cut
+		  << " -> masking " << hot.size() << " pixels";
+    for (unsigned int j = 0; j < hot.size(); ++j) {
+      LOG(logDEBUG) << "mask hot pixel ROC/col/row: " << static_cast<int>(fRocIds[i])
+		    << "/" << static_cast<int>(hot[j].first) << "/" << static_cast<int>(hot[j].second)
+		    << " with #hits = " << getHits(i, hot[j].first, hot[j].second);
+    }
+    if (hot.empty()) continue;
+    apiDut->maskPixels(hot, true, fRocIds[i]);
+    if (untest) apiDut->testPixels(hot, false, fRocIds[i]);
+    cnt += hot.size();
+  }
+  return cnt;
+}
+
+// ----------------------------------------------------------------------
+int PixHotPixels::getNMasked(unsigned int idx) {
+  if (idx >= fRocIds.size()) return 0;
+  return static_cast<int>(count(fMask.begin() + idx*NPIX, fMask.begin() + (idx+1)*NPIX, 1));
+}
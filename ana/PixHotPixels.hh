@@ -0,0 +1,100 @@
+#ifndef PIXHOTPIXELS_H
+#define PIXHOTPIXELS_H
+
+#include "pxardllexport.h"
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace pxar {
+  class dut;
+  class Event;
+  class threadPool;
+}
+
+// ----------------------------------------------------------------------
+/// Robust hit statistics of the unmasked pixels of one ROC
+// ----------------------------------------------------------------------
+struct DLLEXPORT PixHotPixelStat {
+  uint32_t nPixels;  ///< unmasked pixels
+  uint64_t nHits;    ///< hits in unmasked pixels
+  double   mean;
+  uint32_t median;
+  uint32_t mad;      ///< median absolute deviation from the median
+  uint32_t cut;      ///< pixels with more hits than this are hot
+};
+
+// ----------------------------------------------------------------------
+/// Noise and hot pixel search on hit maps of all ROCs.
+///
+/// - hits are counted in dense uint32 arrays (ROC index, col*80+row), filled
+///   directly from the DAQ events or added from other hit maps
+/// - analyze() computes median and MAD of the unmasked pixels of all ROCs in
+///   parallel; a pixel is hot if its count exceeds all of
+///   median + nsigma*1.4826*MAD, rateFactor*median and minHits
+/// - pixels found hot are remembered as masked and excluded from all later
+///   statistics, so masking can be iterated over a long run by just keeping
+///   on filling (or reset() between steps)
+/// - maskHotPixels() applies the new hot pixels with one dut::maskPixels()
+///   call per ROC
+// ----------------------------------------------------------------------
+class DLLEXPORT PixHotPixels {
+public:
+  /// nthreads = 0: the process-wide pxar::threadPool::shared()
+  PixHotPixels(std::vector<uint8_t> rocIds, unsigned int nthreads = 0);
+  ~PixHotPixels();
+
+  /// count all hits of an event
+  void fill(pxar::Event &evt);
+  /// count one hit of the ROC with ID rocId
+  void fill(uint8_t rocId, int col, int row);
+  /// add a hit map (52*80 entries, col*80+row) to the ROC with index idx
+  void add(unsigned int idx, const std::vector<uint32_t> &hits);
+  /// clear all hit counts, pixels already masked stay masked
+  void reset();
+  /// unmask all pixels (the DUT is not touched)
+  void clearMasks();
+
+  /// compute the statistics of all ROCs
+  void analyze();
+  /// hot pixels (col, row) of ROC index idx found by the last analyze() that
+  /// were not masked before; they are marked as masked
+  std::vector<std::pair<uint8_t, uint8_t> > newHotPixels(unsigned int idx);
+  /// analyze() and mask the new hot pixels of all ROCs on the DUT (and
+  /// disable them for calibrates if untest), returns the number of pixels masked
+  int maskHotPixels(pxar::dut *apiDut, bool untest = false);
+
+  PixHotPixelStat& getStat(unsigned int idx) {return fStat[idx];}
+  uint32_t getHits(unsigned int idx, int col, int row) {return fHits[idx*NPIX + col*80 + row];}
+  bool     isMasked(unsigned int idx, int col, int row) {return 0 != fMask[idx*NPIX + col*80 + row];}
+  /// number of pixels masked by this engine on ROC index idx
+  int      getNMasked(unsigned int idx);
+  /// index of the ROC with ID rocId, -1 if it is not known to the engine
+  int      getIdxFromId(uint8_t rocId) {return fId2Idx[rocId];}
+  unsigned int getNRocs() {return fRocIds.size();}
+
+  void setNSigma(double x) {fNSigma = x;}
+  void setRateFactor(double x) {fRateFactor = x;}
+  void setMinHits(uint32_t n) {fMinHits = n;}
+
+  /// statistics of the unmasked pixels of ROC index idx, thread safe for different ROCs
+  void analyzeRoc(unsigned int idx);
+
+private:
+  static const int NPIX = 4160;
+
+  std::vector<uint8_t>  fRocIds;
+  std::vector<int>      fId2Idx;
+  std::vector<uint32_t> fHits;
+  std::vector<uint8_t>  fMask;
+  std::vector<uint32_t> fScratch;
+  std::vector<PixHotPixelStat> fStat;
+
+  double   fNSigma, fRateFactor;
+  uint32_t fMinHits;
+
+  pxar::threadPool *fPool;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "PixTreeWriter.hh"
+
+#include <TTree.h>
+#include <TBranch.h>
+#include <TDirectory.h>
+#include <TThread.h>
+#include <TMutex.h>
+#include <TCondition.h>
+#include <TObjArray.h>
+#include <TString.h>
+
+#include <algorithm>
+
+#include "log.h"
+#include "timer.h"
+
+using namespace std;
+using namespace pxar;
+
+
+// ----------------------------------------------------------------------
+PixTreeWriter::PixTreeWriter(TDirectory *dir, string name, size_t maxEvents) :
+  fDirectory(dir), fName(name), fMaxEvents(maxEvents),
+  fBasketSize(32000), fAutoFlush(-30000000), fCompression(1),
+  fTree(0), fThread(0), fMutex(new TMutex()), fWork(0), fIdle(0),
+  fNQueued(0), fBusy(false), fStop(false), fNWritten(0), fNDropped(0), fFillTime(0), fClock(0),
+  fHeader(0), fTrailer(0), fNpix(0), fProc(256, 0), fPcol(256, 0), fProw(256, 0), fPval(256, 0),
+  fBProc(0), fBPcol(0), fBProw(0), fBPval(0) {
+  fWork = new TCondition(fMutex);
+  fIdle = new TCondition(fMutex);
+}
+
+// ----------------------------------------------------------------------
+PixTreeWriter::~PixTreeWriter() {
+  stop();
+  delete fClock;
+  delete fIdle;
+  delete fWork;
+  delete fMutex;
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::start() {
+  if (fThread) return;
+
+  if (0 == fTree) {
+    fTree = new TTree(fName.c_str(), fName.c_str());
+    fTree->SetDirectory(fDirectory);
+    fTree->Branch("header", &fHeader, "header/s");
+    fTree->Branch("trailer", &fTrailer, "trailer/s");
+    fTree->Branch("npix", &fNpix, "npix/s");
+    fBProc = fTree->Branch("proc", &fProc[0], "proc[npix]/b");
+    fBPcol = fTree->Branch("pcol", &fPcol[0], "pcol[npix]/b");
+    fBProw = fTree->Branch("prow", &fProw[0], "prow[npix]/b");
+    fBPval = fTree->Branch("pval", &fPval[0], "pval[npix]/b");
+
+    fTree->SetBasketSize("*", fBasketSize);
+    fTree->SetAutoFlush(fAutoFlush);
+    TObjArray *branches = fTree->GetListOfBranches();
+    for (int i = 0; i < branches->GetEntriesFast(); ++i) {
+      static_cast<TBranch*>(branches->At(i))->SetCompressionLevel(fCompression);
+    }
+  }
+
+  fStop = false;
+  delete fClock;
+  fClock = new timer();
+  TThread::Initialize();
+  fThread = new TThread(Form("%s_writer", fName.c_str()), &PixTreeWriter::run, this);
+  fThread->Run();
+  LOG(logDEBUG) << "PixTreeWriter: started writing tree " << fName << " (basket size " << fBasketSize
+		<< ", auto-flush " << fAutoFlush << ", compression " << fCompression << ")";
+}
+
+// ----------------------------------------------------------------------
+size_t PixTreeWriter::push(vector<Event> &evts) {
+  size_t n = evts.size();
+  if (0 == n) return 0;
+
+  fMutex->Lock();
+  if (0 == fThread || fNQueued + n > fMaxEvents) {
+    if (0 == fNDropped) {
+      LOG(logWARNING) << "PixTreeWriter: " << (fThread ? "queue full" : "writer not running") << ", dropping events";
+    }
+    fNDropped += n;
+    fMutex->UnLock();
+    evts.clear();
+    return n;
+  }
+  // -- take over the events without copying them
+  fQueue.push_back(vector<Event>());
+  fQueue.back().swap(evts);
+  fNQueued += n;
+  fWork->Signal();
+  fMutex->UnLock();
+  return 0;
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::drain() {
+  fMutex->Lock();
+  while (fThread && (!fQueue.empty() || fBusy)) fIdle->Wait();
+  fMutex->UnLock();
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::stop() {
+  if (0 == fThread) return;
+
+  fMutex->Lock();
+  fStop = true;
+  fWork->Signal();
+  fMutex->UnLock();
+
+  fThread->Join();
+  delete fThread;
+  fThread = 0;
+
+  TDirectory *dir = gDirectory;
+  fDirectory->cd();
+  fTree->Write();
+  dir->cd();
+  report();
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::report() {
+  fMutex->Lock();
+  uint64_t nwritten(fNWritten), ndropped(fNDropped), tfill(fFillTime);
+  size_t nqueued(fNQueued);
+  fMutex->UnLock();
+
+  double mb = (fTree ? fTree->GetTotBytes() : 0.)/1.e6;
+  double mbzip = (fTree ? fTree->GetZipBytes() : 0.)/1.e6;
+  double twall = (fClock ? fClock->get() : 0)/1000.;
+  LOG(logINFO) << "PixTreeWriter: " << nwritten << " events written (" << mb << " MB, " << mbzip << " MB compressed), "
+	       << nqueued << " queued, " << ndropped << " dropped";
+  if (tfill > 0) {
+    LOG(logINFO) << "PixTreeWriter: " << nwritten/(tfill/1000.) << " events/s, " << mb/(tfill/1000.) << " MB/s while writing, "
+		 << tfill/1000. << " s busy out of " << twall << " s";
+  }
+}
+
+// ----------------------------------------------------------------------
+void* PixTreeWriter::run(void *arg) {
+  static_cast<PixTreeWriter*>(arg)->loop();
+  return 0;
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::loop() {
+  vector<Event> batch;
+  fMutex->Lock();
+  while (true) {
+    while (fQueue.empty() && !fStop) fWork->Wait();
+    if (fQueue.empty()) break;
+
+    batch.swap(fQueue.front());
+    fQueue.pop_front();
+    fBusy = true;
+    fMutex->UnLock();
+
+    timer t;
+    for (vector<Event>::iterator it = batch.begin(); it != batch.end(); ++it) fill(*it);
+    uint64_t tfill = t.get();
+    size_t n = batch.size();
+    batch.clear();
+
+    fMutex->Lock();
+    fNQueued -= n;
+    fNWritten += n;
+    fFillTime += tfill;
+    fBusy = false;
+    if (fQueue.empty()) fIdle->Broadcast();
+  }
+  fIdle->Broadcast();
+  fMutex->UnLock();
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::fill(Event &evt) {
+  size_t npix = evt.pixels.size();
+  if (npix > 0xffff) npix = 0xffff;
+  if (npix > fProc.size()) {
+    size_t n = max(npix, 2*fProc.size());
+    fProc.resize(n);
+    fPcol.resize(n);
+    fProw.resize(n);
+    fPval.resize(n);
+    setAddresses();
+  }
+
+  fHeader  = evt.header;
+  fTrailer = evt.trailer;
+  fNpix    = static_cast<UShort_t>(npix);
+  for (size_t i = 0; i < npix; ++i) {
+    fProc[i] = evt.pixels[i].roc_id;
+    fPcol[i] = evt.pixels[i].column;
+    fProw[i] = evt.pixels[i].row;
+    fPval[i] = static_cast<UChar_t>(evt.pixels[i].getValue());
+  }
+  fTree->Fill();
+}
+
+// ----------------------------------------------------------------------
+void PixTreeWriter::setAddresses() {
+  fBProc->SetAddress(&fProc[0]);
+  fBPcol->SetAddress(&fPcol[0]);
+  fBProw->SetAddress(&fProw[0]);
+  fBPval->SetAddress(&fPval[0]);
+}
@@ -0,0 +1,100 @@
+#ifndef PIXTREEWRITER_H
+#define PIXTREEWRITER_H
+
+#include "pxardllexport.h"
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <stdint.h>
+
+#include <Rtypes.h>
+
+#include "api.h"
+
+class TTree;
+class TBranch;
+class TDirectory;
+class TThread;
+class TMutex;
+class TCondition;
+
+namespace pxar {
+  class timer;
+}
+
+// ----------------------------------------------------------------------
+/// Writes DAQ events into a TTree on its own thread.
+///
+/// - push() hands over complete event vectors (no copy) into a bounded
+///   queue and never blocks: if the queue is full, the events are dropped
+///   and counted, so disk output cannot stall the readout
+/// - the writer thread fills the tree with variable-length pixel branches
+///   (header, trailer, npix, proc[npix], pcol[npix], prow[npix], pval[npix])
+/// - basket size, auto-flush and compression level can be set before start()
+/// - report() logs the write throughput
+///
+/// The tree belongs to the given directory. While the writer is running,
+/// nothing else must write to the same file.
+// ----------------------------------------------------------------------
+class DLLEXPORT PixTreeWriter {
+public:
+  /// at most maxEvents events are queued, everything beyond is dropped
+  PixTreeWriter(TDirectory *dir, std::string name = "events", size_t maxEvents = 1000000);
+  /// stop() if still running
+  ~PixTreeWriter();
+
+  void setBasketSize(Int_t bytes) {fBasketSize = bytes;}
+  /// > 0: number of entries, < 0: number of bytes between flushes (as TTree::SetAutoFlush)
+  void setAutoFlush(Long64_t n) {fAutoFlush = n;}
+  void setCompressionLevel(Int_t level) {fCompression = level;}
+
+  /// book the tree and start the writer thread
+  void start();
+  /// queue the events for writing, evts is empty afterwards; returns the number of events dropped
+  size_t push(std::vector<pxar::Event> &evts);
+  /// wait until all queued events are in the tree
+  void drain();
+  /// drain, stop the writer thread and write the tree to its directory
+  void stop();
+  /// log number of events, bytes and write rates
+  void report();
+
+  bool     isRunning() {return 0 != fThread;}
+  uint64_t getNWritten() {return fNWritten;}
+  uint64_t getNDropped() {return fNDropped;}
+  TTree*   getTree() {return fTree;}
+
+private:
+  static void* run(void *arg);
+  void loop();
+  void fill(pxar::Event &evt);
+  void setAddresses();
+
+  TDirectory   *fDirectory;
+  std::string   fName;
+  size_t        fMaxEvents;
+  Int_t         fBasketSize;
+  Long64_t      fAutoFlush;
+  Int_t         fCompression;
+
+  TTree        *fTree;
+  TThread      *fThread;
+  TMutex       *fMutex;
+  TCondition   *fWork, *fIdle;
+
+  // -- protected by fMutex
+  std::deque<std::vector<pxar::Event> > fQueue;
+  size_t        fNQueued;
+  bool          fBusy, fStop;
+  uint64_t      fNWritten, fNDropped;
+  uint64_t      fFillTime; // ms spent in TTree::Fill()
+  pxar::timer  *fClock;
+
+  // -- branch buffers, only touched by the writer thread
+  UShort_t      fHeader, fTrailer, fNpix;
+  std::vector<UChar_t> fProc, fPcol, fProw, fPval;
+  TBranch      *fBProc, *fBPcol, *fBProw, *fBPval;
+};
+
+#endif
@@ -35,6 +35,18 @@ void PixUtil::replaceAll(string& str, const string& from, const string& to) {
   }
 }
 
+// ----------------------------------------------------------------------
+vector<string> PixUtil::split(const string& str, char delim) {
+  vector<string> tokens;
+  size_t start_pos = 0, end_pos;
+  while((end_pos = str.find(delim, start_pos)) != string::npos) {
+    if (end_pos > start_pos) tokens.push_back(str.substr(start_pos, end_pos - start_pos));
+    start_pos = end_pos + 1;
+  }
+  if (start_pos < str.size()) tokens.push_back(str.substr(start_pos));
+  return tokens;
+}
+
 // ----------------------------------------------------------------------
 double PixUtil::dEff(int in, int iN) {
   double n = (double)in;
@@ -4,6 +4,7 @@
 #include "pxardllexport.h"
 
 #include <string>
+#include <vector>
 
 class DLLEXPORT PixUtil {
 
@@ -11,6 +12,7 @@ public:
   static void setPlotStyle();
   static bool bothAreSpaces(char lhs, char rhs);
   static void replaceAll(std::string& str, const std::string& from, const std::string& to);
+  static std::vector<std::string> split(const std::string& str, char delim);
   static double dEff(int in, int iN); 
   static double dBinomial(int in, int iN);
 };
@@ -6,20 +6,32 @@
 #include "hal.h"
 #include "log.h"
 #include "timer.h"
+#include "threadpool.h"
 #include "helper.h"
 #include "dictionaries.h"
 #include <algorithm>
+#include <set>
 #include <fstream>
+#include <sstream>
 #include <cmath>
 #include "constants.h"
 #include "config.h"
 
 using namespace pxar;
 
-api::api(std::string usbId, std::string logLevel) : 
+api::api(std::string usbId, std::string logLevel, unsigned int nThreads) : 
   _daq_running(false), 
   _daq_buffersize(DTB_SOURCE_BUFFER_SIZE),
-  _ndecode_errors_lastdaq(0)
+  _ndecode_errors_lastdaq(0),
+  _telemetry(TELEMETRY_BUFFER_SIZE),
+  _telemetry_head(0),
+  _telemetry_count(0),
+  _telemetry_period(1000),
+  _telemetry_clock(),
+  _pool(NULL),
+  _scancache_enabled(false),
+  _scancache_hits(0),
+  _scancache_misses(0)
 {
 
   LOG(logQUIET) << "Instanciating API for " << PACKAGE_STRING;
@@ -33,11 +45,17 @@ api::api(std::string usbId, std::string logLevel) :
 
   // Get the DUT up and running:
   _dut = new dut();
+
+  // Worker threads for the data processing, shared with all other users
+  // in the process unless a pool size has been requested:
+  _pool = (nThreads == 0 ? &threadPool::shared() : new threadPool(nThreads));
+  LOG(logDEBUGAPI) << "Processing data with " << _pool->size() << " threads.";
 }
 
 api::~api() {
   delete _dut;
   delete _hal;
+  if(_pool != &threadPool::shared()) { delete _pool; }
 }
 
 std::string api::getVersion() { return PACKAGE_STRING; }
@@ -61,6 +79,7 @@ bool api::initTestboard(std::vector<std::pair<std::string,uint8_t> > sig_delays,
   verifyPatternGenerator(pg_setup);
 
   // Call the HAL to do the job:
+  clearScanCache();
   _hal->initTestboard(_dut->sig_delays,_dut->pg_setup,_dut->pg_sum,_dut->va,_dut->vd,_dut->ia,_dut->id);
   return true;
 }
@@ -269,6 +288,9 @@ bool api::programDUT() {
     return false;
   }
 
+  // All devices are reprogrammed, stored scan results are void:
+  clearScanCache();
+
   // First thing to do: startup DUT power if not yet done
   _hal->Pon();
 
@@ -374,7 +396,8 @@ bool api::flashTB(std::string filename) {
     return false;
   }
   
-  // Call the HAL routine to do the flashing:
+  // Call the HAL routine to do the flashing, the testboard restarts:
+  clearScanCache();
   bool status = false;
   status = _hal->flashTestboard(flashFile);
   flashFile.close();
@@ -402,16 +425,172 @@ double api::getTBvd() {
   return _hal->getTBvd();
 }
 
+void api::setTelemetryRate(double rate) {
+  if(rate <= 0) { _telemetry_period = 0; }
+  else { _telemetry_period = static_cast<uint32_t>(1000/rate); }
+  LOG(logDEBUGAPI) << "Telemetry sampling period set to " << _telemetry_period << "ms.";
+}
+
+bool api::telemetryTick() {
+  if(_telemetry_period == 0 || !telemetryDue()) { return false; }
+  sampleTelemetry();
+  return true;
+}
+
+telemetrySample api::getTelemetry() {
+  if(_telemetry_count == 0) { return telemetrySample(); }
+  return _telemetry.at((_telemetry_head + _telemetry.size() - 1) % _telemetry.size());
+}
+
+std::vector<telemetrySample> api::getTelemetryHistory() {
+  std::vector<telemetrySample> history;
+  for(size_t i = 0; i < _telemetry_count; i++) {
+    history.push_back(_telemetry.at((_telemetry_head + _telemetry.size() - _telemetry_count + i) % _telemetry.size()));
+  }
+  return history;
+}
+
+double api::waitTelemetrySettled(std::string channel, double tolerance, uint16_t nSamples, uint32_t timeout) {
+
+  if(channel != "ia" && channel != "id" && channel != "va" && channel != "vd") {
+    LOG(logERROR) << "Unknown telemetry channel \"" << channel << "\"!";
+    return 0;
+  }
+  if(nSamples < 1) { nSamples = 1; }
+
+  // Sample at the configured rate, but not slower than every 50ms:
+  uint32_t period = (_telemetry_period > 0 && _telemetry_period < 50) ? _telemetry_period : 50;
+
+  timer t;
+  std::vector<double> series;
+  while(true) {
+    series.push_back(sampleTelemetry().get(channel));
+
+    if(series.size() >= nSamples) {
+      std::vector<double>::iterator first = series.end() - nSamples;
+      double vmin = *std::min_element(first,series.end());
+      double vmax = *std::max_element(first,series.end());
+      if(vmax - vmin <= tolerance) {
+	double mean = 0;
+	for(std::vector<double>::iterator it = first; it != series.end(); ++it) { mean += *it; }
+	mean /= nSamples;
+	LOG(logDEBUGAPI) << "Telemetry channel " << channel << " settled at " << mean
+			 << " after " << t << "ms (" << series.size() << " samples).";
+	return mean;
+      }
+    }
+
+    if(t.get() >= timeout) {
+      LOG(logWARNING) << "Telemetry channel " << channel << " did not settle within "
+		      << timeout << "ms, returning last value " << series.back();
+      return series.back();
+    }
+    mDelay(period);
+  }
+}
+
+std::vector< std::pair<uint8_t, std::pair<double,double> > > api::getCurrentVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t rocid, uint32_t settle, bool adaptive) {
+
+  std::vector< std::pair<uint8_t, std::pair<double,double> > > result;
+  if(!status()) {return result;}
+
+  // Check DAC range
+  if(dacMin > dacMax) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dacMin;
+    dacMin = dacMax;
+    dacMax = temp;
+  }
+  if(dacStep == 0) { dacStep = 1; }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) return result;
+
+  if(_dut->roc.size() <= rocid) {
+    LOG(logERROR) << "ROC " << static_cast<int>(rocid) << " does not exist in the DUT!";
+    return result;
+  }
+  uint8_t roci2c = _dut->roc.at(rocid).i2c_address;
+
+  // Maximum difference between two readings of a settled current, in A:
+  const double tolerance = 2E-4;
+
+  // Measure time:
+  timer t;
+
+  std::vector<uint8_t> values;
+  for(size_t dac = dacMin; dac <= dacMax; dac += dacStep) { values.push_back(static_cast<uint8_t>(dac)); }
+
+  std::vector< std::pair<double,double> > readings = _hal->rocCurrentVsDAC(roci2c, dacRegister, values, settle, adaptive);
+
+  for(size_t i = 0; i < values.size(); i++) {
+    if(!adaptive) {
+      result.push_back(std::make_pair(values.at(i),readings.at(i)));
+      continue;
+    }
+
+    // Compare the two readings of this step and repeat with longer settling time if needed:
+    std::pair<double,double> first = readings.at(2*i), second = readings.at(2*i+1);
+    uint32_t wait = settle;
+    for(int retry = 0; retry < 3; retry++) {
+      if(std::fabs(first.first - second.first) <= tolerance && std::fabs(first.second - second.second) <= tolerance) break;
+      wait = (wait > 0 ? 2*wait : 1000);
+      LOG(logDEBUGAPI) << "Currents for " << dacName << " = " << static_cast<int>(values.at(i))
+		       << " not settled, repeating with " << wait << "us settling time.";
+      std::vector< std::pair<double,double> > repeated = _hal->rocCurrentVsDAC(roci2c, dacRegister, std::vector<uint8_t>(1,values.at(i)), wait, true);
+      first = repeated.at(0);
+      second = repeated.at(1);
+    }
+    result.push_back(std::make_pair(values.at(i),second));
+  }
+
+  // Reset the original value for the scanned DAC:
+  uint8_t oldDacValue = _dut->getDAC(rocid,dacName);
+  LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
+  _hal->rocSetDAC(roci2c,dacRegister,oldDacValue);
+
+  LOG(logDEBUGAPI) << "Current vs. DAC sweep of " << values.size() << " steps took " << t << "ms.";
+  return result;
+}
+
+telemetrySample api::sampleTelemetry() {
+
+  telemetrySample sample;
+  sample.time = static_cast<uint32_t>(_telemetry_clock.get());
+  if(_hal->status()) {
+    sample.ia = _hal->getTBia();
+    sample.id = _hal->getTBid();
+    sample.va = _hal->getTBva();
+    sample.vd = _hal->getTBvd();
+  }
+
+  _telemetry.at(_telemetry_head) = sample;
+  _telemetry_head = (_telemetry_head + 1) % _telemetry.size();
+  if(_telemetry_count < _telemetry.size()) { _telemetry_count++; }
+  return sample;
+}
+
+bool api::telemetryDue() {
+  if(_telemetry_count == 0) { return true; }
+  const telemetrySample & last = _telemetry.at((_telemetry_head + _telemetry.size() - 1) % _telemetry.size());
+  return (_telemetry_clock.get() - last.time >= _telemetry_period);
+}
+
 
 void api::HVoff() {
+  clearScanCache();
   _hal->HVoff();
 }
 
 void api::HVon() {
+  clearScanCache();
   _hal->HVon();
 }
 
 void api::Poff() {
+  clearScanCache();
   _hal->Poff();
   // Reset the programmed state of the DUT (lost by turning off power)
   _dut->_programmed = false;
@@ -714,6 +893,61 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
   return result;
 }
 
+std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDACList(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers) {
+  return getDacListData(dacName, dacValues, flags, nTriggers, false);
+}
+
+std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDACList(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers) {
+  return getDacListData(dacName, dacValues, flags, nTriggers, true);
+}
+
+std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getDacListData(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers, bool efficiency) {
+
+  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+
+  if(dacValues.empty()) {
+    LOG(logWARNING) << "No DAC values given, nothing to scan.";
+    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+  }
+
+  // Get the register number and check the range of all values from dictionary:
+  uint8_t dacRegister;
+  for(std::vector<uint8_t>::iterator dac = dacValues.begin(); dac != dacValues.end(); ++dac) {
+    if(!verifyRegister(dacName, dacRegister, *dac, ROC_REG)) {
+      return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    }
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacList;
+  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacList;
+  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacList;
+  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacList;
+
+  // Load the test parameters into vector, followed by the list of DAC values:
+  std::vector<int32_t> param;
+  param.push_back(static_cast<int32_t>(dacRegister));
+  param.push_back(static_cast<int32_t>(flags));
+  param.push_back(static_cast<int32_t>(nTriggers));
+  for(std::vector<uint8_t>::iterator dac = dacValues.begin(); dac != dacValues.end(); ++dac) {
+    param.push_back(static_cast<int32_t>(*dac));
+  }
+
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  // repack data into the expected return format
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result = repackDacListData(data,dacValues,nTriggers,flags,efficiency);
+
+  // Reset the original value for the scanned DAC:
+  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
+  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+    uint8_t oldDacValue = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dacName);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << static_cast<int>(oldDacValue);
+    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dacRegister,oldDacValue);
+  }
+
+  return result;
+}
+
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getThresholdVsDAC(std::string dacName, std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
   // Get the full DAC range for scanning:
   uint8_t dac1min = 0;
@@ -949,10 +1183,24 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   return result;
 }
 
+DacDacGrid api::getPulseheightVsDACDACGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
+  return getDacDacGrid(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, false);
+}
+
+DacDacGrid api::getEfficiencyVsDACDACGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers) {
+  return getDacDacGrid(dac1name, dac1step, dac1min, dac1max, dac2name, dac2step, dac2min, dac2max, flags, nTriggers, true);
+}
+
 std::vector<pixel> api::getPulseheightMap(uint16_t flags, uint16_t nTriggers) {
 
   if(!status()) {return std::vector<pixel>();}
 
+  // Check if this very scan has been taken before:
+  std::ostringstream scan;
+  scan << "PulseheightMap " << flags << " " << nTriggers;
+  std::vector<pixel> cached;
+  if(scanCacheLookup(scan.str(), cached)) { return cached; }
+
   // Setup the correct _hal calls for this test
   HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelCalibrate;
   HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelCalibrate;
@@ -970,6 +1218,7 @@ std::vector<pixel> api::getPulseheightMap(uint16_t flags, uint16_t nTriggers) {
   // Repacking of all data segments into one long map vector:
   std::vector<pixel> result = repackMapData(data, nTriggers, flags,false);
 
+  scanCacheStore(scan.str(), result);
   return result;
 }
 
@@ -977,6 +1226,12 @@ std::vector<pixel> api::getEfficiencyMap(uint16_t flags, uint16_t nTriggers) {
 
   if(!status()) {return std::vector<pixel>();}
 
+  // Check if this very scan has been taken before:
+  std::ostringstream scan;
+  scan << "EfficiencyMap " << flags << " " << nTriggers;
+  std::vector<pixel> cached;
+  if(scanCacheLookup(scan.str(), cached)) { return cached; }
+
   // Setup the correct _hal calls for this test
   HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelCalibrate;
   HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelCalibrate;
@@ -994,6 +1249,7 @@ std::vector<pixel> api::getEfficiencyMap(uint16_t flags, uint16_t nTriggers) {
   // Repacking of all data segments into one long map vector:
   std::vector<pixel> result = repackMapData(data, nTriggers, flags, true);
 
+  scanCacheStore(scan.str(), result);
   return result;
 }
 
@@ -1027,6 +1283,14 @@ std::vector<pixel> api::getThresholdMap(std::string dacName, uint8_t dacStep, ui
     return std::vector<pixel>();
   }
 
+  // Check if this very scan has been taken before:
+  std::ostringstream scan;
+  scan << "ThresholdMap " << static_cast<int>(dacRegister) << " " << static_cast<int>(dacStep) << " "
+       << static_cast<int>(dacMin) << " " << static_cast<int>(dacMax) << " " << static_cast<int>(threshold) << " "
+       << flags << " " << nTriggers;
+  std::vector<pixel> cached;
+  if(scanCacheLookup(scan.str(), cached)) { return cached; }
+
   // Setup the correct _hal calls for this test, a threshold map is a 1D dac scan:
   HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacScan;
   HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacScan;
@@ -1048,9 +1312,198 @@ std::vector<pixel> api::getThresholdMap(std::string dacName, uint8_t dacStep, ui
   // Repacking of all data segments into one long map vector:
   std::vector<pixel> result = repackThresholdMapData(data, dacStep, dacMin, dacMax, threshold, nTriggers, flags);
 
+  scanCacheStore(scan.str(), result);
   return result;
 }
+
+std::vector<pixel> api::getThresholdMapAdaptive(std::string dacName, uint8_t precision, uint8_t threshold, uint16_t flags, uint16_t nTriggers) {
+
+  if(!status()) {return std::vector<pixel>();}
+
+  // Step size of the initial coarse scan over the full DAC range:
+  uint8_t coarseStep = 8;
+  uint8_t dacMax = getDACRange(dacName);
+
+  // Nothing to gain if the requested precision is coarser than that:
+  if(precision >= coarseStep) { return getThresholdMap(dacName, precision, 0, dacMax, threshold, flags, nTriggers); }
+
+  LOG(logDEBUGAPI) << "Adaptive threshold scan: coarse pass with step size " << static_cast<int>(coarseStep);
+  std::vector<pixel> coarse = getThresholdMap(dacName, coarseStep, 0, dacMax, threshold, flags, nTriggers);
+
+  // The coarse threshold is only known to within one coarse step:
+  return getThresholdMapAdaptive(dacName, precision, coarseStep, threshold, flags, nTriggers, coarse);
+}
+
+std::vector<pixel> api::getThresholdMapAdaptive(std::string dacName, uint8_t precision, uint8_t margin, uint8_t threshold, uint16_t flags, uint16_t nTriggers, std::vector<pixel> prior) {
+
+  if(!status()) {return std::vector<pixel>();}
+
+  uint8_t dacMax = getDACRange(dacName);
+  if(precision == 0) { precision = 1; }
+
+  // Without any prior knowledge we have to fall back to the full scan:
+  if(prior.empty()) {
+    LOG(logDEBUGAPI) << "No prior threshold information, scanning the full DAC range.";
+    return getThresholdMap(dacName, precision, 0, dacMax, threshold, flags, nTriggers);
+  }
+
+  timer t;
+
+  // Find the window covering the prior thresholds of every ROC, ignoring the
+  // 2% outliers on either side. ROCs with the same window are scanned together:
+  std::map<uint8_t, std::vector<int> > values;
+  for(std::vector<pixel>::iterator px = prior.begin(); px != prior.end(); ++px) { values[px->roc_id].push_back(static_cast<int>(px->getValue())); }
+
+  std::map<uint8_t, std::pair<uint8_t,uint8_t> > window;
+  std::map<std::pair<uint8_t,uint8_t>, std::vector<uint8_t> > windowRocs;
+  for(std::map<uint8_t, std::vector<int> >::iterator roc = values.begin(); roc != values.end(); ++roc) {
+    std::vector<int> & v = roc->second;
+    std::sort(v.begin(),v.end());
+    size_t nOutliers = v.size()/50;
+    int dacLow = v.at(nOutliers) - margin;
+    int dacHigh = v.at(v.size() - 1 - nOutliers) + margin;
+    std::pair<uint8_t,uint8_t> w(static_cast<uint8_t>(std::max(dacLow, 0)), static_cast<uint8_t>(std::min(dacHigh, static_cast<int>(dacMax))));
+    window[roc->first] = w;
+    windowRocs[w].push_back(roc->first);
+  }
+
+  // Store the current ROC and pixel enable configuration:
+  std::vector<bool> rocEnabled;
+  std::vector<std::vector<pixelConfig> > enabled;
+  for(size_t roc = 0; roc < _dut->getNRocs(); roc++) {
+    rocEnabled.push_back(_dut->roc.at(roc).enable);
+    enabled.push_back(_dut->getEnabledPixels(roc));
+  }
+
+  std::set<pixel> found, rescan;
+  std::vector<pixel> final_result;
+  try {
+    for(std::map<std::pair<uint8_t,uint8_t>, std::vector<uint8_t> >::iterator w = windowRocs.begin(); w != windowRocs.end(); ++w) {
+      uint8_t dacMin = w->first.first, dacMaxWindow = w->first.second;
+
+      // Only run the ROCs sharing this window:
+      bool any = false;
+      for(size_t roc = 0; roc < rocEnabled.size(); roc++) {
+	bool on = rocEnabled.at(roc) && std::find(w->second.begin(), w->second.end(), roc) != w->second.end();
+	_dut->setROCEnable(roc, on);
+	any |= on;
+      }
+      if(!any) continue;
+
+      LOG(logDEBUGAPI) << "Adaptive threshold scan: fine pass of " << w->second.size() << " ROC(s) from " << static_cast<int>(dacMin)
+		       << " to " << static_cast<int>(dacMaxWindow) << " with step size " << static_cast<int>(precision);
+      std::vector<pixel> result = getThresholdMap(dacName, precision, dacMin, dacMaxWindow, threshold, flags, nTriggers);
+
+      // Pixels without threshold inside the window or at its edges need to be rescanned:
+      for(std::vector<pixel>::iterator px = result.begin(); px != result.end(); ++px) {
+	if(window.find(px->roc_id) == window.end() || window[px->roc_id] != w->first) continue;
+	bool at_edge = (px->getValue() <= dacMin && dacMin > 0)
+	  || (px->getValue() + precision > dacMaxWindow && dacMaxWindow < dacMax);
+	if(at_edge) { rescan.insert(*px); continue; }
+	found.insert(*px);
+	final_result.push_back(*px);
+      }
+    }
+
+    for(std::vector<pixel>::iterator px = prior.begin(); px != prior.end(); ++px) {
+      if(found.find(*px) == found.end()) { rescan.insert(*px); }
+    }
+
+    // Enabled ROCs without any prior thresholds are scanned over the full range:
+    for(size_t roc = 0; roc < rocEnabled.size(); roc++) {
+      if(!rocEnabled.at(roc) || values.find(static_cast<uint8_t>(roc)) != values.end()) continue;
+      for(std::vector<pixelConfig>::iterator px = enabled.at(roc).begin(); px != enabled.at(roc).end(); ++px) {
+	rescan.insert(pixel(static_cast<uint8_t>(roc), px->column, px->row, 0));
+      }
+    }
+
+    if(!rescan.empty()) {
+      LOG(logDEBUGAPI) << "Adaptive threshold scan: rescanning " << rescan.size() << " pixels over the full range.";
+
+      // Only enable the pixels to be rescanned, on their own ROC:
+      for(size_t roc = 0; roc < rocEnabled.size(); roc++) { _dut->setROCEnable(roc, rocEnabled.at(roc)); }
+      _dut->testAllPixels(false);
+      for(std::set<pixel>::iterator px = rescan.begin(); px != rescan.end(); ++px) {
+	_dut->testPixel(px->column, px->row, true, px->roc_id);
+      }
+
+      std::vector<pixel> full = getThresholdMap(dacName, precision, 0, dacMax, threshold, flags, nTriggers);
+      for(std::vector<pixel>::iterator px = full.begin(); px != full.end(); ++px) {
+	if(rescan.find(*px) != rescan.end()) { final_result.push_back(*px); }
+      }
+    }
+  }
+  catch(...) {
+    // Restore the enable configuration before passing on the exception:
+    restoreTestConfig(rocEnabled, enabled);
+    throw;
+  }
+  restoreTestConfig(rocEnabled, enabled);
+
+  // Sort the output map by ROC->col->row - just because we are so nice:
+  if((flags&FLAG_NOSORT) == 0) { std::sort(final_result.begin(),final_result.end()); }
+
+  LOG(logDEBUGAPI) << "Adaptive threshold scan took " << t << "ms.";
+  return final_result;
+}
+
+void api::restoreTestConfig(const std::vector<bool> & rocEnabled, const std::vector<std::vector<pixelConfig> > & enabled) {
+  _dut->testAllPixels(false);
+  for(size_t roc = 0; roc < rocEnabled.size(); roc++) {
+    _dut->setROCEnable(roc, rocEnabled.at(roc));
+    for(std::vector<pixelConfig>::const_iterator px = enabled.at(roc).begin(); px != enabled.at(roc).end(); ++px) { _dut->testPixel(px->column, px->row, true, roc); }
+  }
+}
   
+void api::setScanCache(bool enable) {
+  _scancache_enabled = enable;
+  if(!enable) { clearScanCache(); }
+  LOG(logDEBUGAPI) << "Scan result cache " << (enable ? "enabled." : "disabled.");
+}
+
+void api::clearScanCache() {
+  if(_scancache.empty()) return;
+  LOG(logDEBUGAPI) << "Dropping " << _scancache.size() << " cached scan results.";
+  _scancache.clear();
+  _scancache_order.clear();
+}
+
+void api::getScanCacheStatistics(uint32_t & hits, uint32_t & misses) {
+  hits = _scancache_hits;
+  misses = _scancache_misses;
+}
+
+bool api::scanCacheLookup(const std::string & scan, std::vector<pixel> & result) {
+
+  if(!_scancache_enabled) return false;
+
+  std::map<std::pair<uint64_t,std::string>, std::vector<pixel> >::iterator it = _scancache.find(std::make_pair(_dut->getStateHash(), scan));
+  if(it == _scancache.end()) {
+    _scancache_misses++;
+    return false;
+  }
+
+  _scancache_hits++;
+  LOG(logDEBUGAPI) << "Scan \"" << scan << "\" taken before on the same DUT state, returning cached result.";
+  result = it->second;
+  return true;
+}
+
+void api::scanCacheStore(const std::string & scan, const std::vector<pixel> & result) {
+
+  if(!_scancache_enabled) return;
+
+  std::pair<uint64_t,std::string> key = std::make_pair(_dut->getStateHash(), scan);
+  if(_scancache.find(key) == _scancache.end()) { _scancache_order.push_back(key); }
+  _scancache[key] = result;
+
+  // Drop the oldest results:
+  while(_scancache_order.size() > SCAN_CACHE_SIZE) {
+    _scancache.erase(_scancache_order.front());
+    _scancache_order.erase(_scancache_order.begin());
+  }
+}
+
 int32_t api::getReadbackValue(std::string /*parameterName*/) {
 
   if(!status()) {return -1;}
@@ -1120,6 +1573,9 @@ bool api::daqStatus(uint8_t & perFull) {
 
   LOG(logDEBUGAPI) << "Everything alright, buffer size " << filled_buffer
 		   << "/" << _daq_buffersize;
+
+  // DAQ loops poll the status regularly, take a telemetry sample in between if due:
+  if(_telemetry_period > 0 && telemetryDue()) { sampleTelemetry(); }
   return true;
 }
 
@@ -1173,50 +1629,54 @@ std::vector<uint16_t> api::daqGetBuffer() {
 std::vector<rawEvent> api::daqGetRawEventBuffer() {
 
   // Reading out all data from the DTB and returning the raw blob.
-  // Select the right readout channels depending on the number of TBMs
-  std::vector<rawEvent> data = std::vector<rawEvent>();
-  std::vector<rawEvent*> buffer = _hal->daqAllRawEvents();
-
-  // Dereference all vector entries and give data back:
-  for(std::vector<rawEvent*>::iterator it = buffer.begin(); it != buffer.end(); ++it) {
-    data.push_back(**it);
-  }
+  // The Events are read directly into the returned vector, no copies kept:
+  std::vector<rawEvent> data;
+  _hal->daqAllRawEvents(data);
   return data;
 }
 
 std::vector<Event> api::daqGetEventBuffer() {
 
   // Reading out all data from the DTB and returning the decoded Event buffer.
-  // Select the right readout channels depending on the number of TBMs
-  std::vector<Event> data = std::vector<Event>();
-  std::vector<Event*> buffer = _hal->daqAllEvents();
+  // The Events are decoded directly into the returned vector, no copies kept:
+  std::vector<Event> data;
+  _hal->daqAllEvents(data);
 
   // check the data for decoder errors and update our internal counter
-  getDecoderErrorCount(buffer);
-
-  // Dereference all vector entries and give data back:
-  for(std::vector<Event*>::iterator it = buffer.begin(); it != buffer.end(); ++it) {
-    data.push_back(**it);
-  }
+  getDecoderErrorCount(data);
   return data;
 }
 
 Event api::daqGetEvent() {
 
-  // Check DAQ status:
-  if(!daqStatus()) { return Event(); }
+  Event evt;
+  if(!daqGetEvent(evt)) { return Event(); }
+  return evt;
+}
 
-  // Return the next decoded Event from the FIFO buffer:
-  return (*_hal->daqEvent());
+bool api::daqGetEvent(Event & evt) {
+
+  // Only check the local DAQ state, asking the DTB for its buffer fill
+  // level would cost one USB round trip per Event:
+  if(!_daq_running) { return false; }
+
+  // Read the next decoded Event from the FIFO buffer:
+  return _hal->daqEvent(evt);
 }
 
 rawEvent api::daqGetRawEvent() {
 
-  // Check DAQ status:
-  if(!daqStatus()) { return rawEvent(); }
+  rawEvent evt;
+  if(!daqGetRawEvent(evt)) { return rawEvent(); }
+  return evt;
+}
+
+bool api::daqGetRawEvent(rawEvent & evt) {
+
+  if(!_daq_running) { return false; }
 
-  // Return the next raw data record from the FIFO buffer:
-  return (*_hal->daqRawEvent());
+  // Read the next raw data record from the FIFO buffer:
+  return _hal->daqRawEvent(evt);
 }
 
 uint32_t api::daqGetNDecoderErrors() {
@@ -1225,6 +1685,12 @@ uint32_t api::daqGetNDecoderErrors() {
   return _ndecode_errors_lastdaq;
 }
 
+alignmentStatistics api::daqGetAlignmentStatistics() {
+
+  // Return the channel alignment statistics of the DAQ session:
+  return _hal->daqAlignmentStatistics();
+}
+
 
 bool api::daqStop() {
 
@@ -1296,23 +1762,32 @@ std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelPa
       std::vector<Event*> rocdata = std::vector<Event*>();
       std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixels(enabledRocs.front());
 
-      LOG(logDEBUGAPI) << "\"The Loop\" contains "
-		       << enabledPixels.size() << " calls to \'multipixelfn\'";
+      // Run all pixels within one DAQ session if the HAL provides a batched function:
+      HalMemFnPixelParallelBatch batchfn = getBatchFunction(multipixelfn);
+      if(batchfn != NULL) {
+	LOG(logDEBUGAPI) << "\"The Loop\" contains one batched call for "
+			 << enabledPixels.size() << " pixels";
+	rocdata = CALL_MEMBER_FN(*_hal,batchfn)(rocs_i2c, enabledPixels, param);
+      }
+      else {
+	LOG(logDEBUGAPI) << "\"The Loop\" contains "
+			 << enabledPixels.size() << " calls to \'multipixelfn\'";
 
-      for (std::vector<pixelConfig>::iterator px = enabledPixels.begin(); px != enabledPixels.end(); ++px) {
-	// execute call to HAL layer routine and store data in buffer
-	std::vector<Event*> buffer = CALL_MEMBER_FN(*_hal,multipixelfn)(rocs_i2c, px->column, px->row, param);
+	for (std::vector<pixelConfig>::iterator px = enabledPixels.begin(); px != enabledPixels.end(); ++px) {
+	  // execute call to HAL layer routine and store data in buffer
+	  std::vector<Event*> buffer = CALL_MEMBER_FN(*_hal,multipixelfn)(rocs_i2c, px->column, px->row, param);
 
-	// merge pixel data into roc data storage vector
-	if (rocdata.empty()){
-	  rocdata = buffer; // for first time call
-	} else {
-	  // Add buffer vector to the end of existing Event data:
-	  rocdata.reserve(rocdata.size() + buffer.size());
-	  rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
-	}
-      } // pixel loop
-	// append rocdata to main data storage vector
+	  // merge pixel data into roc data storage vector
+	  if (rocdata.empty()){
+	    rocdata = buffer; // for first time call
+	  } else {
+	    // Add buffer vector to the end of existing Event data:
+	    rocdata.reserve(rocdata.size() + buffer.size());
+	    rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
+	  }
+	} // pixel loop
+      }
+      // append rocdata to main data storage vector
       if (data.empty()) data = rocdata;
       else {
 	data.reserve(data.size() + rocdata.size());
@@ -1362,21 +1837,30 @@ std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelPa
 	std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixels(static_cast<uint8_t>(rocit - enabledRocs.begin()));
 
 
-	LOG(logDEBUGAPI) << "\"The Loop\" for the current ROC contains " \
-			 << enabledPixels.size() << " calls to \'pixelfn\'";
-
-	for (std::vector<pixelConfig>::iterator pixit = enabledPixels.begin(); pixit != enabledPixels.end(); ++pixit) {
-	  // execute call to HAL layer routine and store data in buffer
-	  std::vector<Event*> buffer = CALL_MEMBER_FN(*_hal,pixelfn)(rocit->i2c_address, pixit->column, pixit->row, param);
-	  // merge pixel data into roc data storage vector
-	  if (rocdata.empty()){
-	    rocdata = buffer; // for first time call
-	  } else {
-	    // Add buffer vector to the end of existing Event data:
-	    rocdata.reserve(rocdata.size() + buffer.size());
-	    rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
-	  }
-	} // pixel loop
+	// Run all pixels of this ROC within one DAQ session if the HAL provides a batched function:
+	HalMemFnPixelSerialBatch batchfn = getBatchFunction(pixelfn);
+	if(batchfn != NULL) {
+	  LOG(logDEBUGAPI) << "\"The Loop\" for the current ROC contains one batched call for "
+			   << enabledPixels.size() << " pixels";
+	  rocdata = CALL_MEMBER_FN(*_hal,batchfn)(rocit->i2c_address, enabledPixels, param);
+	}
+	else {
+	  LOG(logDEBUGAPI) << "\"The Loop\" for the current ROC contains " \
+			   << enabledPixels.size() << " calls to \'pixelfn\'";
+
+	  for (std::vector<pixelConfig>::iterator pixit = enabledPixels.begin(); pixit != enabledPixels.end(); ++pixit) {
+	    // execute call to HAL layer routine and store data in buffer
+	    std::vector<Event*> buffer = CALL_MEMBER_FN(*_hal,pixelfn)(rocit->i2c_address, pixit->column, pixit->row, param);
+	    // merge pixel data into roc data storage vector
+	    if (rocdata.empty()){
+	      rocdata = buffer; // for first time call
+	    } else {
+	      // Add buffer vector to the end of existing Event data:
+	      rocdata.reserve(rocdata.size() + buffer.size());
+	      rocdata.insert(rocdata.end(), buffer.begin(), buffer.end());
+	    }
+	  } // pixel loop
+	}
 	// append rocdata to main data storage vector
         if (data.empty()) data = rocdata;
 	else {
@@ -1411,24 +1895,37 @@ std::vector<Event*> api::expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelPa
   return data;
 } // expandLoop()
 
+HalMemFnPixelParallelBatch api::getBatchFunction(HalMemFnPixelParallel multipixelfn) {
 
-std::vector<Event*> api::condenseTriggers(std::vector<Event*> data, uint16_t nTriggers, bool efficiency) {
+  if(multipixelfn == &hal::MultiRocOnePixelCalibrate) return &hal::MultiRocSelectedPixelsCalibrate;
+  if(multipixelfn == &hal::MultiRocOnePixelDacScan) return &hal::MultiRocSelectedPixelsDacScan;
+  if(multipixelfn == &hal::MultiRocOnePixelDacDacScan) return &hal::MultiRocSelectedPixelsDacDacScan;
+  if(multipixelfn == &hal::MultiRocOnePixelDacList) return &hal::MultiRocSelectedPixelsDacList;
+  return NULL;
+}
 
-  std::vector<Event*> packed;
+HalMemFnPixelSerialBatch api::getBatchFunction(HalMemFnPixelSerial pixelfn) {
+
+  if(pixelfn == &hal::SingleRocOnePixelCalibrate) return &hal::SingleRocSelectedPixelsCalibrate;
+  if(pixelfn == &hal::SingleRocOnePixelDacScan) return &hal::SingleRocSelectedPixelsDacScan;
+  if(pixelfn == &hal::SingleRocOnePixelDacDacScan) return &hal::SingleRocSelectedPixelsDacDacScan;
+  if(pixelfn == &hal::SingleRocOnePixelDacList) return &hal::SingleRocSelectedPixelsDacList;
+  return NULL;
+}
 
-  if(data.size()%nTriggers != 0) {
-    LOG(logCRITICAL) << "Data size does not correspond to " << nTriggers << " triggers! Aborting data processing!";
-    return packed;
-  }
 
-  for(std::vector<Event*>::iterator Eventit = data.begin(); Eventit!= data.end(); Eventit += nTriggers) {
+namespace {
+
+  // Condense the nTriggers Events starting at "first" into one new Event,
+  // deleting the original Events:
+  Event * condenseGroup(std::vector<Event*>::iterator first, uint16_t nTriggers, bool efficiency) {
 
     Event * evt = new Event();
     std::map<pixel,uint16_t> pxcount = std::map<pixel,uint16_t>();
     std::map<pixel,double> pxmean = std::map<pixel,double>();
     std::map<pixel,double> pxm2 = std::map<pixel,double>();
 
-    for(std::vector<Event*>::iterator it = Eventit; it != Eventit+nTriggers; ++it) {
+    for(std::vector<Event*>::iterator it = first; it != first+nTriggers; ++it) {
 
       // Loop over all contained pixels:
       for(std::vector<pixel>::iterator pixit = (*it)->pixels.begin(); pixit != (*it)->pixels.end(); ++pixit) {
@@ -1473,9 +1970,59 @@ std::vector<Event*> api::condenseTriggers(std::vector<Event*> data, uint16_t nTr
 	px->setVariance(pxm2[*px]/(pxcount[*px] - 1)); // The variance
       }
     }
-    packed.push_back(evt);
+    return evt;
   }
 
+  // Every item condenses one group of triggers into its own output slot:
+  class condenseJob : public threadJob {
+  public:
+    condenseJob(std::vector<Event*> & data, std::vector<Event*> & packed, uint16_t nTriggers, bool efficiency) :
+      _data(data), _packed(packed), _nTriggers(nTriggers), _efficiency(efficiency) {}
+    void process(size_t item) {
+      _packed.at(item) = condenseGroup(_data.begin() + item*_nTriggers, _nTriggers, _efficiency);
+    }
+  private:
+    std::vector<Event*> & _data;
+    std::vector<Event*> & _packed;
+    uint16_t _nTriggers;
+    bool _efficiency;
+  };
+
+  // Every item collects the pixels of one DAC point, i.e. of every
+  // npoints-th Event starting at the item index, keeping the Event order:
+  class dacPointJob : public threadJob {
+  public:
+    dacPointJob(std::vector<Event*> & packed, std::vector< std::vector<pixel> > & points) :
+      _packed(packed), _points(points) {}
+    void process(size_t item) {
+      std::vector<pixel> & pixels = _points.at(item);
+      for(size_t evt = item; evt < _packed.size(); evt += _points.size()) {
+	pixels.insert(pixels.end(), _packed.at(evt)->pixels.begin(), _packed.at(evt)->pixels.end());
+      }
+    }
+  private:
+    std::vector<Event*> & _packed;
+    std::vector< std::vector<pixel> > & _points;
+  };
+
+}
+
+std::vector<Event*> api::condenseTriggers(std::vector<Event*> data, uint16_t nTriggers, bool efficiency) {
+
+  std::vector<Event*> packed;
+
+  if(data.size()%nTriggers != 0) {
+    LOG(logCRITICAL) << "Data size does not correspond to " << nTriggers << " triggers! Aborting data processing!";
+    return packed;
+  }
+
+  // The trigger groups are independent, condense them in parallel. Every
+  // group has its fixed slot, so the output order does not depend on the
+  // thread scheduling:
+  packed.resize(data.size()/nTriggers, NULL);
+  condenseJob job(data, packed, nTriggers, efficiency);
+  _pool->run(job, packed.size());
+
   return packed;
 }
 
@@ -1539,17 +2086,17 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::repackDacScanData (s
 
   LOG(logDEBUGAPI) << "Packing DAC range " << static_cast<int>(dacMin) << " - " << static_cast<int>(dacMax) << " (step size " << static_cast<int>(dacStep) << "), data has " << packed.size() << " entries.";
 
-  // Prepare the result vector
-  for(size_t dac = dacMin; dac <= dacMax; dac += dacStep) { result.push_back(std::make_pair(dac,std::vector<pixel>())); }
+  // Separate the packed data into DAC ranges, potentially several rounds.
+  // Event i belongs to DAC point i%npoints, the points are filled in parallel:
+  std::vector< std::vector<pixel> > points((dacMax-dacMin)/dacStep+1);
+  dacPointJob job(packed, points);
+  _pool->run(job, points.size());
 
-  size_t currentDAC = dacMin;
-  // Loop over the packed data and separate into DAC ranges, potentially several rounds:
-  for(std::vector<Event*>::iterator Eventit = packed.begin(); Eventit!= packed.end(); ++Eventit) {
-    if(currentDAC > dacMax) { currentDAC = dacMin; }
-    result.at((currentDAC-dacMin)/dacStep).second.insert(result.at((currentDAC-dacMin)/dacStep).second.end(),
-					       (*Eventit)->pixels.begin(),
-					       (*Eventit)->pixels.end());
-    currentDAC += dacStep;
+  // Prepare the result vector
+  result.reserve(points.size());
+  for(size_t dac = dacMin; dac <= dacMax; dac += dacStep) {
+    result.push_back(std::make_pair(dac,std::vector<pixel>()));
+    result.back().second.swap(points.at((dac-dacMin)/dacStep));
   }
   
   // Cleanup temporary data:
@@ -1560,6 +2107,43 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::repackDacScanData (s
   return result;
 }
 
+std::vector< std::pair<uint8_t, std::vector<pixel> > > api::repackDacListData (std::vector<Event*> data, std::vector<uint8_t> dacValues, uint16_t nTriggers, uint16_t /*flags*/, bool efficiency){
+
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+
+  // Measure time:
+  timer t;
+
+  // First reduce triggers, we have #nTriggers Events which belong together:
+  std::vector<Event*> packed = condenseTriggers(data, nTriggers, efficiency);
+
+  if(packed.size() % dacValues.size() != 0) {
+    LOG(logCRITICAL) << "Data size not as expected! " << packed.size() << " data blocks do not fit to " << dacValues.size() << " DAC values!";
+    for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
+    return result;
+  }
+
+  LOG(logDEBUGAPI) << "Packing list of " << dacValues.size() << " DAC values, data has " << packed.size() << " entries.";
+
+  // Event i belongs to list entry i%nvalues, the entries are filled in parallel:
+  std::vector< std::vector<pixel> > points(dacValues.size());
+  dacPointJob job(packed, points);
+  _pool->run(job, points.size());
+
+  result.reserve(points.size());
+  for(size_t i = 0; i < dacValues.size(); i++) {
+    result.push_back(std::make_pair(dacValues.at(i),std::vector<pixel>()));
+    result.back().second.swap(points.at(i));
+  }
+
+  // Cleanup temporary data:
+  for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
+
+  LOG(logDEBUGAPI) << "Correctly repacked DacList data for delivery.";
+  LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
+  return result;
+}
+
 std::vector<pixel> api::repackThresholdMapData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags) {
 
   std::vector<pixel> result;
@@ -1732,38 +2316,148 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
 		   << ", step size " << static_cast<int>(dac2step)
 		   << "], data has " << packed.size() << " entries.";
 
+  // Separate the packed data into DAC ranges, potentially several rounds.
+  // DAC2 runs fastest, Event i belongs to DAC point i%npoints, the points
+  // are filled in parallel:
+  std::vector< std::vector<pixel> > points(((dac1max-dac1min)/dac1step+1)*((dac2max-dac2min)/dac2step+1));
+  dacPointJob job(packed, points);
+  _pool->run(job, points.size());
+
   // Prepare the result vector
+  result.reserve(points.size());
+  size_t point = 0;
   for(size_t dac1 = dac1min; dac1 <= dac1max; dac1 += dac1step) {
-    std::pair<uint8_t,std::vector<pixel> > dacpair;
     for(size_t dac2 = dac2min; dac2 <= dac2max; dac2 += dac2step) {
-      dacpair = std::make_pair(dac2,std::vector<pixel>());
-      result.push_back(std::make_pair(dac1,dacpair));
+      result.push_back(std::make_pair(dac1,std::make_pair(dac2,std::vector<pixel>())));
+      result.back().second.second.swap(points.at(point++));
     }
   }
+  
+  // Cleanup temporary data:
+  for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
+
+  LOG(logDEBUGAPI) << "Correctly repacked DacDacScan data for delivery.";
+  LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
+  return result;
+}
+
+DacDacGrid api::getDacDacGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, bool efficiency) {
+
+  if(!status()) {return DacDacGrid();}
+
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) { return DacDacGrid(); }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) { return DacDacGrid(); }
 
-  size_t current1dac = dac1min;
-  size_t current2dac = dac2min;
+  // Setup the correct _hal calls for this test
+  HalMemFnPixelSerial   pixelfn      = &hal::SingleRocOnePixelDacDacScan;
+  HalMemFnPixelParallel multipixelfn = &hal::MultiRocOnePixelDacDacScan;
+  HalMemFnRocSerial     rocfn        = &hal::SingleRocAllPixelsDacDacScan;
+  HalMemFnRocParallel   multirocfn   = &hal::MultiRocAllPixelsDacDacScan;
 
-  // Loop over the packed data and separeate into DAC ranges, potentially several rounds:
-  int i = 0;
-  for(std::vector<Event*>::iterator Eventit = packed.begin(); Eventit!= packed.end(); ++Eventit) {
-    if(current2dac > dac2max) {
-      current2dac = dac2min;
-      current1dac += dac1step;
+  // Load the test parameters into vector
+  std::vector<int32_t> param;
+  param.push_back(static_cast<int32_t>(dac1register));
+  param.push_back(static_cast<int32_t>(dac1min));
+  param.push_back(static_cast<int32_t>(dac1max));
+  param.push_back(static_cast<int32_t>(dac2register));
+  param.push_back(static_cast<int32_t>(dac2min));
+  param.push_back(static_cast<int32_t>(dac2max));
+  param.push_back(static_cast<int32_t>(flags));
+  param.push_back(static_cast<int32_t>(nTriggers));
+  param.push_back(static_cast<int32_t>(dac1step));
+  param.push_back(static_cast<int32_t>(dac2step));
+
+  std::vector<Event*> data = expandLoop(pixelfn, multipixelfn, rocfn, multirocfn, param, flags);
+  // condense the data directly into the dense grid
+  DacDacGrid result = repackDacDacScanGrid(data,dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,nTriggers,flags,efficiency);
+
+  // Reset the original value for the scanned DAC:
+  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
+  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
+    uint8_t oldDac1Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(static_cast<size_t>(rocit - enabledRocs.begin()),dac2name);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << static_cast<int>(oldDac1Value);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << static_cast<int>(oldDac2Value);
+    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac1register,oldDac1Value);
+    _hal->rocSetDAC(static_cast<uint8_t>(rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+  }
+
+  return result;
+}
+
+DacDacGrid api::repackDacDacScanGrid (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t nTriggers, uint16_t /*flags*/, bool efficiency) {
+
+  // Measure time:
+  timer t;
+
+  // Build the pixel index table from all enabled pixels:
+  std::vector<pixel> pixels;
+  std::vector<uint8_t> enabledRocs = _dut->getEnabledRocIDs();
+  for(std::vector<uint8_t>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit) {
+    std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixels(*rocit);
+    for(std::vector<pixelConfig>::iterator pxit = enabledPixels.begin(); pxit != enabledPixels.end(); ++pxit) {
+      pixels.push_back(pixel(*rocit,pxit->column,pxit->row,0));
     }
-    if(current1dac > dac1max) { current1dac = dac1min; }
+  }
+
+  DacDacGrid result(dac1step,dac1min,dac1max,dac2step,dac2min,dac2max,pixels);
+  size_t npoints = result.getNDac1()*result.getNDac2();
 
-    result.at((current1dac-dac1min)/dac1step*((dac2max-dac2min)/dac2step+1) + (current2dac-dac2min)/dac2step).second.second.insert(result.at((current1dac-dac1min)/dac1step*((dac2max-dac2min)/dac2step+1) + (current2dac-dac2min)/dac2step).second.second.end(),
-												       (*Eventit)->pixels.begin(),
-												       (*Eventit)->pixels.end());
-    i++;
-    current2dac += dac2step;
+  size_t block = npoints*nTriggers;
+  if(block == 0 || data.size() % block != 0) {
+    LOG(logCRITICAL) << "Data size not as expected! " << data.size() << " data blocks do not fit to " << npoints
+		     << " DAC values with " << nTriggers << " triggers!";
+    for(std::vector<Event*>::iterator it = data.begin(); it != data.end(); ++it) { delete *it; }
+    uint32_t missing = (block == 0 ? 0 : static_cast<uint32_t>(block - data.size() % block));
+    throw DataMissingEvent("Incomplete DAQ data in function "+std::string(__func__),missing);
   }
-  
-  // Cleanup temporary data:
-  for(std::vector<Event*>::iterator it = packed.begin(); it != packed.end(); ++it) { delete *it; }
 
-  LOG(logDEBUGAPI) << "Correctly repacked DacDacScan data for delivery.";
+  LOG(logDEBUGAPI) << "Packing DAC range [" << static_cast<int>(dac1min) << " - " << static_cast<int>(dac1max)
+		   << ", step size " << static_cast<int>(dac1step) << "]x["
+		   << static_cast<int>(dac2min) << " - " << static_cast<int>(dac2max)
+		   << ", step size " << static_cast<int>(dac2step)
+		   << "] into dense grid, data has " << data.size() << " entries.";
+
+  // Loop over the triggers and fill the DAC points, potentially several rounds
+  // (one per pixel or ROC):
+  size_t point = 0;
+  for(std::vector<Event*>::iterator Eventit = data.begin(); Eventit != data.end(); Eventit += nTriggers) {
+    size_t idac1 = point / result.getNDac2();
+    size_t idac2 = point % result.getNDac2();
+
+    for(std::vector<Event*>::iterator it = Eventit; it != Eventit+nTriggers; ++it) {
+      for(std::vector<pixel>::iterator pixit = (*it)->pixels.begin(); pixit != (*it)->pixels.end(); ++pixit) {
+	result.fill(idac1,idac2,*pixit,efficiency);
+      }
+      // Delete the original data, not needed anymore:
+      delete *it;
+    }
+    if(++point == npoints) { point = 0; }
+  }
+  if(!efficiency) { result.finalize(); }
+
+  if(result.getNDropped() > 0) {
+    LOG(logDEBUGAPI) << "Dropped " << result.getNDropped() << " hits from pixels which are not enabled.";
+  }
+  LOG(logDEBUGAPI) << "Correctly repacked DacDacScan data into dense grid.";
   LOG(logDEBUGAPI) << "Repacking took " << t << "ms.";
   return result;
 }
@@ -1816,11 +2510,9 @@ void api::SetCalibrateBits(bool enable) {
     LOG(logDEBUGAPI) << "Configuring calibrate bits in all enabled PUCs of ROC@I2C " << static_cast<int>(rocit->i2c_address);
     // Check if the signal has to be turned on or off:
     if(enable) {
-      // Loop over all pixels in this ROC and set the Cal bit:
-      for(std::vector<pixelConfig>::iterator pxit = rocit->pixels.begin(); pxit != rocit->pixels.end(); ++pxit) {
-	if(pxit->enable == true) { _hal->PixelSetCalibrate(rocit->i2c_address,pxit->column,pxit->row,0); }
-      }
-
+      // Hand all pixels of this ROC to the HAL in one go, it sets the Cal
+      // bit of the enabled ones:
+      _hal->RocSetCalibrate(rocit->i2c_address,rocit->pixels,0);
     }
     // Clear the signal for the full ROC:
     else {_hal->RocClearCalibrate(rocit->i2c_address);}
@@ -1970,9 +2662,21 @@ void api::getDecoderErrorCount(std::vector<Event*> &data){
   }
 }
 
+void api::getDecoderErrorCount(std::vector<Event> &data){
+  // check the data for any decoding errors (stored in the events as counters)
+  _ndecode_errors_lastdaq = 0; // reset counter
+  for (std::vector<Event>::iterator evtit = data.begin(); evtit != data.end(); ++evtit){
+    _ndecode_errors_lastdaq += evtit->numDecoderErrors;
+  }
+  if (_ndecode_errors_lastdaq){
+    LOG(logCRITICAL) << "A total of " << _ndecode_errors_lastdaq << " pixels could not be decoded in this DAQ readout.";
+  }
+}
+
 void api::setClockStretch(uint8_t src, uint16_t delay, uint16_t width)
 {
   LOG(logDEBUGAPI) << "Set Clock Stretch " << static_cast<int>(src) << " " << static_cast<int>(delay) << " " << static_cast<int>(width); 
+  clearScanCache();
   _hal->SetClockStretch(src,width,delay);
   
 }
@@ -18,6 +18,7 @@ typedef short int int16_t;
 typedef unsigned int uint32_t;
 typedef unsigned short int uint16_t;
 typedef unsigned char uint8_t;
+typedef unsigned long long uint64_t;
 #else
 #include <stdint.h>
 #endif
@@ -27,6 +28,7 @@ typedef unsigned char uint8_t;
 #include <map>
 #include "datatypes.h"
 #include "exceptions.h"
+#include "timer.h"
 
 // PXAR Flags
 
@@ -82,6 +84,17 @@ typedef unsigned char uint8_t;
  */
 #define FLAG_FORCE_UNMASKED   0x0100
 
+/** Flag to pulse sparse pixel selections in groups instead of one pixel at a time. Pixels
+ *  in different double columns do not interfere, so one pixel per double column is armed
+ *  per group and the hits are assigned to the pixels by their address. This reduces the
+ *  number of trigger sequences by up to a factor 26. The triggers are sent by the pattern
+ *  generator and DAC values are written as given, without the NIOS lookup table. DAC scans
+ *  are therefore only grouped together with FLAG_DISABLE_DACCAL, calibrate loops always.
+ *  Not applied together with FLAG_XTALK or FLAG_CHECK_ORDER, the pixels are then pulsed
+ *  one at a time as without this flag.
+ */
+#define FLAG_GROUP_PIXELS     0x0200
+
 
 /** Define a macro for calls to member functions through pointers 
  *  to member functions (used in the loop expansion routines).
@@ -99,6 +112,10 @@ namespace pxar {
    */
   class hal;
 
+  /** Forward declaration, not including the header file!
+   */
+  class threadPool;
+
 
   /** Define typedefs to allow easy passing of member function
    *  addresses from the HAL class, used e.g. in loop expansion routines.
@@ -109,6 +126,12 @@ namespace pxar {
   typedef  std::vector<Event*> (hal::*HalMemFnRocSerial)(uint8_t rocid, std::vector<int32_t> parameter);
   typedef  std::vector<Event*> (hal::*HalMemFnPixelSerial)(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
 
+  /** Typedefs for the batched pixel functions of the HAL, running the loops for a list of
+   *  selected pixels within one DAQ session.
+   */
+  typedef  std::vector<Event*> (hal::*HalMemFnPixelParallelBatch)(std::vector<uint8_t> rocids, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+  typedef  std::vector<Event*> (hal::*HalMemFnPixelSerialBatch)(uint8_t rocid, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+
 
 
   /** pxar API class definition
@@ -158,8 +181,14 @@ namespace pxar {
      *  If the firmware on the DTB does not match the expected version for pxar,
      *  a pxar::FirmwareVersionMismatch exception is thrown.
      *
+     *  The "nThreads" parameter sets the number of threads used to process
+     *  the returned data, e.g. to repack the Events of DAC scans. Zero (the
+     *  default) uses the process-wide pxar::threadPool::shared(), any other
+     *  value a pool of its own; one processes everything in the calling
+     *  thread.
+     *
      */
-    api(std::string usbId = "*", std::string logLevel = "WARNING");
+    api(std::string usbId = "*", std::string logLevel = "WARNING", unsigned int nThreads = 0);
 
     /** Default destructor for libpxar API
      *
@@ -295,6 +324,54 @@ namespace pxar {
      */
     double getTBvd();
 
+    /** Function to set the rate (in Hz) at which the DTB supply telemetry
+     *  (ia, id, va, vd) is sampled. Samples are taken between the regular
+     *  test RPC calls while polling the DAQ status, or by telemetryTick(),
+     *  and stored in a timestamped ring buffer. A rate of zero disables the
+     *  automatic sampling. The default is 1 Hz.
+     */
+    void setTelemetryRate(double rate);
+
+    /** Function to take a telemetry sample if the latest one is older than
+     *  the sampling period. Meant to be called from an idle timer, e.g. in a
+     *  GUI, to keep the telemetry up to date while no DAQ is running.
+     *  Returns true if a sample was taken.
+     */
+    bool telemetryTick();
+
+    /** Function to return the latest cached telemetry sample. Never reads
+     *  from the DTB, so it can be polled e.g. from GUI timers without adding
+     *  RPC traffic. Returns an empty sample if none has been taken yet.
+     */
+    telemetrySample getTelemetry();
+
+    /** Function to return all telemetry samples currently held in the ring
+     *  buffer, oldest first.
+     */
+    std::vector<telemetrySample> getTelemetryHistory();
+
+    /** Function to wait until the telemetry channel "ia", "id", "va" or "vd"
+     *  has settled, i.e. until the last nSamples samples differ by no more
+     *  than "tolerance" (in Ampere or Volts). Samples are taken at the
+     *  configured telemetry rate (at least every 50 ms). Returns the mean of
+     *  the settled samples, or the last sample if the timeout (in ms) is
+     *  reached first.
+     */
+    double waitTelemetrySettled(std::string channel, double tolerance, uint16_t nSamples = 3, uint32_t timeout = 2000);
+
+    /** Method to sweep a DAC of ROC "rocid" and read the analog and digital
+     *  supply currents (in Ampere) at every step
+     *
+     *  Returns a vector of DAC values paired with (ia, id). The whole sweep
+     *  is sent to the DTB as one pipelined command sequence, waiting "settle"
+     *  microseconds on the DTB after each DAC change. If "adaptive" is set,
+     *  the currents are read twice per step and steps where the readings
+     *  differ by more than 0.2mA are measured again with doubled settling
+     *  time (up to three times).
+     *  The DAC is reset to its original value afterwards.
+     */
+    std::vector< std::pair<uint8_t, std::pair<double,double> > > getCurrentVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t rocid, uint32_t settle, bool adaptive = false);
+
     /** turn off HV
      */
     void HVoff();
@@ -409,6 +486,30 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getEfficiencyVsDAC(std::string dacName, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to measure the pulse height for an explicit list of DAC values
+     *
+     *  Returns a vector of pairs containing set dac value and a pxar::pixel vector,
+     *  with the value of the pxar::pixel struct being the averaged pulse height
+     *  over "nTriggers" triggers. The entries follow the order of "dacValues",
+     *  which can be non-uniform (e.g. a set of calibration points). All values are
+     *  measured within one test loop, i.e. with a single trim upload and DAQ session.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    std::vector< std::pair<uint8_t, std::vector<pixel> > > getPulseheightVsDACList(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers);
+
+    /** Method to measure the efficiency for an explicit list of DAC values
+     *
+     *  Returns a vector of pairs containing set dac value and pixels,
+     *  with the value of the pxar::pixel struct being the number of hits in that
+     *  pixel. Efficiency == 1 for nhits == nTriggers
+     *  The entries follow the order of "dacValues", all values are measured within
+     *  one test loop.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     */
+    std::vector< std::pair<uint8_t, std::vector<pixel> > > getEfficiencyVsDACList(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers);
+
     /** Method to scan a DAC range and measure the pixel threshold
      *
      *  Returns a vector of pairs containing set dac value and pixels,
@@ -515,6 +616,38 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the
+     *  pulse height
+     *
+     *  Returns a pxar::DacDacGrid holding the averaged pulse height and its
+     *  variance for all enabled pixels in a dense [dac1][dac2][pixel] array.
+     *  The grid is filled directly from the readout data without creating
+     *  intermediate pxar::pixel vectors. The format returned by
+     *  getPulseheightVsDACDAC can be obtained from DacDacGrid::getDacDacVector.
+     *  Hits from pixels which are not enabled are not stored.
+     *
+     *  The mean and the sample variance are computed over all triggers in
+     *  which the pixel responded. This differs from getPulseheightVsDACDAC,
+     *  which only uses the first hit of a pixel to seed its running mean and
+     *  averages the remaining hits (a pixel with a single hit is reported
+     *  with pulse height 0 there).
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     *
+     */
+    DacDacGrid getPulseheightVsDACDACGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure the efficiency
+     *
+     *  Returns a pxar::DacDacGrid holding the number of hits for all enabled
+     *  pixels in a dense [dac1][dac2][pixel] array, see
+     *  getPulseheightVsDACDACGrid.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     *
+     */
+    DacDacGrid getEfficiencyVsDACDACGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers);
+
     /** Method to get a map of the pulse height
      *
      *  Returns a vector of pixels, with the value of the pxar::pixel struct being
@@ -586,6 +719,34 @@ namespace pxar {
      */
     std::vector<pixel> getThresholdMap(std::string dacName, uint16_t flags, uint16_t nTriggers);
 
+    /** Method to get a map of the pixel threshold using an adaptive coarse-to-fine scan
+     *
+     *  Returns the same vector of pixels as getThresholdMap, with the value of the
+     *  pxar::pixel struct being the threshold value of that pixel.
+     *
+     *  Instead of scanning the full DAC range with the requested precision, a coarse
+     *  scan of the full range is taken first. The DAC range of every ROC is then narrowed
+     *  down to the window covered by its coarse thresholds (ignoring 2% outliers on either
+     *  side) and rescanned with the step size given by the "precision" parameter. ROCs
+     *  with the same window are scanned together. Pixels whose threshold is found at the
+     *  edge of their window are rescanned individually over the full range.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     *
+     */
+    std::vector<pixel> getThresholdMapAdaptive(std::string dacName, uint8_t precision, uint8_t threshold, uint16_t flags, uint16_t nTriggers);
+
+    /** Method to get a map of the pixel threshold using an adaptive scan around a prior
+     *
+     *  Same as above, but the coarse scan is replaced by the supplied prior threshold
+     *  map (e.g. from the previous iteration of a trimming procedure). The window is
+     *  opened by "margin" DAC units around the prior thresholds.
+     *
+     *  If the readout of the DTB is corrupt, a pxar::DataMissingEvent is thrown.
+     *
+     */
+    std::vector<pixel> getThresholdMapAdaptive(std::string dacName, uint8_t precision, uint8_t margin, uint8_t threshold, uint16_t flags, uint16_t nTriggers, std::vector<pixel> prior);
+
     // FIXME missing documentation
     int32_t getReadbackValue(std::string parameterName);
 
@@ -631,6 +792,19 @@ namespace pxar {
      */
     rawEvent daqGetRawEvent();
 
+    /** Function to read the next pxar::Event of the running DAQ session into
+     *  evt. Meant for Event-by-Event readout loops: the decoding pipeline
+     *  stays connected for the whole session, a reused evt is overwritten
+     *  without new allocations and no DTB status is polled. Returns false
+     *  if no DAQ session is running or no more Events are buffered.
+     */
+    bool daqGetEvent(Event & evt);
+
+    /** Function to read the next raw data record of the running DAQ session
+     *  into evt, same semantics as daqGetEvent(Event & evt).
+     */
+    bool daqGetRawEvent(rawEvent & evt);
+
     /** Function to fire the previously defined pattern command list "nTrig"
      *  times, the function parameter defaults to 1.
      *  The function returns the triggering period actually used after cross-check
@@ -678,6 +852,43 @@ namespace pxar {
      */
     uint32_t daqGetNDecoderErrors();
 
+    /** Function that returns the Event alignment statistics of the current
+     *  or last DAQ session. For modules read out on several DAQ channels the
+     *  TBM Event counters of all channels are compared Event by Event; on a
+     *  mismatch the channels are resynchronized and the dropped or incomplete
+     *  Events are counted per channel, together with the Events carrying TBM
+     *  trailer error bits (see pxar::alignmentStatistics).
+     */
+    alignmentStatistics daqGetAlignmentStatistics();
+
+    /** Enables or disables the scan result cache (disabled by default).
+     *
+     *  With the cache enabled, the results of getPulseheightMap, getEfficiencyMap
+     *  and getThresholdMap are stored together with a hash of the full DUT state
+     *  (DACs, trims, masks, enabled pixels, TBM registers and testboard settings)
+     *  and the scan parameters. Repeating an identical scan on an unchanged DUT
+     *  returns the stored result without taking any data. Settings the DUT
+     *  keeps track of (DACs, TBM registers, masks, trims, signal delays, pattern
+     *  generator, power limits) are covered by the state hash, so e.g. restoring
+     *  the DACs after a test keeps the results valid. Changes the DUT does not
+     *  track drop all stored results: initTestboard, programDUT, power and HV
+     *  switching, setClockStretch and flashTB.
+     *
+     *  Only use it if nothing outside of the API (e.g. an external HV supply or
+     *  source) changes the conditions between identical scans.
+     */
+    void setScanCache(bool enable);
+
+    /** Drops all results stored in the scan cache. To be called when the
+     *  conditions of the DUT changed without the API noticing.
+     */
+    void clearScanCache();
+
+    /** Returns the number of scans answered from the scan cache and the number
+     *  of scans that had to be taken since the API was created.
+     */
+    void getScanCacheStatistics(uint32_t & hits, uint32_t & misses);
+
     /** DUT object for book keeping of settings
      */
     dut * _dut;
@@ -704,6 +915,12 @@ namespace pxar {
      */
     std::vector<Event*> expandLoop(HalMemFnPixelSerial pixelfn, HalMemFnPixelParallel multipixelfn, HalMemFnRocSerial rocfn, HalMemFnRocParallel multirocfn, std::vector<int32_t> param, uint16_t flags = 0);
 
+    /** Helpers to look up the batched HAL counterpart of a single pixel HAL function.
+     *  Returns NULL if no batched version is available.
+     */
+    HalMemFnPixelParallelBatch getBatchFunction(HalMemFnPixelParallel multipixelfn);
+    HalMemFnPixelSerialBatch getBatchFunction(HalMemFnPixelSerial pixelfn);
+
     /** Merges all consecutive triggers into one pxar::Event. This function deletes the original event data after
      *  merging! 
      */
@@ -719,10 +936,24 @@ namespace pxar {
      */
     std::vector<pixel> repackThresholdMapData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
 
+    /** Restores the ROC enable flags and the enabled (tested) pixels of all
+     *  ROCs stored before a scan changed them.
+     */
+    void restoreTestConfig(const std::vector<bool> & rocEnabled, const std::vector<std::vector<pixelConfig> > & enabled);
+
     /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors.
      */
     std::vector< std::pair<uint8_t, std::vector<pixel> > > repackDacScanData (std::vector<Event*> data, uint8_t dacStep, uint8_t dacMin, uint8_t dacMax, uint16_t nTriggers, uint16_t flags, bool efficiency);
 
+    /** Runs a DAC scan over an explicit list of DAC values, shared by
+     *  getPulseheightVsDACList and getEfficiencyVsDACList
+     */
+    std::vector< std::pair<uint8_t, std::vector<pixel> > > getDacListData(std::string dacName, std::vector<uint8_t> dacValues, uint16_t flags, uint16_t nTriggers, bool efficiency);
+
+    /** Repacks DAC list scan data into pairs of DAC values with fired pxar::pixel vectors.
+     */
+    std::vector< std::pair<uint8_t, std::vector<pixel> > > repackDacListData (std::vector<Event*> data, std::vector<uint8_t> dacValues, uint16_t nTriggers, uint16_t flags, bool efficiency);
+
     /** Repacks DAC scan data into pairs of DAC values with fired pxar::pixel vectors and return the threshold value.
      */
     std::vector<std::pair<uint8_t,std::vector<pixel> > > repackThresholdDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint8_t thresholdlevel, uint16_t nTriggers, uint16_t flags);
@@ -732,6 +963,17 @@ namespace pxar {
      */
     std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > repackDacDacScanData (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t nTriggers, uint16_t flags, bool efficiency);
 
+    /** Runs a (2D) DAC-DAC scan and returns the result as pxar::DacDacGrid
+     */
+    DacDacGrid getDacDacGrid(std::string dac1name, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, std::string dac2name, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint16_t nTriggers, bool efficiency);
+
+    /** Condenses the triggers of (2D) DAC-DAC scan data directly into a
+     *  dense pxar::DacDacGrid for all enabled pixels. This function deletes
+     *  the original event data. Throws pxar::DataMissingEvent if the number
+     *  of Events does not match the scan points and triggers.
+     */
+    DacDacGrid repackDacDacScanGrid (std::vector<Event*> data, uint8_t dac1step, uint8_t dac1min, uint8_t dac1max, uint8_t dac2step, uint8_t dac2min, uint8_t dac2max, uint16_t nTriggers, uint16_t flags, bool efficiency);
+
     /** Helper function for conversion from string to register value
      *
      *  Type tells it whether it is a DTB, TBM or ROC register to look for.
@@ -811,6 +1053,7 @@ namespace pxar {
      *  with the number found in the data sample passed to the function
      */
     void getDecoderErrorCount(std::vector<Event*> &data);
+    void getDecoderErrorCount(std::vector<Event> &data);
 
     /** Status of the DAQ
      */
@@ -823,6 +1066,49 @@ namespace pxar {
     /** Number of pixel decoding errors in last DAQ readout */
     uint32_t _ndecode_errors_lastdaq;
 
+    /** Reads a new telemetry sample from the DTB and stores it in the
+     *  ring buffer
+     */
+    telemetrySample sampleTelemetry();
+
+    /** Returns true if the latest telemetry sample is older than the
+     *  sampling period (or no sample has been taken yet)
+     */
+    bool telemetryDue();
+
+    /** Ring buffer of telemetry samples, with the position of the next
+     *  sample to be written and the number of valid samples
+     */
+    std::vector<telemetrySample> _telemetry;
+    size_t _telemetry_head;
+    size_t _telemetry_count;
+
+    /** Telemetry sampling period in ms, zero for no automatic sampling */
+    uint32_t _telemetry_period;
+
+    /** Reference time for the telemetry timestamps */
+    timer _telemetry_clock;
+
+    /** Worker threads for the data repacking */
+    threadPool * _pool;
+
+    /** Looks up a scan in the scan cache. Returns true and fills the result if
+     *  an identical scan has been taken on the current DUT state.
+     */
+    bool scanCacheLookup(const std::string & scan, std::vector<pixel> & result);
+
+    /** Stores a scan result for the current DUT state in the scan cache */
+    void scanCacheStore(const std::string & scan, const std::vector<pixel> & result);
+
+    /** Scan result cache, keyed by DUT state hash and scan description, with
+     *  the keys in order of insertion for dropping the oldest entries
+     */
+    bool _scancache_enabled;
+    std::map<std::pair<uint64_t,std::string>, std::vector<pixel> > _scancache;
+    std::vector<std::pair<uint64_t,std::string> > _scancache_order;
+    uint32_t _scancache_hits;
+    uint32_t _scancache_misses;
+
   }; // class api
 
 
@@ -953,6 +1239,17 @@ namespace pxar {
      */
     void maskPixel(uint8_t column, uint8_t row, bool mask, uint8_t rocid);
 
+    /** Function to mask a list of pixels (column, row) on a specific ROC at
+     *  once, e.g. the hot pixels found by an analysis. Much faster than
+     *  calling maskPixel() for every single pixel.
+     */
+    void maskPixels(std::vector<std::pair<uint8_t, uint8_t> > pixels, bool mask, uint8_t rocid);
+
+    /** Function to enable a list of pixels (column, row) on a specific ROC at
+     *  once, see maskPixels().
+     */
+    void testPixels(std::vector<std::pair<uint8_t, uint8_t> > pixels, bool enable, uint8_t rocid);
+
     /** Function to enable all pixels on all ROCs:
      */
     void testAllPixels(bool enable);
@@ -980,6 +1277,13 @@ namespace pxar {
     /** Function to update trim bits for one particular pixel on a given ROC.
      */
     bool updateTrimBits(pixelConfig trim, uint8_t rocid);
+
+    /** Function returning a hash of the full DUT configuration, i.e. all
+     *  TBM and ROC registers, all pixel trim, mask and enable settings and
+     *  the testboard settings. Any change in the configuration changes the
+     *  hash.
+     */
+    uint64_t getStateHash();
    
     /** Function to check the status of the DUT
      */
@@ -32,4 +32,91 @@ namespace pxar {
     }
   }
 
+  DacDacGrid::DacDacGrid(uint8_t dac1step, uint8_t dac1min, uint8_t dac1max,
+			 uint8_t dac2step, uint8_t dac2min, uint8_t dac2max,
+			 std::vector<pixel> pixels) :
+    _dac1min(dac1min), _dac1step(dac1step), _ndac1((dac1max-dac1min)/dac1step+1),
+    _dac2min(dac2min), _dac2step(dac2step), _ndac2((dac2max-dac2min)/dac2step+1),
+    _pixels(), _index(), _value(), _variance(), _count(), _dropped(0) {
+
+    // Build the pixel index table, skipping duplicates:
+    for(std::vector<pixel>::iterator px = pixels.begin(); px != pixels.end(); ++px) {
+      if(_index.find(*px) != _index.end()) continue;
+      _index.insert(std::make_pair(*px,_pixels.size()));
+      _pixels.push_back(pixel(px->roc_id,px->column,px->row,0));
+    }
+
+    size_t size = _ndac1*_ndac2*_pixels.size();
+    LOG(logDEBUGAPI) << "Allocating DacDacGrid of " << _ndac1 << "x" << _ndac2
+		     << " DAC points for " << _pixels.size() << " pixels.";
+    _value.resize(size,0);
+    _variance.resize(size,0);
+    _count.resize(size,0);
+  }
+
+  int DacDacGrid::getPixelIndex(uint8_t roc_id, uint8_t column, uint8_t row) const {
+    std::map<pixel,size_t>::const_iterator it = _index.find(pixel(roc_id,column,row,0));
+    if(it == _index.end()) return -1;
+    return static_cast<int>(it->second);
+  }
+
+  std::vector<pixel> DacDacGrid::getHitPixels(size_t idac1, size_t idac2) const {
+    std::vector<pixel> result;
+    size_t base = cell(idac1,idac2,0);
+    for(size_t ipx = 0; ipx < _pixels.size(); ipx++) {
+      if(_count.at(base+ipx) == 0) continue;
+      pixel px = _pixels.at(ipx);
+      px.setValue(_value.at(base+ipx));
+      px.setVariance(_variance.at(base+ipx));
+      result.push_back(px);
+    }
+    return result;
+  }
+
+  std::vector<double> DacDacGrid::getPixelMap(size_t ipx) const {
+    std::vector<double> result;
+    result.reserve(_ndac1*_ndac2);
+    for(size_t idac1 = 0; idac1 < _ndac1; idac1++) {
+      for(size_t idac2 = 0; idac2 < _ndac2; idac2++) {
+	result.push_back(_value.at(cell(idac1,idac2,ipx)));
+      }
+    }
+    return result;
+  }
+
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > DacDacGrid::getDacDacVector() const {
+    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+    result.reserve(_ndac1*_ndac2);
+    for(size_t idac1 = 0; idac1 < _ndac1; idac1++) {
+      for(size_t idac2 = 0; idac2 < _ndac2; idac2++) {
+	result.push_back(std::make_pair(getDac1Value(idac1),
+					std::make_pair(getDac2Value(idac2),getHitPixels(idac1,idac2))));
+      }
+    }
+    return result;
+  }
+
+  bool DacDacGrid::fill(size_t idac1, size_t idac2, const pixel & px, bool efficiency) {
+    std::map<pixel,size_t>::const_iterator it = _index.find(px);
+    if(it == _index.end()) { _dropped++; return false; }
+
+    size_t c = cell(idac1,idac2,it->second);
+    _count.at(c)++;
+    if(efficiency) { _value.at(c) += 1; }
+    else {
+      // Welford's method, the variance array holds the sum of squares until finalize():
+      double val = pixel(px).getValue();
+      double delta = val - _value.at(c);
+      _value.at(c) += static_cast<float>(delta/_count.at(c));
+      _variance.at(c) += static_cast<float>(delta*(val - _value.at(c)));
+    }
+    return true;
+  }
+
+  void DacDacGrid::finalize() {
+    for(size_t c = 0; c < _count.size(); c++) {
+      _variance.at(c) = (_count.at(c) > 1) ? _variance.at(c)/(_count.at(c) - 1) : 0;
+    }
+  }
+
 } // namespace pxar
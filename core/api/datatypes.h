@@ -18,6 +18,7 @@ typedef unsigned char uint8_t;
 #endif
 
 #include <iostream>
+#include <string>
 #include <vector>
 #include <map>
 #include <limits>
@@ -172,6 +173,138 @@ namespace pxar {
   };
 
 
+  /** Class to store the result of a two-dimensional DAC scan in a dense
+   *  array of [dac1][dac2][pixel] values and variances.
+   *
+   *  The pixels are addressed through an index table which is fixed at
+   *  construction time, usually the list of enabled pixels of the DUT.
+   *  Hits from pixels not contained in the table are dropped when filling.
+   *  The values for all pixels of one DAC point are stored contiguously.
+   */
+  class DLLEXPORT DacDacGrid {
+  public:
+  DacDacGrid() : _dac1min(0), _dac1step(1), _ndac1(0), _dac2min(0), _dac2step(1), _ndac2(0),
+      _pixels(), _index(), _value(), _variance(), _count(), _dropped(0) {}
+
+    /** Constructor for a grid covering the DAC ranges [dac1min,dac1max] and
+     *  [dac2min,dac2max] with the given step sizes, for the pixels in the
+     *  index table "pixels". Pixel values in the index table are ignored.
+     */
+    DacDacGrid(uint8_t dac1step, uint8_t dac1min, uint8_t dac1max,
+	       uint8_t dac2step, uint8_t dac2min, uint8_t dac2max,
+	       std::vector<pixel> pixels);
+
+    /** Number of scan points of the first DAC
+     */
+    size_t getNDac1() const { return _ndac1; }
+
+    /** Number of scan points of the second DAC
+     */
+    size_t getNDac2() const { return _ndac2; }
+
+    /** Number of pixels in the index table
+     */
+    size_t getNPixels() const { return _pixels.size(); }
+
+    /** Returns the DAC value of the first DAC for scan point idac1
+     */
+    uint8_t getDac1Value(size_t idac1) const { return static_cast<uint8_t>(_dac1min + idac1*_dac1step); }
+
+    /** Returns the DAC value of the second DAC for scan point idac2
+     */
+    uint8_t getDac2Value(size_t idac2) const { return static_cast<uint8_t>(_dac2min + idac2*_dac2step); }
+
+    /** Returns the pixel index table
+     */
+    const std::vector<pixel> & getPixels() const { return _pixels; }
+
+    /** Returns the index of the given pixel in the index table or -1 if the
+     *  pixel is not contained in the grid
+     */
+    int getPixelIndex(uint8_t roc_id, uint8_t column, uint8_t row) const;
+
+    /** Returns the mean value (pulse height or number of hits) of pixel ipx
+     *  at the given scan point
+     */
+    double getValue(size_t idac1, size_t idac2, size_t ipx) const { return _value.at(cell(idac1,idac2,ipx)); }
+
+    /** Returns the variance of the pulse height of pixel ipx at the given
+     *  scan point
+     */
+    double getVariance(size_t idac1, size_t idac2, size_t ipx) const { return _variance.at(cell(idac1,idac2,ipx)); }
+
+    /** Returns the number of triggers in which pixel ipx responded at the
+     *  given scan point
+     */
+    uint16_t getHits(size_t idac1, size_t idac2, size_t ipx) const { return _count.at(cell(idac1,idac2,ipx)); }
+
+    /** Returns a pointer to the getNPixels() contiguous values of the given
+     *  scan point, ordered as the pixel index table
+     */
+    const float * getValues(size_t idac1, size_t idac2) const { return &_value.at(cell(idac1,idac2,0)); }
+
+    /** Returns a pointer to the getNPixels() contiguous variances of the
+     *  given scan point, ordered as the pixel index table
+     */
+    const float * getVariances(size_t idac1, size_t idac2) const { return &_variance.at(cell(idac1,idac2,0)); }
+
+    /** Returns all pixels which responded at the given scan point, with
+     *  their values and variances set
+     */
+    std::vector<pixel> getHitPixels(size_t idac1, size_t idac2) const;
+
+    /** Returns the [dac1][dac2] map of values for pixel ipx, with the
+     *  second DAC running fastest
+     */
+    std::vector<double> getPixelMap(size_t ipx) const;
+
+    /** Converts the grid to the nested vector format returned by the
+     *  api::get*VsDACDAC functions
+     */
+    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > getDacDacVector() const;
+
+    /** Adds one pixel hit to scan point (idac1,idac2). For efficiency
+     *  measurements only the number of hits is recorded, otherwise mean and
+     *  variance of the pixel value are updated incrementally (Welford's
+     *  method over all hits, unlike the legacy trigger condensing which
+     *  only seeds the mean with the first hit). Returns false if the pixel
+     *  is not contained in the index table.
+     */
+    bool fill(size_t idac1, size_t idac2, const pixel & px, bool efficiency);
+
+    /** Converts the accumulated sums of squares into variances. Needs to be
+     *  called once after all pulse height hits have been filled.
+     */
+    void finalize();
+
+    /** Number of pixel hits which were dropped since the pixel was not
+     *  contained in the index table
+     */
+    size_t getNDropped() const { return _dropped; }
+
+  private:
+    size_t cell(size_t idac1, size_t idac2, size_t ipx) const {
+      return (idac1*_ndac2 + idac2)*_pixels.size() + ipx;
+    }
+
+    uint8_t _dac1min, _dac1step;
+    size_t _ndac1;
+    uint8_t _dac2min, _dac2step;
+    size_t _ndac2;
+
+    /** Pixel index table and the lookup from the pixel address to the index
+     */
+    std::vector<pixel> _pixels;
+    std::map<pixel,size_t> _index;
+
+    /** Dense [dac1][dac2][pixel] arrays of values, variances and hit counts
+     */
+    std::vector<float> _value;
+    std::vector<float> _variance;
+    std::vector<uint16_t> _count;
+    size_t _dropped;
+  };
+
   /** Class to store raw evet data records containing a list of flags to indicate the 
    *  Event status as well as a vector of uint16_t data records containing the actual
    *  Event data in undecoded raw format.
@@ -214,6 +347,82 @@ namespace pxar {
     }
   };
 
+  /** Class to store the Event alignment statistics of a DAQ session read
+   *  out on several DAQ channels (one per TBM core or link). The TBM Event
+   *  counters of all channels are compared to channel 0 for every Event;
+   *  channels are resynchronized to channel 0 on a mismatch.
+   *  All counters are per channel, index 0-3.
+   */
+  class DLLEXPORT alignmentStatistics {
+  public:
+  alignmentStatistics() : channels(0), merged(0), resyncs(0), incomplete(0) { Clear(); }
+    void Clear() {
+      merged = 0; resyncs = 0; incomplete = 0;
+      for(size_t c = 0; c < 4; c++) { events[c] = 0; trailerErrors[c] = 0; skipped[c] = 0; missing[c] = 0; }
+    }
+    /** Returns true if no channel showed trailer errors or misaligned Events */
+    bool IsClean() const {
+      if(incomplete) return false;
+      for(size_t c = 0; c < 4; c++) { if(trailerErrors[c] || skipped[c] || missing[c]) return false; }
+      return true;
+    }
+
+    /** Number of DAQ channels aligned */
+    uint8_t channels;
+    /** Number of merged Events delivered */
+    uint32_t merged;
+    /** Number of merged Events for which at least one channel had to be resynchronized */
+    uint32_t resyncs;
+    /** Number of merged Events flushed at the end of the readout with at least one channel missing */
+    uint32_t incomplete;
+    /** Events read from the channel */
+    uint32_t events[4];
+    /** Events with any of the TBM trailer error bits set */
+    uint32_t trailerErrors[4];
+    /** Events dropped because channel 0 did not see their Event counter */
+    uint32_t skipped[4];
+    /** Channel 0 Events for which this channel had no data */
+    uint32_t missing[4];
+
+  private:
+    /** Overloaded ostream operator for simple printing of the statistics
+     */
+    friend std::ostream & operator<<(std::ostream &out, const alignmentStatistics& stat) {
+      out << stat.merged << " Events from " << static_cast<int>(stat.channels) << " channels, " << stat.resyncs << " resynchronized, " << stat.incomplete << " incomplete";
+      for(size_t c = 0; c < stat.channels && c < 4; c++) {
+	out << "; ch" << c << ": " << stat.events[c] << " read, " << stat.trailerErrors[c] << " trailer errors, "
+	    << stat.skipped[c] << " skipped, " << stat.missing[c] << " missing";
+      }
+      return out;
+    }
+  };
+
+  /** Class to store one sample of the DTB supply telemetry: analog and
+   *  digital DUT supply currents (in Ampere) and voltages (in Volts), and
+   *  the time of the measurement in milliseconds since the API was created.
+   */
+  class DLLEXPORT telemetrySample {
+  public:
+  telemetrySample() : time(0), ia(0), id(0), va(0), vd(0) {}
+
+    /** Returns the value of the channel "ia", "id", "va" or "vd",
+     *  zero for unknown channel names
+     */
+    double get(std::string channel) const {
+      if(channel == "ia") return ia;
+      if(channel == "id") return id;
+      if(channel == "va") return va;
+      if(channel == "vd") return vd;
+      return 0;
+    }
+
+    uint32_t time;
+    double ia;
+    double id;
+    double va;
+    double vd;
+  };
+
   /** Class to store the configuration for single pixels (i.e. their mask state,
    *  trim bit settings and whether they belong to the currently run test ("enable").
    *  By default, pixelConfigs have the  mask bit set.
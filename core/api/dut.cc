@@ -336,6 +336,46 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask, uint8_t rocid) {
   }
 }
 
+void dut::maskPixels(std::vector<std::pair<uint8_t, uint8_t> > pixels, bool mask, uint8_t rocid) {
+
+  if(status() && rocid < roc.size()) {
+    LOG(logDEBUGAPI) << "Set mask bit to " << static_cast<int>(mask) << " for " << pixels.size() << " pixels on ROC " << static_cast<int>(rocid);
+    std::vector<pixelConfig> & px = roc.at(rocid).pixels;
+    // Look up the pixels by address instead of searching for every single one:
+    std::vector<int> index(ROC_NUMCOLS*ROC_NUMROWS, -1);
+    for(size_t i = 0; i < px.size(); i++) {
+      if(px.at(i).column < ROC_NUMCOLS && px.at(i).row < ROC_NUMROWS) { index.at(px.at(i).column*ROC_NUMROWS + px.at(i).row) = i; }
+    }
+    for(std::vector<std::pair<uint8_t, uint8_t> >::iterator it = pixels.begin(); it != pixels.end(); ++it) {
+      if(it->first < ROC_NUMCOLS && it->second < ROC_NUMROWS && index.at(it->first*ROC_NUMROWS + it->second) >= 0) {
+	px.at(index.at(it->first*ROC_NUMROWS + it->second)).mask = mask;
+      } else {
+	LOG(logWARNING) << "Pixel at column " << static_cast<int>(it->first) << " and row " << static_cast<int>(it->second) << " not found for ROC " << static_cast<int>(rocid)<< "!" ;
+      }
+    }
+  }
+}
+
+void dut::testPixels(std::vector<std::pair<uint8_t, uint8_t> > pixels, bool enable, uint8_t rocid) {
+
+  if(status() && rocid < roc.size()) {
+    LOG(logDEBUGAPI) << "Set enable bit to " << static_cast<int>(enable) << " for " << pixels.size() << " pixels on ROC " << static_cast<int>(rocid);
+    std::vector<pixelConfig> & px = roc.at(rocid).pixels;
+    // Look up the pixels by address instead of searching for every single one:
+    std::vector<int> index(ROC_NUMCOLS*ROC_NUMROWS, -1);
+    for(size_t i = 0; i < px.size(); i++) {
+      if(px.at(i).column < ROC_NUMCOLS && px.at(i).row < ROC_NUMROWS) { index.at(px.at(i).column*ROC_NUMROWS + px.at(i).row) = i; }
+    }
+    for(std::vector<std::pair<uint8_t, uint8_t> >::iterator it = pixels.begin(); it != pixels.end(); ++it) {
+      if(it->first < ROC_NUMCOLS && it->second < ROC_NUMROWS && index.at(it->first*ROC_NUMROWS + it->second) >= 0) {
+	px.at(index.at(it->first*ROC_NUMROWS + it->second)).enable = enable;
+      } else {
+	LOG(logWARNING) << "Pixel at column " << static_cast<int>(it->first) << " and row " << static_cast<int>(it->second) << " not found for ROC " << static_cast<int>(rocid)<< "!" ;
+      }
+    }
+  }
+}
+
 void dut::testPixel(uint8_t column, uint8_t row, bool enable) {
 
   if(status()) {
@@ -458,23 +498,91 @@ bool dut::updateTrimBits(uint8_t column, uint8_t row, uint8_t trim, uint8_t roci
 bool dut::updateTrimBits(std::vector<pixelConfig> trimming, uint8_t rocid) {
 
   if(status() && rocid < roc.size()) {
+    std::vector<pixelConfig> & pixels = roc.at(rocid).pixels;
+    // The trimming is usually given in the same order as the pixels are stored,
+    // so continue searching after the previous match:
+    std::vector<pixelConfig>::iterator next = pixels.begin();
+
     // Loop over all trimbit pixelConfigs we got as parameter:
     for (std::vector<pixelConfig>::iterator it = trimming.begin(); it != trimming.end(); ++it){
 
       // Find the pixel in the given ROC pixels vector:
-      std::vector<pixelConfig>::iterator px = std::find_if(roc.at(rocid).pixels.begin(),
-							   roc.at(rocid).pixels.end(),
-							   findPixelXY(it->column,it->row));
-      // Pixel was not found:
-      if(px == roc.at(0).pixels.end()) return false;
+      std::vector<pixelConfig>::iterator px = std::find_if(next, pixels.end(), findPixelXY(it->column,it->row));
+      if(px == pixels.end()) {
+	px = std::find_if(pixels.begin(), next, findPixelXY(it->column,it->row));
+	// Pixel was not found:
+	if(px == next) return false;
+      }
       // Pixel was found, set the new trimming values:
       px->trim = it->trim;
+      next = px + 1;
     }
     return true;
   }
   else { return false; }
 }
 
+namespace {
+  // 64 bit FNV-1a hash, fed with one value after the other:
+  class stateHash {
+  public:
+    stateHash() : h(14695981039346656037ULL) {}
+    void add(const void * data, size_t size) {
+      const unsigned char * p = static_cast<const unsigned char *>(data);
+      for(size_t i = 0; i < size; i++) { h ^= p[i]; h *= 1099511628211ULL; }
+    }
+    template <typename T> void add(T value) { add(&value, sizeof(value)); }
+    void add(const std::map<uint8_t,uint8_t> & regs) {
+      add(regs.size());
+      for(std::map<uint8_t,uint8_t>::const_iterator it = regs.begin(); it != regs.end(); ++it) { add(it->first); add(it->second); }
+    }
+    uint64_t get() { return h; }
+  private:
+    uint64_t h;
+  };
+}
+
+uint64_t dut::getStateHash() {
+
+  stateHash h;
+  h.add(_initialized);
+  h.add(_programmed);
+  h.add(hubId);
+
+  h.add(tbm.size());
+  for(std::vector<tbmConfig>::iterator it = tbm.begin(); it != tbm.end(); ++it) {
+    h.add(it->type);
+    h.add(it->enable);
+    h.add(it->dacs);
+  }
+
+  h.add(roc.size());
+  for(std::vector<rocConfig>::iterator it = roc.begin(); it != roc.end(); ++it) {
+    h.add(it->type);
+    h.add(it->i2c_address);
+    h.add(it->enable);
+    h.add(it->dacs);
+    h.add(it->pixels.size());
+    for(std::vector<pixelConfig>::iterator px = it->pixels.begin(); px != it->pixels.end(); ++px) {
+      h.add(px->column);
+      h.add(px->row);
+      h.add(px->trim);
+      h.add(px->mask);
+      h.add(px->enable);
+    }
+  }
+
+  h.add(sig_delays);
+  h.add(va); h.add(vd); h.add(ia); h.add(id);
+  h.add(pg_setup.size());
+  for(std::vector<std::pair<uint16_t,uint8_t> >::iterator it = pg_setup.begin(); it != pg_setup.end(); ++it) {
+    h.add(it->first);
+    h.add(it->second);
+  }
+  h.add(pg_sum);
+  return h.get();
+}
+
 bool dut::status() {
 
   if(!_initialized || !_programmed) {
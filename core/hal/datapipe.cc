@@ -34,103 +34,29 @@ namespace pxar {
     return lastSample = buffer[pos++];
   }
 
-  rawEvent* dtbEventSplitter::SplitDeser400() {
-    record.Clear();
-
-    // If last one had Event end marker, get a new sample:
-    if (!nextStartDetected) { Get(); }
-
-    // If new sample does not have start marker keep on reading until we find it:
-    if ((GetLast() & 0xe000) != 0xa000) {
-      record.SetStartError();
-      Get();
-    }
-    record.Add(GetLast());
-
-    // Else keep reading and adding samples until we find any marker.
-    while ((Get() & 0xe000) != 0xc000) {
-      // Check if the last read sample has Event end marker:
-      if ((GetLast() & 0xe000) == 0xa000) {
-	record.SetEndError();
-	nextStartDetected = true;
-	return &record;
-      }
-      // If total Event size is too big, break:
-      if (record.GetSize() < 40000) record.Add(GetLast());
-      else record.SetOverflow();
-    }
-    record.Add(GetLast());
-
-    LOG(logDEBUGPIPES) << "-------------------------";
-    LOG(logDEBUGPIPES) << listVector(record.data,true);
-
-    return &record;
-  }
-
-  rawEvent* dtbEventSplitter::SplitDeser160() {
-    record.Clear();
-
-    // If last one had Event end marker, get a new sample:
-    if (GetLast() & 0x4000) { Get(); }
-
-    // If new sample does not have start marker keep on reading until we find it:
-    if (!(GetLast() & 0x8000)) {
-      record.SetStartError();
-      while (!(GetLast() & 0x8000)) Get();
-    }
-
-    // Else keep reading and adding samples until we find any marker.
-    do {
-      // If total Event size is too big, break:
-      if (record.GetSize() >= 40000) {
-	record.SetOverflow();
-	break;
-      }
-
-      // FIXME Very first Event starts with 0xC - which srews up empty Event detection here!
-      // If the Event start sample is also Event end sample, write and quit:
-      if((GetLast() & 0xc000) == 0xc000) { break; }
-
-      record.Add(GetLast() & 0x0fff);
-    } while ((Get() & 0xc000) == 0);
-
-    // Check if the last read sample has Event end marker:
-    if (GetLast() & 0x4000) record.Add(GetLast() & 0x0fff);
-    // Else set Event end error:
-    else record.SetEndError();
-
-    LOG(logDEBUGPIPES) << "-------------------------";
-    LOG(logDEBUGPIPES) << listVector(record.data,true);
-
-    return &record;
-  }
-
-  Event* dtbEventDecoder::DecodeDeser400() {
+  void decodeDeser400(rawEvent & sample, Event & roc_Event, int16_t roc_offset, bool invertedAddress) {
 
     roc_Event.Clear();
-    rawEvent *sample = Get();
 
     unsigned int raw = 0;
     unsigned int pos = 0;
-    unsigned int size = sample->GetSize();
+    unsigned int size = sample.GetSize();
+    const uint16_t * data = (size > 0 ? &sample.data[0] : 0);
     uint16_t v;
 
-    // Get the right ROC id, channel 0: 0-7, channel 1: 8-15
-    int16_t roc_n = -1 + GetChannel() * 8;
+    // ROC id of the first ROC of this channel, counted up at every ROC header:
+    int16_t roc_n = roc_offset;
 
-    // Check if ROC has inverted pixel address (ROC_PSI46DIG):
-    bool invertedAddress = ( GetDeviceType() == ROC_PSI46DIG ? true : false );
-    
 
     // --- decode TBM header ---------------------------------
 
     // H1
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+    v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
     //if ((v & 0xe000) != 0xa000) roc_Event.error |= 0x0800;
     raw = (v & 0x00ff) << 8;
 
     // H2
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+    v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
     //if ((v & 0xe000) != 0x8000) roc_Event.error |= 0x0400;
     raw += v & 0x00ff;
 
@@ -139,13 +65,13 @@ namespace pxar {
     // --- decode ROC data -----------------------------------
 
     // while ROC header
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+    v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
     while ((v & 0xe000) == 0x4000) { // ROC Header
 
       // Count ROC Headers up:
       roc_n++;
 
-      v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+      v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
       while ((v & 0xe000) <= 0x2000) { // R0 ... R1
 
 	for (unsigned int i = 0; i <= 1; i++) {
@@ -156,12 +82,12 @@ namespace pxar {
 	      //roc.error |= 0x0001;
 	      //roc.pixel.push_back(pixel);
 	      //x.roc.push_back(roc);
-	      v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+	      v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
 	      goto trailer;
 	    }
 	  }
 	  raw = (raw << 12) + (v & 0x0fff);
-	  v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+	  v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
 	}
 
 	try {
@@ -186,32 +112,28 @@ namespace pxar {
     raw = (v & 0x00ff) << 8;
 
     // T2
-    v = (pos < size) ? (*sample)[pos++] : 0x6000; //MDD_ERROR_MARKER;
+    v = (pos < size) ? data[pos++] : 0x6000; //MDD_ERROR_MARKER;
     //if ((v & 0xe000) != 0xc000) roc_Event.error |= 0x0040;
     raw += v & 0x00ff;
 
     roc_Event.trailer = raw;
 
     LOG(logDEBUGPIPES) << roc_Event;
-    return &roc_Event;
   }
 
-  Event* dtbEventDecoder::DecodeDeser160() {
+  void decodeDeser160(rawEvent & sample, Event & roc_Event, bool invertedAddress) {
 
     roc_Event.Clear();
 
-    // Check if ROC has inverted pixel address (ROC_PSI46DIG):
-    bool invertedAddress = ( GetDeviceType() == ROC_PSI46DIG ? true : false );
-
-    rawEvent *sample = Get();
-    unsigned int n = sample->GetSize();
+    unsigned int n = sample.GetSize();
     if (n > 0) {
+      const uint16_t * data = &sample.data[0];
       if (n > 1) roc_Event.pixels.reserve((n-1)/2);
-      roc_Event.header = (*sample)[0];
+      roc_Event.header = data[0];
       unsigned int pos = 1;
       while (pos < n-1) {
-	uint32_t raw = (*sample)[pos++] << 12;
-	raw += (*sample)[pos++];
+	uint32_t raw = data[pos++] << 12;
+	raw += data[pos++];
 	try{
 	  pixel pix(raw,invertedAddress);
 	  roc_Event.pixels.push_back(pix);
@@ -224,6 +146,5 @@ namespace pxar {
     }
 
     LOG(logDEBUGPIPES) << roc_Event;
-    return &roc_Event;
   }
 }
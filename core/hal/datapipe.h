@@ -2,8 +2,12 @@
 #define PXAR_DATAPIPE_H
 
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
 #include "datatypes.h"
 #include "rpc_calls.h"
+#include "helper.h"
+#include "constants.h"
 
 namespace pxar {
 
@@ -27,6 +31,11 @@ namespace pxar {
     virtual bool ReadState() = 0;
     virtual uint8_t ReadChannel() = 0;
     virtual uint8_t ReadDeviceType() = 0;
+    // Optional block access to samples which are already buffered.
+    // ReadBlock returns the number of buffered samples following the last
+    // one read, ReadSkip consumes n of them (the last becomes ReadLast()):
+    virtual size_t ReadBlock(const T* &block) { block = 0; return 0; }
+    virtual void ReadSkip(size_t /*n*/) {}
   public:
     virtual ~dataSource() {}
     template <class S> friend class dataSink;
@@ -62,6 +71,8 @@ namespace pxar {
     bool GetState() { return src->ReadState(); }
     uint8_t GetChannel() { return src->ReadChannel(); }
     uint8_t GetDeviceType() { return src->ReadDeviceType(); }
+    size_t GetBlock(const T* &block) { return src->ReadBlock(block); }
+    void Skip(size_t n) { src->ReadSkip(n); }
     void GetAll() { while (true) Get(); }
     template <class TI, class TO> friend void operator >> (dataSource<TI> &, dataSink<TO> &); 
     template  <class TI, class TO> friend dataSource<TO>& operator >> (dataSource<TI> &in, dataPipe<TI,TO> &out);
@@ -119,14 +130,10 @@ namespace pxar {
     uint16_t FillBuffer();
 
     // --- virtual data access methods
-    uint16_t Read() { 
-      if(!connected) throw dpNotConnected();
-      return (pos < buffer.size()) ? lastSample = buffer[pos++] : FillBuffer();
-    }
-    uint16_t ReadLast() {
-      if(!connected) throw dpNotConnected();
-      return lastSample;
-    }
+    uint16_t Read() { return Get(); }
+    uint16_t ReadLast() { return GetLast(); }
+    size_t ReadBlock(const uint16_t* &block) { return GetBlock(block); }
+    void ReadSkip(size_t n) { Skip(n); }
     bool ReadState() {
       if(!connected) throw dpNotConnected();
       return tbm_present;
@@ -145,47 +152,472 @@ namespace pxar {
   dtbSource() : connected(false) {}
     bool isConnected() { return connected; }
 
+    // --- direct (non-virtual) data access, same semantics as the dataSink methods
+    uint16_t Get() { 
+      if(!connected) throw dpNotConnected();
+      return (pos < buffer.size()) ? lastSample = buffer[pos++] : FillBuffer();
+    }
+    uint16_t GetLast() {
+      if(!connected) throw dpNotConnected();
+      return lastSample;
+    }
+    size_t GetBlock(const uint16_t* &block) {
+      if(!connected) throw dpNotConnected();
+      if(pos >= buffer.size()) { block = 0; return 0; }
+      block = &buffer[pos];
+      return buffer.size() - pos;
+    }
+    void Skip(size_t n) {
+      if(n == 0) return;
+      pos += static_cast<unsigned int>(n);
+      lastSample = buffer[pos-1];
+    }
+
     // --- control and status
     uint8_t  GetState() { return dtbState; }
     uint32_t GetRemainingSize() { return dtbRemainingSize; }
     void Stop() { stopAtEmptyData = true; }
   };
 
+  // Event splitting algorithms, shared by the runtime dtbEventSplitter and the
+  // compile-time dtbPipeline. The source S has to provide Get(), GetLast(),
+  // GetBlock() and Skip() like dataSink<uint16_t> or dtbSource.
+  template <class S> void splitDeser160(S & src, rawEvent & record);
+  template <class S> void splitDeser400(S & src, rawEvent & record, bool & nextStartDetected);
+
+  // Event decoding routines, shared as well:
+  DLLEXPORT void decodeDeser160(rawEvent & sample, Event & roc_Event, bool invertedAddress);
+  DLLEXPORT void decodeDeser400(rawEvent & sample, Event & roc_Event, int16_t roc_offset, bool invertedAddress);
+
   // DTB data Event splitter
   class dtbEventSplitter : public dataPipe<uint16_t, rawEvent*> {
     rawEvent record;
     rawEvent* Read() {
-      if(GetState()) return SplitDeser400();
-      else return SplitDeser160();
+      if(GetState()) splitDeser400(*this, record, nextStartDetected);
+      else splitDeser160(*this, record);
+      return &record;
     }
     rawEvent* ReadLast() { return &record; }
     bool ReadState() { return GetState(); }
     uint8_t ReadChannel() { return GetChannel(); }
     uint8_t ReadDeviceType() { return GetDeviceType(); }
 
-    // The splitter routines:
-    rawEvent* SplitDeser160();
-    rawEvent* SplitDeser400();
-
     bool nextStartDetected;
   public:
-    dtbEventSplitter() {}
+  dtbEventSplitter() : nextStartDetected(false) {}
   };
 
   // DTB data decoding class
   class dtbEventDecoder : public dataPipe<rawEvent*, Event*> {
     Event roc_Event;
     Event* Read() {
-      if(GetState()) return DecodeDeser400();
-      else return DecodeDeser160();
+      // Get the right ROC id, channel 0: 0-7, channel 1: 8-15
+      // Check if ROC has inverted pixel address (ROC_PSI46DIG):
+      if(GetState()) decodeDeser400(*Get(), roc_Event, -1 + GetChannel() * 8, GetDeviceType() == ROC_PSI46DIG);
+      else decodeDeser160(*Get(), roc_Event, GetDeviceType() == ROC_PSI46DIG);
+      return &roc_Event;
     }
     Event* ReadLast() { return &roc_Event; }
     bool ReadState() { return GetState(); }
     uint8_t ReadChannel() { return GetChannel(); }
     uint8_t ReadDeviceType() { return GetDeviceType(); }
+  };
+
+  // Compile-time composed DTB pipeline: source -> Event splitter -> Event decoder.
+  // The configuration (deserializer, ROC type, channel) is fixed by Connect(),
+  // and the stages call each other directly instead of through the virtual
+  // dataSource chain. The splitter scans whole source blocks, the decoder gets
+  // complete raw Events. SOURCE is usually a dtbSource; the runtime classes
+  // above and operator >> remain available for tools.
+  template <class SOURCE>
+    class dtbPipeline {
+  public:
+  dtbPipeline() : src(0), deser400(false), invertedAddress(false), roc_offset(-1), nextStartDetected(false) {}
+
+    void Connect(SOURCE * source, bool module, uint8_t devicetype, uint8_t channel) {
+      src = source;
+      deser400 = module;
+      invertedAddress = (devicetype == ROC_PSI46DIG);
+      roc_offset = static_cast<int16_t>(-1 + channel * 8);
+      nextStartDetected = false;
+      record.Clear();
+      roc_Event.Clear();
+    }
+    void Disconnect() { src = 0; }
+    bool isConnected() { return src != 0; }
 
-    Event* DecodeDeser160();
-    Event* DecodeDeser400();
+    // Split the next raw Event from the source:
+    rawEvent* GetRawEvent() {
+      if(!src) throw dpNotConnected();
+      if(deser400) splitDeser400(*src, record, nextStartDetected);
+      else splitDeser160(*src, record);
+      return &record;
+    }
+
+    // Split and decode the next Event from the source:
+    Event* GetEvent() {
+      GetRawEvent();
+      if(deser400) decodeDeser400(record, roc_Event, roc_offset, invertedAddress);
+      else decodeDeser160(record, roc_Event, invertedAddress);
+      return &roc_Event;
+    }
+
+  private:
+    SOURCE * src;
+    bool deser400;
+    bool invertedAddress;
+    int16_t roc_offset;
+    bool nextStartDetected;
+    rawEvent record;
+    Event roc_Event;
   };
+
+
+  // Event alignment of several DAQ channels (TBM cores or links) of one
+  // module. The decoded Events of each channel are fetched into a buffer
+  // together with their 8 bit TBM Event counter (upper byte of the header).
+  // The counters of blocks of ALIGN_BLOCK Events are compared between the
+  // channels as contiguous byte arrays, matching blocks are merged without
+  // any further checks. On a mismatch the channels are resynchronized to
+  // channel 0 Event by Event: Events channel 0 has not seen are dropped,
+  // channel 0 Events another channel has no data for are merged without it.
+  // Events are only merged once every channel delivered its part, the rest
+  // stays buffered for the next call. Pixel data is moved, never copied,
+  // and the buffered Events are recycled to keep the decoder allocation free.
+  static const size_t ALIGN_BLOCK = 64;
+
+  template <class PIPE>
+    class dtbEventAligner {
+  public:
+  dtbEventAligner() : nchannels(0), finished(false) {}
+
+    void Connect(std::vector<PIPE*> pipes) {
+      nchannels = std::min(pipes.size(), static_cast<size_t>(4));
+      for(size_t c = 0; c < nchannels; c++) { pipe[c] = pipes[c]; fill[c] = 0; pos[c] = 0; }
+      finished = false;
+      stats.Clear();
+      stats.channels = static_cast<uint8_t>(nchannels);
+    }
+    void Disconnect() { nchannels = 0; }
+
+    // No more data will arrive: once the pipes are drained, the remaining
+    // channel 0 Events are delivered without their missing partners and the
+    // unmatched Events of the other channels are dropped:
+    void Finish() { finished = true; }
+
+    // Merge the next complete Event into evt, false if there is none yet:
+    bool GetEvent(Event & evt) {
+      if(nchannels == 0) throw dpNotConnected();
+      if(!Available(0) && !Fetch(0)) {
+	if(finished) Drop();
+	return false;
+      }
+      uint8_t ref = ctr[0][pos[0]];
+
+      // Resynchronize: drop Events behind channel 0, wait for all channels
+      // unless the readout is finished:
+      bool resync = false, complete = true;
+      for(size_t c = 1; c < nchannels; c++) {
+	while(1) {
+	  if(!Available(c) && !Fetch(c)) {
+	    if(!finished) return false;
+	    complete = false;
+	    break;
+	  }
+	  int8_t d = static_cast<int8_t>(ctr[c][pos[c]] - ref);
+	  if(d >= 0) { resync |= (d > 0); break; }
+	  LOG(logDEBUGPIPES) << "Channel " << c << ": dropping Event " << static_cast<int>(ctr[c][pos[c]])
+			     << ", channel 0 is at Event " << static_cast<int>(ref);
+	  stats.skipped[c]++;
+	  pos[c]++;
+	  resync = true;
+	}
+      }
+
+      Take(evt);
+      for(size_t c = 1; c < nchannels; c++) {
+	if(Available(c) && ctr[c][pos[c]] == ref) { Append(evt, c); }
+	else {
+	  LOG(logDEBUGPIPES) << "Channel " << c << ": no data for Event " << static_cast<int>(ref);
+	  stats.missing[c]++;
+	}
+      }
+      stats.merged++;
+      if(resync) stats.resyncs++;
+      if(!complete) stats.incomplete++;
+      return true;
+    }
+
+    // Fetch everything available from all channels and append all complete
+    // Events to data:
+    void GetAllEvents(std::vector<Event> & data) {
+      if(nchannels == 0) throw dpNotConnected();
+      for(size_t c = 0; c < nchannels; c++) { while(Fetch(c)) {} }
+
+      while(1) {
+	size_t n = Available(0);
+	for(size_t c = 1; c < nchannels; c++) { n = std::min(n, Available(c)); }
+	if(n == 0 && !(finished && Available(0))) {
+	  if(finished) Drop();
+	  break;
+	}
+
+	// Compare the Event counters of the next block on all channels:
+	size_t block = std::min(n, ALIGN_BLOCK);
+	bool aligned = (block > 0);
+	for(size_t c = 1; c < nchannels; c++) {
+	  aligned &= (std::memcmp(&ctr[0][pos[0]], &ctr[c][pos[c]], block) == 0);
+	}
+
+	if(aligned) {
+	  size_t first = data.size();
+	  data.resize(first + block);
+	  for(size_t i = first; i < first + block; i++) {
+	    Take(data[i]);
+	    for(size_t c = 1; c < nchannels; c++) { Append(data[i], c); }
+	  }
+	  stats.merged += static_cast<uint32_t>(block);
+	  continue;
+	}
+
+	// Resynchronize Event by Event:
+	data.push_back(Event());
+	if(!GetEvent(data.back())) { data.pop_back(); break; }
+      }
+    }
+
+    alignmentStatistics & GetStatistics() { return stats; }
+
+  private:
+    size_t Available(size_t c) { return fill[c] - pos[c]; }
+
+    // Drop the Events of the other channels channel 0 will never see:
+    void Drop() {
+      for(size_t c = 1; c < nchannels; c++) {
+	if(!Available(c)) continue;
+	LOG(logDEBUGPIPES) << "Channel " << c << ": dropping " << Available(c) << " Events without channel 0 data";
+	stats.skipped[c] += static_cast<uint32_t>(Available(c));
+	pos[c] = fill[c];
+      }
+    }
+
+    // Decode the next Event of channel c into its buffer, false if empty:
+    bool Fetch(size_t c) {
+      Event * evt;
+      try { evt = pipe[c]->GetEvent(); }
+      catch(dsBufferEmpty &) { return false; }
+
+      // Recycle the buffer slots, shift pending Events to the front if full:
+      if(pos[c] == fill[c]) { pos[c] = 0; fill[c] = 0; }
+      else if(fill[c] == buf[c].size() && pos[c] > 0) {
+	for(size_t i = pos[c]; i < fill[c]; i++) {
+	  Event & dst = buf[c][i - pos[c]];
+	  dst.header = buf[c][i].header;
+	  dst.trailer = buf[c][i].trailer;
+	  dst.numDecoderErrors = buf[c][i].numDecoderErrors;
+	  dst.pixels.swap(buf[c][i].pixels);
+	  ctr[c][i - pos[c]] = ctr[c][i];
+	}
+	fill[c] -= pos[c];
+	pos[c] = 0;
+      }
+      if(fill[c] == buf[c].size()) { buf[c].push_back(Event()); ctr[c].push_back(0); }
+
+      Event & slot = buf[c][fill[c]];
+      slot.header = evt->header;
+      slot.trailer = evt->trailer;
+      slot.numDecoderErrors = evt->numDecoderErrors;
+      slot.pixels.swap(evt->pixels);
+      // The decoder gets the old slot vector back, size it for the next Event:
+      evt->pixels.reserve(slot.pixels.size());
+      ctr[c][fill[c]] = static_cast<uint8_t>(evt->header >> 8);
+      fill[c]++;
+
+      stats.events[c]++;
+      stats.trailerErrors[c] += ((evt->trailer & TBM_TRAILER_ERRORS) != 0);
+      return true;
+    }
+
+    // Move the next channel 0 Event into evt:
+    void Take(Event & evt) {
+      Event & src = buf[0][pos[0]++];
+      evt.header = src.header;
+      evt.trailer = src.trailer;
+      evt.numDecoderErrors = src.numDecoderErrors;
+      evt.pixels.swap(src.pixels);
+    }
+
+    // Append the next Event of channel c to evt, keep its error flags:
+    void Append(Event & evt, size_t c) {
+      Event & src = buf[c][pos[c]++];
+      evt.trailer |= (src.trailer & TBM_TRAILER_ERRORS);
+      evt.numDecoderErrors += src.numDecoderErrors;
+      evt.pixels.insert(evt.pixels.end(), src.pixels.begin(), src.pixels.end());
+    }
+
+    size_t nchannels;
+    bool finished;
+    PIPE * pipe[4];
+    std::vector<Event> buf[4];
+    std::vector<uint8_t> ctr[4];
+    size_t fill[4];
+    size_t pos[4];
+    alignmentStatistics stats;
+  };
+
+  // Scanning helpers for the Event splitter. The samples are tested in groups
+  // of 16 without early exit, which allows the compiler to vectorize the
+  // compares. Only the group containing the marker is searched sample by sample.
+  static const size_t SCAN_GROUP = 16;
+
+  // Position of the first sample with any of the bits "bits" set, n if none:
+  inline size_t findAnyBit(const uint16_t * p, size_t n, uint16_t bits) {
+    size_t i = 0;
+    for(; i + SCAN_GROUP <= n; i += SCAN_GROUP) {
+      uint16_t hit = 0;
+      for(size_t j = 0; j < SCAN_GROUP; j++) hit |= p[i+j];
+      if(hit & bits) break;
+    }
+    for(; i < n; i++) { if(p[i] & bits) return i; }
+    return n;
+  }
+
+  // Position of the first sample with (sample & 0xe000) being one of the two markers, n if none:
+  inline size_t findMarker(const uint16_t * p, size_t n, uint16_t marker1, uint16_t marker2) {
+    size_t i = 0;
+    for(; i + SCAN_GROUP <= n; i += SCAN_GROUP) {
+      unsigned int hit = 0;
+      for(size_t j = 0; j < SCAN_GROUP; j++) {
+	uint16_t m = p[i+j] & 0xe000;
+	hit |= (m == marker1) | (m == marker2);
+      }
+      if(hit) break;
+    }
+    for(; i < n; i++) {
+      uint16_t m = p[i] & 0xe000;
+      if(m == marker1 || m == marker2) return i;
+    }
+    return n;
+  }
+
+  // Append n samples to the record:
+  inline void addSamples(rawEvent & record, const uint16_t * samples, size_t n, uint16_t mask) {
+    if(n == 0) return;
+    size_t size = record.data.size();
+    record.data.resize(size + n);
+    uint16_t * out = &record.data[size];
+    for(size_t i = 0; i < n; i++) out[i] = samples[i] & mask;
+  }
+
+  template <class S> void splitDeser400(S & src, rawEvent & record, bool & nextStartDetected) {
+    record.Clear();
+
+    // If last one had Event end marker, get a new sample:
+    if (!nextStartDetected) { src.Get(); }
+
+    // If new sample does not have start marker keep on reading until we find it:
+    if ((src.GetLast() & 0xe000) != 0xa000) {
+      record.SetStartError();
+      src.Get();
+    }
+    record.Add(src.GetLast());
+
+    // Else keep reading and adding samples until we find the trailer (or the next header).
+    // Whole blocks of buffered samples are scanned at once, single samples are only
+    // read to trigger the next buffer refill.
+    const uint16_t * block;
+    while (true) {
+      size_t n = src.GetBlock(block);
+      if (n == 0) {
+	if ((src.Get() & 0xe000) == 0xc000) break;
+	if ((src.GetLast() & 0xe000) != 0xa000) {
+	  // If total Event size is too big, do not add:
+	  if (record.GetSize() < 40000) record.Add(src.GetLast());
+	  else record.SetOverflow();
+	  continue;
+	}
+      }
+      else {
+	size_t k = findMarker(block, n, 0xc000, 0xa000);
+	// If total Event size is too big, only add what fits:
+	size_t room = 40000 - std::min(record.GetSize(), static_cast<size_t>(40000));
+	if (k > room) record.SetOverflow();
+	addSamples(record, block, std::min(k, room), 0xffff);
+	src.Skip(k < n ? k + 1 : n);
+	if (k == n) continue;
+	if ((src.GetLast() & 0xe000) == 0xc000) break;
+      }
+
+      // The last read sample has Event start marker:
+      record.SetEndError();
+      nextStartDetected = true;
+      return;
+    }
+    record.Add(src.GetLast());
+
+    LOG(logDEBUGPIPES) << "-------------------------";
+    LOG(logDEBUGPIPES) << listVector(record.data,true);
+  }
+
+  template <class S> void splitDeser160(S & src, rawEvent & record) {
+    record.Clear();
+
+    // If last one had Event end marker, get a new sample:
+    if (src.GetLast() & 0x4000) { src.Get(); }
+
+    // If new sample does not have start marker keep on reading until we find it:
+    const uint16_t * block;
+    if (!(src.GetLast() & 0x8000)) {
+      record.SetStartError();
+      while (!(src.GetLast() & 0x8000)) {
+	size_t n = src.GetBlock(block);
+	if (n == 0) { src.Get(); continue; }
+	size_t k = findAnyBit(block, n, 0x8000);
+	src.Skip(k < n ? k + 1 : n);
+      }
+    }
+
+    // FIXME Very first Event starts with 0xC - which srews up empty Event detection here!
+    // If the Event start sample is also Event end sample, write and quit:
+    if ((src.GetLast() & 0xc000) != 0xc000) {
+      record.Add(src.GetLast() & 0x0fff);
+
+      // Else keep reading and adding samples until we find any marker.
+      while (true) {
+	size_t n = src.GetBlock(block);
+	if (n == 0) {
+	  if (src.Get() & 0xc000) break;
+	  // If total Event size is too big, break:
+	  if (record.GetSize() >= 40000) {
+	    record.SetOverflow();
+	    break;
+	  }
+	  record.Add(src.GetLast() & 0x0fff);
+	  continue;
+	}
+
+	size_t k = findAnyBit(block, n, 0xc000);
+	size_t room = 40000 - std::min(record.GetSize(), static_cast<size_t>(40000));
+	// If total Event size is too big, stop after the first sample which does not fit:
+	if (k > room) {
+	  addSamples(record, block, room, 0x0fff);
+	  src.Skip(room + 1);
+	  record.SetOverflow();
+	  break;
+	}
+	addSamples(record, block, k, 0x0fff);
+	src.Skip(k < n ? k + 1 : n);
+	if (k < n) break;
+      }
+    }
+
+    // Check if the last read sample has Event end marker:
+    if (src.GetLast() & 0x4000) record.Add(src.GetLast() & 0x0fff);
+    // Else set Event end error:
+    else record.SetEndError();
+
+    LOG(logDEBUGPIPES) << "-------------------------";
+    LOG(logDEBUGPIPES) << listVector(record.data,true);
+  }
 }
 #endif
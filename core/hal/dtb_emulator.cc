@@ -0,0 +1,727 @@
+#include "dtb_emulator.h"
+#include "rpc.h"
+#include "log.h"
+#include "constants.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace pxar {
+
+  namespace {
+    // Size in bytes of the scalar RPC types:
+    size_t typeSize(char type) {
+      switch(type) {
+      case 'b': case 'c': case 'C': return 1;
+      case 's': case 'S': return 2;
+      case 'i': case 'I': return 4;
+      case 'l': case 'L': return 8;
+      default: return 0;
+      }
+    }
+
+    // Little endian scalars as used by rpcMessage, signed types are sign-extended:
+    int64_t getScalar(const uint8_t * p, char type) {
+      uint64_t x = 0;
+      size_t n = typeSize(type);
+      for(size_t i = 0; i < n; i++) { x |= static_cast<uint64_t>(p[i]) << (8*i); }
+      switch(type) {
+      case 'c': return static_cast<int8_t>(x);
+      case 's': return static_cast<int16_t>(x);
+      case 'i': return static_cast<int32_t>(x);
+      default: return static_cast<int64_t>(x);
+      }
+    }
+
+    void putScalar(std::vector<uint8_t> & out, char type, int64_t value) {
+      size_t n = typeSize(type);
+      uint64_t x = static_cast<uint64_t>(value);
+      for(size_t i = 0; i < n; i++) { out.push_back(static_cast<uint8_t>(x >> (8*i))); }
+    }
+
+    // Raw pixel address and pulse height as sent by the digital ROCs (not inverted):
+    uint32_t encodePixel(int column, int row, int ph) {
+      int c = column/2;
+      int r = 2*(80 - row) + (column&1);
+      return ((c/6) << 21) | ((c%6) << 18) | ((r/36) << 15) | (((r/6)%6) << 12) | ((r%6) << 9)
+	| ((ph & 0xf0) << 1) | (ph & 0x0f);
+    }
+
+    // Same string hashing as the DTB firmware uses for GetRpcCallHash:
+    uint32_t hashString(const char * s) {
+      uint32_t h = 31;
+      while (*s) { h = (h * 54059) ^ (s[0] * 76963); s++; }
+      return h%86969;
+    }
+  }
+
+  dtbEmulator::dtbEmulator(std::vector<std::string> callNames, uint32_t latency, double bandwidth) :
+    _callNames(callNames),
+    _pendingWrite(0), _outputPos(0), _turnaround(false),
+    _latency(latency), _bandwidth(bandwidth), _pendingDelay(0), _transferTime(0),
+    _nTransfers(0), _nRoundTrips(0), _nCalls(0), _bytesWritten(0), _bytesRead(0),
+    _power(false), _vd(0), _va(0), _id(0), _ia(0), _roc(0),
+    _bufferLimit(1 << 22), _deser400(false), _eventCounter(0), _pgLoop(false), _loopPosition(0)
+  {
+    for(size_t ch = 0; ch < 8; ch++) {
+      _channels[ch].open = false;
+      _channels[ch].running = false;
+      _channels[ch].size = 0;
+      _channels[ch].pos = 0;
+    }
+
+    _handlers["GetRpcVersion$S"] = &dtbEmulator::GetRpcVersion;
+    _handlers["GetRpcCallId$i3c"] = &dtbEmulator::GetRpcCallId;
+    _handlers["GetRpcTimestamp$v4c"] = &dtbEmulator::GetString;
+    _handlers["GetRpcCallCount$i"] = &dtbEmulator::GetRpcCallCount;
+    _handlers["GetRpcCallName$bi4c"] = &dtbEmulator::GetRpcCallName;
+    _handlers["GetRpcCallHash$I"] = &dtbEmulator::GetRpcCallHash;
+    _handlers["GetInfo$v4c"] = &dtbEmulator::GetString;
+    _handlers["GetHWVersion$v4c"] = &dtbEmulator::GetString;
+    _handlers["GetBoardId$S"] = &dtbEmulator::GetVersion;
+    _handlers["GetFWVersion$S"] = &dtbEmulator::GetVersion;
+    _handlers["GetSWVersion$S"] = &dtbEmulator::GetVersion;
+    _handlers["Pon$v"] = &dtbEmulator::Power;
+    _handlers["Poff$v"] = &dtbEmulator::Power;
+    _handlers["_SetVD$vS"] = &dtbEmulator::SetPower;
+    _handlers["_SetVA$vS"] = &dtbEmulator::SetPower;
+    _handlers["_SetID$vS"] = &dtbEmulator::SetPower;
+    _handlers["_SetIA$vS"] = &dtbEmulator::SetPower;
+    _handlers["_GetVD$S"] = &dtbEmulator::GetPower;
+    _handlers["_GetVA$S"] = &dtbEmulator::GetPower;
+    _handlers["_GetID$S"] = &dtbEmulator::GetPower;
+    _handlers["_GetIA$S"] = &dtbEmulator::GetPower;
+    _handlers["roc_I2cAddr$vC"] = &dtbEmulator::RocI2cAddr;
+    _handlers["roc_SetDAC$vCC"] = &dtbEmulator::RocSetDAC;
+    _handlers["roc_Pix_Trim$vCCC"] = &dtbEmulator::RocPixTrim;
+    _handlers["roc_Pix_Mask$vCC"] = &dtbEmulator::RocPixMask;
+    _handlers["roc_Chip_Mask$v"] = &dtbEmulator::RocChipMask;
+    _handlers["roc_Pix_Cal$vCCb"] = &dtbEmulator::RocPixCal;
+    _handlers["roc_ClrCal$v"] = &dtbEmulator::RocClrCal;
+    _handlers["TrimChip$s1s"] = &dtbEmulator::TrimChip;
+    _handlers["SetI2CAddresses$b1C"] = &dtbEmulator::SetI2CAddresses;
+    _handlers["SetTrimValues$bC1C"] = &dtbEmulator::SetTrimValues;
+    _handlers["tbm_Set$vCC"] = &dtbEmulator::TbmSet;
+    _handlers["tbm_Get$bC0C"] = &dtbEmulator::TbmGet;
+    _handlers["Daq_Open$IIC"] = &dtbEmulator::DaqOpen;
+    _handlers["Daq_Close$vC"] = &dtbEmulator::DaqClose;
+    _handlers["Daq_Start$vC"] = &dtbEmulator::DaqStart;
+    _handlers["Daq_Stop$vC"] = &dtbEmulator::DaqStop;
+    _handlers["Daq_GetSize$IC"] = &dtbEmulator::DaqGetSize;
+    _handlers["Daq_FillLevel$CC"] = &dtbEmulator::DaqFillLevel;
+    _handlers["Daq_FillLevel$C"] = &dtbEmulator::DaqFillLevel;
+    _handlers["Daq_Read$C5SIC"] = &dtbEmulator::DaqRead;
+    _handlers["Daq_Read$C5SI0IC"] = &dtbEmulator::DaqRead;
+    _handlers["Daq_Select_Deser160$vC"] = &dtbEmulator::DaqSelect;
+    _handlers["Daq_Select_Deser400$v"] = &dtbEmulator::DaqSelect;
+    _handlers["Daq_Select_ADC$vSCCC"] = &dtbEmulator::DaqSelect;
+    _handlers["Daq_Select_Datagenerator$vS"] = &dtbEmulator::DaqSelect;
+    _handlers["Daq_DeselectAll$v"] = &dtbEmulator::DaqSelect;
+    _handlers["Pg_Single$v"] = &dtbEmulator::PgTrigger;
+    _handlers["Pg_Trigger$v"] = &dtbEmulator::PgTrigger;
+    _handlers["Pg_Triggers$vIS"] = &dtbEmulator::PgTrigger;
+    _handlers["Pg_Loop$vS"] = &dtbEmulator::PgLoop;
+    _handlers["Pg_Stop$v"] = &dtbEmulator::PgStop;
+    _handlers["LoopInterruptReset$v"] = &dtbEmulator::LoopInterruptReset;
+
+    // All NIOS trigger loops share one implementation, the variant is
+    // taken from the call name:
+    for(size_t i = 0; i < _callNames.size(); i++) {
+      if(_callNames.at(i).compare(0, 12, "LoopMultiRoc") == 0 || _callNames.at(i).compare(0, 13, "LoopSingleRoc") == 0) {
+	_handlers[_callNames.at(i)] = &dtbEmulator::TriggerLoop;
+      }
+    }
+
+    LOG(logDEBUGHAL) << "DTB emulator with " << _callNames.size() << " RPC calls, latency " << _latency
+		     << "us, bandwidth " << (_bandwidth > 0 ? _bandwidth : 0) << " B/s.";
+  }
+
+
+  // --- transport -----------------------------------------------------------
+
+  void dtbEmulator::Write(const void *buffer, uint32_t size) {
+    const uint8_t * p = static_cast<const uint8_t *>(buffer);
+    _input.insert(_input.end(), p, p + size);
+    _pendingWrite += size;
+  }
+
+  void dtbEmulator::Flush() {
+    if(_pendingWrite == 0) return;
+
+    // One USB transfer with everything written since the last flush:
+    _nTransfers++;
+    _bytesWritten += _pendingWrite;
+    Delay(_latency + (_bandwidth > 0 ? 1e6*_pendingWrite/_bandwidth : 0));
+    _pendingWrite = 0;
+
+    ProcessInput();
+  }
+
+  void dtbEmulator::Clear() {
+    _input.clear();
+    _pendingWrite = 0;
+    _output.clear();
+    _outputPos = 0;
+  }
+
+  void dtbEmulator::Read(void *buffer, uint32_t size) {
+
+    // The first read after new replies waits for the round trip:
+    if(_turnaround) {
+      _nRoundTrips++;
+      _turnaround = false;
+      Delay(_latency);
+    }
+
+    if(_output.size() - _outputPos < size) { throw CRpcError(CRpcError::READ_TIMEOUT); }
+    memcpy(buffer, &_output[_outputPos], size);
+    _outputPos += size;
+    _bytesRead += size;
+    if(_bandwidth > 0) { Delay(1e6*size/_bandwidth); }
+
+    if(_outputPos == _output.size()) {
+      _output.clear();
+      _outputPos = 0;
+    }
+  }
+
+  void dtbEmulator::Delay(double us) {
+    if(us <= 0) return;
+    _transferTime += us;
+
+    // Sleep in chunks, the single reads are far below the timer resolution:
+    _pendingDelay += us;
+    if(_pendingDelay < 100) return;
+#ifdef WIN32
+    if(_pendingDelay < 1000) return;
+    Sleep(static_cast<DWORD>(_pendingDelay/1000));
+    _pendingDelay -= 1000*static_cast<DWORD>(_pendingDelay/1000);
+#else
+    usleep(static_cast<useconds_t>(_pendingDelay));
+    _pendingDelay = 0;
+#endif
+  }
+
+
+  // --- RPC message handling ---------------------------------------------------
+
+  bool dtbEmulator::ParseSignature(rpcCall & call) {
+
+    size_t pos = call.name.rfind('$');
+    if(pos == std::string::npos || pos + 1 >= call.name.size()) return false;
+
+    call.ret = call.name[++pos];
+    for(pos++; pos < call.name.size(); pos++) {
+      char prefix = '-';
+      if(call.name[pos] >= '0' && call.name[pos] <= '5') {
+	prefix = call.name[pos++];
+	if(pos >= call.name.size()) return false;
+      }
+      call.prefix.push_back(prefix);
+      call.type.push_back(call.name[pos]);
+    }
+    call.value.assign(call.type.size(), 0);
+    call.data.assign(call.type.size(), std::vector<uint8_t>());
+    return true;
+  }
+
+  void dtbEmulator::ProcessInput() {
+
+    size_t pos = 0;
+    while(_input.size() - pos >= 4) {
+      const uint8_t * msg = &_input[pos];
+
+      // Data messages are only expected right after their command:
+      if(msg[0] == RPC_TYPE_DTB_DATA) {
+	uint32_t size = msg[1] | (msg[2] << 8) | (msg[3] << 16);
+	if(_input.size() - pos < 4 + size) break;
+	LOG(logERROR) << "DTB emulator: unexpected data message of " << size << " bytes.";
+	pos += 4 + size;
+	continue;
+      }
+      if(msg[0] != RPC_TYPE_DTB) {
+	LOG(logERROR) << "DTB emulator: invalid message type " << static_cast<int>(msg[0]) << ", dropping input.";
+	pos = _input.size();
+	break;
+      }
+
+      uint16_t cmd = static_cast<uint16_t>(msg[1] | (msg[2] << 8));
+      uint8_t size = msg[3];
+      if(_input.size() - pos < 4u + size) break;
+
+      rpcCall call;
+      if(cmd >= _callNames.size() || !(call.name = _callNames.at(cmd), ParseSignature(call))) {
+	LOG(logERROR) << "DTB emulator: unknown RPC call id " << cmd;
+	pos += 4 + size;
+	continue;
+      }
+
+      // Collect the data messages of all vector and string parameters:
+      size_t next = pos + 4 + size;
+      bool complete = true;
+      for(size_t i = 0; i < call.type.size() && complete; i++) {
+	if(call.prefix[i] != '1' && call.prefix[i] != '3') continue;
+	if(_input.size() - next < 4 || _input[next] != RPC_TYPE_DTB_DATA) { complete = false; break; }
+	uint32_t length = _input[next+1] | (_input[next+2] << 8) | (_input[next+3] << 16);
+	if(_input.size() - next < 4 + length) { complete = false; break; }
+	call.data[i].assign(_input.begin() + next + 4, _input.begin() + next + 4 + length);
+	next += 4 + length;
+      }
+      if(!complete) break;
+
+      // Scalar and reference parameters from the command message:
+      size_t par = pos + 4;
+      for(size_t i = 0; i < call.type.size(); i++) {
+	if(call.prefix[i] != '-' && call.prefix[i] != '0') continue;
+	if(par + typeSize(call.type[i]) > pos + 4 + size) break;
+	call.value[i] = getScalar(&_input[par], call.type[i]);
+	par += typeSize(call.type[i]);
+      }
+
+      // Calls without emulation succeed and return zero:
+      call.retval = (call.ret == 'b' ? 1 : 0);
+      std::map<std::string, callHandler>::iterator handler = _handlers.find(call.name);
+      if(handler != _handlers.end()) { (this->*(handler->second))(call); }
+      _nCalls++;
+
+      SendReply(cmd, call);
+      pos = next;
+    }
+
+    _input.erase(_input.begin(), _input.begin() + pos);
+  }
+
+  void dtbEmulator::SendReply(uint16_t cmd, rpcCall & call) {
+
+    // Only calls with return value or output parameters are answered:
+    bool reply = (call.ret != 'v');
+    for(size_t i = 0; i < call.prefix.size(); i++) {
+      if(call.prefix[i] == '0' || call.prefix[i] == '2' || call.prefix[i] == '4' || call.prefix[i] == '5') reply = true;
+    }
+    if(!reply) return;
+
+    std::vector<uint8_t> par;
+    if(call.ret != 'v') { putScalar(par, call.ret, call.retval); }
+    for(size_t i = 0; i < call.prefix.size(); i++) {
+      if(call.prefix[i] == '0') { putScalar(par, call.type[i], call.value[i]); }
+    }
+
+    _output.push_back(RPC_TYPE_DTB);
+    _output.push_back(static_cast<uint8_t>(cmd));
+    _output.push_back(static_cast<uint8_t>(cmd >> 8));
+    _output.push_back(static_cast<uint8_t>(par.size()));
+    _output.insert(_output.end(), par.begin(), par.end());
+
+    for(size_t i = 0; i < call.prefix.size(); i++) {
+      if(call.prefix[i] != '2' && call.prefix[i] != '4' && call.prefix[i] != '5') continue;
+      uint32_t length = static_cast<uint32_t>(call.data[i].size());
+      _output.push_back(RPC_TYPE_DTB_DATA);
+      _output.push_back(static_cast<uint8_t>(length));
+      _output.push_back(static_cast<uint8_t>(length >> 8));
+      _output.push_back(static_cast<uint8_t>(length >> 16));
+      _output.insert(_output.end(), call.data[i].begin(), call.data[i].end());
+    }
+    _turnaround = true;
+  }
+
+
+  // --- board model ------------------------------------------------------------
+
+  std::vector<uint8_t> & dtbEmulator::Dacs(uint8_t roc) {
+    std::vector<uint8_t> & dacs = _dacs[roc];
+    if(dacs.empty()) { dacs.assign(256, 0); }
+    return dacs;
+  }
+
+  std::vector<uint8_t> & dtbEmulator::Trims(uint8_t roc) {
+    std::vector<uint8_t> & trims = _trims[roc];
+    if(trims.empty()) { trims.assign(ROC_NUMCOLS*ROC_NUMROWS, 15); }
+    return trims;
+  }
+
+  std::vector<uint8_t> & dtbEmulator::NiosTrims(uint8_t roc) {
+    std::vector<uint8_t> & trims = _niosTrims[roc];
+    if(trims.empty()) { trims.assign(ROC_NUMCOLS*ROC_NUMROWS, 20); }
+    return trims;
+  }
+
+  std::vector<bool> & dtbEmulator::CalBits(uint8_t roc) {
+    std::vector<bool> & cal = _calbits[roc];
+    if(cal.empty()) { cal.assign(ROC_NUMCOLS*ROC_NUMROWS, false); }
+    return cal;
+  }
+
+  bool dtbEmulator::PixelHit(uint8_t roc, uint8_t column, uint8_t row, uint8_t trim, uint8_t & ph) {
+
+    // Trim values above 15 mark masked pixels:
+    if(trim > 15 || !_power) return false;
+
+    // Injected charge in low range Vcal units:
+    std::vector<uint8_t> & dacs = Dacs(roc);
+    int vcal = dacs[ROC_DAC_Vcal]*((dacs[ROC_DAC_CtrlReg] & 0x04) ? 7 : 1);
+
+    // Threshold with a fixed pixel-to-pixel spread of +-10, lowered by
+    // VthrComp and by the trim bits (weighted with Vtrim):
+    uint32_t seed = (static_cast<uint32_t>(roc)*ROC_NUMCOLS*ROC_NUMROWS + column*ROC_NUMROWS + row)*2654435761u;
+    int spread = static_cast<int>((seed >> 16)%21) - 10;
+    int threshold = 60 + spread - (dacs[ROC_DAC_VthrComp] - 80)/2 - (15 - trim)*dacs[ROC_DAC_Vtrim]/60;
+    if(vcal < threshold) return false;
+
+    ph = static_cast<uint8_t>(std::min(255, 20 + (vcal - threshold)/2));
+    return true;
+  }
+
+  bool dtbEmulator::Trigger(const std::vector<uint8_t> & rocs, int column, int row) {
+
+    // Hits of all pulsed pixels: one pixel of a NIOS loop, trimmed with the
+    // values stored on the NIOS, or all pixels with Calibrate bit set
+    std::map<uint8_t, std::vector<uint32_t> > hits;
+    uint8_t ph;
+    for(std::vector<uint8_t>::const_iterator roc = rocs.begin(); roc != rocs.end(); ++roc) {
+      if(column >= 0) {
+	if(PixelHit(*roc, column, row, NiosTrims(*roc).at(column*ROC_NUMROWS + row), ph)) hits[*roc].push_back(encodePixel(column, row, ph));
+	continue;
+      }
+      std::vector<bool> & cal = CalBits(*roc);
+      std::vector<uint8_t> & trims = Trims(*roc);
+      for(size_t px = 0; px < cal.size(); px++) {
+	if(cal[px] && PixelHit(*roc, px/ROC_NUMROWS, px%ROC_NUMROWS, trims[px], ph)) hits[*roc].push_back(encodePixel(px/ROC_NUMROWS, px%ROC_NUMROWS, ph));
+      }
+    }
+
+    // Build the event for every running channel:
+    std::vector<uint16_t> words[4];
+    if(_deser400) {
+      // TBM header, eight ROCs per channel, TBM trailer:
+      for(uint8_t ch = 0; ch < 4; ch++) {
+	if(!_channels[ch].running) continue;
+	words[ch].push_back(0xa000 | (_eventCounter & 0xff));
+	words[ch].push_back(0x8000);
+	for(uint8_t i = 0; i < 8; i++) {
+	  words[ch].push_back(0x4000 | 0x7f8);
+	  std::vector<uint32_t> & rochits = hits[ch*8 + i];
+	  for(size_t hit = 0; hit < rochits.size(); hit++) {
+	    words[ch].push_back((rochits[hit] >> 12) & 0x0fff);
+	    words[ch].push_back(0x2000 | (rochits[hit] & 0x0fff));
+	  }
+	}
+	words[ch].push_back(0xe000);
+	words[ch].push_back(0xc000);
+      }
+    }
+    else if(_channels[0].running) {
+      // Single ROC: header with start (and end) marker, last sample with end marker:
+      std::vector<uint32_t> all;
+      for(std::map<uint8_t, std::vector<uint32_t> >::iterator it = hits.begin(); it != hits.end(); ++it) {
+	all.insert(all.end(), it->second.begin(), it->second.end());
+      }
+      words[0].push_back((all.empty() ? 0xc000 : 0x8000) | 0x7f8);
+      for(size_t hit = 0; hit < all.size(); hit++) {
+	words[0].push_back((all[hit] >> 12) & 0x0fff);
+	words[0].push_back((all[hit] & 0x0fff) | (hit + 1 == all.size() ? 0x4000 : 0));
+      }
+    }
+
+    // The event has to fit into every channel, otherwise it is not taken:
+    for(uint8_t ch = 0; ch < 4; ch++) {
+      if(words[ch].empty()) continue;
+      uint32_t filled = DaqSize(ch);
+      if(filled > 0 && filled + words[ch].size() > _channels[ch].size) return false;
+    }
+    for(uint8_t ch = 0; ch < 4; ch++) {
+      _channels[ch].buffer.insert(_channels[ch].buffer.end(), words[ch].begin(), words[ch].end());
+    }
+    _eventCounter++;
+    return true;
+  }
+
+  size_t dtbEmulator::TriggerCalibrated(size_t nEvents) {
+
+    std::vector<uint8_t> rocs = _i2cAddresses;
+    if(rocs.empty()) { rocs.push_back(_roc); }
+
+    size_t n = 0;
+    while(n < nEvents && Trigger(rocs, -1, -1)) { n++; }
+    return n;
+  }
+
+  uint32_t dtbEmulator::DaqSize(uint8_t channel) {
+    if(channel >= 8) return 0;
+    return static_cast<uint32_t>(_channels[channel].buffer.size() - _channels[channel].pos);
+  }
+
+  void dtbEmulator::PgLoopFill() {
+    // The free running Pattern Generator delivers a burst of events every
+    // time the buffer is looked at:
+    if(_pgLoop) { TriggerCalibrated(100); }
+  }
+
+
+  // --- RPC call handlers ---------------------------------------------------------
+
+  void dtbEmulator::GetRpcVersion(rpcCall & call) { call.retval = RPC_DTB_VERSION; }
+
+  void dtbEmulator::GetRpcCallId(rpcCall & call) {
+    std::string name(call.data[0].begin(), call.data[0].end());
+    std::vector<std::string>::iterator it = std::find(_callNames.begin(), _callNames.end(), name);
+    call.retval = (it != _callNames.end() ? static_cast<int64_t>(it - _callNames.begin()) : -1);
+  }
+
+  void dtbEmulator::GetRpcCallCount(rpcCall & call) { call.retval = static_cast<int64_t>(_callNames.size()); }
+
+  void dtbEmulator::GetRpcCallName(rpcCall & call) {
+    int64_t id = call.value[0];
+    if(id < 0 || id >= static_cast<int64_t>(_callNames.size())) { call.retval = 0; return; }
+    call.data[1].assign(_callNames.at(id).begin(), _callNames.at(id).end());
+  }
+
+  void dtbEmulator::GetRpcCallHash(rpcCall & call) {
+    uint32_t hash = 0;
+    for(size_t i = 0; i < _callNames.size(); i++) { hash += (i+1)*hashString(_callNames.at(i).c_str()); }
+    call.retval = hash;
+  }
+
+  void dtbEmulator::GetString(rpcCall & call) {
+    std::string s;
+    if(call.name == "GetInfo$v4c") {
+      std::stringstream info;
+      info << "Board id:    0" << std::endl
+	   << "HW version:  DTB emulator" << std::endl
+	   << "RPC calls:   " << _callNames.size() << std::endl;
+      s = info.str();
+    }
+    else if(call.name == "GetHWVersion$v4c") { s = "DTB emulator"; }
+    call.data[0].assign(s.begin(), s.end());
+  }
+
+  void dtbEmulator::GetVersion(rpcCall & call) {
+    call.retval = (call.name == "GetBoardId$S" ? 0 : 0x0400);
+  }
+
+  void dtbEmulator::Power(rpcCall & call) { _power = (call.name == "Pon$v"); }
+
+  void dtbEmulator::SetPower(rpcCall & call) {
+    uint16_t value = static_cast<uint16_t>(call.value[0]);
+    if(call.name == "_SetVD$vS") _vd = value;
+    else if(call.name == "_SetVA$vS") _va = value;
+    else if(call.name == "_SetID$vS") _id = value;
+    else _ia = value;
+  }
+
+  void dtbEmulator::GetPower(rpcCall & call) {
+    // Currents in 0.1mA: about 25mA digital and 24mA analog per ROC
+    int64_t nrocs = (_i2cAddresses.empty() ? 1 : static_cast<int64_t>(_i2cAddresses.size()));
+    if(!_power) call.retval = 0;
+    else if(call.name == "_GetVD$S") call.retval = _vd;
+    else if(call.name == "_GetVA$S") call.retval = _va;
+    else if(call.name == "_GetID$S") call.retval = std::min<int64_t>(_id, 250*nrocs);
+    else call.retval = std::min<int64_t>(_ia, 240*nrocs);
+  }
+
+  void dtbEmulator::RocI2cAddr(rpcCall & call) { _roc = static_cast<uint8_t>(call.value[0]); }
+
+  void dtbEmulator::RocSetDAC(rpcCall & call) { Dacs(_roc).at(call.value[0] & 0xff) = static_cast<uint8_t>(call.value[1]); }
+
+  void dtbEmulator::RocPixTrim(rpcCall & call) {
+    if(call.value[0] >= ROC_NUMCOLS || call.value[1] >= ROC_NUMROWS) return;
+    Trims(_roc).at(call.value[0]*ROC_NUMROWS + call.value[1]) = static_cast<uint8_t>(call.value[2] & 0x0f);
+  }
+
+  void dtbEmulator::RocPixMask(rpcCall & call) {
+    if(call.value[0] >= ROC_NUMCOLS || call.value[1] >= ROC_NUMROWS) return;
+    Trims(_roc).at(call.value[0]*ROC_NUMROWS + call.value[1]) = 20;
+  }
+
+  void dtbEmulator::RocChipMask(rpcCall & /*call*/) { Trims(_roc).assign(ROC_NUMCOLS*ROC_NUMROWS, 20); }
+
+  void dtbEmulator::RocPixCal(rpcCall & call) {
+    if(call.value[0] >= ROC_NUMCOLS || call.value[1] >= ROC_NUMROWS) return;
+    CalBits(_roc).at(call.value[0]*ROC_NUMROWS + call.value[1]) = true;
+  }
+
+  void dtbEmulator::RocClrCal(rpcCall & /*call*/) { CalBits(_roc).assign(ROC_NUMCOLS*ROC_NUMROWS, false); }
+
+  void dtbEmulator::TrimChip(rpcCall & call) {
+    // One int16_t per pixel, negative values mask the pixel:
+    std::vector<uint8_t> & trims = Trims(_roc);
+    for(size_t px = 0; px < trims.size() && 2*px + 1 < call.data[0].size(); px++) {
+      int16_t trim = static_cast<int16_t>(call.data[0][2*px] | (call.data[0][2*px+1] << 8));
+      trims[px] = (trim < 0 ? 20 : static_cast<uint8_t>(trim & 0x0f));
+    }
+  }
+
+  void dtbEmulator::SetI2CAddresses(rpcCall & call) { _i2cAddresses = call.data[0]; }
+
+  void dtbEmulator::SetTrimValues(rpcCall & call) {
+    if(call.data[1].size() != ROC_NUMCOLS*ROC_NUMROWS) { call.retval = 0; return; }
+    NiosTrims(static_cast<uint8_t>(call.value[0])) = call.data[1];
+  }
+
+  void dtbEmulator::TbmSet(rpcCall & call) { _tbmRegs[static_cast<uint8_t>(call.value[0])] = static_cast<uint8_t>(call.value[1]); }
+
+  void dtbEmulator::TbmGet(rpcCall & call) { call.value[1] = _tbmRegs[static_cast<uint8_t>(call.value[0])]; }
+
+  void dtbEmulator::DaqOpen(rpcCall & call) {
+    uint8_t ch = static_cast<uint8_t>(call.value[1]);
+    if(ch >= 8) { call.retval = 0; return; }
+    _channels[ch].open = true;
+    _channels[ch].running = false;
+    _channels[ch].size = std::min(static_cast<uint32_t>(call.value[0]), _bufferLimit);
+    _channels[ch].buffer.clear();
+    _channels[ch].pos = 0;
+    call.retval = _channels[ch].size;
+  }
+
+  void dtbEmulator::DaqClose(rpcCall & call) {
+    uint8_t ch = static_cast<uint8_t>(call.value[0]);
+    if(ch >= 8) return;
+    _channels[ch].open = false;
+    _channels[ch].running = false;
+    std::vector<uint16_t>().swap(_channels[ch].buffer);
+    _channels[ch].pos = 0;
+  }
+
+  void dtbEmulator::DaqStart(rpcCall & call) {
+    uint8_t ch = static_cast<uint8_t>(call.value[0]);
+    if(ch < 8) _channels[ch].running = _channels[ch].open;
+  }
+
+  void dtbEmulator::DaqStop(rpcCall & call) {
+    uint8_t ch = static_cast<uint8_t>(call.value[0]);
+    if(ch < 8) _channels[ch].running = false;
+  }
+
+  void dtbEmulator::DaqGetSize(rpcCall & call) {
+    PgLoopFill();
+    call.retval = DaqSize(static_cast<uint8_t>(call.value[0]));
+  }
+
+  void dtbEmulator::DaqFillLevel(rpcCall & call) {
+    PgLoopFill();
+    int64_t level = 0;
+    for(uint8_t ch = 0; ch < 8; ch++) {
+      if(call.name == "Daq_FillLevel$CC" && ch != call.value[0]) continue;
+      if(_channels[ch].size > 0) level = std::max<int64_t>(level, 100*static_cast<int64_t>(DaqSize(ch))/_channels[ch].size);
+    }
+    call.retval = level;
+  }
+
+  void dtbEmulator::DaqRead(rpcCall & call) {
+    PgLoopFill();
+
+    // Daq_Read(data, size, [remaining,] channel):
+    bool remaining = (call.name == "Daq_Read$C5SI0IC");
+    uint8_t ch = static_cast<uint8_t>(call.value[remaining ? 3 : 2]);
+    if(ch >= 8) return;
+
+    daqChannel & channel = _channels[ch];
+    uint32_t n = std::min(static_cast<uint32_t>(call.value[1]), DaqSize(ch));
+    call.data[0].resize(2*n);
+    for(uint32_t i = 0; i < n; i++) {
+      uint16_t sample = channel.buffer[channel.pos + i];
+      call.data[0][2*i] = static_cast<uint8_t>(sample);
+      call.data[0][2*i+1] = static_cast<uint8_t>(sample >> 8);
+    }
+    channel.pos += n;
+    if(channel.pos == channel.buffer.size()) {
+      channel.buffer.clear();
+      channel.pos = 0;
+    }
+    if(remaining) { call.value[2] = DaqSize(ch); }
+  }
+
+  void dtbEmulator::DaqSelect(rpcCall & call) { _deser400 = (call.name == "Daq_Select_Deser400$v"); }
+
+  void dtbEmulator::PgTrigger(rpcCall & call) {
+    TriggerCalibrated(call.name == "Pg_Triggers$vIS" ? static_cast<size_t>(call.value[0]) : 1);
+  }
+
+  void dtbEmulator::PgLoop(rpcCall & /*call*/) { _pgLoop = true; }
+
+  void dtbEmulator::PgStop(rpcCall & /*call*/) { _pgLoop = false; }
+
+  void dtbEmulator::LoopInterruptReset(rpcCall & /*call*/) {
+    _loopKey.clear();
+    _loopPosition = 0;
+  }
+
+  void dtbEmulator::TriggerLoop(rpcCall & call) {
+
+    // Parameters: ROC(s), [column, row,] nTriggers, flags, then per DAC
+    // register, [step,] min, max
+    bool multi = (call.name.compare(0, 12, "LoopMultiRoc") == 0);
+    bool onepixel = (call.name.find("OnePixel") != std::string::npos);
+    int ndacs = (call.name.find("DacDacScan") != std::string::npos ? 2 : (call.name.find("DacScan") != std::string::npos ? 1 : 0));
+
+    size_t i = 0;
+    std::vector<uint8_t> rocs;
+    if(multi) { rocs = call.data[i++]; }
+    else { rocs.push_back(static_cast<uint8_t>(call.value[i++])); }
+    int column = -1, row = -1;
+    if(onepixel) {
+      column = static_cast<int>(call.value[i++]);
+      row = static_cast<int>(call.value[i++]);
+    }
+    uint64_t nTriggers = static_cast<uint64_t>(call.value[i++]);
+    i++;
+
+    bool steps = (ndacs > 0 && call.type.size() - i == static_cast<size_t>(4*ndacs));
+    uint8_t reg[2] = {0, 0};
+    int dacmin[2] = {0, 0}, dacstep[2] = {1, 1};
+    uint64_t npoints[2] = {1, 1};
+    for(int d = 0; d < ndacs; d++) {
+      reg[d] = static_cast<uint8_t>(call.value[i++]);
+      if(steps) { dacstep[d] = std::max<int>(1, static_cast<int>(call.value[i++])); }
+      dacmin[d] = static_cast<int>(call.value[i++]);
+      int dacmax = static_cast<int>(call.value[i++]);
+      npoints[d] = (dacmax >= dacmin[d] ? (dacmax - dacmin[d])/dacstep[d] + 1 : 0);
+    }
+
+    // An interrupted loop with the same parameters is resumed:
+    std::stringstream key;
+    key << call.name;
+    for(size_t j = 0; j < call.value.size(); j++) { key << " " << call.value[j]; }
+    for(size_t j = 0; j < rocs.size(); j++) { key << " r" << static_cast<int>(rocs[j]); }
+    if(key.str() != _loopKey) {
+      _loopKey = key.str();
+      _loopPosition = 0;
+    }
+
+    // Keep the DAC settings, the loop changes them:
+    std::map<uint8_t, std::vector<uint8_t> > saved;
+    for(size_t j = 0; j < rocs.size(); j++) { saved[rocs[j]] = Dacs(rocs[j]); }
+
+    // Pixels (column by column), DAC1, DAC2 and triggers, the last one runs fastest:
+    uint64_t npixels = (onepixel ? 1 : ROC_NUMCOLS*ROC_NUMROWS);
+    uint64_t total = npixels*npoints[0]*npoints[1]*nTriggers;
+    for(; _loopPosition < total; _loopPosition++) {
+      uint64_t k = _loopPosition/nTriggers;
+      uint64_t point2 = k%npoints[1];
+      k /= npoints[1];
+      uint64_t point1 = k%npoints[0];
+      uint64_t px = k/npoints[0];
+
+      for(size_t j = 0; j < rocs.size(); j++) {
+	if(ndacs > 0) Dacs(rocs[j]).at(reg[0]) = static_cast<uint8_t>(dacmin[0] + point1*dacstep[0]);
+	if(ndacs > 1) Dacs(rocs[j]).at(reg[1]) = static_cast<uint8_t>(dacmin[1] + point2*dacstep[1]);
+      }
+      if(!Trigger(rocs, onepixel ? column : static_cast<int>(px/ROC_NUMROWS), onepixel ? row : static_cast<int>(px%ROC_NUMROWS))) break;
+    }
+
+    for(std::map<uint8_t, std::vector<uint8_t> >::iterator it = saved.begin(); it != saved.end(); ++it) { _dacs[it->first] = it->second; }
+
+    // Finished, or interrupted because the DAQ buffer is full:
+    call.retval = (_loopPosition >= total);
+    if(call.retval) {
+      _loopKey.clear();
+      _loopPosition = 0;
+    }
+  }
+
+}
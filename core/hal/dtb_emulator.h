@@ -0,0 +1,175 @@
+#ifndef PXAR_DTB_EMULATOR_H
+#define PXAR_DTB_EMULATOR_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#include "rpc_io.h"
+
+namespace pxar {
+
+  /** In-process emulation of a DTB with attached ROCs, connected to the
+   *  CTestboard instead of the USB interface. It implements the board side
+   *  of the RPC protocol: command and data message framing, call id lookup
+   *  and hashing, and replies for every call of the host command list
+   *  (derived from the call signatures, zero/true for calls that are not
+   *  emulated). On top of that it keeps the ROC state (DACs, trim and mask
+   *  bits, Calibrate bits), the DAQ channel buffers and runs the Pattern
+   *  Generator and the NIOS trigger loops, producing DESER160 (single ROC)
+   *  or DESER400 (module) data with a simple threshold and pulse height
+   *  model.
+   *
+   *  Every Flush() with pending data counts as one USB transfer and every
+   *  read turnaround as one round trip, both can be given a latency and a
+   *  bandwidth limit. This allows to run the full HAL without a board and
+   *  to measure RPC batching and readout throughput.
+   */
+  class dtbEmulator : public CRpcIo {
+  public:
+    /** Emulated board with the given RPC command list (usually the one of
+     *  the host, i.e. a matching firmware). Latency in microseconds per
+     *  transfer and round trip, bandwidth in bytes per second (0: no limit).
+     */
+    dtbEmulator(std::vector<std::string> callNames, uint32_t latency = 0, double bandwidth = 0);
+
+    // CRpcIo interface:
+    void Write(const void *buffer, uint32_t size);
+    void Flush();
+    void Clear();
+    void Read(void *buffer, uint32_t size);
+    void Close() {}
+
+    /** Maximum size of a DAQ channel buffer in samples. Trigger loops which
+     *  would overflow it are interrupted and resume at the next call, as
+     *  the NIOS loops do.
+     */
+    void SetBufferLimit(uint32_t samples) { _bufferLimit = samples; }
+
+    /** Statistics: USB write transfers, read round trips, RPC calls,
+     *  bytes in both directions and the modelled transfer time in us.
+     */
+    uint64_t GetNTransfers() { return _nTransfers; }
+    uint64_t GetNRoundTrips() { return _nRoundTrips; }
+    uint64_t GetNCalls() { return _nCalls; }
+    uint64_t GetBytesWritten() { return _bytesWritten; }
+    uint64_t GetBytesRead() { return _bytesRead; }
+    uint64_t GetTransferTime() { return static_cast<uint64_t>(_transferTime); }
+
+  private:
+    /** One decoded RPC call: scalar parameters (incl. references) and data
+     *  blocks (vectors, strings) by parameter position, plus return value
+     */
+    struct rpcCall {
+      std::string name;
+      char ret;
+      std::vector<char> prefix;
+      std::vector<char> type;
+      std::vector<int64_t> value;
+      std::vector<std::vector<uint8_t> > data;
+      int64_t retval;
+    };
+    typedef void (dtbEmulator::*callHandler)(rpcCall &);
+
+    /** DAQ channel: allocated buffer and running state */
+    struct daqChannel {
+      bool open;
+      bool running;
+      uint32_t size;
+      std::vector<uint16_t> buffer;
+      size_t pos;
+    };
+
+    // --- protocol
+    void ProcessInput();
+    bool ParseSignature(rpcCall & call);
+    void SendReply(uint16_t cmd, rpcCall & call);
+    void Delay(double us);
+
+    // --- board model
+    std::vector<uint8_t> & Dacs(uint8_t roc);
+    std::vector<uint8_t> & Trims(uint8_t roc);
+    std::vector<uint8_t> & NiosTrims(uint8_t roc);
+    std::vector<bool> & CalBits(uint8_t roc);
+    bool PixelHit(uint8_t roc, uint8_t column, uint8_t row, uint8_t trim, uint8_t & ph);
+    bool Trigger(const std::vector<uint8_t> & rocs, int column, int row);
+    size_t TriggerCalibrated(size_t nEvents);
+    uint32_t DaqSize(uint8_t channel);
+    void PgLoopFill();
+
+    // --- RPC call handlers
+    void GetRpcVersion(rpcCall & call);
+    void GetRpcCallId(rpcCall & call);
+    void GetRpcCallCount(rpcCall & call);
+    void GetRpcCallName(rpcCall & call);
+    void GetRpcCallHash(rpcCall & call);
+    void GetString(rpcCall & call);
+    void GetVersion(rpcCall & call);
+    void Power(rpcCall & call);
+    void SetPower(rpcCall & call);
+    void GetPower(rpcCall & call);
+    void RocI2cAddr(rpcCall & call);
+    void RocSetDAC(rpcCall & call);
+    void RocPixTrim(rpcCall & call);
+    void RocPixMask(rpcCall & call);
+    void RocChipMask(rpcCall & call);
+    void RocPixCal(rpcCall & call);
+    void RocClrCal(rpcCall & call);
+    void TrimChip(rpcCall & call);
+    void SetI2CAddresses(rpcCall & call);
+    void SetTrimValues(rpcCall & call);
+    void TbmSet(rpcCall & call);
+    void TbmGet(rpcCall & call);
+    void DaqOpen(rpcCall & call);
+    void DaqClose(rpcCall & call);
+    void DaqStart(rpcCall & call);
+    void DaqStop(rpcCall & call);
+    void DaqGetSize(rpcCall & call);
+    void DaqFillLevel(rpcCall & call);
+    void DaqRead(rpcCall & call);
+    void DaqSelect(rpcCall & call);
+    void PgTrigger(rpcCall & call);
+    void PgLoop(rpcCall & call);
+    void PgStop(rpcCall & call);
+    void LoopInterruptReset(rpcCall & call);
+    void TriggerLoop(rpcCall & call);
+
+    std::vector<std::string> _callNames;
+    std::map<std::string, callHandler> _handlers;
+
+    // --- transport and statistics
+    std::vector<uint8_t> _input;
+    size_t _pendingWrite;
+    std::vector<uint8_t> _output;
+    size_t _outputPos;
+    bool _turnaround;
+    uint32_t _latency;
+    double _bandwidth;
+    double _pendingDelay;
+    double _transferTime;
+    uint64_t _nTransfers, _nRoundTrips, _nCalls, _bytesWritten, _bytesRead;
+
+    // --- board state
+    bool _power;
+    uint16_t _vd, _va, _id, _ia;
+    uint8_t _roc;
+    std::vector<uint8_t> _i2cAddresses;
+    std::map<uint8_t, std::vector<uint8_t> > _dacs;
+    std::map<uint8_t, std::vector<uint8_t> > _trims;
+    std::map<uint8_t, std::vector<uint8_t> > _niosTrims;
+    std::map<uint8_t, std::vector<bool> > _calbits;
+    std::map<uint8_t, uint8_t> _tbmRegs;
+
+    // --- DAQ and trigger state
+    daqChannel _channels[8];
+    uint32_t _bufferLimit;
+    bool _deser400;
+    uint32_t _eventCounter;
+    bool _pgLoop;
+    std::string _loopKey;
+    uint64_t _loopPosition;
+  };
+
+}
+#endif
@@ -108,6 +108,11 @@ double hal::getTBvd() {
   return (5.23);
 }
 
+std::vector< std::pair<double,double> > hal::rocCurrentVsDAC(uint8_t /*roci2c*/, uint8_t /*dacId*/, std::vector<uint8_t> values, uint32_t /*settle_us*/, bool repeat) {
+  // Return one or two constant readings per DAC value:
+  return std::vector< std::pair<double,double> >(values.size()*(repeat ? 2 : 1), std::make_pair(5.23,5.23));
+}
+
 
 void hal::setTBia(double /*IA*/) {
 }
@@ -149,6 +154,9 @@ void hal::AllColumnsSetEnable(uint8_t /*rocid*/, bool /*enable*/) {
 void hal::PixelSetCalibrate(uint8_t /*rocid*/, uint8_t /*column*/, uint8_t /*row*/, uint16_t /*flags*/) {
 }
 
+void hal::RocSetCalibrate(uint8_t /*rocid*/, std::vector<pixelConfig> /*pixels*/, uint16_t /*flags*/) {
+}
+
 void hal::RocClearCalibrate(uint8_t /*rocid*/) {
 }
 
@@ -511,6 +519,104 @@ std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t rocid, uint8_t colu
   return data;
 }
 
+std::vector<Event*> hal::MultiRocSelectedPixelsCalibrate(std::vector<uint8_t> rocids, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_CALIBRATE, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsCalibrate(uint8_t rocid, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_CALIBRATE, std::vector<uint8_t>(1,rocid), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacScan(std::vector<uint8_t> rocids, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACSCAN, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacScan(uint8_t rocid, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACSCAN, std::vector<uint8_t>(1,rocid), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacDacScan(std::vector<uint8_t> rocids, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACDACSCAN, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacDacScan(uint8_t rocid, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACDACSCAN, std::vector<uint8_t>(1,rocid), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacList(std::vector<uint8_t> rocids, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACLIST, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacList(uint8_t rocid, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACLIST, std::vector<uint8_t>(1,rocid), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocOnePixelDacList(std::vector<uint8_t> rocids, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+  std::vector<pixelConfig> pixels(1,pixelConfig(column,row,0));
+  return SelectedPixelsLoop(LOOP_DACLIST, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocOnePixelDacList(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+  std::vector<pixelConfig> pixels(1,pixelConfig(column,row,0));
+  return SelectedPixelsLoop(LOOP_DACLIST, std::vector<uint8_t>(1,rocid), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocAllPixelsDacList(std::vector<uint8_t> rocids, std::vector<int32_t> parameter) {
+  return AllPixelsDacListLoop(rocids, true, parameter);
+}
+
+std::vector<Event*> hal::SingleRocAllPixelsDacList(uint8_t rocid, std::vector<int32_t> parameter) {
+  return AllPixelsDacListLoop(std::vector<uint8_t>(1,rocid), false, parameter);
+}
+
+std::vector<Event*> hal::AllPixelsDacListLoop(std::vector<uint8_t> rocids, bool /*multiroc*/, std::vector<int32_t> & parameter) {
+
+  std::vector<pixelConfig> pixels;
+  for(size_t i = 0; i < ROC_NUMCOLS; i++) {
+    for(size_t j = 0; j < ROC_NUMROWS; j++) { pixels.push_back(pixelConfig(i,j,0)); }
+  }
+  return SelectedPixelsLoop(LOOP_DACLIST, rocids, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SelectedPixelsLoop(pixelLoopType looptype, std::vector<uint8_t> rocids, bool multiroc, std::vector<pixelConfig> & pixels, std::vector<int32_t> & parameter) {
+
+  // Just mimic the batched loop by concatenating the single pixel data:
+  std::vector<Event*> data;
+  for(std::vector<pixelConfig>::iterator px = pixels.begin(); px != pixels.end(); ++px) {
+    std::vector<Event*> buffer;
+    if(looptype == LOOP_CALIBRATE) {
+      if(multiroc) buffer = MultiRocOnePixelCalibrate(rocids, px->column, px->row, parameter);
+      else buffer = SingleRocOnePixelCalibrate(rocids.front(), px->column, px->row, parameter);
+    }
+    else if(looptype == LOOP_DACSCAN) {
+      if(multiroc) buffer = MultiRocOnePixelDacScan(rocids, px->column, px->row, parameter);
+      else buffer = SingleRocOnePixelDacScan(rocids.front(), px->column, px->row, parameter);
+    }
+    else if(looptype == LOOP_DACLIST) {
+      uint16_t nTriggers = static_cast<uint16_t>(parameter.at(2));
+      for(size_t dac = 3; dac < parameter.size(); dac++) {
+	for(size_t k = 0; k < nTriggers; k++) {
+	  Event* evt = new Event();
+	  for(std::vector<uint8_t>::iterator roc = rocids.begin(); roc != rocids.end(); ++roc) {
+	    // Mimic a pulse height rising with the DAC value:
+	    if(parameter.at(dac) > 0) evt->pixels.push_back(pixel(*roc,px->column,px->row,parameter.at(dac)/2));
+	  }
+	  buffer.push_back(evt);
+	}
+      }
+    }
+    else {
+      if(multiroc) buffer = MultiRocOnePixelDacDacScan(rocids, px->column, px->row, parameter);
+      else buffer = SingleRocOnePixelDacDacScan(rocids.front(), px->column, px->row, parameter);
+    }
+    data.insert(data.end(), buffer.begin(), buffer.end());
+  }
+
+  LOG(logDEBUGHAL) << "Readout size: " << data.size() << " Events.";
+
+  return data;
+}
+
 // Testboard power switches:
 
 void hal::HVon() {
@@ -550,11 +656,8 @@ void hal::SetClockStretch(uint8_t /*src*/, uint16_t /*delay*/, uint16_t /*width*
 
 void hal::daqStart(uint8_t /*deser160phase*/, uint8_t /*nTBMs*/, uint32_t /*buffersize*/) {}
 
-Event* hal::daqEvent() {
-
-  Event* current_Event = new Event();
-
-  return current_Event;
+bool hal::daqEvent(Event & /*evt*/) {
+  return false;
 }
 
 std::vector<Event*> hal::daqAllEvents() {
@@ -563,10 +666,14 @@ std::vector<Event*> hal::daqAllEvents() {
   return evt;
 }
 
-rawEvent* hal::daqRawEvent() {
+void hal::daqAllEvents(std::vector<Event> & /*data*/) {}
 
-  rawEvent* current_Event = new rawEvent();
-  return current_Event;
+alignmentStatistics hal::daqAlignmentStatistics() {
+  return alignmentStatistics();
+}
+
+bool hal::daqRawEvent(rawEvent & /*evt*/) {
+  return false;
 }
 
 std::vector<rawEvent*> hal::daqAllRawEvents() {
@@ -575,6 +682,8 @@ std::vector<rawEvent*> hal::daqAllRawEvents() {
   return raw;
 }
 
+void hal::daqAllRawEvents(std::vector<rawEvent> & /*data*/) {}
+
 std::vector<uint16_t> hal::daqBuffer() {
   
   std::vector<uint16_t> raw;
@@ -1,32 +1,57 @@
 #include "hal.h"
+#include "dtb_emulator.h"
 #include "log.h"
 #include "timer.h"
 #include "helper.h"
 #include "config.h"
 #include "constants.h"
 #include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 using namespace pxar;
 
 
 
 hal::hal(std::string name) :
+  _emulator(NULL),
   _initialized(false),
   _compatible(false),
   tbmtype(0x00),
   deser160phase(4),
-  rocType(0)
+  rocType(0),
+  _pgDelaySum(0)
 {
 
+  // Measure the time until the board is ready for operation:
+  timer t;
+
   // Get a new CTestboard class instance:
   _testboard = new CTestboard();
 
-  // Check if any boards are connected:
-  FindDTB(name);
+  bool connected;
+  if(name.compare(0, strlen(DTB_EMULATOR_NAME), DTB_EMULATOR_NAME) == 0) {
+    // Emulated board, optionally with USB latency [us] and bandwidth [B/s]:
+    uint32_t latency = 0;
+    double bandwidth = 0;
+    std::string options = name.substr(strlen(DTB_EMULATOR_NAME));
+    std::replace(options.begin(), options.end(), ':', ' ');
+    std::istringstream(options) >> latency >> bandwidth;
+
+    _emulator = new dtbEmulator(_testboard->GetHostRpcCallNames(), latency, bandwidth);
+    connected = _testboard->Open(*_emulator);
+  }
+  else {
+    // Check if any boards are connected:
+    FindDTB(name);
+
+    // Open the testboard connection:
+    connected = _testboard->Open(name);
+  }
 
-  // Open the testboard connection:
-  if(_testboard->Open(name)) {
+  if(connected) {
     LOG(logQUIET) << "Connection to board " << name << " opened.";
     try {
       // Print the useful SW/FW versioning info:
@@ -44,6 +69,7 @@ hal::hal(std::string name) :
 	// Finally, initialize the testboard:
 	_testboard->Init();
 
+	LOG(logDEBUGHAL) << "Testboard ready after " << t.get() << "ms.";
       }
     }
     catch(CRpcError &e) {
@@ -78,6 +104,16 @@ hal::~hal() {
   LOG(logQUIET) << "Connection to board " << _testboard->GetBoardId() << " closed.";
   _testboard->Close();
   delete _testboard;
+
+  if(_emulator) {
+    LOG(logDEBUGHAL) << "DTB emulator: " << _emulator->GetNCalls() << " RPC calls in "
+		     << _emulator->GetNTransfers() << " transfers and "
+		     << _emulator->GetNRoundTrips() << " round trips, "
+		     << _emulator->GetBytesWritten() << " bytes written, "
+		     << _emulator->GetBytesRead() << " bytes read, modelled transfer time "
+		     << _emulator->GetTransferTime()/1000 << "ms.";
+    delete _emulator;
+  }
 }
 
 bool hal::status() {
@@ -169,6 +205,7 @@ void hal::SetupPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > pg_set
 
   _testboard->Pg_SetCmdAll(cmd);
   _testboard->Pg_SetSum(delaysum);
+  _pgDelaySum = delaysum;
 
   // Since the last delay is known to be zero we don't have to overwrite the rest of the address range - 
   // the Pattern generator will stop automatically at that point.
@@ -313,6 +350,10 @@ bool hal::CheckCompatibility() {
   if(dtb_hashcmd.compare("GetRpcCallHash$I") != 0 || dtbCmdHash != hostCmdHash) {
     LOG(logWARNING) << "RPC Call hashes of DTB and Host do not match!";
 
+    // Resolving all calls one by one costs one round trip each, try to
+    // take the call ids from an earlier session with this firmware:
+    bool cached = LoadRpcCallIds(dtbCmdHash,hostCmdHash);
+
     if(!_testboard->RpcLink()) {
       LOG(logCRITICAL) << "Please update your DTB with the correct flash file.";
       LOG(logCRITICAL) << "Get Firmware " << PACKAGE_FIRMWARE << " from " << PACKAGE_FIRMWARE_URL;
@@ -322,17 +363,121 @@ bool hal::CheckCompatibility() {
     }
     else { 
       // hashes do not match but all functions we need for pxar are present
+      if(!cached) { StoreRpcCallIds(dtbCmdHash,hostCmdHash); }
       return true; 
     }
   }
-  else { LOG(logINFO) << "RPC call hashes of host and DTB match: " << hostCmdHash; }
+  else {
+    LOG(logINFO) << "RPC call hashes of host and DTB match: " << hostCmdHash;
+    // Identical command lists, the call ids are the list positions and do
+    // not have to be requested from the DTB one by one:
+    _testboard->RpcLinkIdentical();
+  }
 
   // We are though all checks, testboard is successfully connected:
   return true;
 }
 
+std::string hal::RpcCallIdCacheFile(uint32_t dtbCmdHash, uint32_t hostCmdHash) {
+
+#ifdef WIN32
+  const char * home = getenv("USERPROFILE");
+#else
+  const char * home = getenv("HOME");
+#endif
+  if(home == NULL || *home == 0) return "";
+
+  std::stringstream filename;
+  filename << home << "/.pxar_rpcids_" << dtbCmdHash << "_" << hostCmdHash << ".dat";
+  return filename.str();
+}
+
+bool hal::LoadRpcCallIds(uint32_t dtbCmdHash, uint32_t hostCmdHash) {
+
+  std::string filename = RpcCallIdCacheFile(dtbCmdHash,hostCmdHash);
+  if(filename.empty()) return false;
+
+  std::ifstream file(filename.c_str());
+  if(!file.is_open()) return false;
+
+  // One line per host RPC call: call id and name. The names have to match
+  // the host command list exactly, otherwise the cache is ignored:
+  std::vector<std::string> names = _testboard->GetHostRpcCallNames();
+  std::vector<int32_t> ids;
+  int32_t id;
+  std::string name;
+  while(file >> id >> name) {
+    if(ids.size() >= names.size() || names.at(ids.size()) != name) {
+      LOG(logDEBUGHAL) << "RPC call id cache " << filename << " does not match host command list.";
+      return false;
+    }
+    ids.push_back(id);
+  }
+
+  if(!_testboard->SetRpcCallIds(ids)) return false;
+  LOG(logDEBUGHAL) << "Read " << ids.size() << " RPC call ids from " << filename;
+  return true;
+}
+
+void hal::StoreRpcCallIds(uint32_t dtbCmdHash, uint32_t hostCmdHash) {
+
+  std::string filename = RpcCallIdCacheFile(dtbCmdHash,hostCmdHash);
+  if(filename.empty()) return;
+
+  std::ofstream file(filename.c_str());
+  if(!file.is_open()) {
+    LOG(logDEBUGHAL) << "Could not write RPC call id cache " << filename;
+    return;
+  }
+
+  std::vector<std::string> names = _testboard->GetHostRpcCallNames();
+  std::vector<int32_t> ids = _testboard->GetRpcCallIds();
+  for(size_t i = 0; i < ids.size() && i < names.size(); i++) {
+    file << ids.at(i) << " " << names.at(i) << std::endl;
+  }
+  LOG(logDEBUGHAL) << "Stored " << ids.size() << " RPC call ids in " << filename;
+}
+
+uint16_t hal::RpcCallId(std::string callName) {
+
+  // Look the function up by name in the host command list, the position in
+  // the list and the DTB call id both depend on the firmware version:
+  std::vector<std::string> names = _testboard->GetHostRpcCallNames();
+  std::vector<int32_t> ids = _testboard->GetRpcCallIds();
+  for(size_t i = 0; i < names.size() && i < ids.size(); i++) {
+    if(names.at(i).substr(0,names.at(i).find('$')) != callName) continue;
+    int32_t id = ids.at(i);
+    // Not linked yet, ask the DTB:
+    if(id < 0) { id = _testboard->GetRpcCallId(names.at(i)); }
+    if(id >= 0) return static_cast<uint16_t>(id);
+    break;
+  }
+  LOG(logCRITICAL) << "RPC function " << callName << " not available on the DTB!";
+  throw CRpcError(CRpcError::UNKNOWN_CMD);
+}
+
+void hal::RpcSendRequest(uint16_t callId) {
+  rpcMessage msg;
+  msg.Create(callId);
+  msg.Send(_testboard->GetIo());
+}
+
+uint16_t hal::RpcReceiveUINT16(uint16_t callId) {
+  rpcMessage msg;
+  msg.Receive(_testboard->GetIo());
+  msg.Check(callId,2);
+  return msg.Get_UINT16();
+}
+
 bool hal::FindDTB(std::string &usbId) {
 
+  // A specific board was requested, no need to look at all of them. If it
+  // is not attached, opening the connection fails with a proper error:
+  if(!usbId.empty() && usbId != "*") {
+    LOG(logDEBUGHAL) << "Using DTB " << usbId;
+    return true;
+  }
+
   // Find attached USB devices that match the DTB naming scheme:
   std::string name;
   std::vector<std::string> devList;
@@ -371,21 +516,11 @@ bool hal::FindDTB(std::string &usbId) {
     return true;
   }
 
-  // If more than 1 connected device list them
+  // If more than 1 connected device list them. The USB name carries the
+  // board serial already, the boards are not opened to read their ids:
   LOG(logINFO) << "\nConnected DTBs:\n";
   for (nr=0; nr<devList.size(); nr++) {
     LOG(logINFO) << nr << ":" << devList[nr];
-    if (_testboard->Open(devList[nr], false)) {
-      try {
-	unsigned int bid = _testboard->GetBoardId();
-	LOG(logINFO) << "  BID=" << bid;
-      }
-      catch (...) {
-	LOG(logERROR) << "  Not identifiable\n";
-      }
-      _testboard->Close();
-    }
-    else LOG(logWARNING) << " - in use\n";
   }
 
   LOG(logINFO) << "Please choose DTB (0-" << (nDev-1) << "): ";
@@ -423,6 +558,55 @@ double hal::getTBvd() {
   return (_testboard->_GetVD()/1000.0);
 }
 
+std::vector< std::pair<double,double> > hal::rocCurrentVsDAC(uint8_t roci2c, uint8_t dacId, std::vector<uint8_t> values, uint32_t settle_us, bool repeat) {
+
+  std::vector< std::pair<double,double> > result;
+
+  // Number of DAC steps queued before the answers are collected, keeps the
+  // DTB output well below the USB buffer size:
+  const size_t chunk = 32;
+  size_t nreadings = (repeat ? 2 : 1);
+
+  LOG(logDEBUGHAL) << "ROC@I2C " << static_cast<int>(roci2c) << ": sweeping DAC" << static_cast<int>(dacId)
+		   << " over " << values.size() << " values, settling time " << settle_us << "us"
+		   << (repeat ? ", two readings per value." : ".");
+
+  // The current readings are sent split-phase, outside the generated RPC calls:
+  uint16_t getIA = RpcCallId("_GetIA");
+  uint16_t getID = RpcCallId("_GetID");
+
+  // Make sure we are writing to the correct ROC by setting the I2C address:
+  _testboard->roc_I2cAddr(roci2c);
+
+  for(size_t first = 0; first < values.size(); first += chunk) {
+    size_t last = std::min(first + chunk, values.size());
+
+    // Queue DAC setting, settling delay and current readings for all steps of this chunk:
+    for(size_t i = first; i < last; i++) {
+      _testboard->roc_SetDAC(dacId, values.at(i));
+      for(size_t r = 0; r < nreadings; r++) {
+	for(uint32_t wait = settle_us; wait > 0; wait -= std::min(wait, static_cast<uint32_t>(60000))) {
+	  _testboard->uDelay(static_cast<uint16_t>(std::min(wait, static_cast<uint32_t>(60000))));
+	}
+	RpcSendRequest(getIA);
+	RpcSendRequest(getID);
+      }
+    }
+    _testboard->Flush();
+
+    // Collect the answers in the order they were requested:
+    for(size_t i = first; i < last; i++) {
+      for(size_t r = 0; r < nreadings; r++) {
+	double ia = RpcReceiveUINT16(getIA)/10000.0;
+	double id = RpcReceiveUINT16(getID)/10000.0;
+	result.push_back(std::make_pair(ia,id));
+      }
+    }
+  }
+
+  return result;
+}
+
 
 void hal::setTBia(double IA) {
   // Set the VA analog current limit in A:
@@ -537,6 +721,7 @@ void hal::SetupTrimValues(uint8_t roci2c, std::vector<pixelConfig> pixels) {
 		   << static_cast<int>(roci2c) << ".";
 
   _testboard->SetTrimValues(roci2c,trim);
+  _niosTrims[roci2c] = trim;
 }
 
 void hal::RocSetMask(uint8_t roci2c, bool mask, std::vector<pixelConfig> pixels) {
@@ -599,6 +784,32 @@ void hal::PixelSetCalibrate(uint8_t roci2c, uint8_t column, uint8_t row, uint16_
   _testboard->roc_Pix_Cal(column,row,useSensorPadForCalibration);
 }
 
+void hal::RocSetCalibrate(uint8_t roci2c, std::vector<pixelConfig> pixels, uint16_t flags) {
+
+  // Collect the enabled pixels in a bitmap, ordered by column:
+  std::vector<bool> calibrate(ROC_NUMCOLS*ROC_NUMROWS,false);
+  size_t npixels = 0;
+  for(std::vector<pixelConfig>::iterator pxIt = pixels.begin(); pxIt != pixels.end(); ++pxIt) {
+    if(!pxIt->enable || pxIt->column >= ROC_NUMCOLS || pxIt->row >= ROC_NUMROWS) continue;
+    size_t position = pxIt->column*ROC_NUMROWS + pxIt->row;
+    if(!calibrate[position]) { calibrate[position] = true; npixels++; }
+  }
+
+  LOG(logDEBUGHAL) << "Setting calibrate bits of " << npixels << " pixels for ROC@I2C " << static_cast<int>(roci2c);
+  if(npixels == 0) return;
+
+  // Set the correct ROC I2C address once for all pixels:
+  _testboard->roc_I2cAddr(roci2c);
+
+  // The calls are only queued in the RPC write buffer and go out in as
+  // few USB transfers as possible:
+  bool useSensorPadForCalibration  = (flags & FLAG_CALS) != 0;
+  for(size_t position = 0; position < calibrate.size(); position++) {
+    if(!calibrate[position]) continue;
+    _testboard->roc_Pix_Cal(static_cast<uint8_t>(position/ROC_NUMROWS),static_cast<uint8_t>(position%ROC_NUMROWS),useSensorPadForCalibration);
+  }
+}
+
 void hal::RocClearCalibrate(uint8_t roci2c) {
 
   // Set the correct ROC I2C address:
@@ -656,10 +867,14 @@ std::vector<Event*> hal::MultiRocAllPixelsCalibrate(std::vector<uint8_t> roci2cs
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for missing events
@@ -708,10 +923,14 @@ std::vector<Event*> hal::MultiRocOnePixelCalibrate(std::vector<uint8_t> roci2cs,
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // We expect one Event per trigger, all ROCs are triggered in parallel:
@@ -762,10 +981,14 @@ std::vector<Event*> hal::SingleRocAllPixelsCalibrate(uint8_t roci2c, std::vector
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for missing events
@@ -812,10 +1035,14 @@ std::vector<Event*> hal::SingleRocOnePixelCalibrate(uint8_t roci2c, uint8_t colu
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // We are expecting one Event per trigger:
@@ -874,10 +1101,14 @@ std::vector<Event*> hal::MultiRocAllPixelsDacScan(std::vector<uint8_t> roci2cs,
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -937,10 +1168,14 @@ std::vector<Event*> hal::MultiRocOnePixelDacScan(std::vector<uint8_t> roci2cs, u
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -996,10 +1231,14 @@ std::vector<Event*> hal::SingleRocAllPixelsDacScan(uint8_t roci2c, std::vector<i
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1055,10 +1294,14 @@ std::vector<Event*> hal::SingleRocOnePixelDacScan(uint8_t roci2c, uint8_t column
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1124,10 +1367,14 @@ std::vector<Event*> hal::MultiRocAllPixelsDacDacScan(std::vector<uint8_t> roci2c
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1196,10 +1443,14 @@ std::vector<Event*> hal::MultiRocOnePixelDacDacScan(std::vector<uint8_t> roci2cs
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1264,10 +1515,14 @@ std::vector<Event*> hal::SingleRocAllPixelsDacDacScan(uint8_t roci2c, std::vecto
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1332,10 +1587,14 @@ std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t col
     LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
     data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
   LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
 
   // Clear & reset the DAQ buffer on the testboard.
-  daqStop();
   daqClear();
 
   // check for errors in readout (i.e. missing events)
@@ -1353,6 +1612,481 @@ std::vector<Event*> hal::SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t col
   return data;
 }
 
+std::vector<Event*> hal::MultiRocSelectedPixelsCalibrate(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_CALIBRATE, roci2cs, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsCalibrate(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_CALIBRATE, std::vector<uint8_t>(1,roci2c), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacScan(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACSCAN, roci2cs, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacScan(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACSCAN, std::vector<uint8_t>(1,roci2c), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacDacScan(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACDACSCAN, roci2cs, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacDacScan(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACDACSCAN, std::vector<uint8_t>(1,roci2c), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocSelectedPixelsDacList(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACLIST, roci2cs, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocSelectedPixelsDacList(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter) {
+  return SelectedPixelsLoop(LOOP_DACLIST, std::vector<uint8_t>(1,roci2c), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocOnePixelDacList(std::vector<uint8_t> roci2cs, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+  std::vector<pixelConfig> pixels(1,pixelConfig(column,row,0));
+  return SelectedPixelsLoop(LOOP_DACLIST, roci2cs, true, pixels, parameter);
+}
+
+std::vector<Event*> hal::SingleRocOnePixelDacList(uint8_t roci2c, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+  std::vector<pixelConfig> pixels(1,pixelConfig(column,row,0));
+  return SelectedPixelsLoop(LOOP_DACLIST, std::vector<uint8_t>(1,roci2c), false, pixels, parameter);
+}
+
+std::vector<Event*> hal::MultiRocAllPixelsDacList(std::vector<uint8_t> roci2cs, std::vector<int32_t> parameter) {
+  return AllPixelsDacListLoop(roci2cs, true, parameter);
+}
+
+std::vector<Event*> hal::SingleRocAllPixelsDacList(uint8_t roci2c, std::vector<int32_t> parameter) {
+  return AllPixelsDacListLoop(std::vector<uint8_t>(1,roci2c), false, parameter);
+}
+
+std::vector<hal::dacRun> hal::splitDacList(std::vector<int32_t> & parameter, size_t offset) {
+
+  std::vector<dacRun> runs;
+  size_t i = offset;
+  while(i < parameter.size()) {
+    dacRun run;
+    run.min = run.max = static_cast<uint8_t>(parameter.at(i));
+    run.step = 1;
+    run.n = 1;
+
+    // Extend the run as long as the values keep rising with the same step size:
+    if(i+1 < parameter.size() && parameter.at(i+1) > parameter.at(i)) {
+      run.step = static_cast<uint8_t>(parameter.at(i+1) - parameter.at(i));
+      while(i+run.n < parameter.size() && parameter.at(i+run.n) - parameter.at(i+run.n-1) == run.step) {
+	run.max = static_cast<uint8_t>(parameter.at(i+run.n));
+	run.n++;
+      }
+    }
+    runs.push_back(run);
+    i += run.n;
+  }
+  return runs;
+}
+
+std::vector<Event*> hal::GroupedPixelsLoop(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> & pixels, uint16_t flags, uint16_t nTriggers, std::vector<uint8_t> dacRegs, std::vector<std::vector<uint8_t> > & points) {
+
+  // Sort the pixels by double column, group n holds the n-th pixel of every
+  // double column. Hits within one group can be told apart by their address:
+  std::vector<std::vector<size_t> > groups;
+  std::vector<size_t> depth(ROC_NUMCOLS/2, 0);
+  for(size_t i = 0; i < pixels.size(); i++) {
+    size_t dcol = pixels.at(i).column/2;
+    if(depth.at(dcol) == groups.size()) { groups.push_back(std::vector<size_t>()); }
+    groups.at(depth.at(dcol)++).push_back(i);
+  }
+
+  bool unmasked = ((flags & FLAG_FORCE_UNMASKED) != 0);
+  bool useSensorPadForCalibration = ((flags & FLAG_CALS) != 0);
+  size_t perPixel = points.size()*nTriggers;
+  size_t expected = groups.size()*perPixel;
+
+  LOG(logDEBUGHAL) << "Pulsing " << pixels.size() << " pixels in " << groups.size() << " groups, "
+		   << points.size() << " DAC settings with " << nTriggers << " triggers each.";
+  LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
+
+  // Estimated number of DAQ words per group, same scheme as estimateDataVolume.
+  // Read out the DTB before the buffer fills up, keep a safety margin of one half:
+  uint32_t wordsPerHit = perPixel*roci2cs.size()*(tbmtype != 0x00 ? 6 : 2);
+  uint32_t wordsPerEvent = perPixel*roci2cs.size()*(tbmtype != 0x00 ? 3 : 1);
+  uint32_t wordsPending = 0;
+
+  // Prepare for data acquisition, only once for all groups:
+  daqStart(deser160phase,tbmtype);
+  timer t;
+
+  std::vector<Event*> readout = std::vector<Event*>();
+  readout.reserve(expected);
+  std::vector<Event*> tmpdata = std::vector<Event*>();
+
+  for(std::vector<std::vector<size_t> >::iterator group = groups.begin(); group != groups.end(); ++group) {
+
+    // Drain the DTB buffer if the next group might not fit anymore. The
+    // pattern generator triggers cannot be interrupted like the NIOS loops:
+    uint32_t words = wordsPerEvent + wordsPerHit*group->size();
+    if(wordsPending > 0 && wordsPending + words > DTB_SOURCE_BUFFER_SIZE/2) {
+      LOG(logDEBUGHAL) << "DAQ buffer filling up (" << t << "ms), reading " << daqBufferStatus() << " words...";
+      tmpdata = daqAllEvents();
+      LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+      readout.insert(readout.end(),tmpdata.begin(),tmpdata.end());
+      wordsPending = 0;
+    }
+
+    // Trim, enable and arm all pixels of the group on every ROC, with the
+    // trim values the NIOS loops would use:
+    for(std::vector<uint8_t>::iterator roc = roci2cs.begin(); roc != roci2cs.end(); ++roc) {
+      std::map<uint8_t, std::vector<uint8_t> >::iterator trims = _niosTrims.find(*roc);
+      _testboard->roc_I2cAddr(*roc);
+      for(std::vector<size_t>::iterator px = group->begin(); px != group->end(); ++px) {
+	pixelConfig & pix = pixels.at(*px);
+	if(!unmasked) {
+	  uint8_t trim = (trims != _niosTrims.end() ? trims->second.at(pix.column*ROC_NUMROWS + pix.row) : pix.trim);
+	  if(pix.mask || trim > 15) continue;
+	  _testboard->roc_Pix_Trim(pix.column, pix.row, trim);
+	  _testboard->roc_Col_Enable(pix.column, true);
+	}
+	_testboard->roc_Pix_Cal(pix.column, pix.row, useSensorPadForCalibration);
+      }
+    }
+
+    // Trigger the group for all DAC settings:
+    for(std::vector<std::vector<uint8_t> >::iterator point = points.begin(); point != points.end(); ++point) {
+      for(std::vector<uint8_t>::iterator roc = roci2cs.begin(); roc != roci2cs.end() && !dacRegs.empty(); ++roc) {
+	_testboard->roc_I2cAddr(*roc);
+	for(size_t dac = 0; dac < dacRegs.size(); dac++) { _testboard->roc_SetDAC(dacRegs.at(dac), point->at(dac)); }
+      }
+      _testboard->Pg_Triggers(nTriggers, _pgDelaySum);
+    }
+
+    // Disarm the group again, mask everything unless running unmasked:
+    for(std::vector<uint8_t>::iterator roc = roci2cs.begin(); roc != roci2cs.end(); ++roc) {
+      _testboard->roc_I2cAddr(*roc);
+      _testboard->roc_ClrCal();
+      if(!unmasked) { _testboard->roc_Chip_Mask(); }
+    }
+    _testboard->Flush();
+    wordsPending += words;
+  }
+
+  // Read the remaining data:
+  LOG(logDEBUGHAL) << "Groups finished (" << t << "ms), reading " << daqBufferStatus() << " words...";
+  tmpdata = daqAllEvents();
+  LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+  readout.insert(readout.end(),tmpdata.begin(),tmpdata.end());
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  readout.insert(readout.end(),tmpdata.begin(),tmpdata.end());
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << readout.size() << " events.";
+
+  // Clear & reset the DAQ buffer on the testboard.
+  daqClear();
+
+  // check for errors in readout (i.e. missing events)
+  int missing = expected - readout.size();
+  if(missing != 0) {
+    LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
+    // serious runtime issue as data is invalid and cannot be recovered at this point:
+    for(std::vector<Event*>::iterator evtit = readout.begin();evtit != readout.end(); evtit++){
+      // clean up (now garbage) events
+      delete *evtit;
+    }
+    throw DataMissingEvent("Incomplete DAQ data readout in function "+std::string(__func__),missing);
+  }
+
+  // Split every Event by pixel address into one Event per pixel of its group,
+  // stored in pixel by pixel order as delivered by the OnePixel loops:
+  std::vector<Event*> data(pixels.size()*perPixel, static_cast<Event*>(NULL));
+  for(size_t g = 0; g < groups.size(); g++) {
+    for(size_t i = 0; i < perPixel; i++) {
+      Event * evt = readout.at(g*perPixel + i);
+      for(std::vector<size_t>::iterator px = groups.at(g).begin(); px != groups.at(g).end(); ++px) {
+	Event * pxevt = new Event();
+	pxevt->header = evt->header;
+	pxevt->trailer = evt->trailer;
+	for(std::vector<pixel>::iterator hit = evt->pixels.begin(); hit != evt->pixels.end(); ++hit) {
+	  if(hit->getColumn() == pixels.at(*px).column && hit->getRow() == pixels.at(*px).row) { pxevt->pixels.push_back(*hit); }
+	}
+	data.at(*px*perPixel + i) = pxevt;
+      }
+      // Decoder errors cannot be assigned to a pixel, keep them with the first one:
+      data.at(groups.at(g).front()*perPixel + i)->numDecoderErrors = evt->numDecoderErrors;
+      delete evt;
+    }
+  }
+
+  return data;
+}
+
+std::vector<Event*> hal::AllPixelsDacListLoop(std::vector<uint8_t> roci2cs, bool multiroc, std::vector<int32_t> & parameter) {
+
+  uint8_t dacreg = static_cast<uint8_t>(parameter.at(0));
+  uint16_t flags = static_cast<uint16_t>(parameter.at(1));
+  uint16_t nTriggers = static_cast<uint16_t>(parameter.at(2));
+  std::vector<dacRun> runs = splitDacList(parameter, 3);
+  size_t npixels = ROC_NUMCOLS*ROC_NUMROWS;
+
+  // We expect one Event per listed DAC value per trigger per pixel:
+  int expected = (parameter.size() - 3)*nTriggers*npixels;
+
+  LOG(logDEBUGHAL) << "Called " << (multiroc ? "MultiRoc" : "SingleRoc") << "AllPixelsDacList with flags "
+		   << static_cast<int>(flags) << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Function will take care of all pixels on " << roci2cs.size() << " ROCs with the I2C addresses:";
+  LOG(logDEBUGHAL) << listVector(roci2cs);
+  LOG(logDEBUGHAL) << "Scanning DAC " << static_cast<int>(dacreg) << " over " << (parameter.size() - 3)
+		   << " values in " << runs.size() << " loops";
+  LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
+  estimateDataVolume(expected, roci2cs.size(), tbmtype);
+
+  // Prepare for data acquisition, only once for all DAC values:
+  daqStart(deser160phase,tbmtype);
+  timer t;
+
+  std::vector<Event*> data = std::vector<Event*>();
+  data.reserve(expected);
+  std::vector<Event*> tmpdata = std::vector<Event*>();
+
+  // Call the RPC command containing the trigger loop for every run of DAC values:
+  for(std::vector<dacRun>::iterator run = runs.begin(); run != runs.end(); ++run) {
+    bool done = false;
+    while(!done) {
+      if(multiroc) done = _testboard->LoopMultiRocAllPixelsDacScan(roci2cs, nTriggers, flags, dacreg, run->step, run->min, run->max);
+      else done = _testboard->LoopSingleRocAllPixelsDacScan(roci2cs.front(), nTriggers, flags, dacreg, run->step, run->min, run->max);
+      LOG(logDEBUGHAL) << "Loop " << (done ? "finished" : "interrupted") << " (" << t << "ms), reading " << daqBufferStatus() << " words...";
+      tmpdata = daqAllEvents();
+      LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+      data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+    }
+  }
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+
+  // Clear & reset the DAQ buffer on the testboard.
+  daqClear();
+
+  // check for errors in readout (i.e. missing events)
+  int missing = expected - data.size();
+  if(missing != 0) {
+    LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
+    // serious runtime issue as data is invalid and cannot be recovered at this point:
+    for(std::vector<Event*>::iterator evtit = data.begin();evtit != data.end(); evtit++){
+      // clean up (now garbage) events
+      delete *evtit;
+    }
+    throw DataMissingEvent("Incomplete DAQ data readout in function "+std::string(__func__),missing);
+  }
+
+  // Every loop ran over all pixels, bring the Events into pixel by pixel order
+  // with the DAC values of all runs in a row:
+  if(runs.size() > 1) {
+    std::vector<Event*> sorted;
+    sorted.reserve(data.size());
+    for(size_t px = 0; px < npixels; px++) {
+      size_t offset = 0;
+      for(std::vector<dacRun>::iterator run = runs.begin(); run != runs.end(); ++run) {
+	size_t perPixel = run->n*nTriggers;
+	std::vector<Event*>::iterator first = data.begin() + offset + px*perPixel;
+	sorted.insert(sorted.end(), first, first + perPixel);
+	offset += perPixel*npixels;
+      }
+    }
+    data.swap(sorted);
+  }
+
+  return data;
+}
+
+std::vector<Event*> hal::SelectedPixelsLoop(pixelLoopType looptype, std::vector<uint8_t> roci2cs, bool multiroc, std::vector<pixelConfig> & pixels, std::vector<int32_t> & parameter) {
+
+  // Unpack the parameters in the same layout as the OnePixel functions:
+  uint16_t flags = 0, nTriggers = 0;
+  uint8_t dac1reg = 0, dac1min = 0, dac1max = 0, dac1step = 1;
+  uint8_t dac2reg = 0, dac2min = 0, dac2max = 0, dac2step = 1;
+  size_t perPixel = 0;
+  std::vector<dacRun> runs;
+
+  if(looptype == LOOP_CALIBRATE) {
+    flags = static_cast<uint16_t>(parameter.at(0));
+    nTriggers = static_cast<uint16_t>(parameter.at(1));
+    // We expect one Event per trigger:
+    perPixel = nTriggers;
+  }
+  else if(looptype == LOOP_DACSCAN) {
+    dac1reg = static_cast<uint8_t>(parameter.at(0));
+    dac1min = static_cast<uint8_t>(parameter.at(1));
+    dac1max = static_cast<uint8_t>(parameter.at(2));
+    flags = static_cast<uint16_t>(parameter.at(3));
+    nTriggers = static_cast<uint16_t>(parameter.at(4));
+    dac1step = static_cast<uint8_t>(parameter.at(5));
+    // We expect one Event per DAC value per trigger:
+    perPixel = static_cast<size_t>((dac1max-dac1min)/dac1step+1)*nTriggers;
+  }
+  else if(looptype == LOOP_DACLIST) {
+    dac1reg = static_cast<uint8_t>(parameter.at(0));
+    flags = static_cast<uint16_t>(parameter.at(1));
+    nTriggers = static_cast<uint16_t>(parameter.at(2));
+    runs = splitDacList(parameter, 3);
+    // We expect one Event per listed DAC value per trigger:
+    perPixel = (parameter.size() - 3)*nTriggers;
+  }
+  else {
+    dac1reg = static_cast<uint8_t>(parameter.at(0));
+    dac1min = static_cast<uint8_t>(parameter.at(1));
+    dac1max = static_cast<uint8_t>(parameter.at(2));
+    dac2reg = static_cast<uint8_t>(parameter.at(3));
+    dac2min = static_cast<uint8_t>(parameter.at(4));
+    dac2max = static_cast<uint8_t>(parameter.at(5));
+    flags = static_cast<uint16_t>(parameter.at(6));
+    nTriggers = static_cast<uint16_t>(parameter.at(7));
+    dac1step = static_cast<uint8_t>(parameter.at(8));
+    dac2step = static_cast<uint8_t>(parameter.at(9));
+    // We expect one Event per DAC1 value per DAC2 value per trigger:
+    perPixel = static_cast<size_t>((dac1max-dac1min)/dac1step+1)*static_cast<size_t>((dac2max-dac2min)/dac2step+1)*nTriggers;
+  }
+
+  int expected = perPixel*pixels.size();
+
+  LOG(logDEBUGHAL) << "Called " << (multiroc ? "MultiRoc" : "SingleRoc") << "SelectedPixels loop with flags "
+		   << static_cast<int>(flags) << ", running " << nTriggers << " triggers on "
+		   << pixels.size() << " pixels.";
+  LOG(logDEBUGHAL) << "Function will take care of " << roci2cs.size() << " ROCs with the I2C addresses:";
+  LOG(logDEBUGHAL) << listVector(roci2cs);
+  LOG(logDEBUGHAL) << "Expecting " << expected << " events.";
+  estimateDataVolume(expected, roci2cs.size(), tbmtype);
+
+  // Pulse the pixels in groups of one pixel per double column if requested,
+  // with the DAC values of all points the OnePixel loops would scan. The
+  // DACs are written from here without the NIOS lookup table, so DAC scans
+  // are only grouped if the lookup is disabled anyway. Demultiplexing by
+  // address would hide the pixel address errors FLAG_CHECK_ORDER looks for:
+  bool groupable = (looptype == LOOP_CALIBRATE || (flags & FLAG_DISABLE_DACCAL) != 0)
+    && (flags & FLAG_XTALK) == 0 && (flags & FLAG_CHECK_ORDER) == 0;
+  if((flags & FLAG_GROUP_PIXELS) != 0 && !groupable) {
+    LOG(logDEBUGHAL) << "Pixel grouping not applicable for these flags, pulsing pixel by pixel.";
+  }
+  if((flags & FLAG_GROUP_PIXELS) != 0 && groupable) {
+    std::vector<uint8_t> dacRegs;
+    std::vector<std::vector<uint8_t> > points;
+    if(looptype == LOOP_CALIBRATE) { points.push_back(std::vector<uint8_t>()); }
+    else if(looptype == LOOP_DACSCAN) {
+      dacRegs.push_back(dac1reg);
+      for(int dac1 = dac1min; dac1 <= dac1max; dac1 += dac1step) { points.push_back(std::vector<uint8_t>(1,static_cast<uint8_t>(dac1))); }
+    }
+    else if(looptype == LOOP_DACLIST) {
+      dacRegs.push_back(dac1reg);
+      for(size_t i = 3; i < parameter.size(); i++) { points.push_back(std::vector<uint8_t>(1,static_cast<uint8_t>(parameter.at(i)))); }
+    }
+    else {
+      dacRegs.push_back(dac1reg);
+      dacRegs.push_back(dac2reg);
+      for(int dac1 = dac1min; dac1 <= dac1max; dac1 += dac1step) {
+	for(int dac2 = dac2min; dac2 <= dac2max; dac2 += dac2step) {
+	  std::vector<uint8_t> point;
+	  point.push_back(static_cast<uint8_t>(dac1));
+	  point.push_back(static_cast<uint8_t>(dac2));
+	  points.push_back(point);
+	}
+      }
+    }
+    return GroupedPixelsLoop(roci2cs, pixels, flags, nTriggers, dacRegs, points);
+  }
+
+  // Estimated number of DAQ words per pixel, same scheme as estimateDataVolume.
+  // Read out the DTB before the buffer fills up, keep a safety margin of one half:
+  uint32_t wordsPerPixel = perPixel*roci2cs.size()*(tbmtype != 0x00 ? (3+6) : (1+2));
+  uint32_t wordsPending = 0;
+
+  // Prepare for data acquisition, only once for all pixels:
+  daqStart(deser160phase,tbmtype);
+  timer t;
+
+  std::vector<Event*> data = std::vector<Event*>();
+  data.reserve(expected);
+  std::vector<Event*> tmpdata = std::vector<Event*>();
+
+  for(std::vector<pixelConfig>::iterator px = pixels.begin(); px != pixels.end(); ++px) {
+
+    // Drain the DTB buffer if the next pixel might not fit anymore:
+    if(wordsPending > 0 && wordsPending + wordsPerPixel > DTB_SOURCE_BUFFER_SIZE/2) {
+      LOG(logDEBUGHAL) << "DAQ buffer filling up (" << t << "ms), reading " << daqBufferStatus() << " words...";
+      tmpdata = daqAllEvents();
+      LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+      data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+      wordsPending = 0;
+    }
+
+    // Call the RPC command containing the trigger loop for this pixel,
+    // one loop per run of DAC values for DAC lists:
+    for(size_t run = 0; run < (looptype == LOOP_DACLIST ? runs.size() : 1); run++) {
+      bool done = false;
+      while(!done) {
+	if(looptype == LOOP_CALIBRATE) {
+	  if(multiroc) done = _testboard->LoopMultiRocOnePixelCalibrate(roci2cs, px->column, px->row, nTriggers, flags);
+	  else done = _testboard->LoopSingleRocOnePixelCalibrate(roci2cs.front(), px->column, px->row, nTriggers, flags);
+	}
+	else if(looptype == LOOP_DACSCAN) {
+	  if(multiroc) done = _testboard->LoopMultiRocOnePixelDacScan(roci2cs, px->column, px->row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max);
+	  else done = _testboard->LoopSingleRocOnePixelDacScan(roci2cs.front(), px->column, px->row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max);
+	}
+	else if(looptype == LOOP_DACLIST) {
+	  if(multiroc) done = _testboard->LoopMultiRocOnePixelDacScan(roci2cs, px->column, px->row, nTriggers, flags, dac1reg, runs.at(run).step, runs.at(run).min, runs.at(run).max);
+	  else done = _testboard->LoopSingleRocOnePixelDacScan(roci2cs.front(), px->column, px->row, nTriggers, flags, dac1reg, runs.at(run).step, runs.at(run).min, runs.at(run).max);
+	}
+	else {
+	  if(multiroc) done = _testboard->LoopMultiRocOnePixelDacDacScan(roci2cs, px->column, px->row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
+	  else done = _testboard->LoopSingleRocOnePixelDacDacScan(roci2cs.front(), px->column, px->row, nTriggers, flags, dac1reg, dac1step, dac1min, dac1max, dac2reg, dac2step, dac2min, dac2max);
+	}
+
+	// The DTB interrupted the loop because its buffer is full, read out before resuming:
+	if(!done) {
+	  LOG(logDEBUGHAL) << "Loop interrupted (" << t << "ms), reading " << daqBufferStatus() << " words...";
+	  tmpdata = daqAllEvents();
+	  LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+	  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+	  wordsPending = 0;
+	}
+      }
+    }
+    wordsPending += wordsPerPixel;
+  }
+
+  // Read the remaining data:
+  LOG(logDEBUGHAL) << "Loops finished (" << t << "ms), reading " << daqBufferStatus() << " words...";
+  tmpdata = daqAllEvents();
+  LOG(logDEBUGHAL) << tmpdata.size() << " events read (" << t << "ms).";
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+
+  // Stop the DAQ and flush the Events still waiting for data from other channels:
+  daqStop();
+  tmpdata = daqAllEvents();
+  data.insert(data.end(),tmpdata.begin(),tmpdata.end());
+  LOG(logDEBUGHAL) << "Loop done after " << t << "ms. Readout size: " << data.size() << " events.";
+
+  // Clear & reset the DAQ buffer on the testboard.
+  daqClear();
+
+  // check for errors in readout (i.e. missing events)
+  int missing = expected - data.size();
+  if(missing != 0) {
+    LOG(logCRITICAL) << "Incomplete DAQ data readout! Missing " << missing << " Events.";
+    // serious runtime issue as data is invalid and cannot be recovered at this point:
+    for(std::vector<Event*>::iterator evtit = data.begin();evtit != data.end(); evtit++){
+      // clean up (now garbage) events
+      delete *evtit;
+    }
+    throw DataMissingEvent("Incomplete DAQ data readout in function "+std::string(__func__),missing);
+  }
+
+  return data;
+}
+
 // Testboard power switches:
 
 void hal::HVon() {
@@ -1435,7 +2169,7 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
   uint32_t allocated_buffer_ch0 = _testboard->Daq_Open(buffersize,0);
   LOG(logDEBUGHAL) << "Allocated buffer size, Channel 0: " << allocated_buffer_ch0;
   src0 = dtbSource(_testboard,0,(tbmtype != 0x00),rocType,true);
-  src0 >> splitter0;
+  pipe0.Connect(&src0,(tbmtype != 0x00),rocType,0);
 
   _testboard->uDelay(100);
 
@@ -1445,7 +2179,7 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
     uint32_t allocated_buffer_ch1 = _testboard->Daq_Open(buffersize,1);
     LOG(logDEBUGHAL) << "Allocated buffer size, Channel 1: " << allocated_buffer_ch1;
     src1 = dtbSource(_testboard,1,(tbmtype != 0x00),rocType,true);
-    src1 >> splitter1;
+    pipe1.Connect(&src1,(tbmtype != 0x00),rocType,1);
 
     // For Dual-link TBMs (2x400MHz) we need even more DAQ channels:
     if(tbmtype >= TBM_09) {
@@ -1454,14 +2188,21 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
       uint32_t allocated_buffer_ch2 = _testboard->Daq_Open(buffersize,2);
       LOG(logDEBUGHAL) << "Allocated buffer size, Channel 2: " << allocated_buffer_ch2;
       src2 = dtbSource(_testboard,2,(tbmtype != 0x00),rocType,true);
-      src2 >> splitter2;
+      pipe2.Connect(&src2,(tbmtype != 0x00),rocType,2);
 
       uint32_t allocated_buffer_ch3 = _testboard->Daq_Open(buffersize,3);
       LOG(logDEBUGHAL) << "Allocated buffer size, Channel 3: " << allocated_buffer_ch3;
       src3 = dtbSource(_testboard,3,(tbmtype != 0x00),rocType,true);
-      src3 >> splitter3;
+      pipe3.Connect(&src3,(tbmtype != 0x00),rocType,3);
     }
 
+    // Align the Events of all channels by their TBM Event counters:
+    std::vector<dtbPipeline<dtbSource>*> pipes;
+    pipes.push_back(&pipe0);
+    pipes.push_back(&pipe1);
+    if(tbmtype >= TBM_09) { pipes.push_back(&pipe2); pipes.push_back(&pipe3); }
+    aligner.Connect(pipes);
+
     // Reset the Deserializer 400, re-synchronize:
     _testboard->Daq_Deser400_Reset(3);
 
@@ -1481,6 +2222,7 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
     LOG(logDEBUGHAL) << "Enabling Deserializer160 for data acquisition."
 		     << " Phase: " << static_cast<int>(deser160phase);
     _testboard->Daq_Select_Deser160(deser160phase);
+    aligner.Connect(std::vector<dtbPipeline<dtbSource>*>(1, &pipe0));
   }
 
   _testboard->Daq_Start(0);
@@ -1488,152 +2230,128 @@ void hal::daqStart(uint8_t deser160phase, uint8_t tbmtype, uint32_t buffersize)
   _testboard->Flush();
 }
 
-Event* hal::daqEvent() {
+bool hal::daqEvent(Event & evt) {
 
-  Event* current_Event = new Event();
-
-  dataSink<Event*> Eventpump0, Eventpump1, Eventpump2, Eventpump3;
-  splitter0 >> decoder0 >> Eventpump0;
-
-  if(src1.isConnected()) { splitter1 >> decoder1 >> Eventpump1; }
-  if(src2.isConnected()) { splitter2 >> decoder2 >> Eventpump2; }
-  if(src3.isConnected()) { splitter3 >> decoder3 >> Eventpump3; }
-
-  // FIXME check carefully: in principle we expect the same number of triggers
-  // (==Events) on each pipe. Throw a critical if difference is found?
-  try {
-    // Read the next Event from each of the pipes, copy the data:
-    *current_Event = *Eventpump0.Get();
-    if(src1.isConnected()) {
-      Event* tmp = Eventpump1.Get(); 
-      current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-    }
-    if(src2.isConnected()) {
-      Event* tmp = Eventpump2.Get(); 
-      current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-    }
-    if(src3.isConnected()) {
-      Event* tmp = Eventpump3.Get(); 
-      current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-    }
-  }
-  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
-  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+  // Merge the next Event of all channels, resynchronizing them if necessary:
+  try { if(aligner.GetEvent(evt)) return true; }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); return false; }
 
-  return current_Event;
+  LOG(logDEBUGHAL) << "Finished readout.";
+  return false;
 }
 
 std::vector<Event*> hal::daqAllEvents() {
 
-  std::vector<Event*> evt;
-
-  dataSink<Event*> Eventpump0, Eventpump1, Eventpump2, Eventpump3;
-  splitter0 >> decoder0 >> Eventpump0;
-
-  if(src1.isConnected()) { splitter1 >> decoder1 >> Eventpump1; }
-  if(src2.isConnected()) { splitter2 >> decoder2 >> Eventpump2; }
-  if(src3.isConnected()) { splitter3 >> decoder3 >> Eventpump3; }
+  std::vector<Event> data;
+  daqAllEvents(data);
 
-  // FIXME check carefully: in principle we expect the same number of triggers
-  // (==Events) on each pipe. Throw a critical if difference is found?
-  try {
-    while(1) {
-      // Read the next Event from each of the pipes:
-      Event* current_Event = new Event(*Eventpump0.Get());
-      if(src1.isConnected()) {
-	Event* tmp = Eventpump1.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      if(src2.isConnected()) {
-	Event* tmp = Eventpump2.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      if(src3.isConnected()) {
-	Event* tmp = Eventpump3.Get(); 
-	current_Event->pixels.insert(current_Event->pixels.end(), tmp->pixels.begin(), tmp->pixels.end());
-      }
-      evt.push_back(current_Event);
-    }
+  // Hand out the merged Events, moving their pixel data:
+  std::vector<Event*> evt;
+  evt.reserve(data.size());
+  for(std::vector<Event>::iterator it = data.begin(); it != data.end(); ++it) {
+    Event* current_Event = new Event();
+    current_Event->header = it->header;
+    current_Event->trailer = it->trailer;
+    current_Event->numDecoderErrors = it->numDecoderErrors;
+    current_Event->pixels.swap(it->pixels);
+    evt.push_back(current_Event);
   }
-  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
-  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
-
   return evt;
 }
 
-rawEvent* hal::daqRawEvent() {
+void hal::daqAllEvents(std::vector<Event> & data) {
 
-  rawEvent* current_Event = new rawEvent();
+  alignmentStatistics & stats = aligner.GetStatistics();
+  uint32_t resyncs = stats.resyncs, incomplete = stats.incomplete;
 
-  dataSink<rawEvent*> rawpump0, rawpump1, rawpump2, rawpump3;
-  splitter0 >> rawpump0;
+  // Fetch all Events of all channels and merge the complete ones:
+  try { aligner.GetAllEvents(data); }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+  LOG(logDEBUGHAL) << "Finished readout.";
 
-  if(src1.isConnected()) { splitter1 >> rawpump1; }
-  if(src2.isConnected()) { splitter2 >> rawpump2; }
-  if(src3.isConnected()) { splitter3 >> rawpump3; }
+  if(stats.resyncs != resyncs) {
+    LOG(logWARNING) << "DAQ channels out of sync, resynchronized " << (stats.resyncs - resyncs) << " Events.";
+    LOG(logDEBUGHAL) << stats;
+  }
+  if(stats.incomplete != incomplete) {
+    LOG(logWARNING) << "DAQ readout finished with " << (stats.incomplete - incomplete) << " Events missing data from other channels.";
+    LOG(logDEBUGHAL) << stats;
+  }
+}
+
+bool hal::daqRawEvent(rawEvent & evt) {
 
   // FIXME check carefully: in principle we expect the same number of triggers
   // (==Events) on each pipe. Throw a critical if difference is found?
   try {
     // Read the next Event from each of the pipes, copy the data:
-    *current_Event = *rawpump0.Get();
+    evt = *pipe0.GetRawEvent();
     if(src1.isConnected()) {
-      rawEvent tmp = *rawpump1.Get();
-      for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+      rawEvent* tmp = pipe1.GetRawEvent();
+      evt.data.insert(evt.data.end(), tmp->data.begin(), tmp->data.end());
     }
     if(src2.isConnected()) {
-      rawEvent tmp = *rawpump2.Get();
-      for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+      rawEvent* tmp = pipe2.GetRawEvent();
+      evt.data.insert(evt.data.end(), tmp->data.begin(), tmp->data.end());
     }
     if(src3.isConnected()) {
-      rawEvent tmp = *rawpump3.Get();
-      for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+      rawEvent* tmp = pipe3.GetRawEvent();
+      evt.data.insert(evt.data.end(), tmp->data.begin(), tmp->data.end());
     }
   }
-  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
-  catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
+  catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; return false; }
+  catch (dataPipeException &e) { LOG(logERROR) << e.what(); return false; }
 
-  return current_Event;
+  return true;
 }
 
 std::vector<rawEvent*> hal::daqAllRawEvents() {
 
   std::vector<rawEvent*> raw;
-
-  dataSink<rawEvent*> rawpump0, rawpump1, rawpump2, rawpump3;
-  splitter0 >> rawpump0;
-
-  if(src1.isConnected()) { splitter1 >> rawpump1; }
-  if(src2.isConnected()) { splitter2 >> rawpump2; }
-  if(src3.isConnected()) { splitter3 >> rawpump3; }
+  rawEvent* current_Event = NULL;
 
   // FIXME check carefully: in principle we expect the same number of triggers
   // (==Events) on each pipe. Throw a critical if difference is found?
   try {
     while(1) {
       // Read the next Event from each of the pipes:
-      rawEvent* current_Event = new rawEvent(*rawpump0.Get());
+      current_Event = new rawEvent(*pipe0.GetRawEvent());
       if(src1.isConnected()) {
-	rawEvent tmp = *rawpump1.Get();
-	for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+	rawEvent* tmp = pipe1.GetRawEvent();
+	current_Event->data.insert(current_Event->data.end(), tmp->data.begin(), tmp->data.end());
       }
       if(src2.isConnected()) {
-	rawEvent tmp = *rawpump2.Get();
-	for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+	rawEvent* tmp = pipe2.GetRawEvent();
+	current_Event->data.insert(current_Event->data.end(), tmp->data.begin(), tmp->data.end());
       }
       if(src3.isConnected()) {
-	rawEvent tmp = *rawpump3.Get();
-	for(size_t record = 0; record < tmp.GetSize(); record++) { current_Event->Add(tmp[record]); }
+	rawEvent* tmp = pipe3.GetRawEvent();
+	current_Event->data.insert(current_Event->data.end(), tmp->data.begin(), tmp->data.end());
       }
       raw.push_back(current_Event);
+      current_Event = NULL;
     }
   }
   catch (dsBufferEmpty &) { LOG(logDEBUGHAL) << "Finished readout."; }
   catch (dataPipeException &e) { LOG(logERROR) << e.what(); }
 
+  // Drop the incomplete Event if one of the later pipes ran empty:
+  delete current_Event;
   return raw;
 }
 
+void hal::daqAllRawEvents(std::vector<rawEvent> & data) {
+
+  // Read each Event in place, the last slot is unused when the buffer is empty:
+  while(1) {
+    data.push_back(rawEvent());
+    if(!daqRawEvent(data.back())) {
+      data.pop_back();
+      break;
+    }
+  }
+}
+
 std::vector<uint16_t> hal::daqBuffer() {
 
   std::vector<uint16_t> raw;
@@ -1711,6 +2429,9 @@ void hal::daqStop() {
   _testboard->uDelay(100);
   _testboard->Flush();
 
+  // No more Events will arrive, the aligner may flush incomplete ones:
+  aligner.Finish();
+
   LOG(logDEBUGHAL) << "Stopped DAQ session.";
 }
 
@@ -1721,8 +2442,17 @@ void hal::daqClear() {
   src1 = dtbSource();
   src2 = dtbSource();
   src3 = dtbSource();
+  pipe0.Disconnect();
+  pipe1.Disconnect();
+  pipe2.Disconnect();
+  pipe3.Disconnect();
+  aligner.Disconnect();
 
   // Running Daq_Close() to delete all data and free allocated RAM:
   LOG(logDEBUGHAL) << "Closing DAQ session, deleting data buffers.";
   for(uint8_t channel = 0; channel < 8; channel++) { _testboard->Daq_Close(channel); }
 }
+
+alignmentStatistics hal::daqAlignmentStatistics() {
+  return aligner.GetStatistics();
+}
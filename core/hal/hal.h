@@ -8,6 +8,8 @@
 
 namespace pxar {
 
+  class dtbEmulator;
+
   class hal
   {
 
@@ -15,6 +17,8 @@ namespace pxar {
     /** Default constructor for cerating a new HAL instance. Takes
      *  a testboard USB ID name as parameter and tries to connect to
      *  the board. Exception is thrown if connection fails.
+     *  The name "emulator[:latency_us[:bandwidth_Bps]]" connects to an
+     *  in-process DTB emulation instead of a board.
      */
     hal(std::string name = "*");
 
@@ -127,6 +131,15 @@ namespace pxar {
      */
     double getTBvd();
 
+    /** Sweep DAC dacId of the ROC with I2C address roci2c through the given
+     *  values and read the analog and digital currents (in A) after each
+     *  step. All commands are pipelined, waiting settle_us microseconds on
+     *  the DTB before reading. If "repeat" is set, the currents are read a
+     *  second time after another settle_us, returning two readings per
+     *  DAC value. The DAC is left at the last value of the sweep.
+     */
+    std::vector< std::pair<double,double> > rocCurrentVsDAC(uint8_t roci2c, uint8_t dacId, std::vector<uint8_t> values, uint32_t settle_us, bool repeat);
+
 
     // Testboard probe channel commands:
     /** Selects "signal" as output for the DTB probe channel D1 (digital) 
@@ -238,6 +251,33 @@ namespace pxar {
      */
     std::vector<Event*> SingleRocOnePixelDacDacScan(uint8_t roci2c, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
 
+    /** Batched versions of the OnePixel test functions above for a list of selected pixels.
+     *  All pixels are handled within one DAQ session: the trigger loops are issued back-to-back
+     *  and the DTB is only read out when a loop was interrupted, when the buffer is about to
+     *  fill up, or at the very end. The returned Events are ordered pixel by pixel, identical
+     *  to calling the respective OnePixel function once for every pixel.
+     */
+    std::vector<Event*> MultiRocSelectedPixelsCalibrate(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocSelectedPixelsCalibrate(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> MultiRocSelectedPixelsDacScan(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocSelectedPixelsDacScan(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> MultiRocSelectedPixelsDacDacScan(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocSelectedPixelsDacDacScan(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+
+    /** Functions to scan a given DAC over an explicit list of values, e.g. a set of
+     *  non-uniform calibration points, within a single DAQ session. The parameter vector
+     *  holds the DAC register, the flags, the number of triggers and then the DAC values.
+     *  Ascending values with constant spacing are combined into one DTB trigger loop.
+     *  The returned Events are ordered pixel by pixel and, per pixel, in the order of the
+     *  DAC value list - the same layout as for the corresponding DacScan functions.
+     */
+    std::vector<Event*> MultiRocAllPixelsDacList(std::vector<uint8_t> roci2cs, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocAllPixelsDacList(uint8_t roci2c, std::vector<int32_t> parameter);
+    std::vector<Event*> MultiRocOnePixelDacList(std::vector<uint8_t> roci2cs, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocOnePixelDacList(uint8_t roci2c, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
+    std::vector<Event*> MultiRocSelectedPixelsDacList(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+    std::vector<Event*> SingleRocSelectedPixelsDacList(uint8_t roci2c, std::vector<pixelConfig> pixels, std::vector<int32_t> parameter);
+
 
     // DAQ functions:
     /** Starting a new data acquisition session
@@ -257,7 +297,8 @@ namespace pxar {
     void daqTriggerLoopHalt();
 
     /** Stopping the current DAQ session. This is not resetting the data buffers.
-     *  All DAQ channels are stopped.
+     *  All DAQ channels are stopped. Events still incomplete on some channels
+     *  are delivered by the next readout with the missing channel data left out.
      */
     void daqStop();
 
@@ -273,22 +314,45 @@ namespace pxar {
      */
     std::vector<rawEvent*> daqAllRawEvents();
 
-    /** Read the next decoded Event from the FIFO buffer
+    /** Read the next decoded Event from the FIFO buffer into evt. The
+     *  pipelines stay connected for the whole DAQ session and evt is
+     *  overwritten in place, so a reused Event costs no allocations.
+     *  The Events of all channels are aligned by their TBM Event counters.
+     *  Returns false if no complete Event could be read.
      */
-    Event* daqEvent();
+    bool daqEvent(Event & evt);
 
-    /** Read the next raw (undecoded) Event from the FIFO buffer
+    /** Read the next raw (undecoded) Event from the FIFO buffer into evt,
+     *  same semantics as daqEvent()
      */
-    rawEvent* daqRawEvent();
+    bool daqRawEvent(rawEvent & evt);
 
     /** Read all remaining decoded Events from the FIFO buffer
      */
     std::vector<Event*> daqAllEvents();
 
+    /** Read all remaining decoded Events from the FIFO buffer and append
+     *  them to data. The pixel data is moved into the output vector, no
+     *  further copies are made. Events not yet complete on all channels
+     *  stay buffered for the next call until the DAQ has been stopped.
+     */
+    void daqAllEvents(std::vector<Event> & data);
+
+    /** Read all remaining raw Events from the FIFO buffer and append them
+     *  to data, same semantics as daqAllEvents(std::vector<Event>&)
+     */
+    void daqAllRawEvents(std::vector<rawEvent> & data);
+
     /** Clears the DAQ buffer on the DTB, deletes all previously taken and not yet read out data!
      */
     void daqClear();
 
+    /** Returns the Event alignment statistics of the DAQ channels since the
+     *  last daqStart(): Events read, TBM trailer errors, and Events dropped
+     *  or incomplete because the TBM Event counters of the channels differed.
+     */
+    alignmentStatistics daqAlignmentStatistics();
+
 
     // Functions to access NIOS storage of trim values:
 
@@ -311,6 +375,11 @@ namespace pxar {
      */
     void PixelSetCalibrate(uint8_t roci2c, uint8_t column, uint8_t row, uint16_t flags);
 
+    /** Set the Calibrate bit and CALS setting of all enabled pixels of one
+     *  ROC. The ROC is addressed only once, duplicate pixels are dropped.
+     */
+    void RocSetCalibrate(uint8_t roci2c, std::vector<pixelConfig> pixels, uint16_t flags);
+
     /** Reset all Calibrate bits and clear the ROC I2C address:
      */
     void RocClearCalibrate(uint8_t roci2c);
@@ -326,6 +395,11 @@ namespace pxar {
      */
     CTestboard * _testboard;
 
+    /** DTB emulation the testboard RPC interface is connected to instead
+     *  of USB, NULL when running with a real board
+     */
+    dtbEmulator * _emulator;
+
     /** Initialization status of the HAL instance, marks the "ready for
      *  operations" status
      */
@@ -342,6 +416,14 @@ namespace pxar {
     uint8_t rocType;
     uint8_t hubId;
 
+    /** Sum of the Pattern Generator delays, minimum trigger period
+     */
+    uint16_t _pgDelaySum;
+
+    /** Trim values (>15: masked) last written to the NIOS storage, per ROC I2C address
+     */
+    std::map<uint8_t, std::vector<uint8_t> > _niosTrims;
+
     /** Print the info block with software and firmware versions,
      *  MAC and USB ids etc. read from the connected testboard
      */
@@ -352,6 +434,34 @@ namespace pxar {
      */
     bool CheckCompatibility();
 
+    /** Name of the file caching the resolved RPC call ids for the given
+     *  pair of DTB and host command list hashes. Empty if no home directory
+     *  is available to store it.
+     */
+    std::string RpcCallIdCacheFile(uint32_t dtbCmdHash, uint32_t hostCmdHash);
+
+    /** Load the RPC call ids from the cache file, returns false if there
+     *  is no valid cache for this firmware/host combination
+     */
+    bool LoadRpcCallIds(uint32_t dtbCmdHash, uint32_t hostCmdHash);
+
+    /** Store the currently resolved RPC call ids in the cache file
+     */
+    void StoreRpcCallIds(uint32_t dtbCmdHash, uint32_t hostCmdHash);
+
+    /** Resolved DTB call id of the host RPC function callName, given
+     *  without its signature (e.g. "_GetIA")
+     */
+    uint16_t RpcCallId(std::string callName);
+
+    /** Split-phase RPC calls without parameters returning an uint16_t:
+     *  the requests are only queued, the answers are collected in the same
+     *  order after a single Flush(). Allows to pipeline many calls like
+     *  _GetIA/_GetID in one USB round trip.
+     */
+    void RpcSendRequest(uint16_t callId);
+    uint16_t RpcReceiveUINT16(uint16_t callId);
+
     /** Find attached USB devices that match the DTB naming scheme.
      *
      *  If usbId = "*" check for all attached devices and list them,
@@ -365,6 +475,41 @@ namespace pxar {
      */
     void estimateDataVolume(uint32_t events, uint8_t nROCs, uint8_t nTBMs);
 
+    /** Trigger loop types handled by the batched SelectedPixels functions
+     */
+    enum pixelLoopType { LOOP_CALIBRATE, LOOP_DACSCAN, LOOP_DACDACSCAN, LOOP_DACLIST };
+
+    /** Internal worker for the batched SelectedPixels functions, runs the
+     *  requested trigger loop for all pixels within a single DAQ session.
+     */
+    std::vector<Event*> SelectedPixelsLoop(pixelLoopType looptype, std::vector<uint8_t> roci2cs, bool multiroc, std::vector<pixelConfig> & pixels, std::vector<int32_t> & parameter);
+
+    /** Internal worker for the SelectedPixels functions with FLAG_GROUP_PIXELS:
+     *  pulses the pixels in groups of one pixel per double column, with the
+     *  DACs set to each of the given points (values for the registers in
+     *  dacRegs) and nTriggers pattern generator triggers per point. The hits
+     *  are split by pixel address into the same per-pixel Event sequence the
+     *  OnePixel loops deliver.
+     */
+    std::vector<Event*> GroupedPixelsLoop(std::vector<uint8_t> roci2cs, std::vector<pixelConfig> & pixels, uint16_t flags, uint16_t nTriggers, std::vector<uint8_t> dacRegs, std::vector<std::vector<uint8_t> > & points);
+
+    /** Internal worker for the AllPixels DacList functions, runs one trigger
+     *  loop per run of DAC values within a single DAQ session.
+     */
+    std::vector<Event*> AllPixelsDacListLoop(std::vector<uint8_t> roci2cs, bool multiroc, std::vector<int32_t> & parameter);
+
+    /** Ascending run of DAC values with constant step size, covered by
+     *  one DTB DacScan trigger loop
+     */
+    struct dacRun {
+      uint8_t min, max, step;
+      size_t n;
+    };
+
+    /** Split the DAC value list starting at parameter[offset] into runs
+     */
+    static std::vector<dacRun> splitDacList(std::vector<int32_t> & parameter, size_t offset);
+
     // TESTBOARD SET COMMANDS
     /** Set the testboard analog current limit
      */
@@ -400,15 +545,14 @@ namespace pxar {
     dtbSource src2;
     dtbSource src3;
 
-    dtbEventSplitter splitter0;
-    dtbEventSplitter splitter1;
-    dtbEventSplitter splitter2;
-    dtbEventSplitter splitter3;
+    // Splitting and decoding pipelines reading from the sources above:
+    dtbPipeline<dtbSource> pipe0;
+    dtbPipeline<dtbSource> pipe1;
+    dtbPipeline<dtbSource> pipe2;
+    dtbPipeline<dtbSource> pipe3;
 
-    dtbEventDecoder decoder0;
-    dtbEventDecoder decoder1;
-    dtbEventDecoder decoder2;
-    dtbEventDecoder decoder3;
+    // Event alignment and merging of the pipelines of all connected channels:
+    dtbEventAligner<dtbPipeline<dtbSource> > aligner;
 
   };
 }
@@ -15,39 +15,35 @@ void rpcMessage::Create(uint16_t cmd)
 
 void rpcMessage::Send(CRpcIo &rpc_io)
 {
-	rpc_io.Write(&m_type, 1);
-	rpc_io.Write(&m_cmd,  2);
-	rpc_io.Write(&m_size, 1);
-	if (m_size) rpc_io.Write(m_par, m_size);
+	m_msg[0] = m_type;
+	m_msg[1] = uint8_t(m_cmd);
+	m_msg[2] = uint8_t(m_cmd >> 8);
+	m_msg[3] = m_size;
+	rpc_io.Write(m_msg, 4 + m_size);
 }
 
 
 void rpcMessage::Receive(CRpcIo &rpc_io)
 {
 	m_pos = 0;
-	rpc_io.Read(&m_type, 1);
+	rpc_io.Read(m_msg, 4);
+	m_type = m_msg[0];
 	if (m_type == RPC_TYPE_DTB) {}
 	else if (m_type == RPC_TYPE_DTB_DATA)
 	{ // remove unexpected data message from queue
-		uint16_t size = 0;
-		rpc_io.Read(&size, 3);
-		rpc_DataSink(rpc_io, size);
+		rpc_DataSink(rpc_io, m_msg[1] | (m_msg[2] << 8) | (m_msg[3] << 16));
 		throw CRpcError(CRpcError::NO_CMD_MSG);
 	}
 	else if (m_type == RPC_TYPE_DTB_DATA_OLD)
-	{ // remove unexpected old data message from queue
-		uint8_t  chn;
-		uint16_t size;
-		rpc_io.Read(&chn, 1);
-		rpc_io.Read(&size, 2);
-		rpc_DataSink(rpc_io, size);
+	{ // remove unexpected old data message from queue (channel, size)
+		rpc_DataSink(rpc_io, m_msg[2] | (m_msg[3] << 8));
 		throw CRpcError(CRpcError::NO_CMD_MSG);
 	}
 	else throw CRpcError(CRpcError::WRONG_MSG_TYPE);
 
-	rpc_io.Read(&m_cmd, 2);
-	rpc_io.Read(&m_size, 1);
-	if (m_size) rpc_io.Read(m_par, m_size);
+	m_cmd = uint16_t(m_msg[1] | (m_msg[2] << 8));
+	m_size = m_msg[3];
+	if (m_size) rpc_io.Read(m_msg + 4, m_size);
 }
 
 
@@ -55,39 +51,31 @@ void rpcMessage::Receive(CRpcIo &rpc_io)
 
 void CDataHeader::RecvHeader(CRpcIo &rpc_io)
 {
-	rpc_io.Read(&m_type, 1);
+	uint8_t header[4];
+	rpc_io.Read(header, 4);
+	m_type = header[0];
 	if (m_type == RPC_TYPE_DTB_DATA) {}
 	else if (m_type == RPC_TYPE_DTB)
 	{ // remove unexpected command message from queue
-		uint16_t cmd;
-		uint8_t size;
-		rpc_io.Read(&cmd, 2);
-		rpc_io.Read(&size, 1);
-		rpc_DataSink(rpc_io, size);
+		rpc_DataSink(rpc_io, header[3]);
 		throw CRpcError(CRpcError::NO_DATA_MSG);
 	}
 	else if (m_type == RPC_TYPE_DTB_DATA_OLD)
-	{ // remove unexpected old data message from queue
-		uint8_t  chn;
-		uint16_t size;
-		rpc_io.Read(&chn, 1);
-		rpc_io.Read(&size, 2);
-		rpc_DataSink(rpc_io, size);
+	{ // remove unexpected old data message from queue (channel, size)
+		rpc_DataSink(rpc_io, header[2] | (header[3] << 8));
 		throw CRpcError(CRpcError::NO_CMD_MSG);
 	}
 	else throw CRpcError(CRpcError::WRONG_MSG_TYPE);
 
-	m_size = 0;
-	rpc_io.Read(&m_size, 3);
+	m_size = header[1] | (header[2] << 8) | (header[3] << 16);
 }
 
 
 
 void rpc_SendRaw(CRpcIo &rpc_io, const void *x, uint32_t size)
 {
-	uint8_t value = RPC_TYPE_DTB_DATA;
-	rpc_io.Write(&value, 1);
-	rpc_io.Write(&size, 3);
+	uint8_t header[4] = { RPC_TYPE_DTB_DATA, uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16) };
+	rpc_io.Write(header, 4);
 	if (size) rpc_io.Write(x, size);
 //	printf("Send Data [%i]\n", int(size));
 }
@@ -105,14 +93,8 @@ void rpc_Receive(CRpcIo &rpc_io, string &x)
 {
 	CDataHeader msg;
 	msg.RecvHeader(rpc_io);
-	x.clear();
-	x.reserve(msg.m_size);
-	char ch;
-	for (uint32_t i=0; i<msg.m_size; i++)
-	{
-		rpc_io.Read(&ch, 1);
-		x.push_back(ch);
-	}
+	x.assign(msg.m_size, 0);
+	if (msg.m_size) rpc_io.Read(&x[0], msg.m_size);
 }
 
 
@@ -93,7 +93,10 @@ class rpcMessage
 	uint8_t  m_type;
 	uint16_t m_cmd;
 	uint8_t  m_size;
-	uint8_t  m_par[256];
+
+	// message as sent on the wire: type, cmd (2 bytes), size, parameters
+	uint8_t  m_msg[4+256];
+	uint8_t* Par(uint8_t n) { uint8_t *p = m_msg + 4 + m_pos; m_pos += n; return p; }
 public:
 	uint16_t GetCmd() { return m_cmd; }
 
@@ -101,14 +104,19 @@ public:
 	{ if (m_cmd < cmdCnt) return m_cmd; throw CRpcError(CRpcError::UNKNOWN_CMD); }
 
 	void Create(uint16_t cmd);
-	void Put_INT8(int8_t x) { m_par[m_pos++] = int8_t(x); m_size++; }
-	void Put_UINT8(uint8_t x) { m_par[m_pos++] = x; m_size++; }
+	void Put_INT8(int8_t x) { Put_UINT8(uint8_t(x)); }
+	void Put_UINT8(uint8_t x) { *Par(1) = x; m_size++; }
 	void Put_BOOL(bool x) { Put_UINT8(x ? 1 : 0); }
-	void Put_INT16(int16_t x) { Put_UINT8(uint8_t(x)); Put_UINT8(uint8_t(x>>8)); }
-	void Put_UINT16(uint16_t x) { Put_UINT8(uint8_t(x)); Put_UINT8(uint8_t(x>>8)); }
-	void Put_INT32(int32_t x) { Put_UINT16(uint16_t(x)); Put_UINT16(uint16_t(x>>16)); }
-	void Put_UINT32(int32_t x) { Put_UINT16(uint16_t(x)); Put_UINT16(uint16_t(x>>16)); }
-	void Put_INT64(int64_t x) { Put_UINT32(uint32_t(x)); Put_UINT32(uint32_t(x>>32)); }
+	void Put_INT16(int16_t x) { Put_UINT16(uint16_t(x)); }
+	void Put_UINT16(uint16_t x) { uint8_t *p = Par(2); p[0] = uint8_t(x); p[1] = uint8_t(x>>8); m_size += 2; }
+	void Put_INT32(int32_t x) { Put_UINT32(uint32_t(x)); }
+	void Put_UINT32(uint32_t x)
+	{
+		uint8_t *p = Par(4);
+		p[0] = uint8_t(x); p[1] = uint8_t(x>>8); p[2] = uint8_t(x>>16); p[3] = uint8_t(x>>24);
+		m_size += 4;
+	}
+	void Put_INT64(int64_t x) { Put_UINT64(uint64_t(x)); }
 	void Put_UINT64(uint64_t x) { Put_UINT32(uint32_t(x)); Put_UINT32(uint32_t(x>>32)); }
 
 	void Send(CRpcIo &rpc_io);
@@ -121,15 +129,19 @@ public:
 	}
 	void CheckSize(uint8_t size) { if (m_size != size) throw CRpcError(CRpcError::CMD_PAR_SIZE); }
 
-	int8_t Get_INT8() { return int8_t(m_par[m_pos++]); }
-	uint8_t Get_UINT8() { return uint8_t(m_par[m_pos++]); }
+	int8_t Get_INT8() { return int8_t(Get_UINT8()); }
+	uint8_t Get_UINT8() { return *Par(1); }
 	bool Get_BOOL() { return Get_UINT8() != 0; }
-	int16_t Get_INT16() { int16_t x = Get_UINT8(); x += (uint16_t)Get_UINT8() << 8; return x; }
-	uint16_t Get_UINT16() { uint16_t x = Get_UINT8(); x += (uint16_t)Get_UINT8() << 8; return x; }
-	int32_t Get_INT32() { int32_t x = Get_UINT16(); x += (uint32_t)Get_UINT16() << 16; return x; }
-	uint32_t Get_UINT32() { uint32_t x = Get_UINT16(); x += (uint32_t)Get_UINT16() << 16; return x; }
- 	int64_t Get_INT64() { int64_t x = Get_UINT32(); x += (uint64_t)Get_UINT32() << 32; return x; }
-	uint64_t Get_UINT64() { uint64_t x = Get_UINT32(); x = (uint64_t)Get_UINT32() << 32; return x; }
+	int16_t Get_INT16() { return int16_t(Get_UINT16()); }
+	uint16_t Get_UINT16() { const uint8_t *p = Par(2); return uint16_t(p[0] | (p[1] << 8)); }
+	int32_t Get_INT32() { return int32_t(Get_UINT32()); }
+	uint32_t Get_UINT32()
+	{
+		const uint8_t *p = Par(4);
+		return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+	}
+	int64_t Get_INT64() { return int64_t(Get_UINT64()); }
+	uint64_t Get_UINT64() { uint64_t x = Get_UINT32(); x |= (uint64_t)Get_UINT32() << 32; return x; }
 };
 
 
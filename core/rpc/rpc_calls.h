@@ -59,6 +59,25 @@ public:
 	}
 
 
+	// Use the positions in the host command list as RPC call ids. Only valid
+	// if the DTB has the identical command list, i.e. the GetRpcCallHash of
+	// the DTB matches the hash of GetHostRpcCallNames():
+	void RpcLinkIdentical() {
+	  for (unsigned int i = 0; i < rpc_cmdListSize; i++) rpc_cmdId[i] = static_cast<int>(i);
+	}
+
+	// Direct access to the table of resolved call ids (-1: not resolved yet),
+	// e.g. to cache it for a given firmware:
+	std::vector<int32_t> GetRpcCallIds() {
+	  return std::vector<int32_t>(rpc_cmdId, rpc_cmdId + rpc_cmdListSize);
+	}
+	bool SetRpcCallIds(const std::vector<int32_t> &ids) {
+	  if (ids.size() != rpc_cmdListSize) return false;
+	  for (unsigned int i = 2; i < rpc_cmdListSize; i++) rpc_cmdId[i] = ids[i];
+	  return true;
+	}
+
+
 	// === DTB connection ====================================================
 
 	inline bool Open(string &name, bool init=true) {
@@ -68,6 +87,13 @@ public:
 	  return true;
 	}
 
+	// Connect to another transport than USB, e.g. a board emulation:
+	inline bool Open(CRpcIo &io, bool init=true) {
+	  rpc_Connect(io);
+	  if (init) Init();
+	  return true;
+	}
+
 	void Close() {
 	  usb.Close();
 	  rpc_Clear();
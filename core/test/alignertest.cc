@@ -0,0 +1,212 @@
+// Unit test of the Event alignment of two DAQ channels (dtbEventAligner in
+// core/hal/datapipe.h): feeds Events with aligned, dropped and shifted TBM
+// Event counters through a mock pipe and checks the merged Events, the
+// per-channel alignment statistics and the flush of unmatched Events after
+// Finish(). Returns the number of failed checks, registered with CTest in
+// core/test/CMakeLists.txt.
+
+#include "datapipe.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace pxar;
+
+int failures = 0;
+
+void check(bool ok, const std::string & what) {
+  if(!ok) {
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+// Mock for the dtbPipeline of one channel: hands out the queued Events one
+// by one and signals an empty buffer like the DTB source does.
+class mockPipe {
+public:
+  // Queue an Event with the TBM Event counter ctr and one hit on ROC roc:
+  void Add(int ctr, uint8_t roc, uint16_t trailer = 0) {
+    Event evt;
+    evt.header = static_cast<uint16_t>((ctr & 0xff) << 8);
+    evt.trailer = trailer;
+    evt.pixels.push_back(pixel(roc, 1, 1, 0));
+    queue.push_back(evt);
+  }
+  Event* GetEvent() {
+    if(queue.empty()) throw dsBufferEmpty();
+    current = queue.front();
+    queue.pop_front();
+    return &current;
+  }
+private:
+  std::deque<Event> queue;
+  Event current;
+};
+
+// ROC IDs of the two channels:
+const uint8_t ROC_CH0 = 0;
+const uint8_t ROC_CH1 = 8;
+
+// Event counter of a merged Event:
+int counter(const Event & evt) { return (evt.header >> 8) & 0xff; }
+
+// Merged Event with the hits of both channels:
+bool full(const Event & evt) {
+  return evt.pixels.size() == 2 && evt.pixels[0].roc_id == ROC_CH0 && evt.pixels[1].roc_id == ROC_CH1;
+}
+
+// Channel 0 Event delivered without its channel 1 partner:
+bool single(const Event & evt) {
+  return evt.pixels.size() == 1 && evt.pixels[0].roc_id == ROC_CH0;
+}
+
+void connect(dtbEventAligner<mockPipe> & aligner, mockPipe & ch0, mockPipe & ch1) {
+  std::vector<mockPipe*> pipes;
+  pipes.push_back(&ch0);
+  pipes.push_back(&ch1);
+  aligner.Connect(pipes);
+}
+
+// Both channels see the same Events, including the wrap of the 8 bit counter:
+void testAligned() {
+  mockPipe ch0, ch1;
+  for(int i = 0; i < 300; i++) { ch0.Add(i, ROC_CH0); ch1.Add(i, ROC_CH1); }
+  dtbEventAligner<mockPipe> aligner;
+  connect(aligner, ch0, ch1);
+
+  std::vector<Event> data;
+  aligner.GetAllEvents(data);
+  check(data.size() == 300, "aligned: not all Events merged");
+  bool ok = true;
+  for(size_t i = 0; i < data.size(); i++) { ok &= (full(data[i]) && counter(data[i]) == static_cast<int>(i & 0xff)); }
+  check(ok, "aligned: merged Events out of order or without both channels");
+
+  alignmentStatistics & stats = aligner.GetStatistics();
+  check(stats.channels == 2 && stats.merged == 300, "aligned: wrong merged count");
+  check(stats.events[0] == 300 && stats.events[1] == 300, "aligned: wrong number of Events read");
+  check(stats.IsClean() && stats.resyncs == 0, "aligned: alignment errors reported");
+}
+
+// Channel 1 lost two Events, one of its Events has a trailer error:
+void testDropped() {
+  mockPipe ch0, ch1;
+  for(int i = 0; i < 300; i++) {
+    ch0.Add(i, ROC_CH0);
+    if(i == 50 || i == 200) continue;
+    ch1.Add(i, ROC_CH1, (i == 10 ? 0x0100 : 0));
+  }
+  dtbEventAligner<mockPipe> aligner;
+  connect(aligner, ch0, ch1);
+
+  std::vector<Event> data;
+  aligner.GetAllEvents(data);
+  check(data.size() == 300, "dropped: channel 0 Events lost");
+  bool ok = true;
+  for(size_t i = 0; i < data.size(); i++) {
+    ok &= (counter(data[i]) == static_cast<int>(i & 0xff));
+    ok &= ((i == 50 || i == 200) ? single(data[i]) : full(data[i]));
+  }
+  check(ok, "dropped: channel 1 data merged into the wrong Events");
+  check(data.size() > 10 && (data[10].trailer & TBM_TRAILER_ERRORS) == 0x0100, "dropped: channel 1 trailer error not propagated");
+
+  alignmentStatistics & stats = aligner.GetStatistics();
+  check(stats.merged == 300 && stats.resyncs == 2 && stats.incomplete == 0, "dropped: wrong merge statistics");
+  check(stats.events[0] == 300 && stats.events[1] == 298, "dropped: wrong number of Events read");
+  check(stats.missing[0] == 0 && stats.missing[1] == 2, "dropped: wrong number of missing Events");
+  check(stats.skipped[0] == 0 && stats.skipped[1] == 0, "dropped: Events skipped");
+  check(stats.trailerErrors[0] == 0 && stats.trailerErrors[1] == 1, "dropped: wrong number of trailer errors");
+}
+
+// Channel 1 starts with stale Events behind channel 0 and delivers one
+// stray old Event in the middle of the readout:
+void testShifted() {
+  mockPipe ch0, ch1;
+  for(int i = 250; i < 256; i++) { ch1.Add(i, ROC_CH1); }
+  for(int i = 0; i < 100; i++) {
+    ch0.Add(i, ROC_CH0);
+    if(i == 60) ch1.Add(20, ROC_CH1);
+    ch1.Add(i, ROC_CH1);
+  }
+  dtbEventAligner<mockPipe> aligner;
+  connect(aligner, ch0, ch1);
+
+  std::vector<Event> data;
+  aligner.GetAllEvents(data);
+  check(data.size() == 100, "shifted: wrong number of merged Events");
+  bool ok = true;
+  for(size_t i = 0; i < data.size(); i++) { ok &= (full(data[i]) && counter(data[i]) == static_cast<int>(i)); }
+  check(ok, "shifted: channels not realigned");
+
+  alignmentStatistics & stats = aligner.GetStatistics();
+  check(stats.merged == 100 && stats.resyncs == 2 && stats.incomplete == 0, "shifted: wrong merge statistics");
+  check(stats.events[0] == 100 && stats.events[1] == 107, "shifted: wrong number of Events read");
+  check(stats.skipped[0] == 0 && stats.skipped[1] == 7, "shifted: wrong number of skipped Events");
+  check(stats.missing[1] == 0, "shifted: Events reported missing");
+}
+
+// Channel 1 is behind at the end of the readout: the channel 0 Events are
+// held back until Finish() and then delivered without their partners.
+void testFinishChannel0() {
+  mockPipe ch0, ch1;
+  for(int i = 0; i < 10; i++) { ch0.Add(i, ROC_CH0); }
+  for(int i = 0; i < 6; i++) { ch1.Add(i, ROC_CH1); }
+  dtbEventAligner<mockPipe> aligner;
+  connect(aligner, ch0, ch1);
+
+  Event evt;
+  size_t n = 0;
+  bool ok = true;
+  while(aligner.GetEvent(evt)) { ok &= (full(evt) && counter(evt) == static_cast<int>(n)); n++; }
+  check(n == 6 && ok, "finish: complete Events not merged");
+  check(aligner.GetStatistics().merged == 6 && aligner.GetStatistics().missing[1] == 0, "finish: channel 0 Events delivered before Finish()");
+
+  aligner.Finish();
+  while(aligner.GetEvent(evt)) { ok &= (single(evt) && counter(evt) == static_cast<int>(n)); n++; }
+  check(n == 10 && ok, "finish: pending channel 0 Events not flushed");
+
+  alignmentStatistics & stats = aligner.GetStatistics();
+  check(stats.merged == 10 && stats.incomplete == 4, "finish: wrong number of incomplete Events");
+  check(stats.missing[1] == 4 && stats.skipped[1] == 0, "finish: wrong channel 1 statistics");
+}
+
+// Channel 1 is ahead at the end of the readout: its unmatched Events are
+// dropped on Finish().
+void testFinishChannel1() {
+  mockPipe ch0, ch1;
+  for(int i = 0; i < 4; i++) { ch0.Add(i, ROC_CH0); }
+  for(int i = 0; i < 7; i++) { ch1.Add(i, ROC_CH1); }
+  dtbEventAligner<mockPipe> aligner;
+  connect(aligner, ch0, ch1);
+
+  std::vector<Event> data;
+  aligner.GetAllEvents(data);
+  check(data.size() == 4, "finish: complete Events not merged");
+  check(aligner.GetStatistics().skipped[1] == 0, "finish: channel 1 Events dropped before Finish()");
+
+  aligner.Finish();
+  data.clear();
+  aligner.GetAllEvents(data);
+  check(data.empty(), "finish: Events delivered without channel 0 data");
+
+  alignmentStatistics & stats = aligner.GetStatistics();
+  check(stats.merged == 4 && stats.incomplete == 0, "finish: wrong merge statistics");
+  check(stats.skipped[1] == 3 && stats.missing[1] == 0, "finish: unmatched channel 1 Events not dropped");
+}
+
+int main() {
+
+  testAligned();
+  testDropped();
+  testShifted();
+  testFinishChannel0();
+  testFinishChannel1();
+
+  if(failures > 0) {
+    std::cout << failures << " checks FAILED." << std::endl;
+    return failures;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
@@ -0,0 +1,185 @@
+// Functional test of the pxar core library against the DTB emulator:
+// runs an efficiency map, a Vcal DAC scan and a DAQ readout for a module
+// with the given number of ROCs ("-n", default 1) and checks the results.
+// Returns the number of failed checks, registered with CTest in
+// core/test/CMakeLists.txt.
+
+#include "api.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+int failures = 0;
+
+void check(bool ok, const std::string & what) {
+  if(!ok) {
+    std::cout << "FAILED: " << what << std::endl;
+    failures++;
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string board = "emulator";
+  std::string verbosity = "WARNING";
+  size_t nrocs = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-b board        testboard name, default \"emulator\"" << std::endl;
+      std::cout << "-n rocs         number of ROCs, 1 or 16, default 1" << std::endl;
+      std::cout << "-v verbosity    verbosity level, default WARNING" << std::endl;
+      return 0;
+    }
+    if (!strcmp(argv[i],"-b") && i+1 < argc) { board = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-n") && i+1 < argc) { nrocs = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-v") && i+1 < argc) { verbosity = std::string(argv[++i]); }
+    else {
+      std::cout << "Unrecognized command line option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if(nrocs != 1 && nrocs != 16) {
+    std::cout << "Only single ROCs and 16-ROC modules are supported." << std::endl;
+    return 1;
+  }
+
+  const size_t npixels = 52*80;
+  const uint16_t ntrig = 10;
+
+  std::vector<std::pair<std::string,uint8_t> > sig_delays;
+  sig_delays.push_back(std::make_pair("clk",2));
+
+  std::vector<std::pair<std::string,double> > power_settings;
+  power_settings.push_back(std::make_pair("va",1.9));
+  power_settings.push_back(std::make_pair("vd",2.6));
+  power_settings.push_back(std::make_pair("ia",1.190));
+  power_settings.push_back(std::make_pair("id",1.10));
+
+  std::vector<std::pair<std::string,uint8_t> > pg_setup;
+  pg_setup.push_back(std::make_pair("resetroc",25));
+  pg_setup.push_back(std::make_pair("calibrate",106));
+  pg_setup.push_back(std::make_pair("trigger",16));
+  pg_setup.push_back(std::make_pair("token",0));
+
+  std::vector<std::pair<std::string,uint8_t> > dacs;
+  dacs.push_back(std::make_pair("Vcal",100));
+  dacs.push_back(std::make_pair("VthrComp",80));
+  dacs.push_back(std::make_pair("Vtrim",0));
+  dacs.push_back(std::make_pair("CtrlReg",0));
+
+  std::vector<pxar::pixelConfig> pixels;
+  for(int col = 0; col < 52; col++) {
+    for(int row = 0; row < 80; row++) {
+      pixels.push_back(pxar::pixelConfig(col,row,15));
+    }
+  }
+
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > tbmDACs;
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > rocDACs;
+  std::vector<std::vector<pxar::pixelConfig> > rocPixels;
+  for(size_t roc = 0; roc < nrocs; roc++) {
+    rocDACs.push_back(dacs);
+    rocPixels.push_back(pixels);
+  }
+  // Modules are read out through the two cores of the TBM:
+  if(nrocs > 1) {
+    std::vector<std::pair<std::string,uint8_t> > tbm;
+    tbm.push_back(std::make_pair("clear",0xF0));
+    tbmDACs.push_back(tbm);
+    tbmDACs.push_back(tbm);
+  }
+
+  pxar::api * _api = NULL;
+  try {
+    _api = new pxar::api(board,verbosity);
+
+    if(!_api->initTestboard(sig_delays, power_settings, pg_setup)) {
+      std::cout << "FAILED: initTestboard" << std::endl;
+      delete _api;
+      return 1;
+    }
+    if(!_api->initDUT(0,"tbm08b",tbmDACs,"psi46digv21",rocDACs,rocPixels)) {
+      std::cout << "FAILED: initDUT" << std::endl;
+      delete _api;
+      return 1;
+    }
+    _api->_dut->testAllPixels(true);
+    _api->_dut->maskAllPixels(false);
+
+    // Efficiency map: every pixel of every ROC responds to every trigger.
+    std::vector<pxar::pixel> effmap = _api->getEfficiencyMap(0,ntrig);
+    check(effmap.size() == nrocs*npixels, "efficiency map does not contain all pixels");
+    std::vector<size_t> perroc(nrocs,0);
+    size_t full = 0;
+    for(size_t i = 0; i < effmap.size(); i++) {
+      if(effmap[i].roc_id < nrocs) perroc[effmap[i].roc_id]++;
+      if(effmap[i].getValue() == ntrig) full++;
+    }
+    check(full == effmap.size(), "efficiency map has pixels below the number of triggers");
+    for(size_t roc = 0; roc < nrocs; roc++) {
+      check(perroc[roc] == npixels, "efficiency map incomplete for a ROC");
+    }
+    std::cout << "Efficiency map: " << effmap.size() << " pixels, " << full << " fully efficient" << std::endl;
+
+    // Vcal scan: no response at Vcal 0, a threshold turn-on with a rising
+    // number of responding pixels, all pixels fully efficient at Vcal 120.
+    std::vector<std::pair<uint8_t,std::vector<pxar::pixel> > > scan = _api->getEfficiencyVsDAC("Vcal",0,120,0,ntrig);
+    check(scan.size() == 121, "DAC scan does not contain all Vcal points");
+    bool ordered = true, monotonic = true, turnon = false;
+    for(size_t i = 0; i < scan.size(); i++) {
+      if(scan[i].first != i) ordered = false;
+      if(i > 0 && scan[i].second.size() < scan[i-1].second.size()) monotonic = false;
+      if(scan[i].second.size() > 0 && scan[i].second.size() < nrocs*npixels) turnon = true;
+    }
+    check(ordered, "DAC scan points not in Vcal order");
+    check(monotonic, "number of responding pixels not rising with Vcal");
+    check(turnon, "DAC scan has no threshold turn-on");
+    if(!scan.empty()) {
+      check(scan.front().second.empty(), "pixels responding at Vcal 0");
+      std::vector<pxar::pixel> & last = scan.back().second;
+      full = 0;
+      for(size_t i = 0; i < last.size(); i++) { if(last[i].getValue() == ntrig) full++; }
+      check(last.size() == nrocs*npixels && full == last.size(), "not all pixels fully efficient at Vcal 120");
+      std::cout << "DAC scan: " << scan.size() << " points, " << last.size() << " pixels at Vcal " << static_cast<int>(scan.back().first) << std::endl;
+    }
+
+    // DAQ readout: a single pixel enabled on every ROC, one hit per ROC in
+    // every triggered event.
+    _api->_dut->testAllPixels(false);
+    _api->_dut->testPixel(3,4,true);
+    _api->daqStart();
+    _api->daqTrigger(1000,200);
+    _api->daqStop();
+    std::vector<pxar::Event> data = _api->daqGetEventBuffer();
+    check(data.size() == 1000, "DAQ readout did not return one event per trigger");
+    size_t hits = 0, good = 0;
+    for(size_t i = 0; i < data.size(); i++) {
+      hits += data[i].pixels.size();
+      bool ok = (data[i].pixels.size() == nrocs);
+      for(size_t p = 0; p < data[i].pixels.size(); p++) {
+	if(data[i].pixels[p].column != 3 || data[i].pixels[p].row != 4 || data[i].pixels[p].roc_id != p) ok = false;
+      }
+      if(ok) good++;
+    }
+    check(good == data.size(), "DAQ events without exactly one hit per ROC in pixel 3,4");
+    std::cout << "DAQ readout: " << data.size() << " events, " << hits << " hits" << std::endl;
+  }
+  catch (...) {
+    std::cout << "FAILED: pxar caught an exception from the board." << std::endl;
+    delete _api;
+    return 1;
+  }
+
+  delete _api;
+
+  if(failures > 0) {
+    std::cout << failures << " checks FAILED." << std::endl;
+    return failures;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
@@ -21,6 +21,9 @@ typedef uint32_t DWORD;
 
 #ifdef HAVE_LIBFTDI
 #include <ftdi.h>
+// needed for threaded readout of FTDI
+#include <pthread.h>
+#include <semaphore.h>
 #else
 #include <ftd2xx.h>
 #endif
@@ -43,6 +46,21 @@ class CUSB : public CRpcIo
 
 #ifndef HAVE_LIBFTDI
   FT_HANDLE ftHandle;
+#else
+  // All libftdi state is kept per instance so several testboards
+  // can be operated from within the same process. ftdic is NULL after a
+  // timed out Close() handed the context over to the close thread:
+  struct ftdi_context * ftdic;
+
+  // Reader thread and ring buffer for client-side data buffering:
+  pthread_t readerthread;
+  sem_t buf_data, buf_space;
+  unsigned char * read_buffer;
+  int32_t head, tail;
+
+  void add_to_buf(unsigned char c);
+  static void * reader(void * arg);
+  int32_t FindAllUSB(struct ftdi_device_list ** devlist);
 #endif
 
   uint32_t enumPos, enumCount;
@@ -55,6 +73,7 @@ class CUSB : public CRpcIo
   unsigned char m_bufferR[USBREADBUFFERSIZE];
 
   bool FillBuffer(uint32_t minBytesToRead);
+  void WriteData(const unsigned char *data, uint32_t bytesToWrite);
 
 public:
   CUSB();
@@ -215,11 +215,25 @@ void CUSB::Close()
 void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
 {
   if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
-	uint32_t k=0;
-	for (k=0; k < bytesToWrite; k++)
+	const unsigned char * data = static_cast<const unsigned char *>(buffer);
+
+	// Bulk payloads not fitting the buffer go out directly without a copy:
+	if (bytesToWrite >= USBWRITEBUFFERSIZE)
+	{
+		Flush();
+		WriteData(data, bytesToWrite);
+		return;
+	}
+
+	while (bytesToWrite > 0)
 	{
 		if (m_posW >= USBWRITEBUFFERSIZE) { Flush(); }
-		m_bufferW[m_posW++] = ((unsigned char*)buffer)[k];
+		uint32_t n = USBWRITEBUFFERSIZE - m_posW;
+		if (n > bytesToWrite) n = bytesToWrite;
+		memcpy(m_bufferW + m_posW, data, n);
+		m_posW += n;
+		data += n;
+		bytesToWrite -= n;
 	}
 }
 
@@ -232,7 +246,6 @@ void CUSB::WriteCommand(unsigned char x){
 
 void CUSB::Flush()
 {
-	DWORD bytesWritten;
 	DWORD bytesToWrite = m_posW;
 	m_posW = 0;
 
@@ -240,7 +253,14 @@ void CUSB::Flush()
 
 	if (!bytesToWrite) return;
 
-	ftdiStatus = FT_Write(ftHandle, m_bufferW, bytesToWrite, &bytesWritten);
+	WriteData(m_bufferW, bytesToWrite);
+}
+
+void CUSB::WriteData(const unsigned char *data, uint32_t bytesToWrite)
+{
+	DWORD bytesWritten;
+
+	ftdiStatus = FT_Write(ftHandle, const_cast<unsigned char *>(data), bytesToWrite, &bytesWritten);
 
 	if (ftdiStatus != FT_OK) throw UsbConnectionError("Failure writing to USB");
 	if (bytesWritten != bytesToWrite) { ftdiStatus = FT_IO_ERROR; throw UsbConnectionError("Incomplete write to USB."); }
@@ -16,19 +16,8 @@
 #include <pthread.h> 
 #include <semaphore.h>
 
-static struct ftdi_context ftdic;
-
-// the read buffer needs to be accessable outside of our USB class
+// size of the per-instance read ring buffer
 #define BUFSIZE 0x200000
-static pthread_t readerthread;
-static sem_t buf_data, buf_space;
-static unsigned char read_buffer[BUFSIZE];
-static int32_t head, tail; // read buffer is used as ring buffer
-
-// cleanup is threaded to include a timeout on the calls to the device that sometimes hang
-pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_t usbclose_thread, usbdeinit_thread;
-volatile bool usbclose_done, usbdeinit_done;
 
 const int32_t productID_FT232H = 0x6014; // new testboard FTDI chip product id (FT232H)
 const int32_t productID_OLD = 0x6001; //  single channel devices (R Chips) used in older test boards
@@ -37,7 +26,70 @@ const int32_t vendorID = 0x0403; // Future Technology Devices International, Ltd
 using namespace std;
 using namespace pxar;
 
-static void add_to_buf (unsigned char c) {
+// cleanup is threaded to include a timeout on the calls to the device that sometimes hang.
+// The job lives on the heap so a hanging thread never touches an already destroyed CUSB:
+struct usbCleanupJob {
+  struct ftdi_context * ftdic;
+  bool deinit;
+  bool done;
+  bool abandoned;
+  pthread_mutex_t mutex;
+};
+
+static void *usbcleanup (void *arg) {
+  // on some circumstances, the ftdi_usb_close() and ftdi_deinit() calls hang;
+  // this is a workaround to implement a timeout
+    usbCleanupJob *job = (usbCleanupJob *)(arg);
+    if (job->deinit) ftdi_deinit(job->ftdic);
+    else ftdi_usb_close(job->ftdic);
+    pthread_mutex_lock(&job->mutex);
+    job->done = true;
+    bool abandoned = job->abandoned;
+    pthread_mutex_unlock(&job->mutex);
+    // the caller gave up waiting, we own the context and are responsible for cleaning up:
+    if (abandoned) {
+      if (!job->deinit) ftdi_deinit(job->ftdic);
+      delete job->ftdic;
+      pthread_mutex_destroy(&job->mutex);
+      delete job;
+    }
+    return NULL;
+}
+
+// Run the cleanup call in a separate thread and wait up to one second for it.
+// Returns false if the call timed out, ownership of the job and of the context is then
+// passed to the thread, which deinitializes and deletes the context once the call returns.
+static bool runCleanup (struct ftdi_context * ftdic, bool deinit) {
+  usbCleanupJob *job = new usbCleanupJob;
+  job->ftdic = ftdic;
+  job->deinit = deinit;
+  job->done = false;
+  job->abandoned = false;
+  pthread_mutex_init(&job->mutex, NULL);
+
+  pthread_t cleanup_thread;
+  pthread_create (&cleanup_thread, NULL, usbcleanup, job);
+  bool done = false;
+  for (int time = 0; time<1000;time++){
+    usleep(1000); // wait 1ms
+    // check status and break if usbdevice is closed
+    pthread_mutex_lock(&job->mutex);
+    if (job->done) done = true;
+    else if (time == 999) job->abandoned = true;
+    pthread_mutex_unlock(&job->mutex);
+    if (done) break;
+  }
+
+  if (done) {
+    pthread_join(cleanup_thread, NULL);
+    pthread_mutex_destroy(&job->mutex);
+    delete job;
+  }
+  else { pthread_detach(cleanup_thread); }
+  return done;
+}
+
+void CUSB::add_to_buf (unsigned char c) {
     int32_t nh;
 
     sem_wait (&buf_space);
@@ -53,18 +105,18 @@ static void add_to_buf (unsigned char c) {
     sem_post (&buf_data);
 }
 
-static void *reader (void *arg) {
+void *CUSB::reader (void *arg) {
   // there is no non-blocking read command implemented in libftdi ->
-  // therefore we use multithreading and a static buffer to emulate
+  // therefore we use multithreading and a ring buffer to emulate
   // non-blocking calls
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
+    CUSB *usb = (CUSB *)(arg);
     unsigned char buf[0x1000];
     int32_t br, i;
 
     while (1) {
       usleep(100); // wait 0.1 ms
       pthread_testcancel();
-      br = ftdi_read_data (handle, buf, sizeof(buf));
+      br = ftdi_read_data (usb->ftdic, buf, sizeof(buf));
       pthread_testcancel();
       if (br< 0){
 	LOG(logCRITICAL)<< "ERROR during USB read polling: error code from libusb_bulk_transfer(): " << br;
@@ -72,32 +124,14 @@ static void *reader (void *arg) {
       }
       if (br > 0){
 	for (i=0; i<br; i++){
-	  add_to_buf (buf[i]);
+	  usb->add_to_buf (buf[i]);
 	}
       }
     }
     return NULL;
 }
 
-static void *usbclose (void *arg) {
-  // on some circumstances, the ftdi_usb_close() call hangs;
-  // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_usb_close(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbclose_done = true; pthread_mutex_unlock(&cleanup_mutex);
-    return NULL;
-}
-
-static void *usbdeinit (void *arg) {
-  // on some circumstances, the ftdi_deinit() call hangs;
-  // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_deinit(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = true; pthread_mutex_unlock(&cleanup_mutex);
-    return NULL;
-}
-
-uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
+int32_t CUSB::FindAllUSB(struct ftdi_device_list ** devlist){
   int status;
   uint32_t nDevices = 0;
   struct ftdi_device_list *  	devlist_atb;
@@ -106,8 +140,19 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   // Old libfti versions do not allow wildcards for vendorID and productID.
   // This first checks explicitly for DTB boards, then for ATB ones and merges the device lists
 
+  // the context was handed to a hanging close call, start over with a new one:
+  if (!ftdic) {
+    ftdic = new struct ftdi_context;
+    if (ftdi_init(ftdic) < 0) {
+      delete ftdic;
+      ftdic = NULL;
+      LOG(logCRITICAL) << "USBInterface: ftdi_init failed";
+      throw UsbConnectionError("USBInterface: ftdi_init failed");
+    }
+  }
+
   // DTB
-  status =  ftdi_usb_find_all(&ftdic, devlist,vendorID,productID_FT232H);
+  status =  ftdi_usb_find_all(ftdic, devlist,vendorID,productID_FT232H);
   if( status < 0) {
     return status;
   }
@@ -116,7 +161,7 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   }
 
   // ATB
-  status =  ftdi_usb_find_all(&ftdic, &devlist_atb,vendorID,productID_OLD);
+  status =  ftdi_usb_find_all(ftdic, &devlist_atb,vendorID,productID_OLD);
   if( status < 0) {
     return status;
   }
@@ -139,33 +184,32 @@ CUSB::CUSB(){
       isUSB_open = false;
       ftdiStatus = 0;
       enumPos = enumCount = 0;
-      ftdiStatus = ftdi_init(&ftdic);
+      head = tail = 0;
+      read_buffer = new unsigned char[BUFSIZE];
+      ftdic = new struct ftdi_context;
+      ftdiStatus = ftdi_init(ftdic);
       if ( ftdiStatus < 0)
 	{
 	  LOG(logCRITICAL) <<  "USBInterface constructor: ftdi_init failed";
+	  delete ftdic;
+	  delete[] read_buffer;
 	  throw UsbConnectionError("USBInterface constructor: ftdi_init failed");
 	}
 }
 
 CUSB::~CUSB(){ 
   if (isUSB_open) Close(); 
-  pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = false; pthread_mutex_unlock(&cleanup_mutex);
-  // create cleanup thread to allow timeout freeing the USB handle (might hang sometimes)
-  pthread_create (&usbdeinit_thread, NULL, usbdeinit, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex); 
-    if (usbdeinit_done) {
-      done = true;    }
-    pthread_mutex_unlock(&cleanup_mutex);
-    if (done) break;  }
+  // free the USB handle with a timeout (might hang sometimes), the thread
+  // takes care of the context if it does not return in time. There is
+  // no context left to free if it went to a timed out close call:
+  if (ftdic && runCleanup(ftdic, true)) delete ftdic;
+  delete[] read_buffer;
 }
 
 const char* CUSB::GetErrorMsg()
 {
-  return ftdi_get_error_string(&ftdic);
+  if (!ftdic) return "USB context released after close timeout";
+  return ftdi_get_error_string(ftdic);
 }
 
 
@@ -206,7 +250,7 @@ bool CUSB::EnumNext(char name[])
   
   char manufacturer[128], description[128], serial[128];
 
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       LOG(logCRITICAL) << " USBInterface::EnumNext(): Error polling USB device number " << enumPos;
       throw UsbConnectionError(" USBInterface::EnumNext(): Error polling USB device");
@@ -239,7 +283,7 @@ bool CUSB::Enum(char name[], uint32_t pos)
   for (uint32_t i=0; i<pos; i++) devlist = devlist->next;
   
   char manufacturer[128], description[128], serial[128];
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       LOG(logCRITICAL) << " USBInterface::EnumNext(): Error polling USB device number " << pos;
       throw UsbConnectionError(" USBInterface::EnumNext(): Error polling USB device");
@@ -280,7 +324,7 @@ bool CUSB::Open(char serialNumber[])
   for (int32_t i=0; i<ndevices; i++) {
     char manufacturer[128], description[128], serial[128];
     if ((ftdiStatus = 
-	 ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 
+	 ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 
 			      128, description, 128, serial, 128)) < 0){
       LOG(logDEBUGUSB) << " USBInterface::Open(): Error polling USB device number " << i;
       devlist = devlist->next;
@@ -295,7 +339,7 @@ bool CUSB::Open(char serialNumber[])
       // found the device
       LOG(logDEBUGUSB) << " USBInterface::Open(): found device with serial " << serial;
       // now open it
-      ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+      ftdiStatus = ftdi_usb_open_dev(ftdic, devlist->dev);
       if( ftdiStatus < 0) {
 	/* maybe the ftdi_sio and usbserial kernel modules are attached to the device */
 	/* try to detach them using the libusb library directly */
@@ -320,7 +364,7 @@ bool CUSB::Open(char serialNumber[])
 	libusb_close(handle);
 
 	// now open it again
-	ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+	ftdiStatus = ftdi_usb_open_dev(ftdic, devlist->dev);
 	if( ftdiStatus < 0) {
 	  LOG(logCRITICAL) << "FTDI returned status code " << ftdiStatus << " after attempt to detach kernel drivers ";
 	  ftdi_list_free(&devlist);
@@ -354,22 +398,23 @@ bool CUSB::Open(char serialNumber[])
 //     ftdi	pointer to ftdi_context
 //     bitmask	Bitmask to configure lines. HIGH/ON value configures a line as output.
 //     mode	Bitbang mode: use the values defined in ftdi_mpsse_mode
-  ftdiStatus = ftdi_set_bitmode(&ftdic, 0xFF, BITMODE_SYNCFF); //BITMODE_SYNCFF = 0x40, BITMODE_SYNCBB = 0x04
+  ftdiStatus = ftdi_set_bitmode(ftdic, 0xFF, BITMODE_SYNCFF); //BITMODE_SYNCFF = 0x40, BITMODE_SYNCBB = 0x04
   if (ftdiStatus < 0) UsbConnectionError("Error setting FTDI synchronous bit-bang mode.");
   // set the baud rate
-  ftdiStatus = ftdi_set_baudrate(&ftdic, 9600);
+  ftdiStatus = ftdi_set_baudrate(ftdic, 9600);
   if (ftdiStatus < 0) UsbConnectionError("Error setting FTDI baud rate.");
   // set usb transfer size parameters (see: http://www.ftdichip.com/Support/Knowledgebase/ft_setusbparameters.htm)
-  ftdiStatus = ftdi_read_data_set_chunksize(&ftdic, 4096); // default: 4096, must be multiple of 64
+  ftdiStatus = ftdi_read_data_set_chunksize(ftdic, 4096); // default: 4096, must be multiple of 64
   if (ftdiStatus < 0) UsbConnectionError("Error setting USB read size parameters.");
-  ftdiStatus = ftdi_write_data_set_chunksize(&ftdic, 4096); // default: 4096, must be multiple of 64
+  ftdiStatus = ftdi_write_data_set_chunksize(ftdic, 4096); // default: 4096, must be multiple of 64
   if (ftdiStatus < 0) UsbConnectionError("Error setting USB write size parameters.");
 
 
   // init threads for client-side data buffering
   sem_init (&buf_data, 0, 0);
   sem_init (&buf_space, 0, BUFSIZE);
-  pthread_create (&readerthread, NULL, reader, &ftdic);
+  head = tail = 0;
+  pthread_create (&readerthread, NULL, reader, this);
 
   return true;
 }
@@ -384,21 +429,13 @@ void CUSB::Close(){
   sem_destroy (&buf_data);
   sem_destroy (&buf_space);
   usleep(10000);
-  // set the flag (lock mutex first)
-  pthread_mutex_lock(&cleanup_mutex); usbclose_done = false; pthread_mutex_unlock(&cleanup_mutex);
-  // create cleanup thread to allow timeout on call to device (might hang)
-  pthread_create (&usbclose_thread, NULL, usbclose, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex);  // lock mutex
-    if (usbclose_done) {
-      //successfully closed usb connection
-      done = true; }
-    pthread_mutex_unlock(&cleanup_mutex); // unlock mutex
-    if (done) break;}
-  //WARNING: closing the USB connection timed out!
+  // close the device with a timeout on the call (might hang)
+  if (!runCleanup(ftdic, false)) {
+    // the close thread still uses the context and frees it when it returns,
+    // a new context is set up the next time devices are searched:
+    LOG(logWARNING) << "USBInterface: closing the USB connection timed out";
+    ftdic = NULL;
+  }
   isUSB_open = 0;
 }
 
@@ -411,10 +448,23 @@ void CUSB::WriteCommand(unsigned char x){
 void CUSB::Write(uint32_t bytesToWrite, const void *buffer)
 { 
   if (!isUSB_open) throw UsbConnectionError("Attempt to write to USB without open connection.");
-  uint32_t k=0;
-  for( k=0; k < bytesToWrite; k++ ) {
+  const unsigned char * data = static_cast<const unsigned char *>(buffer);
+
+  // Bulk payloads not fitting the buffer go out directly without a copy:
+  if (bytesToWrite >= USBWRITEBUFFERSIZE) {
+    Flush();
+    WriteData(data, bytesToWrite);
+    return;
+  }
+
+  while(bytesToWrite > 0) {
     if( m_posW >= USBWRITEBUFFERSIZE) {Flush();}
-    m_bufferW[m_posW++] = ((unsigned char*)buffer)[k];
+    uint32_t n = USBWRITEBUFFERSIZE - m_posW;
+    if(n > bytesToWrite) n = bytesToWrite;
+    memcpy(m_bufferW + m_posW, data, n);
+    m_posW += n;
+    data += n;
+    bytesToWrite -= n;
   }
   return;
 }
@@ -429,10 +479,15 @@ void CUSB::Flush()
 
   if( !bytesToWrite) return;
 
-  ftdiStatus = ftdi_write_data(&ftdic, m_bufferW, bytesToWrite);
+  WriteData(m_bufferW, bytesToWrite);
+}
+
+void CUSB::WriteData(const unsigned char *data, uint32_t bytesToWrite)
+{
+  ftdiStatus = ftdi_write_data(ftdic, const_cast<unsigned char *>(data), bytesToWrite);
 
   if( ftdiStatus < 0)  throw UsbConnectionError("USB write failed");
-  if( ftdiStatus != bytesToWrite) { 
+  if( ftdiStatus != static_cast<int32_t>(bytesToWrite)) { 
     LOG(logCRITICAL) << " Mismatch of bytes sent to USB chip and bytes written! ";
     throw UsbConnectionError("USBInterface: mismatch of bytes sent to USB chip and bytes written!");
   }
@@ -495,7 +550,7 @@ void CUSB::Clear()
 {
   if( !isUSB_open) return;
 
-  ftdiStatus = ftdi_usb_purge_buffers(&ftdic);
+  ftdiStatus = ftdi_usb_purge_buffers(ftdic);
 
   // drain our buffer.
   while (head != tail) {
@@ -519,7 +574,7 @@ bool CUSB::Show()
   LOG(logINFO) << "  - max timeout for read calls set to " << m_timeout << "ms";
 
   unsigned char latency;
-  if (ftdi_get_latency_timer(&ftdic,&latency)==0){ LOG(logINFO) << "  - FTDI latency timer set to " << (int) latency;}
+  if (ftdi_get_latency_timer(ftdic,&latency)==0){ LOG(logINFO) << "  - FTDI latency timer set to " << (int) latency;}
   LOG(logINFO) << "  - data waiting in local read buffer: " << !(tail == head);
  
   return true;
@@ -16,6 +16,15 @@ namespace pxar {
 #define DTB_DAQ_MEM_OVFL  2 // bit 1 = DAQ RAM FIFO overflow
 #define DTB_DAQ_STOPPED   1 // bit 0 = DAQ stopped (because of overflow)
 
+// Board name selecting the built-in DTB emulation, "emulator[:latency_us[:bandwidth_Bps]]"
+#define DTB_EMULATOR_NAME "emulator"
+
+// --- Telemetry settings ------------------------------------------------------
+#define TELEMETRY_BUFFER_SIZE 1024 // number of ia/id/va/vd samples kept by the API
+
+// --- Scan result cache -------------------------------------------------------
+#define SCAN_CACHE_SIZE 16 // number of scan results kept by the API
+
 
 // --- TBM Types ---------------------------------------------------------------
 // FIXME just an example...
@@ -24,6 +33,10 @@ namespace pxar {
 #define TBM_08B            0x03
 #define TBM_09             0x04
 
+// TBM trailer status bits (first trailer word, upper byte of Event::trailer)
+// flagging a corrupted or incomplete Event: NoTokenPass, SyncError, StackFull
+#define TBM_TRAILER_ERRORS 0x9100
+
 
 // --- TBM Register -----------------------------------------------------------
 // These register addresses give the position relative to the base of the cores
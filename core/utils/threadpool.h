@@ -0,0 +1,260 @@
+#ifndef PXAR_THREADPOOL_H
+#define PXAR_THREADPOOL_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <stddef.h>
+
+#if (defined WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif //WIN32
+
+namespace pxar {
+
+  /** Unit of work for the pxar::threadPool: process() is called exactly once
+   *  for every item index of a run. Different items are processed concurrently
+   *  and have to write to separate output slots.
+   */
+  class threadJob {
+  public:
+    virtual ~threadJob() {}
+    virtual void process(size_t item) = 0;
+  };
+
+  /** Small fixed-size pool of worker threads used to spread independent data
+   *  processing steps (e.g. the repacking of DAC points) over the available
+   *  CPU cores. The calling thread takes part in every run, so a pool of size
+   *  one does not start any threads and processes everything serially.
+   *
+   *  Users that do not need a pool of their own should use the process-wide
+   *  threadPool::shared() instead of creating one, so that several pxar::api
+   *  instances and analysis helpers do not multiply the number of threads.
+   */
+  class threadPool {
+  public:
+    /** Set up the pool, the worker threads are only started with the first
+     *  run that needs them. With nthreads zero the pool is sized to the number
+     *  of CPU cores available, but at most to maxDefaultThreads.
+     */
+    threadPool(unsigned int nthreads = 0) :
+      _started(false), _job(NULL), _nitems(0), _next(0), _chunk(1), _active(0), _generation(0), _stop(false), _failed(false) {
+
+      _nthreads = (nthreads > 0 ? nthreads : defaultSize());
+      lockInit();
+    }
+
+    /** Stop and join all worker threads */
+    ~threadPool() {
+      lock();
+      _stop = true;
+      broadcast(_start);
+      unlock();
+      for(size_t i = 0; i < _threads.size(); i++) {
+#ifdef WIN32
+	WaitForSingleObject(_threads.at(i), INFINITE);
+	CloseHandle(_threads.at(i));
+#else
+	pthread_join(_threads.at(i), NULL);
+#endif
+      }
+      lockDestroy();
+    }
+
+    /** Upper limit for the size of pools created with nthreads zero */
+    static const unsigned int maxDefaultThreads = 4;
+
+    /** The process-wide pool, sized to the default until changed with
+     *  setSize() before its first run
+     */
+    static threadPool & shared() {
+      static threadPool pool;
+      return pool;
+    }
+
+    /** Number of threads working on a run, including the caller */
+    unsigned int size() const { return _nthreads; }
+
+    /** Change the number of threads (zero: default size). Only possible as
+     *  long as the worker threads have not been started, returns false after.
+     */
+    bool setSize(unsigned int nthreads) {
+      lock();
+      bool ok = !_started;
+      if(ok) { _nthreads = (nthreads > 0 ? nthreads : defaultSize()); }
+      unlock();
+      return ok;
+    }
+
+    /** Process items 0...nitems-1 of the job and return when all of them are
+     *  done. Items are handed out in contiguous chunks, the order in which they
+     *  are processed is not defined. If processing of any item throws, a
+     *  std::runtime_error is thrown after all other items have completed.
+     *  While the pool is busy with the run of another caller, the items are
+     *  processed serially in the calling thread instead of waiting.
+     */
+    void run(threadJob & job, size_t nitems) {
+
+      if(nitems == 0) return;
+
+      lock();
+      if(!_started && _job == NULL && nitems > 1) { start(); }
+
+      // Nothing to share or the pool is busy, keep it in the calling thread:
+      if(_threads.empty() || nitems == 1 || _job != NULL) {
+	unlock();
+	for(size_t item = 0; item < nitems; item++) { job.process(item); }
+	return;
+      }
+
+      _job = &job;
+      _nitems = nitems;
+      _next = 0;
+      // A few chunks per thread to balance uneven items without much locking:
+      _chunk = nitems/(4*_nthreads) + 1;
+      _active = static_cast<unsigned int>(_threads.size());
+      _failed = false;
+      _generation++;
+      broadcast(_start);
+
+      // The caller helps out:
+      work();
+      while(_active > 0) { wait(_done); }
+
+      _job = NULL;
+      bool failed = _failed;
+      std::string error = _error;
+      unlock();
+
+      if(failed) { throw std::runtime_error("threadPool: " + error); }
+    }
+
+    /** Size of pools created with nthreads zero: the number of CPU cores
+     *  available, at most maxDefaultThreads
+     */
+    static unsigned int defaultSize() {
+      unsigned int n = hardwareConcurrency();
+      if(n > maxDefaultThreads) { n = maxDefaultThreads; }
+      return n;
+    }
+
+    /** Number of CPU cores available to the process */
+    static unsigned int hardwareConcurrency() {
+#ifdef WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return static_cast<unsigned int>(info.dwNumberOfProcessors);
+#else
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      return (n > 0 ? static_cast<unsigned int>(n) : 1);
+#endif
+    }
+
+  private:
+#ifdef WIN32
+    typedef HANDLE thread_t;
+    typedef CONDITION_VARIABLE cond_t;
+    CRITICAL_SECTION _mutex;
+    void lockInit() { InitializeCriticalSection(&_mutex); InitializeConditionVariable(&_start); InitializeConditionVariable(&_done); }
+    void lockDestroy() { DeleteCriticalSection(&_mutex); }
+    void lock() { EnterCriticalSection(&_mutex); }
+    void unlock() { LeaveCriticalSection(&_mutex); }
+    void wait(cond_t & cond) { SleepConditionVariableCS(&cond, &_mutex, INFINITE); }
+    void signal(cond_t & cond) { WakeConditionVariable(&cond); }
+    void broadcast(cond_t & cond) { WakeAllConditionVariable(&cond); }
+    static DWORD WINAPI worker(LPVOID pool) { static_cast<threadPool*>(pool)->loop(); return 0; }
+#else
+    typedef pthread_t thread_t;
+    typedef pthread_cond_t cond_t;
+    pthread_mutex_t _mutex;
+    void lockInit() { pthread_mutex_init(&_mutex, NULL); pthread_cond_init(&_start, NULL); pthread_cond_init(&_done, NULL); }
+    void lockDestroy() { pthread_cond_destroy(&_done); pthread_cond_destroy(&_start); pthread_mutex_destroy(&_mutex); }
+    void lock() { pthread_mutex_lock(&_mutex); }
+    void unlock() { pthread_mutex_unlock(&_mutex); }
+    void wait(cond_t & cond) { pthread_cond_wait(&cond, &_mutex); }
+    void signal(cond_t & cond) { pthread_cond_signal(&cond); }
+    void broadcast(cond_t & cond) { pthread_cond_broadcast(&cond); }
+    static void * worker(void * pool) { static_cast<threadPool*>(pool)->loop(); return NULL; }
+#endif
+
+    /** Start the worker threads, called with the lock held */
+    void start() {
+      _started = true;
+      for(unsigned int i = 1; i < _nthreads; i++) {
+#ifdef WIN32
+	HANDLE thread = CreateThread(NULL, 0, worker, this, 0, NULL);
+	if(thread == NULL) break;
+#else
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, worker, this) != 0) break;
+#endif
+	_threads.push_back(thread);
+      }
+      // Whatever we did not manage to start runs in the calling thread:
+      _nthreads = static_cast<unsigned int>(_threads.size()) + 1;
+    }
+
+    /** Worker thread main loop: wait for a new run, take part, report back */
+    void loop() {
+      lock();
+      unsigned long seen = 0;
+      while(true) {
+	while(!_stop && _generation == seen) { wait(_start); }
+	if(_stop) break;
+	seen = _generation;
+	work();
+	if(--_active == 0) { signal(_done); }
+      }
+      unlock();
+    }
+
+    /** Process chunks of the current run until none are left. Called and
+     *  returns with the lock held, the items are processed without it.
+     */
+    void work() {
+      while(_next < _nitems) {
+	size_t begin = _next;
+	size_t end = (_nitems - begin > _chunk ? begin + _chunk : _nitems);
+	_next = end;
+	threadJob * job = _job;
+	unlock();
+
+	std::string error;
+	bool failed = false;
+	try {
+	  for(size_t item = begin; item < end; item++) { job->process(item); }
+	}
+	catch(std::exception & e) { failed = true; error = e.what(); }
+	catch(...) { failed = true; error = "unknown exception"; }
+
+	lock();
+	if(failed && !_failed) { _failed = true; _error = error; }
+      }
+    }
+
+    // Not to be copied:
+    threadPool(const threadPool &);
+    threadPool & operator=(const threadPool &);
+
+    unsigned int _nthreads;
+    bool _started;
+    std::vector<thread_t> _threads;
+    cond_t _start;
+    cond_t _done;
+
+    threadJob * _job;
+    size_t _nitems;
+    size_t _next;
+    size_t _chunk;
+    unsigned int _active;
+    unsigned long _generation;
+    bool _stop;
+    bool _failed;
+    std::string _error;
+  };
+
+}
+#endif
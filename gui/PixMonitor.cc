@@ -88,8 +88,11 @@ void PixMonitor::handleButtons(Int_t id) {
 void PixMonitor::Update() {
   static float ia(0.), id(0.); 
   if (fGui->getApi()) {
-    ia = static_cast<float>(fGui->getApi()->getTBia());
-    id = static_cast<float>(fGui->getApi()->getTBid());
+    // -- cached telemetry: DAQ loops keep it up to date, sample here only when idle
+    fGui->getApi()->telemetryTick();
+    telemetrySample sample = fGui->getApi()->getTelemetry();
+    ia = static_cast<float>(sample.ia);
+    id = static_cast<float>(sample.id);
   } else {
     ia += 1.0; 
     id += 1.0; 
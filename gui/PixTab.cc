@@ -209,6 +209,10 @@ PixTab::PixTab(PixGui *p, PixTest *test, string tabname) {
   fTabFrame->Resize(fTabFrame->GetDefaultSize());
   fTabFrame->MapWindow();
 
+  // -- periodically pull the online histograms of DAQ type tests
+  fTimer = new TTimer(1000);
+  fTimer->Connect("Timeout()", "PixTab", this, "pullOnlineHistos()");
+  fTimer->TurnOn();
 }
 
 
@@ -224,12 +228,14 @@ void PixTab::init(PixGui *p, PixTest *test, string tabname) {
   fTest = test; 
   fTabName = tabname; 
   fCount = 0; 
+  fTimer = 0;
 }
 
 // ----------------------------------------------------------------------
 // PixTab destructor
 PixTab::~PixTab() {
   //  LOG(logINFO) << "PixTab destructor";
+  delete fTimer;
 }
 
 
@@ -301,6 +307,7 @@ void PixTab::boxChecked() {
   TGCheckButton *btn = (TGCheckButton*) gTQSender;
   string sTitle = btn->GetTitle();
   LOG(logDEBUG) << "xxxPressed():  " << btn->GetTitle();
+  fTest->setCommonParameter(sTitle, string(btn->IsDown()?"1":"0"));
   fTest->setParameter(sTitle,string(btn->IsDown()?"1":"0")) ;
 
 }
@@ -378,6 +385,7 @@ void PixTab::setParameter() {
 		<< " -> " << fParIds[id]
 	       << " to value " << svalue;
 
+  fTest->setCommonParameter(fParIds[id], svalue);
   fTest->setParameter(fParIds[id], svalue); 
   updateToolTips();
 } 
@@ -457,6 +465,13 @@ void PixTab::update() {
 }
 
 
+// ----------------------------------------------------------------------
+void PixTab::pullOnlineHistos() {
+  if (0 == fEc1 || 0 == fTest) return;
+  if (fTest->syncOnlineHistos()) update();
+}
+
+
 // ----------------------------------------------------------------------
 void PixTab::statusBarUpdate(Int_t event, Int_t px, Int_t py, TObject *selected) {
   //  char text0[200], text2[200];
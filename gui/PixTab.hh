@@ -15,6 +15,7 @@
 #include <TGTextEntry.h>
 #include <TGTextView.h>
 #include <TGStatusBar.h>
+#include <TTimer.h>
 
 #include "PixGui.hh"
 #include "PixTest.hh"
@@ -37,6 +38,7 @@ public:
   virtual void moveUp(); 
 
   void update();
+  void pullOnlineHistos();
   void updateToolTips();
   void clearCanvas();
   void nextHistogram();
@@ -74,6 +76,7 @@ protected:
 
   PixGui               *fGui; 
   PixTest              *fTest; 
+  TTimer               *fTimer;
 
   int                   fBorderN, fBorderT, fBorderL;  // normal, tiny, large
   
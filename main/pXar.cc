@@ -21,6 +21,7 @@
 
 #include "PixTest.hh"
 #include "PixTestFactory.hh"
+#include "PixTestScheduler.hh"
 #include "PixGui.hh"
 #include "PixSetup.hh"
 #include "PixUtil.hh"
@@ -43,30 +44,34 @@ int main(int argc, char *argv[]){
 
   // -- command line arguments
   string dir("."), cmdFile("nada"), rootfile("nada.root"), logfile("nada.log"), 
-    verbosity("INFO"), flashFile("nada"), runtest("fulltest"), trimVcal(""), testParameters("nada"); 
+    verbosity("INFO"), flashFile("nada"), runtest("fulltest"), trimVcal(""), testParameters("nada"), modules(""); 
   bool doRunGui(false), 
     doRunScript(false), 
     doRunSingleTest(false), 
     doUpdateFlash(false),
     doUpdateRootFile(false),
     doMoreWebCloning(false), 
-    doUseRootLogon(false)
+    doUseRootLogon(false), 
+    doScanCache(false)
     ;
   for (int i = 0; i < argc; i++){
     if (!strcmp(argv[i],"-h")) {
       cout << "List of arguments:" << endl;
       cout << "-a                    do not do tests, do not recreate rootfile, but read in existing rootfile" << endl;
+      cout << "-b \"id1=d1[;id2=d2]\"  run the tests given with -t (comma separated) on several DTBs in parallel" << endl;
       cout << "-c filename           read in commands from filename" << endl;
       cout << "-d [--dir] path       directory with config files" << endl;
       cout << "-g                    start with GUI" << endl;
       cout << "-m                    clone pxar histograms into the histograms expected by moreweb" << endl;
       cout << "-p \"p1=v1[;p2=v2]\"  set parameters for test" << endl;
       cout << "-r rootfilename       set rootfile (and logfile) name" << endl;
+      cout << "-s [--scancache]      reuse results of identical scans on an unchanged DUT" << endl;
       cout << "-t test               run test" << endl;
       cout << "-T [--vcal] XX        read in DAC and Trim parameter files corresponding to trim VCAL = XX" << endl;
       cout << "-v verbositylevel     set verbosity level: QUIET CRITICAL ERROR WARNING DEBUG DEBUGAPI DEBUGHAL ..." << endl;
       return 0;
     }
+    if (!strcmp(argv[i],"-b"))                                {modules    = string(argv[++i]); }
     if (!strcmp(argv[i],"-c"))                                {cmdFile    = string(argv[++i]); doRunScript = true;} 
     if (!strcmp(argv[i],"-d") || !strcmp(argv[i], "--dir"))   {dir  = string(argv[++i]); }               
     if (!strcmp(argv[i],"-f"))                                {doUpdateFlash = true; flashFile = string(argv[++i]);} 
@@ -74,6 +79,7 @@ int main(int argc, char *argv[]){
     if (!strcmp(argv[i],"-m"))                                {doMoreWebCloning = true; } 
     if (!strcmp(argv[i],"-p"))                                {testParameters  = string(argv[++i]); }               
     if (!strcmp(argv[i],"-r"))                                {rootfile  = string(argv[++i]); }               
+    if (!strcmp(argv[i],"-s") || !strcmp(argv[i], "--scancache")) {doScanCache = true; }
     if (!strcmp(argv[i],"-t"))                                {doRunSingleTest = true; runtest  = string(argv[++i]); }
     if (!strcmp(argv[i],"-T") || !strcmp(argv[i], "--vcal"))  {trimVcal = string(argv[++i]); }
     if (!strcmp(argv[i],"-u"))                                {doUpdateRootFile = true;} 
@@ -97,6 +103,23 @@ int main(int argc, char *argv[]){
   }
 
 
+  // -- several modules in parallel, each with its own DTB and configuration directory
+  if (modules.compare("")) {
+    PixTestScheduler scheduler(verbosity);
+    vector<string> dtbs = PixUtil::split(modules, ';');
+    for (unsigned int i = 0; i < dtbs.size(); ++i) {
+      string::size_type m1 = dtbs[i].find("=");
+      if (m1 == string::npos) {
+	LOG(logERROR) << "cannot parse module specification ->" << dtbs[i] << "<-, expected DTB=directory";
+	return 1;
+      }
+      scheduler.addModule(dtbs[i].substr(0, m1), dtbs[i].substr(m1+1));
+    }
+    bool ok = scheduler.run(PixUtil::split(runtest, ','));
+    LOG(logINFO) << "pXar: this is the end, my friend";
+    return (ok ? 0 : 1);
+  }
+
   pxar::api *api(0);
   if (doUpdateFlash) {
     api = new pxar::api("*", verbosity);
@@ -158,6 +181,7 @@ int main(int argc, char *argv[]){
   try {
     api = new pxar::api("*", verbosity);
     
+    api->setScanCache(doScanCache); 
     api->initTestboard(sig_delays, power_settings, pg_setup);
     api->initDUT(configParameters->getHubId(),
 		 configParameters->getTbmType(), tbmDACs, 
@@ -250,6 +274,11 @@ int main(int argc, char *argv[]){
   }
   
   // -- clean exit (however, you should not get here when running with the GUI)
+  if (doScanCache) {
+    uint32_t hits(0), misses(0); 
+    api->getScanCacheStatistics(hits, misses); 
+    LOG(logINFO) << "scan cache: " << hits << " scans reused, " << misses << " scans taken"; 
+  }
   rfile->Close();
   if (api) delete api;
 
@@ -8,6 +8,8 @@
 #include <TMath.h>
 #include <TStyle.h>
 #include <TGMsgBox.h>
+#include <TThread.h>
+#include <TMutex.h>
 
 #include "PixTest.hh"
 #include "PixUtil.hh"
@@ -33,6 +35,12 @@ PixTest::PixTest(PixSetup *a, string name) {
   fParameters = a->getPixTestParameters()->getTestParameters(name); 
   fTree = 0; 
 
+  // -- parameters common to all tests, the derived classes do not know them
+  fParGroupPixels = false;
+  for (unsigned int i = 0; i < fParameters.size(); ++i) {
+    setCommonParameter(fParameters[i].first, fParameters[i].second);
+  }
+
   // -- provide default map when all ROCs are selected
   map<int, int> id2idx; 
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
@@ -47,6 +55,7 @@ PixTest::PixTest(PixSetup *a, string name) {
 PixTest::PixTest() {
   //  LOG(logINFO) << "PixTest ctor()";
   fTree = 0; 
+  fParGroupPixels = false;
   
 }
 
@@ -192,6 +201,9 @@ vector<TH1*> PixTest::scurveMaps(string dac, string name, int ntrig, int dacmin,
 vector<TH2D*> PixTest::efficiencyMaps(string name, uint16_t ntrig, uint16_t FLAGS) {
 
   vector<pixel> results;
+  // -- sparse pixel selections (e.g. sparseRoc()) are pulsed one pixel per double column at a time,
+  //    only on request until this has been validated on hardware
+  if (fParGroupPixels) FLAGS |= FLAG_GROUP_PIXELS;
 
   int cnt(0); 
   bool done = false;
@@ -341,6 +353,19 @@ bool PixTest::setParameter(string parName, string value) {
 }
 
 
+// ----------------------------------------------------------------------
+bool PixTest::setCommonParameter(string parName, string sval) {
+  std::transform(parName.begin(), parName.end(), parName.begin(), ::tolower);
+  if (!parName.compare("grouppixels")) {
+    PixUtil::replaceAll(sval, "checkbox(", ""); 
+    PixUtil::replaceAll(sval, ")", ""); 
+    fParGroupPixels = (atoi(sval.c_str()) != 0);
+    LOG(logDEBUG) << "  setting fParGroupPixels -> " << fParGroupPixels;
+    return true;
+  }
+  return false;
+}
+
 // ----------------------------------------------------------------------
 string PixTest::getParameter(std::string parName) {
   for (unsigned int i = 0; i < fParameters.size(); ++i) {
@@ -463,6 +488,62 @@ void PixTest::update() {
 }
 
 
+// ----------------------------------------------------------------------
+namespace {
+  struct readoutJob {
+    PixTest     *test;
+    TMutex       mutex;
+    bool         done;
+    std::string  error;
+  };
+}
+
+// ----------------------------------------------------------------------
+void* PixTest::readoutThread(void *arg) {
+  readoutJob *job = static_cast<readoutJob*>(arg);
+  string error;
+  try {
+    job->test->readoutLoop();
+  } catch (pxar::pxarException &e) {
+    error = e.what();
+  } catch (...) {
+    error = "unknown exception in the readout thread";
+  }
+  job->mutex.Lock();
+  job->error = error;
+  job->done = true;
+  job->mutex.UnLock();
+  return 0;
+}
+
+// ----------------------------------------------------------------------
+void PixTest::runReadout() {
+  readoutJob job;
+  job.test = this;
+  job.done = false;
+
+  TThread::Initialize();
+  TThread readout("readout", &PixTest::readoutThread, &job);
+  readout.Run();
+
+  // -- the GUI timer (online histograms) and stop() only ever run here, never inside the readout loop
+  bool done(false);
+  while (!done) {
+    gSystem->ProcessEvents();
+    gSystem->Sleep(10);
+    job.mutex.Lock();
+    done = job.done;
+    job.mutex.UnLock();
+  }
+  readout.Join();
+
+  if (job.error.size() > 0) {
+    LOG(logERROR) << "readout failed: " << job.error;
+    throw pxar::pxarException(job.error);
+  }
+}
+
+
 // ----------------------------------------------------------------------
 void PixTest::doTest() {
   //  LOG(logINFO) << "PixTest::doTest()";
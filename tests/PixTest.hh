@@ -204,6 +204,8 @@ public:
   std::string getParameter(std::string parName);
   /// set the string value of a parameter
   virtual bool setParameter(std::string parName, std::string sval); 
+  /// set a parameter common to all tests ("GroupPixels"), return true if parName is one of them
+  bool setCommonParameter(std::string parName, std::string sval);
   /// allow setting DACs in scripts for entire DUT
   virtual void setDAC(std::string parName, uint8_t val) {fApi->setDAC(parName, val);}
   /// allow setting DACs in scripts for spcific ROCs
@@ -236,6 +238,8 @@ public:
   void testDone(); // *SIGNAL*
   /// signal to PixTab to update the canvas
   void update();  // *SIGNAL*
+  /// copy the content of online histograms into the displayed ROOT histograms (polled by PixTab); return true if anything changed
+  virtual bool syncOnlineHistos() {return false;}
   /// allow forward iteration through list of histograms
   TH1* nextHist(); 
   /// allow backward iteration through list of histograms
@@ -246,6 +250,11 @@ protected:
 
   int histCycle(std::string hname);   ///< determine histogram cycle
   void fillMap(TH2D *hmod, TH2D *hroc, int iroc);  ///< provides the coordinate transformation to module map
+  /// run readoutLoop() on its own thread; meanwhile this thread keeps processing GUI events (stop, online histogram pulls)
+  void runReadout();
+  /// the DAQ readout loop of tests using runReadout(), must not touch the GUI or the displayed histograms
+  virtual void readoutLoop() {}
+  static void* readoutThread(void *arg); ///< thread function of runReadout()
 
   pxar::api            *fApi;  ///< pointer to the API
   PixSetup             *fPixSetup;  ///< all necessary stuff in one place
@@ -270,6 +279,7 @@ protected:
 
   std::vector<std::pair<int, int> > fPIX; ///< range of enabled pixels for time-consuming tests
   std::map<int, int>    fId2Idx; ///< map the ROC ID onto the (results vector) index of the ROC
+  bool                  fParGroupPixels; ///< efficiencyMaps() pulses sparse pixel selections grouped by double column (FLAG_GROUP_PIXELS), off by default
   TTree                *fTree; 
   TreeEvent             fTreeEvent;
   TTimeStamp           *fTimeStamp; 
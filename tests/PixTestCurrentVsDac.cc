@@ -121,21 +121,17 @@ void PixTestCurrentVsDac::doTest() {
     
     if( hia && hid ) {
       
-      // remember DAC
+      // sweep DAC, the original value is restored by the API
       
-      uint8_t dacval = fApi->_dut->getDAC( roc, fParDAC );
-      
-      // loop over DAC
       int dacmax = fApi->getDACRange(fParDAC);
-      for( int idac = 0; idac <= dacmax; ++idac ) {
-	
-	fApi->setDAC( fParDAC, idac, roc );
-	// delay
-	hia->SetBinContent( idac+1, fApi->getTBia()*1E3 );
-	hid->SetBinContent( idac+1, fApi->getTBid()*1E3 );
-      }
+      std::vector<std::pair<uint8_t, std::pair<double, double> > > 
+	currents = fApi->getCurrentVsDAC( fParDAC, 1, 0, dacmax, roc, 0, true );
       
-      fApi->setDAC( fParDAC, dacval, roc ); // restore
+      for( unsigned int i = 0; i < currents.size(); ++i ) {
+	int idac = currents[i].first;
+	hia->SetBinContent( idac+1, currents[i].second.first*1E3 );
+	hid->SetBinContent( idac+1, currents[i].second.second*1E3 );
+      }
     }
     else {
       LOG(logINFO) << "XX did not find "
@@ -2,6 +2,8 @@
 #include <algorithm>    // std::find
 #include <iostream>
 #include "PixTestDaq.hh"
+#include "PixHistEngine.hh"
+#include "PixTreeWriter.hh"
 #include "log.h"
 #include "helper.h"
 #include "timer.h"
@@ -13,7 +15,7 @@ using namespace pxar;
 ClassImp(PixTestDaq)
 
 // ----------------------------------------------------------------------
-PixTestDaq::PixTestDaq(PixSetup *a, std::string name) : PixTest(a, name), fParNtrig(0), fParStretch(0), fParFillTree(0), fParSeconds(0), fParTriggerFrequency(0), fParIter(0), fParDelayTBM(0), fParResetROC(0) {
+PixTestDaq::PixTestDaq(PixSetup *a, std::string name) : PixTest(a, name), fParNtrig(0), fParStretch(0), fParFillTree(0), fParSeconds(0), fParTriggerFrequency(0), fParIter(0), fParDelayTBM(0), fParResetROC(0), fHistEngine(0), fHistFiller(0), fHistSynced(0), fTreeWriter(0) {
   PixTest::init();
   init(); 
   LOG(logDEBUG) << "PixTestDaq ctor(PixSetup &a, string, TGTab *)";
@@ -25,7 +27,7 @@ PixTestDaq::PixTestDaq(PixSetup *a, std::string name) : PixTest(a, name), fParNt
 
 
 //----------------------------------------------------------
-PixTestDaq::PixTestDaq() : PixTest() {
+PixTestDaq::PixTestDaq() : PixTest(), fHistEngine(0), fHistFiller(0), fHistSynced(0), fTreeWriter(0) {
   LOG(logDEBUG) << "PixTestDaq ctor()";
   fTree = 0; 
 }
@@ -34,7 +36,9 @@ PixTestDaq::PixTestDaq() : PixTest() {
 PixTestDaq::~PixTestDaq() {
 	LOG(logDEBUG) << "PixTestDaq dtor, saving tree ... ";
 	fDirectory->cd();
-	if (fTree && fParFillTree) fTree->Write();
+	delete fHistFiller;
+	delete fTreeWriter;
+	delete fHistEngine;
 }
 
 // ----------------------------------------------------------------------
@@ -163,7 +167,11 @@ void PixTestDaq::pgToDefault() {
 // ----------------------------------------------------------------------
 void PixTestDaq::setHistos(){
 	
-	if (fParFillTree) bookTree();
+	// The events are written into the tree by a separate thread, it never holds up the readout
+	if (fParFillTree && 0 == fTreeWriter) {
+		fTreeWriter = new PixTreeWriter(fDirectory, "events");
+		fTreeWriter->start();
+	}
 	fHits.clear(); fPhmap.clear(); fPh.clear(); fQmap.clear(); fQ.clear();
 
 	std::vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs();
@@ -204,6 +212,35 @@ void PixTestDaq::setHistos(){
 		setTitles(h1, "Q [Vcal]", "Entries/bin");
 		fQ.push_back(h1);
 	}
+
+	// The DAQ loop hands the events to the filler thread, the online histograms
+	// are copied into the ROOT histograms in syncOnlineHistos()
+	delete fHistFiller;
+	delete fHistEngine;
+	fHistEngine = new PixHistEngine(rocIds, fPh[0], fQ[0]);
+	fHistFiller = new PixHistFiller(fHistEngine, fPhCalOK ? &fPhCal : 0);
+	fHistFiller->setTreeWriter(fTreeWriter);
+	fHistFiller->start();
+	fHistSynced = 0;
+}
+
+// ----------------------------------------------------------------------
+bool PixTestDaq::syncOnlineHistos() {
+	if (0 == fHistEngine) return false;
+
+	PixHistData data;
+	uint64_t nhits = fHistEngine->snapshot(data);
+	if (nhits == fHistSynced) return false;
+	fHistSynced = nhits;
+
+	for (unsigned int iroc = 0; iroc < fHits.size(); ++iroc) {
+		data.fillHits(iroc, fHits[iroc]);
+		data.fillPhMap(iroc, fPhmap[iroc]);
+		data.fillPh(iroc, fPh[iroc]);
+		data.fillQMap(iroc, fQmap[iroc]);
+		data.fillQ(iroc, fQ[iroc]);
+	}
+	return true;
 }
 
 // ----------------------------------------------------------------------
@@ -213,8 +250,9 @@ void PixTestDaq::ProcessData(uint16_t numevents){
 	std::vector<pxar::Event> daqdat;
 
 	if (numevents > 0) {
+		pxar::Event evt;
 		for (unsigned int i = 0; i < numevents; i++) {
-			pxar::Event evt = fApi->daqGetEvent();
+			if (!fApi->daqGetEvent(evt)) break;
 			//Check if event is empty?
 			if (evt.pixels.size() > 0)
 				daqdat.push_back(evt);
@@ -225,59 +263,11 @@ void PixTestDaq::ProcessData(uint16_t numevents){
 
 	LOG(logDEBUG) << "Processing Data: " << daqdat.size() << " events.";
 
-	int pixCnt(0);
-	int idx(-1);
-	uint16_t q;
-	vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs();
-	for (std::vector<pxar::Event>::iterator it = daqdat.begin(); it != daqdat.end(); ++it) {
-		pixCnt += it->pixels.size();
-
-		if (fParFillTree) {
-			fTreeEvent.header = it->header;
-			fTreeEvent.dac = 0;
-			fTreeEvent.trailer = it->trailer;
-			fTreeEvent.numDecoderErrors = it->numDecoderErrors;
-			fTreeEvent.npix = it->pixels.size();
-		}
-
-		for (unsigned int ipix = 0; ipix < it->pixels.size(); ++ipix) {
-			idx = getIdxFromId(it->pixels[ipix].roc_id);
-			if(idx == -1) {
-				LOG(logWARNING) << "PixTestDaq::ProcessData() wrong 'idx' value --> return";
-				return;    			
-			}
-			fHits[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row);
-			fPhmap[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row, it->pixels[ipix].getValue());
-			fPh[idx]->Fill(it->pixels[ipix].getValue());
+	LOG(logINFO) << "events read: " << daqdat.size();
 
-			if (fPhCalOK) {
-				q = static_cast<uint16_t>(fPhCal.vcal(it->pixels[ipix].roc_id, it->pixels[ipix].column,	
-								      it->pixels[ipix].row, it->pixels[ipix].getValue()));
-			}
-			else {
-				q = 0;
-			}
-			fQ[idx]->Fill(q);
-			fQmap[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row, q);
-				if (fParFillTree) {
-				fTreeEvent.proc[ipix] = it->pixels[ipix].roc_id;
-				fTreeEvent.pcol[ipix] = it->pixels[ipix].column;
-				fTreeEvent.prow[ipix] = it->pixels[ipix].row;
-				fTreeEvent.pval[ipix] = it->pixels[ipix].getValue();
-				fTreeEvent.pq[ipix] = q;
-			}
-		}
-	}
-	if (fParFillTree) fTree->Fill();
-	
-  	//to draw the hitsmap as 'online' check.
-	TH2D* h2 = (TH2D*)(fHits.back());
-	h2->Draw(getHistOption(h2).c_str());
-	fDisplayedHist = find(fHistList.begin(), fHistList.end(), h2);
-	PixTest::update();
-
-	LOG(logINFO) << Form("events read: %6ld, pixels seen: %3d, hist entries: %4d",
-	                 daqdat.size(), pixCnt,	static_cast<int>(fHits[0]->GetEntries()));	
+	// The filler thread takes over the events and hands them on to the tree writer,
+	// the GUI picks up the online histograms periodically:
+	fHistFiller->push(daqdat);
 }
 
 // ----------------------------------------------------------------------
@@ -289,6 +279,63 @@ void PixTestDaq::FinalCleaning() {
 	fPg_setup.clear();
 }
 
+// ----------------------------------------------------------------------
+void PixTestDaq::readoutLoop() {
+
+  //If using number of triggers
+  if(fParNtrig > 0) {
+
+	for (int i = 0; i < fParIter && fDaq_loop; i++) {
+		//Send the triggers:
+    	fApi->daqTrigger(fParNtrig);
+		ProcessData(0);
+	}
+	fApi->daqStop();
+
+  } else {  //Use seconds
+
+	//Start trigger loop + buffer fill management:
+	int finalPeriod = fApi->daqTriggerLoop(0);  //Period is automatically set to the minimum by Api function
+	LOG(logINFO) << "PixTestDaq:: start TriggerLoop with period " << finalPeriod << " and duration " << fParSeconds << " seconds";
+
+	  //To control the buffer filling
+	uint8_t perFull;
+	uint64_t diff = 0, timepaused = 0, timeff = 0;
+	timer t;
+	bool TotalTime = false;
+
+	while (fDaq_loop){    //Check every n seconds if buffer is full less then 80%
+	  while (fApi->daqStatus(perFull) && perFull < 80 && fDaq_loop) {     //Pause and drain the buffer if almost full.
+		  timeff = t.get() - timepaused;
+		  LOG(logINFO) << "Elapsed time: " << timeff / 1000 << " seconds.";
+		  if (timeff / 1000 >= fParSeconds) {
+			  fDaq_loop = false;
+			  TotalTime = true;
+			  break;
+		  }
+		  LOG(logINFO) << "buffer not full, at " << (int)perFull << "%";
+		  ProcessData();
+	  }
+	  if (fDaq_loop){
+		  LOG(logINFO) << "Buffer almost full, pausing triggers.";
+		  fApi->daqTriggerLoopHalt();
+		  diff = t.get();
+		  ProcessData(0);
+		  diff = t.get() - diff;
+		  timepaused += diff;
+		  LOG(logDEBUG) << "Readout time: " << timepaused / 1000 << " seconds.";
+		  LOG(logINFO) << "Resuming triggers for " << fParSeconds - (timeff/1000) << " seconds.";
+		  fApi->daqTriggerLoop(0);
+	  }
+	  else {
+		  if (TotalTime) { LOG(logINFO) << "PixTestDaq:: total time reached - DAQ stopped."; }
+		  fApi->daqStop();
+		  ProcessData(0);
+	  }
+	}
+  }
+}
+
 // ----------------------------------------------------------------------
 void PixTestDaq::doTest() {
 
@@ -307,6 +354,10 @@ void PixTestDaq::doTest() {
   //Set the histograms:
   if(fHistList.size() == 0) setHistos();  //to book histo only for the first 'doTest' (or after Clear).
 
+  //to draw the hitsmap as 'online' check.
+  fHits.back()->Draw(getHistOption(fHits.back()).c_str());
+  PixTest::update();
+
   // Start the DAQ:
   //::::::::::::::::::::::::::::::::
 
@@ -347,62 +398,18 @@ void PixTestDaq::doTest() {
   //Start the DAQ:
   fApi->daqStart();
 
-  //If using number of triggers
-  if(fParNtrig > 0) {
-
-	for (int i = 0; i < fParIter && fDaq_loop; i++) {
-		//Send the triggers:
-    	fApi->daqTrigger(fParNtrig);
-		gSystem->ProcessEvents();
-		ProcessData(0);
-	}
-	fApi->daqStop();
-
-  } else {  //Use seconds
-
-	//Start trigger loop + buffer fill management:
-	int finalPeriod = fApi->daqTriggerLoop(0);  //Period is automatically set to the minimum by Api function
-	LOG(logINFO) << "PixTestDaq:: start TriggerLoop with period " << finalPeriod << " and duration " << fParSeconds << " seconds";
-
-	  //To control the buffer filling
-	uint8_t perFull;
-	uint64_t diff = 0, timepaused = 0, timeff = 0;
-	timer t;
-	bool TotalTime = false;
+  //The readout runs on its own thread, this thread keeps the GUI alive:
+  runReadout();
 
-	while (fDaq_loop){    //Check every n seconds if buffer is full less then 80%
-	  while (fApi->daqStatus(perFull) && perFull < 80 && fDaq_loop) {     //Pause and drain the buffer if almost full.
-		  timeff = t.get() - timepaused;
-		  LOG(logINFO) << "Elapsed time: " << timeff / 1000 << " seconds.";
-		  if (timeff / 1000 >= fParSeconds) {
-			  fDaq_loop = false;
-			  TotalTime = true;
-			  break;
-		  }
-		  LOG(logINFO) << "buffer not full, at " << (int)perFull << "%";
-		  gSystem->ProcessEvents();
-		  ProcessData();
-	  }
-	  if (fDaq_loop){
-		  LOG(logINFO) << "Buffer almost full, pausing triggers.";
-		  fApi->daqTriggerLoopHalt();
-		  diff = t.get();
-		  ProcessData(0);
-		  diff = t.get() - diff;
-		  timepaused += diff;
-		  LOG(logDEBUG) << "Readout time: " << timepaused / 1000 << " seconds.";
-		  LOG(logINFO) << "Resuming triggers for " << fParSeconds - (timeff/1000) << " seconds.";
-		  fApi->daqTriggerLoop(0);
-	  }
-	  else {
-		  if (TotalTime) { LOG(logINFO) << "PixTestDaq:: total time reached - DAQ stopped."; }
-		  fApi->daqStop();
-		  ProcessData(0);
-	  }
-	}
-  }
   //::::::::::::::::::::::::::::::
   //DAQ - THE END.
+  // The filler hands its batches on to the tree writer, drain it first:
+  fHistFiller->drain();
+  syncOnlineHistos();
+  if (fTreeWriter) {
+	fTreeWriter->drain();
+	fTreeWriter->report();
+  }
 
   //to draw and save histograms
   TH1D *h1(0);
@@ -10,6 +10,10 @@
 
 #include <TTree.h>
 
+class PixHistEngine;
+class PixHistFiller;
+class PixTreeWriter;
+
 class DLLEXPORT PixTestDaq: public PixTest {
 public:
   PixTestDaq(PixSetup *, std::string);
@@ -25,9 +29,13 @@ public:
   void setHistos();
   void ProcessData(uint16_t numevents = 1000);
   void FinalCleaning();
+  virtual bool syncOnlineHistos();
 
   void doTest();
 
+protected:
+  void readoutLoop();
+
 private:
 
   void stop();
@@ -54,6 +62,12 @@ private:
   std::vector<TH1D*> fQ;
   std::vector<TProfile2D*> fQmap;
 
+  PixHistEngine *fHistEngine; //! online histograms
+  PixHistFiller *fHistFiller; //! fills fHistEngine on its own thread
+  uint64_t       fHistSynced; //! number of hits already copied into the ROOT histograms
+
+  PixTreeWriter *fTreeWriter; //! writes the events into the tree on its own thread
+
   ClassDef(PixTestDaq, 1)
 
 };
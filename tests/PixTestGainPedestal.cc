@@ -4,6 +4,7 @@
 #include <fstream>
 
 #include <TH1.h>
+#include <TH2.h>
 #include <TRandom.h>
 #include <TROOT.h>
 #include <TStyle.h>
@@ -11,7 +12,9 @@
 
 #include "PixTestGainPedestal.hh"
 #include "PixUtil.hh"
+#include "PixGainFit.hh"
 #include "log.h"
+#include "helper.h"
 
 
 using namespace std;
@@ -20,14 +23,14 @@ using namespace pxar;
 ClassImp(PixTestGainPedestal)
 
 // ----------------------------------------------------------------------
-PixTestGainPedestal::PixTestGainPedestal(PixSetup *a, std::string name) : PixTest(a, name), fParShowFits(0), fParNtrig(-1)  {
+PixTestGainPedestal::PixTestGainPedestal(PixSetup *a, std::string name) : PixTest(a, name), fParShowFits(0), fParNtrig(-1), fGainData(0)  {
   PixTest::init();
   init(); 
 }
 
 
 //----------------------------------------------------------
-PixTestGainPedestal::PixTestGainPedestal() : PixTest() {
+PixTestGainPedestal::PixTestGainPedestal() : PixTest(), fGainData(0) {
   //  LOG(logDEBUG) << "PixTestGainPedestal ctor()";
 }
 
@@ -102,6 +105,7 @@ void PixTestGainPedestal::bookHist(string /*name*/) {
 //----------------------------------------------------------
 PixTestGainPedestal::~PixTestGainPedestal() {
   LOG(logDEBUG) << "PixTestGainPedestal dtor";
+  delete fGainData;
 }
 
 
@@ -146,25 +150,26 @@ void PixTestGainPedestal::measure() {
 
   cacheDacs();
  
-  TH1D *h1(0); 
+  // -- calibration points in low range units: first the low range, then the high range
+  int scaleLo(7); 
+  vector<double> vcal;
+  for (unsigned int i = 0; i < fLpoints.size(); ++i) vcal.push_back(fLpoints[i]); 
+  for (unsigned int i = 0; i < fHpoints.size(); ++i) vcal.push_back(scaleLo*fHpoints[i]); 
+
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  delete fGainData; 
+  fGainData = new PixGainData(rocIds.size(), vcal); 
+
+  // -- one overview per ROC instead of one histogram per pixel
+  TH2D *h2(0); 
+  vector<TH2D*> hlist; 
   string name; 
-  fHists.clear();
   for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc){
-    for (unsigned int ix = 0; ix < 52; ++ix) {
-      for (unsigned int iy = 0; iy < 80; ++iy) {
-	name = Form("gainPedestal_c%d_r%d_C%d", ix, iy, rocIds[iroc]); 
-	h1 = bookTH1D(name, name, 1800, 0., 1800.);
-	h1->SetMinimum(0);
-	h1->SetMaximum(260.); 
-	h1->SetNdivisions(506);
-	h1->SetMarkerStyle(20);
-	h1->SetMarkerSize(1.);
-	setTitles(h1, "Vcal [low range]", "PH [ADC]"); 
-	fHists.insert(make_pair(name, h1)); 
-	fHistList.push_back(h1);
-      }
-    }
+    name = Form("gainPedestal_C%d", rocIds[iroc]); 
+    h2 = bookTH2D(name, name, 1800, 0., 1800., 260, 0., 260.);
+    setTitles(h2, "Vcal [low range]", "PH [ADC]"); 
+    hlist.push_back(h2); 
+    fHistList.push_back(h2);
   }
 
   fApi->_dut->testAllPixels(true);
@@ -176,96 +181,87 @@ void PixTestGainPedestal::measure() {
   //    OutputFile << "Low range:  50 100 150 200 250 " << endl;
   //    OutputFile << "High range:  30  50  70  90 200 " << endl;
 
-  vector<pair<uint8_t, vector<pixel> > > rresult, lresult, hresult; 
-  for (unsigned int i = 0; i < fLpoints.size(); ++i) {
-    LOG(logINFO) << "scanning low vcal = " << fLpoints[i];
-    int cnt(0); 
-    bool done = false;
-    while (!done){
-      try {
-	rresult = fApi->getPulseheightVsDAC("vcal", fLpoints[i], fLpoints[i], FLAGS, fParNtrig);
-	copy(rresult.begin(), rresult.end(), back_inserter(lresult)); 
-	done = true; // got our data successfully
-      }
-      catch(pxar::DataMissingEvent &e){
-	LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
-	++cnt;
-	if (e.numberMissing > 10) done = true; 
-      } catch(pxarException &e) {
-	LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
-	++cnt;
-      }
-      done = (cnt>5) || done;
+  vector<pair<uint8_t, vector<pixel> > > lresult, hresult; 
+  vector<uint8_t> lpoints(fLpoints.begin(), fLpoints.end());
+  LOG(logINFO) << "scanning low vcal = " << listVector(lpoints);
+  int cnt(0); 
+  bool done = false;
+  while (!done){
+    try {
+      // -- all calibration points in one test loop
+      lresult = fApi->getPulseheightVsDACList("vcal", lpoints, FLAGS, fParNtrig);
+      done = true; // got our data successfully
+    }
+    catch(pxar::DataMissingEvent &e){
+      LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
+      ++cnt;
+      if (e.numberMissing > 10) done = true; 
+    } catch(pxarException &e) {
+      LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
+      ++cnt;
     }
+    done = (cnt>5) || done;
   }
 
   // -- and high range
   fApi->setDAC("ctrlreg", 4);
-  for (unsigned int i = 0; i < fHpoints.size(); ++i) {
-    LOG(logINFO) << "scanning high vcal = " << fHpoints[i] << " (= " << 7*fHpoints[i] << " in low range)";
-    int cnt(0); 
-    bool done = false;
-    while (!done){
-      try {
-	rresult = fApi->getPulseheightVsDAC("vcal", fHpoints[i], fHpoints[i], FLAGS, fParNtrig);
-	copy(rresult.begin(), rresult.end(), back_inserter(hresult)); 
-	done = true; // got our data successfully
-      }
-      catch(pxar::DataMissingEvent &e){
-	LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
-	++cnt;
-	if (e.numberMissing > 10) done = true; 
-      } catch(pxarException &e) {
-	LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
-	++cnt;
-      }
-      done = (cnt>5) || done;
+  vector<uint8_t> hpoints(fHpoints.begin(), fHpoints.end());
+  LOG(logINFO) << "scanning high vcal = " << listVector(hpoints) << " (x7 in low range)";
+  cnt = 0; 
+  done = false;
+  while (!done){
+    try {
+      hresult = fApi->getPulseheightVsDACList("vcal", hpoints, FLAGS, fParNtrig);
+      done = true; // got our data successfully
     }
+    catch(pxar::DataMissingEvent &e){
+      LOG(logCRITICAL) << "problem with readout: "<< e.what() << " missing " << e.numberMissing << " events"; 
+      ++cnt;
+      if (e.numberMissing > 10) done = true; 
+    } catch(pxarException &e) {
+      LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
+      ++cnt;
+    }
+    done = (cnt>5) || done;
   }
 
   double sf(2.), err(0.);
   for (unsigned int i = 0; i < lresult.size(); ++i) {
     int dac = lresult[i].first; 
+    vector<int>::iterator ip = find(fLpoints.begin(), fLpoints.end(), dac); 
+    if (ip == fLpoints.end()) continue;
+    int ipoint = ip - fLpoints.begin(); 
     vector<pixel> vpix = lresult[i].second;
     for (unsigned int ipx = 0; ipx < vpix.size(); ++ipx) {
-      int roc = vpix[ipx].roc_id;
-      int ic = vpix[ipx].column;
-      int ir = vpix[ipx].row;
-      name = Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc); 
-      h1 = fHists[name];
-      if (h1) {
-	h1->SetBinContent(dac+1, vpix[ipx].getValue());
-	h1->SetBinError(dac+1, (err>1?sf*err:sf)); //FIXME using variance as error
-      } else {
-	LOG(logDEBUG) << " histogram " << Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc) << " not found";
-      }
+      int idx = getIdxFromId(vpix[ipx].roc_id);
+      if (idx < 0) continue;
+      fGainData->fill(idx, vpix[ipx].column, vpix[ipx].row, ipoint, vpix[ipx].getValue(), (err>1?sf*err:sf)); //FIXME using variance as error
+      hlist[idx]->Fill(dac, vpix[ipx].getValue()); 
     } 
   } 
 
-  int scaleLo(7); 
   for (unsigned int i = 0; i < hresult.size(); ++i) {
     int dac = hresult[i].first; 
+    vector<int>::iterator ip = find(fHpoints.begin(), fHpoints.end(), dac); 
+    if (ip == fHpoints.end()) continue;
+    int ipoint = fLpoints.size() + (ip - fHpoints.begin()); 
     vector<pixel> vpix = hresult[i].second;
     for (unsigned int ipx = 0; ipx < vpix.size(); ++ipx) {
-      int roc = vpix[ipx].roc_id;
-      int ic = vpix[ipx].column;
-      int ir = vpix[ipx].row;
-      name = Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc); 
-      h1 = fHists[name];
-      if (h1) {
-	h1->SetBinContent(scaleLo*dac+1, vpix[ipx].getValue());
-	err = vpix[ipx].getVariance();
-	h1->SetBinError(scaleLo*dac+1, (err>1?sf*err:sf)); //FIXME using variance as error
-      } else {
-	LOG(logDEBUG) << " histogram " << Form("gainPedestal_c%d_r%d_C%d", ic, ir, roc) << " not found";
-      }
+      int idx = getIdxFromId(vpix[ipx].roc_id);
+      if (idx < 0) continue;
+      err = vpix[ipx].getVariance();
+      fGainData->fill(idx, vpix[ipx].column, vpix[ipx].row, ipoint, vpix[ipx].getValue(), (err>1?sf*err:sf)); //FIXME using variance as error
+      hlist[idx]->Fill(scaleLo*dac, vpix[ipx].getValue()); 
     } 
   } 
 
   gStyle->SetOptStat(0); 
   gROOT->ForceStyle();
-  h1->Draw(); 
-  fDisplayedHist = find(fHistList.begin(), fHistList.end(), h1);
+  if (hlist.size() > 0) {
+    h2 = hlist.back(); 
+    h2->Draw("colz"); 
+    fDisplayedHist = find(fHistList.begin(), fHistList.end(), h2);
+  }
 
   printHistograms();
 
@@ -282,13 +278,12 @@ void PixTestGainPedestal::fit() {
   PixTest::update(); 
   fDirectory->cd();
 
+  if (0 == fGainData) {
+    LOG(logWARNING) << "PixTestGainPedestal::fit() no data, run measure first"; 
+    return;
+  }
 
-  TH1D *h1 = (*fHists.begin()).second; 
-  TF1 *f = fPIF->gpTanH(h1); 
-
-  vector<vector<gainPedestalParameters> > v;
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
-  gainPedestalParameters a; a.p0 = a.p1 = a.p2 = a.p3 = 0.;
   TH1D* h(0);
   vector<TH1D*> p1list; 
   for (unsigned int i = 0; i < rocIds.size(); ++i) {
@@ -296,34 +291,52 @@ void PixTestGainPedestal::fit() {
     h = bookTH1D(Form("gainPedestalP1_C%d", i), Form("gainPedestalP1_C%d", rocIds[i]), 100, 0., 2.); 
     setTitles(h, "p1", "Entries / Bin"); 
     p1list.push_back(h); 
-    vector<gainPedestalParameters> vroc;
-    for (unsigned j = 0; j < 4160; ++j) {
-      vroc.push_back(a); 
-    }
-    v.push_back(vroc); 
   }
-  
-  map<string, TH1D*>::iterator hend = fHists.end(); 
-  int ic, ir, iroc, idx; 
-  for (map<string, TH1D*>::iterator i = fHists.begin(); i != hend; ++i) {
-    h1 = (*i).second; 
-    if (h1->GetEntries() < 1) continue;
-    string h1name = h1->GetName();
-    if (fParShowFits) {
-      LOG(logDEBUG) << h1name; 
-      h1->Fit(f, "r");
-      PixTest::update(); 
-    } else {
-      h1->Fit(f, "rq");
-    }
-    sscanf(h1name.c_str(), "gainPedestal_c%d_r%d_C%d", &ic, &ir, &iroc); 
-    idx = ic*80 + ir; 
+
+  // -- all pixels at once on the plain arrays, spread over the CPU cores
+  vector<vector<gainPedestalParameters> > v;
+  PixGainFitter fitter; 
+  vector<pair<unsigned int, int> > failed = fitter.fit(*fGainData, v); 
+  LOG(logDEBUG) << "fitted " << fGainData->getNRocs()*4160 << " pixels, " << failed.size() << " failed"; 
+
+  // -- pixels that did not converge: histogram and fit with ROOT as before
+  TH1D *h1(0); 
+  TF1 *f(0); 
+  for (unsigned int i = 0; i < failed.size(); ++i) {
+    unsigned int iroc = failed[i].first; 
+    int idx = failed[i].second; 
+    h1 = bookPixelHist(iroc, idx); 
+    f = fPIF->gpTanH(h1); 
+    h1->Fit(f, (fParShowFits ? "r" : "rq"));
     v[iroc][idx].p0 = f->GetParameter(0); 
     v[iroc][idx].p1 = f->GetParameter(1); 
     v[iroc][idx].p2 = f->GetParameter(2); 
     v[iroc][idx].p3 = f->GetParameter(3); 
+    LOG(logDEBUG) << "ROOT fit for " << h1->GetName() << ": p1 = " << v[iroc][idx].p1; 
+    if (fParShowFits) PixTest::update(); 
+  }
 
-    p1list[getIdxFromId(iroc)]->Fill(f->GetParameter(1)); 
+  // -- display all fits on request, with the parameters found above
+  if (fParShowFits) {
+    for (unsigned int iroc = 0; iroc < fGainData->getNRocs(); ++iroc) {
+      for (int idx = 0; idx < 4160; ++idx) {
+	if (0 == fGainData->nValid(iroc, idx)) continue;
+	h1 = bookPixelHist(iroc, idx); 
+	f = fPIF->gpTanH(h1); 
+	f->SetParameters(v[iroc][idx].p0, v[iroc][idx].p1, v[iroc][idx].p2, v[iroc][idx].p3); 
+	h1->GetListOfFunctions()->Add(f->Clone()); 
+	h1->Draw(); 
+	LOG(logDEBUG) << h1->GetName(); 
+	PixTest::update(); 
+      }
+    }
+  }
+
+  for (unsigned int iroc = 0; iroc < fGainData->getNRocs(); ++iroc) {
+    for (int idx = 0; idx < 4160; ++idx) {
+      if (0 == fGainData->nValid(iroc, idx)) continue;
+      p1list[iroc]->Fill(v[iroc][idx].p1); 
+    }
   }
 
   fPixSetup->getConfigParameters()->setGainPedestalParameters(v);
@@ -341,12 +354,34 @@ void PixTestGainPedestal::fit() {
   fDisplayedHist = find(fHistList.begin(), fHistList.end(), h);
   PixTest::update(); 
 
-  LOG(logINFO) << "PixTestGainPedestal::fit() done"; 
+  LOG(logINFO) << "PixTestGainPedestal::fit() done, " << failed.size() << " pixels fitted with ROOT"; 
   LOG(logINFO) << "p1 mean: " << p1MeanString; 
   LOG(logINFO) << "p1 RMS:  " << p1RmsString; 
 }
 
 
+// ----------------------------------------------------------------------
+TH1D* PixTestGainPedestal::bookPixelHist(unsigned int iroc, int idx) {
+  int ic = idx/80, ir = idx%80; 
+  string name = Form("gainPedestal_c%d_r%d_C%d", ic, ir, getIdFromIdx(iroc)); 
+  TH1D *h1 = bookTH1D(name, name, 1800, 0., 1800.);
+  h1->SetMinimum(0);
+  h1->SetMaximum(260.); 
+  h1->SetNdivisions(506);
+  h1->SetMarkerStyle(20);
+  h1->SetMarkerSize(1.);
+  setTitles(h1, "Vcal [low range]", "PH [ADC]"); 
+  for (unsigned int i = 0; i < fGainData->getNPoints(); ++i) {
+    if (!fGainData->valid(iroc, idx, i)) continue;
+    int bin = static_cast<int>(fGainData->vcal(i)) + 1; 
+    h1->SetBinContent(bin, fGainData->ph(iroc, idx, i));
+    h1->SetBinError(bin, fGainData->err(iroc, idx, i));
+  }
+  fHistList.push_back(h1);
+  return h1; 
+}
+
+
 
 // ----------------------------------------------------------------------
 void PixTestGainPedestal::saveGainPedestalParameters() {
@@ -363,8 +398,8 @@ void PixTestGainPedestal::output4moreweb() {
 void PixTestGainPedestal::printHistograms() {
 
   ofstream OutputFile;
-  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
-  unsigned nRocs = rocIds.size(); 
+  if (0 == fGainData) return;
+  unsigned nRocs = fGainData->getNRocs(); 
 
   for (unsigned int iroc = 0; iroc < nRocs; ++iroc) {
 
@@ -381,19 +416,13 @@ void PixTestGainPedestal::printHistograms() {
     OutputFile << endl;
     OutputFile << endl;
 
-    TH1D *h1(0); 
     for (int ic = 0; ic < 52; ++ic) {
       for (int ir = 0; ir < 80; ++ir) {
-	h1 = fHists[Form("gainPedestal_c%d_r%d_C%d", ic, ir, iroc)];
-
-	string h1name(h1->GetName()), line(""); 
+	string line(""); 
 
-	for (unsigned int i = 0; i < fLpoints.size(); ++i) {
-	  line += Form(" %3d", static_cast<int>(h1->GetBinContent(fLpoints[i]+1))); 
-	}
-	
-	for (unsigned int i = 0; i < fHpoints.size(); ++i) {
-	  line += Form(" %3d", static_cast<int>(h1->GetBinContent(7*fHpoints[i]+1))); 
+	// -- low range points first, then high range points
+	for (unsigned int i = 0; i < fGainData->getNPoints(); ++i) {
+	  line += Form(" %3d", static_cast<int>(fGainData->ph(iroc, ic*80+ir, i))); 
 	}
 	
 	line += Form("    Pix %2d %2d", ic, ir); 
@@ -3,6 +3,8 @@
 
 #include "PixTest.hh"
 
+class PixGainData;
+
 class DLLEXPORT PixTestGainPedestal: public PixTest {
 public:
   PixTestGainPedestal(PixSetup *, std::string);
@@ -24,10 +26,11 @@ public:
   void output4moreweb();
 
 private:
+  TH1D* bookPixelHist(unsigned int iroc, int ipx); 
 
   int         fParShowFits, fParNtrig, fParNpointsLo, fParNpointsHi;
 
-  std::map<std::string, TH1D*> fHists; 
+  PixGainData *fGainData; //! (vcal, ph, err) of all pixels, filled in measure()
   std::vector<int> fLpoints, fHpoints;
 
   ClassDef(PixTestGainPedestal, 1)
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <fstream>
 #include "PixTestHighRate.hh"
+#include "PixHotPixels.hh"
 #include "log.h"
 
 
@@ -19,7 +20,7 @@ ClassImp(PixTestHighRate)
 // ----------------------------------------------------------------------
 PixTestHighRate::PixTestHighRate(PixSetup *a, std::string name) : PixTest(a, name), 
   fParTriggerFrequency(0), fParRunSeconds(0),  
-  fParFillTree(false), fParDelayTBM(false) {
+  fParFillTree(false), fParDelayTBM(false), fHotPixels(0) {
   PixTest::init();
   init(); 
   LOG(logDEBUG) << "PixTestHighRate ctor(PixSetup &a, string, TGTab *)";
@@ -31,7 +32,7 @@ PixTestHighRate::PixTestHighRate(PixSetup *a, std::string name) : PixTest(a, nam
 
 
 //----------------------------------------------------------
-PixTestHighRate::PixTestHighRate() : PixTest() {
+PixTestHighRate::PixTestHighRate() : PixTest(), fHotPixels(0) {
   LOG(logDEBUG) << "PixTestHighRate ctor()";
   fTree = 0; 
 }
@@ -281,63 +282,6 @@ double PixTestHighRate::meanHit(TH2D *h2) {
   return mean; 
 }
 
-// ----------------------------------------------------------------------
-double PixTestHighRate::noiseLevel(TH2D *h2) {
-
-  TH1D *h1 = new TH1D("h1", "h1", 1000, 0., 1000.); 
-
-  for (int ix = 0; ix < h2->GetNbinsX(); ++ix) {
-    for (int iy = 0; iy < h2->GetNbinsY(); ++iy) {
-      h1->Fill(h2->GetBinContent(ix+1, iy+1)); 
-    }
-  }
-  
-  // -- skip bin for zero hits!
-  int noise(-1);
-  for (int ix = 1; ix < h1->GetNbinsX(); ++ix) {
-    if (h1->GetBinContent(ix+1) < 1) {
-      noise = ix; 
-      break;
-    }
-  }
-
-  int lastbin(1);
-  for (int ix = 1; ix < h1->GetNbinsX(); ++ix) {
-    if (h1->GetBinContent(ix+1) > 1) {
-      lastbin = ix; 
-    }
-  }
-
-
-  delete h1; 
-  LOG(logINFO) << "hist " << h2->GetName() 
-	       << " (maximum: " << h2->GetMaximum() << ") "
-	       << " noise level = " << noise << " last bin above 1: " << lastbin; 
-  return lastbin; 
-}
-
-
-// ----------------------------------------------------------------------
-int PixTestHighRate::countHitsAndMaskPixels(TH2D *h2, double noiseLevel, int iroc) {
-  
-  int cnt(0); 
-  double entries(0.); 
-  for (int ix = 0; ix < h2->GetNbinsX(); ++ix) {
-    for (int iy = 0; iy < h2->GetNbinsY(); ++iy) {
-      entries = h2->GetBinContent(ix+1, iy+1);
-      if (entries > noiseLevel) {
-	fApi->_dut->maskPixel(ix, iy, true, iroc); 
-	LOG(logINFO) << "ROC " << iroc << " masking pixel " << ix << "/" << iy 
-		     << " with #hits = " << entries << " (cut: " << noiseLevel << ")"; 
-      } else {
-	cnt += static_cast<int>(entries);
-      }
-    }
-  }
-  return cnt; 
-}
-
-
 // ----------------------------------------------------------------------
 void PixTestHighRate::pgToDefault(vector<pair<std::string, uint8_t> > /*pg_setup*/) {
   fPg_setup.clear();
@@ -373,6 +317,8 @@ void PixTestHighRate::maskHotPixels() {
   fApi->_dut->maskAllPixels(false);
   
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs();
+  fHotPixels = new PixHotPixels(rocIds);
+  fHotPixels->setRateFactor(6.);
   
   // -- Check and mask hot pixels
   bool done(false);
@@ -392,20 +338,16 @@ void PixTestHighRate::maskHotPixels() {
     for (unsigned i = 0; i < fHitMap.size(); ++i) {
       fHitMap[i]->Reset();
     }
+    fHotPixels->reset();
 
     doHitMap(1); 
-    for (unsigned int i = 0; i < rocIds.size(); ++i) {
-      vector<pair<int,int> > hotPixels = checkHotPixels(fHitMap[i]);
-      for (unsigned int j = 0; j<hotPixels.size(); ++j) {
- 	LOG(logDEBUG) << "mask hot pixel ROC/col/row: " << static_cast<int>(rocIds[i]) 
- 		      << "/" <<  hotPixels[j].first << "/" << hotPixels[j].second; 
- 	fApi->_dut->maskPixel(hotPixels[j].first, hotPixels[j].second, true,  rocIds[i]);
- 	fApi->_dut->testPixel(hotPixels[j].first, hotPixels[j].second, false, rocIds[i]);
-      }
-    }
-
+    int nmasked = fHotPixels->maskHotPixels(fApi->_dut, true);
+    LOG(logDEBUG) << "masked " << nmasked << " hot pixels at vthrcomp = " << vThrComp;
   }
 
+  delete fHotPixels;
+  fHotPixels = 0;
+
 
   LOG(logINFO) << "# masked pixels per ROC:"; 
   for (unsigned int i = 0; i < rocIds.size(); ++i) {
@@ -481,6 +423,7 @@ void PixTestHighRate::readData() {
     for (unsigned int ipix = 0; ipix < it->pixels.size(); ++ipix) {
       fHitMap[getIdxFromId(it->pixels[ipix].roc_id)]->Fill(it->pixels[ipix].column, it->pixels[ipix].row);
     }
+    if (fHotPixels) fHotPixels->fill(*it);
   }
   LOG(logDEBUG) << "Processing Data: " << daqdat.size() << " events with " << pixCnt << " pixels";
 }
@@ -6,6 +6,8 @@
 
 #include <TProfile2D.h>
 
+class PixHotPixels;
+
 
 class DLLEXPORT PixTestHighRate: public PixTest {
 public:
@@ -31,8 +33,6 @@ public:
   void doHitMap(int nseconds = 1);
 
   double meanHit(TH2D*); 
-  double noiseLevel(TH2D*); 
-  int    countHitsAndMaskPixels(TH2D*, double noiseLevel, int iroc); 
 
 private:
 
@@ -52,6 +52,8 @@ private:
 
   std::vector<TH2D*> fHitMap;
 
+  PixHotPixels *fHotPixels; //! hit counts for the hot pixel search, filled in readData() while set
+
   ClassDef(PixTestHighRate, 1)
 
 };
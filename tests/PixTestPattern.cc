@@ -569,7 +569,8 @@ void PixTestPattern::doTest()
 
 	//set the input filename (for Pattern and Pixels)
 	string fname;
-	ConfigParameters* config = ConfigParameters::Singleton();
+	// the module's own configuration, several modules may run in parallel (PixTestScheduler):
+	ConfigParameters* config = fPixSetup->getConfigParameters();
 	f_Directory = config->getDirectory();
 	fname = f_Directory + "/testPatterns.dat";
 
@@ -125,29 +125,29 @@ void PixTestPh::doTest() {
   fApi->_dut->testAllPixels(false);
   fApi->_dut->maskAllPixels(true);
   vector<pair<uint8_t, vector<pixel> > > rresult, result; 
-  for (int ievt = 0; ievt < fParNtrig; ++ievt) {
-    for (unsigned int i = 0; i < fPIX.size(); ++i) {
-      if (fPIX[i].first > -1)  {
-	fApi->_dut->testPixel(fPIX[i].first, fPIX[i].second, true);
-	fApi->_dut->maskPixel(fPIX[i].first, fPIX[i].second, false);
-
-	int cnt(0); 
-	bool done(false);
-	while (!done) {
-	  try {
-	    rresult = fApi->getPulseheightVsDAC(fParDAC, fParDacVal, fParDacVal, FLAGS, 1);
-	    done = true;
-	  } catch(pxarException &e) {
-	    LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
-	    ++cnt;
-	  }
-	  done = (cnt>5) || done;
+  // -- one entry per trigger: the same DAC value listed fParNtrig times, measured in one test loop
+  vector<uint8_t> dacValues(fParNtrig > 0 ? fParNtrig : 0, static_cast<uint8_t>(fParDacVal));
+  for (unsigned int i = 0; i < fPIX.size(); ++i) {
+    if (fPIX[i].first > -1)  {
+      fApi->_dut->testPixel(fPIX[i].first, fPIX[i].second, true);
+      fApi->_dut->maskPixel(fPIX[i].first, fPIX[i].second, false);
+
+      int cnt(0); 
+      bool done(false);
+      while (!done) {
+	try {
+	  rresult = fApi->getPulseheightVsDACList(fParDAC, dacValues, FLAGS, 1);
+	  done = true;
+	} catch(pxarException &e) {
+	  LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
+	  ++cnt;
 	}
-	
-	copy(rresult.begin(), rresult.end(), back_inserter(result)); 
-	fApi->_dut->testPixel(fPIX[i].first, fPIX[i].second, false);
-	fApi->_dut->maskPixel(fPIX[i].first, fPIX[i].second, true);
+	done = (cnt>5) || done;
       }
+	
+      copy(rresult.begin(), rresult.end(), back_inserter(result)); 
+      fApi->_dut->testPixel(fPIX[i].first, fPIX[i].second, false);
+      fApi->_dut->maskPixel(fPIX[i].first, fPIX[i].second, true);
     }
   }
 
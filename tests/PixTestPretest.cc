@@ -2,7 +2,6 @@
 #include <stdlib.h>  
 #include <algorithm> 
 
-#include <TStopwatch.h>
 #include <TMarker.h>
 #include <TStyle.h>
 
@@ -202,15 +201,8 @@ void PixTestPretest::setVana() {
     fApi->setDAC("vana", 0, iroc);
   }
   
-  double i016 = fApi->getTBia()*1E3;
-
-  // FIXME this should not be a stopwatch, but a delay
-  TStopwatch sw;
-  sw.Start(kTRUE); // reset
-  do {
-    sw.Start(kFALSE); // continue
-    i016 = fApi->getTBia()*1E3;
-  } while (sw.RealTime() < 0.1);
+  // -- wait for the analog current to settle (within 0.2 mA)
+  double i016 = fApi->waitTelemetrySettled("ia", 2E-4, 3, 1000)*1E3;
 
   // subtract one ROC to get the offset from the other Rocs (on average):
   double i015 = (nRocs-1) * i016 / nRocs; // = 0 for single chip tests
@@ -230,12 +222,7 @@ void PixTestPretest::setVana() {
     int vana = vanaStart[roc];
     fApi->setDAC("vana", vana, roc); // start value
 
-    double ia = fApi->getTBia()*1E3; // [mA], just to be sure to flush usb
-    sw.Start(kTRUE); // reset
-    do {
-      sw.Start(kFALSE); // continue
-      ia = fApi->getTBia()*1E3; // [mA]
-    } while (sw.RealTime() < 0.1);
+    double ia = fApi->waitTelemetrySettled("ia", 2E-4, 3, 1000)*1E3; // [mA]
 
     double diff = fTargetIa + extra - (ia - i015);
 
@@ -263,12 +250,7 @@ void PixTestPretest::setVana() {
       fApi->setDAC("vana", vana, roc);
       iter++;
 
-      sw.Start(kTRUE); // reset
-      do {
-	sw.Start(kFALSE); // continue
-	ia = fApi->getTBia()*1E3; // [mA]
-      }
-      while( sw.RealTime() < 0.1 );
+      ia = fApi->waitTelemetrySettled("ia", 2E-4, 3, 1000)*1E3; // [mA]
 
       diff = fTargetIa + extra - (ia - i015);
 
@@ -310,14 +292,7 @@ void PixTestPretest::setVana() {
     hcurr->Fill(roc, rocIana[roc]); 
   }
   
-  double ia16 = fApi->getTBia()*1E3; // [mA]
-
-  sw.Start(kTRUE); // reset
-  do {
-    sw.Start(kFALSE); // continue
-    ia16 = fApi->getTBia()*1E3; // [mA]
-  }
-  while( sw.RealTime() < 0.1 );
+  double ia16 = fApi->waitTelemetrySettled("ia", 2E-4, 3, 1000)*1E3; // [mA]
 
 
   hsum->Draw();
@@ -514,14 +489,7 @@ void PixTestPretest::setVthrCompId() {
     fApi->setDAC("VthrComp", 0, roc); // off
   }
 
-  double i016 = fApi->getTBid()*1E3;
-  TStopwatch sw;
-  sw.Start(kTRUE); // reset
-  do {
-    sw.Start(kFALSE); // continue
-    i016 = fApi->getTBid()*1E3;
-  }
-  while( sw.RealTime() < 0.1 ); // discharge time
+  double i016 = fApi->waitTelemetrySettled("id", 2E-4, 3, 1000)*1E3; // discharge time
 
   double i015 = (nRocs-1) * i016 / nRocs; // = 0 for single chip tests
 
@@ -540,10 +508,9 @@ void PixTestPretest::setVthrCompId() {
       
     hid = hsts[roc];
 
-    for (size_t idac = 0; idac < 256; ++idac) {
-      fApi->setDAC("VthrComp", idac, roc);
-      // delay?
-      hid->Fill(idac, fApi->getTBid()*1E3 - i015);
+    vector<pair<uint8_t, pair<double, double> > > currents = fApi->getCurrentVsDAC("VthrComp", 1, 0, 255, roc, 0);
+    for (size_t i = 0; i < currents.size(); ++i) {
+      hid->Fill(currents[i].first, currents[i].second.second*1E3 - i015);
     } 
 
     fApi->setDAC("VthrComp", 0, roc); // switch off
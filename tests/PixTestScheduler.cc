@@ -0,0 +1,149 @@
+#include <iostream>
+
+#include <TThread.h>
+#include <TROOT.h>
+#include <RVersion.h>
+
+#include "PixTestScheduler.hh"
+#include "PixTestFactory.hh"
+#include "PixTestParameters.hh"
+#include "ConfigParameters.hh"
+#include "PixSetup.hh"
+#include "PixTest.hh"
+
+#include "api.h"
+#include "log.h"
+
+using namespace std;
+using namespace pxar;
+
+// ----------------------------------------------------------------------
+PixTestScheduler::PixTestScheduler(string verbosity) : fVerbosity(verbosity) {
+  LOG(logDEBUG) << "PixTestScheduler ctor()";
+}
+
+// ----------------------------------------------------------------------
+PixTestScheduler::~PixTestScheduler() {
+  LOG(logDEBUG) << "PixTestScheduler dtor()";
+}
+
+// ----------------------------------------------------------------------
+void PixTestScheduler::addModule(string usbId, string directory) {
+  moduleJob job;
+  job.usbId     = usbId;
+  job.directory = directory;
+  job.verbosity = fVerbosity;
+  job.success   = false;
+  fModules.push_back(job);
+  LOG(logINFO) << "PixTestScheduler: module " << fModules.size()-1 << " on DTB " << usbId << " from " << directory;
+}
+
+// ----------------------------------------------------------------------
+string PixTestScheduler::getError(unsigned int i) {
+  if (i >= fModules.size()) return "no such module";
+  return fModules[i].error;
+}
+
+// ----------------------------------------------------------------------
+bool PixTestScheduler::run(vector<string> tests) {
+
+  // -- ROOT needs to know that several threads will use it
+  bool parallel(true);
+  TThread::Initialize();
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  ROOT::EnableThreadSafety();
+#else
+  // -- the tests share gFile, gDirectory and the Form() buffer, this cannot be made thread safe before ROOT 6.06
+  parallel = false;
+  LOG(logWARNING) << "PixTestScheduler: ROOT " << gROOT->GetVersion() << " is not thread safe, running the modules one after the other";
+#endif
+
+  // -- create the factory before spawning threads, the singleton is not thread safe
+  PixTestFactory::instance();
+
+  vector<TThread*> threads;
+  for (unsigned int i = 0; i < fModules.size(); ++i) {
+    fModules[i].tests   = tests;
+    fModules[i].success = false;
+    fModules[i].error   = "";
+    if (!parallel) {
+      runModule(&fModules[i]);
+      continue;
+    }
+    TThread *t = new TThread(Form("module%u", i), &PixTestScheduler::runModule, &fModules[i]);
+    threads.push_back(t);
+    t->Run();
+  }
+
+  bool success(true);
+  for (unsigned int i = 0; i < fModules.size(); ++i) {
+    if (parallel) {
+      threads[i]->Join();
+      delete threads[i];
+    }
+    if (!fModules[i].success) {
+      LOG(logERROR) << "PixTestScheduler: module " << i << " on DTB " << fModules[i].usbId << " failed: " << fModules[i].error;
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+// ----------------------------------------------------------------------
+void* PixTestScheduler::runModule(void *arg) {
+
+  moduleJob *job = static_cast<moduleJob*>(arg);
+  pxar::api *api(0);
+  TFile *rfile(0);
+
+  try {
+    // -- every module has its own configuration, do not use the ConfigParameters singleton here
+    ConfigParameters configParameters;
+    configParameters.setDirectory(job->directory);
+    string cfgFile = configParameters.getDirectory() + string("/configParameters.dat");
+    if (!configParameters.readConfigParameterFile(cfgFile)) {
+      job->error = "cannot read " + cfgFile;
+      return 0;
+    }
+
+    PixTestParameters ptp(configParameters.getDirectory() + "/" + configParameters.getTestParameterFileName());
+
+    api = new pxar::api(job->usbId, job->verbosity);
+    api->initTestboard(configParameters.getTbSigDelays(), configParameters.getTbPowerSettings(), configParameters.getTbPgSettings());
+    api->initDUT(configParameters.getHubId(),
+		 configParameters.getTbmType(), configParameters.getTbmDacs(),
+		 configParameters.getRocType(), configParameters.getRocDacs(),
+		 configParameters.getRocPixelConfig());
+
+    string rootfile = configParameters.getDirectory() + "/" + configParameters.getRootFileName();
+    rfile = TFile::Open(rootfile.c_str(), "RECREATE");
+
+    PixSetup a(api, &ptp, &configParameters);
+    if (configParameters.getHvOn()) api->HVon();
+
+    PixTestFactory *factory = PixTestFactory::instance();
+    for (unsigned int i = 0; i < job->tests.size(); ++i) {
+      LOG(logINFO) << "DTB " << job->usbId << " running: " << job->tests[i];
+      PixTest *t = factory->createTest(job->tests[i], &a);
+      if (!t) {
+	LOG(logWARNING) << "DTB " << job->usbId << ": test ->" << job->tests[i] << "<- not known, ignored";
+	continue;
+      }
+      t->doTest();
+      delete t;
+    }
+    if (configParameters.getHvOn()) api->HVoff();
+    job->success = true;
+  }
+  catch (pxar::pxarException &e) {
+    job->error = e.what();
+  }
+  catch (...) {
+    job->error = "unknown exception";
+  }
+
+  if (rfile) rfile->Close();
+  delete api;
+  return 0;
+}
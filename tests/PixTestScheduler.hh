@@ -0,0 +1,55 @@
+#ifndef PIXTESTSCHEDULER_H
+#define PIXTESTSCHEDULER_H
+
+#include <string>
+#include <vector>
+
+#include "pxardllexport.h"
+
+///
+/// PixTestScheduler
+/// ================
+///
+/// Runs the same sequence of tests on several modules in parallel, one
+/// thread and one pxar::api instance per DTB. Every module is configured
+/// from its own directory (configParameters.dat and friends) and writes
+/// into its own rootfile there.
+///
+/// With ROOT versions before 6.06, ROOT cannot be made thread safe and the
+/// modules are run one after the other instead.
+///
+/// Usage:
+///   PixTestScheduler s("INFO");
+///   s.addModule("DTB_WRQ0AB", "module1");
+///   s.addModule("DTB_WRQ0CD", "module2");
+///   s.run(tests);
+///
+class DLLEXPORT PixTestScheduler {
+public:
+  PixTestScheduler(std::string verbosity = "INFO");
+  ~PixTestScheduler();
+
+  /// register a module: DTB USB ID and the directory holding its configuration
+  void addModule(std::string usbId, std::string directory);
+  /// run the list of tests on all registered modules in parallel, returns true if all succeeded
+  bool run(std::vector<std::string> tests);
+  /// error message of the last run for module i, empty if everything went fine
+  std::string getError(unsigned int i);
+
+private:
+  struct moduleJob {
+    std::string usbId;
+    std::string directory;
+    std::string verbosity;
+    std::vector<std::string> tests;
+    bool success;
+    std::string error;
+  };
+
+  static void* runModule(void *arg);
+
+  std::string fVerbosity;
+  std::vector<moduleJob> fModules;
+};
+
+#endif
@@ -168,8 +168,14 @@ void PixTestScurves::scurves() {
   }
   
 
-  fApi->_dut->testAllPixels(true);
-  fApi->_dut->maskAllPixels(false);
+  if (fParNpix > 0 && fParNpix < 1000) {
+    fApi->_dut->testAllPixels(false);
+    fApi->_dut->maskAllPixels(true);
+    sparseRoc(fParNpix);
+  } else {
+    fApi->_dut->testAllPixels(true);
+    fApi->_dut->maskAllPixels(false);
+  }
 
   int results(7); 
   vector<TH1*> thr0 = scurveMaps(fParDac, "scurve"+fParDac, fParNtrig, fParDacLo, fParDacHi, results, 1); 
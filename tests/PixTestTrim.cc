@@ -18,7 +18,7 @@ using namespace pxar;
 ClassImp(PixTestTrim)
 
 // ----------------------------------------------------------------------
-PixTestTrim::PixTestTrim(PixSetup *a, std::string name) : PixTest(a, name), fParVcal(-1), fParNtrig(-1) {
+PixTestTrim::PixTestTrim(PixSetup *a, std::string name) : PixTest(a, name), fParVcal(-1), fParNtrig(-1), fParBinary(false) {
   PixTest::init();
   init(); 
   //  LOG(logINFO) << "PixTestTrim ctor(PixSetup &a, string, TGTab *)";
@@ -49,6 +49,12 @@ bool PixTestTrim::setParameter(string parName, string sval) {
 	fParVcal = atoi(sval.c_str()); 
 	LOG(logDEBUG) << "  setting fParVcal  ->" << fParVcal << "<- from sval = " << sval;
       }
+      if (!parName.compare("binary")) {
+	PixUtil::replaceAll(sval, "checkbox(", ""); 
+	PixUtil::replaceAll(sval, ")", ""); 
+	fParBinary = atoi(sval.c_str()); 
+	LOG(logDEBUG) << "  setting fParBinary  ->" << fParBinary << "<- from sval = " << sval;
+      }
       break;
     }
   }
@@ -81,6 +87,10 @@ void PixTestTrim::runCommand(std::string command) {
     trimTest(); 
     return;
   }
+  if (!command.compare("trimbinary")) {
+    trimBinary(); 
+    return;
+  }
   LOG(logDEBUG) << "did not find command ->" << command << "<-";
 }
 
@@ -116,7 +126,11 @@ void PixTestTrim::doTest() {
   PixTest::update(); 
   bigBanner(Form("PixTestTrim::doTest()"));
 
-  trimTest(); 
+  if (fParBinary) {
+    trimBinary(); 
+  } else {
+    trimTest(); 
+  }
   TH1 *h1 = (*fDisplayedHist); 
   h1->Draw(getHistOption(h1).c_str());
   PixTest::update(); 
@@ -138,6 +152,298 @@ void PixTestTrim::trimTest() {
   PixTest::update(); 
   banner(Form("PixTestTrim::trimTest() ntrig = %d, vcal = %d", fParNtrig, fParVcal));
 
+  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  map<int, int> rocVthrComp, rocTrim;
+  trimVthrCompVtrim(rocVthrComp, rocTrim); 
+
+  TH2D* h2(0); 
+  string hname(""); 
+
+  fApi->_dut->testAllPixels(true);
+  fApi->_dut->maskAllPixels(false);
+
+  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+    for (int ix = 0; ix < 52; ++ix) {
+      for (int iy = 0; iy < 80; ++iy) {
+	fTrimBits[iroc][ix][iy] = 7; 
+      }
+    }
+  }
+  setTrimBits();  
+
+  // -- set trim bits
+  int correction = 4;
+  int NTRIG(fParNtrig); 
+  vector<TH1*> thr2  = scurveMaps("vcal", "TrimThr2", fParNtrig, 0, 200, 1); 
+  vector<TH1*> thro = mapsWithString(thr2, "thr_");
+  double maxthr = getMaximumThreshold(thro);
+  double minthr = getMinimumThreshold(thro);
+  print(Form("TrimThr2 extremal thresholds: %f .. %f", minthr,  maxthr));
+  if (maxthr < 245) maxthr += 10; 
+  if (minthr > 10)  minthr -= 10; 
+  vector<TH1*> thr2a = trimStep("trimStepCorr4", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
+
+
+  correction = 2; 
+  vector<TH1*> thr3  = scurveMaps("vcal", "TrimThr3", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
+  thro.clear(); 
+  thro = mapsWithString(thr3, "thr_");
+  maxthr = getMaximumThreshold(thro);
+  minthr = getMinimumThreshold(thro);
+  print(Form("TrimThr3 extremal thresholds: %f .. %f", minthr,  maxthr));
+  if (maxthr < 245) maxthr += 10; 
+  if (minthr > 10)  minthr -= 10; 
+  vector<TH1*> thr3a = trimStep("trimStepCorr2", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
+  
+  correction = 1; 
+  vector<TH1*> thr4  = scurveMaps("vcal", "TrimThr4", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
+  thro.clear(); 
+  thro = mapsWithString(thr4, "thr_");
+  maxthr = getMaximumThreshold(thro);
+  minthr = getMinimumThreshold(thro);
+  print(Form("TrimThr4 extremal thresholds: %f .. %f", minthr,  maxthr));
+  if (maxthr < 245) maxthr += 10; 
+  if (minthr > 10)  minthr -= 10; 
+  vector<TH1*> thr4a = trimStep("trimStepCorr1a", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
+  
+  correction = 1; 
+  vector<TH1*> thr5  = scurveMaps("vcal", "TrimThr5", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
+  thro.clear(); 
+  thro = mapsWithString(thr5, "thr_");
+  maxthr = getMaximumThreshold(thro);
+  minthr = getMinimumThreshold(thro);
+  print(Form("TrimThr5 extremal thresholds: %f .. %f", minthr,  maxthr));
+  if (maxthr < 245) maxthr += 10; 
+  if (minthr > 10)  minthr -= 10; 
+  vector<TH1*> thr5a = trimStep("trimStepCorr1b", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
+
+  // -- create trimMap
+  for (unsigned int i = 0; i < thro.size(); ++i) {
+    h2 = bookTH2D(Form("TrimMap_C%d", i), 
+		  Form("TrimMap_C%d", i), 
+		  52, 0., 52., 80, 0., 80.);
+    for (int ix = 0; ix < 52; ++ix) {
+      for (int iy = 0; iy < 80; ++iy) {
+	h2->SetBinContent(ix+1, iy+1, fTrimBits[i][ix][iy]); 
+      }
+    }
+    
+    fHistList.push_back(h2); 
+    fHistOptions.insert(make_pair(h2, "colz"));
+
+    TH1* d1 = distribution(h2, 16, 0., 16.); 
+    fHistList.push_back(d1); 
+  }
+
+  vector<TH1*> thrF = scurveMaps("vcal", "TrimThrFinal", fParNtrig, fParVcal-20, fParVcal+20, 3); 
+  string trimMeanString, trimRmsString; 
+  for (unsigned int i = 0; i < thrF.size(); ++i) {
+    hname = thrF[i]->GetName();
+    // -- skip sig_ and thn_ histograms
+    if (string::npos == hname.find("dist_thr_")) continue;
+    trimMeanString += Form("%6.2f ", thrF[i]->GetMean()); 
+    trimRmsString += Form("%6.2f ", thrF[i]->GetRMS()); 
+  }
+
+  TH1 *h1 = (*fDisplayedHist); 
+  h1->Draw(getHistOption(h1).c_str());
+  PixTest::update(); 
+  restoreDacs();
+  string vtrimString, vthrcompString; 
+  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+    fApi->setDAC("vtrim", rocTrim[rocIds[iroc]], rocIds[iroc]);
+    vtrimString += Form("%3d ", rocTrim[rocIds[iroc]]); 
+    fApi->setDAC("vthrcomp", rocVthrComp[rocIds[iroc]], rocIds[iroc]);
+    vthrcompString += Form("%3d ", rocVthrComp[rocIds[iroc]]); 
+  }
+
+  // -- save into files
+  fPixSetup->getConfigParameters()->setTrimVcalSuffix(Form("%d", fParVcal)); 
+  saveDacs();
+  saveTrimBits();
+  
+  // -- summary printout
+  LOG(logINFO) << "PixTestAlive::trimTest() done";
+  LOG(logINFO) << "vtrim:     " << vtrimString; 
+  LOG(logINFO) << "vthrcomp:  " << vthrcompString; 
+  LOG(logINFO) << "vcal mean: " << trimMeanString; 
+  LOG(logINFO) << "vcal RMS:  " << trimRmsString; 
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestTrim::trimBinary() {
+
+  cacheDacs();
+  fDirectory->cd();
+  PixTest::update(); 
+  banner(Form("PixTestTrim::trimBinary() ntrig = %d, vcal = %d", fParNtrig, fParVcal));
+
+  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  map<int, int> rocVthrComp, rocTrim;
+  trimVthrCompVtrim(rocVthrComp, rocTrim); 
+
+  fApi->_dut->testAllPixels(true);
+  fApi->_dut->maskAllPixels(false);
+
+  // -- binary search over the trim bits, starting in the middle of the range. Every step
+  //    moves each pixel towards fParVcal, the trim bits closest to it are kept per pixel.
+  vector<int> corrections; 
+  corrections.push_back(4); 
+  corrections.push_back(2); 
+  corrections.push_back(1); 
+  corrections.push_back(1); 
+
+  vector<int> bestTrim(rocIds.size()*4160, 7); 
+  vector<double> bestDist(rocIds.size()*4160, 999.); 
+  vector<pixel> thr; 
+  setTrimBits(7); 
+  trimThrMap("TrimBinary7", thr, 0); 
+  for (unsigned int istep = 0; istep <= corrections.size(); ++istep) {
+    int correction = (istep < corrections.size() ? corrections[istep] : 0); 
+    for (unsigned int ipix = 0; ipix < thr.size(); ++ipix) {
+      int idx = getIdxFromId(thr[ipix].roc_id); 
+      if (idx < 0) continue;
+      int ic = thr[ipix].column, ir = thr[ipix].row; 
+      int i = idx*4160 + ic*80 + ir; 
+      double dist = TMath::Abs(thr[ipix].getValue() - fParVcal); 
+      if (dist < bestDist[i]) {
+	bestDist[i] = dist; 
+	bestTrim[i] = fTrimBits[idx][ic][ir]; 
+      }
+      if (0 == correction) continue;
+      int trim = fTrimBits[idx][ic][ir] + (thr[ipix].getValue() > fParVcal ? -correction : correction); 
+      if (trim < 1) trim = 1; 
+      if (trim > 15) trim = 15; 
+      fTrimBits[idx][ic][ir] = trim; 
+    }
+    if (0 == correction) break;
+
+    setTrimBits(); 
+    trimThrMap(Form("TrimBinaryCorr%d_%d", correction, istep), thr, 2*correction + 4); 
+  }
+
+  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+    for (int ix = 0; ix < 52; ++ix) {
+      for (int iy = 0; iy < 80; ++iy) {
+	fTrimBits[iroc][ix][iy] = bestTrim[iroc*4160 + ix*80 + iy]; 
+      }
+    }
+  }
+  setTrimBits(); 
+
+  // -- create trimMap
+  TH2D* h2(0); 
+  for (unsigned int i = 0; i < rocIds.size(); ++i) {
+    h2 = bookTH2D(Form("TrimMap_C%d", i), 
+		  Form("TrimMap_C%d", i), 
+		  52, 0., 52., 80, 0., 80.);
+    for (int ix = 0; ix < 52; ++ix) {
+      for (int iy = 0; iy < 80; ++iy) {
+	h2->SetBinContent(ix+1, iy+1, fTrimBits[i][ix][iy]); 
+      }
+    }
+    
+    fHistList.push_back(h2); 
+    fHistOptions.insert(make_pair(h2, "colz"));
+
+    TH1* d1 = distribution(h2, 16, 0., 16.); 
+    fHistList.push_back(d1); 
+  }
+
+  vector<TH1*> thrF = trimThrMap("TrimThrFinal", thr, 4); 
+  string trimMeanString, trimRmsString; 
+  for (unsigned int i = 0; i < thrF.size(); ++i) {
+    TH1* d1 = distribution((TH2D*)thrF[i], 256, 0., 256.); 
+    fHistList.push_back(d1); 
+    trimMeanString += Form("%6.2f ", d1->GetMean()); 
+    trimRmsString += Form("%6.2f ", d1->GetRMS()); 
+  }
+
+  TH1 *h1 = (*fDisplayedHist); 
+  h1->Draw(getHistOption(h1).c_str());
+  PixTest::update(); 
+  restoreDacs();
+  string vtrimString, vthrcompString; 
+  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+    fApi->setDAC("vtrim", rocTrim[rocIds[iroc]], rocIds[iroc]);
+    vtrimString += Form("%3d ", rocTrim[rocIds[iroc]]); 
+    fApi->setDAC("vthrcomp", rocVthrComp[rocIds[iroc]], rocIds[iroc]);
+    vthrcompString += Form("%3d ", rocVthrComp[rocIds[iroc]]); 
+  }
+
+  // -- save into files
+  fPixSetup->getConfigParameters()->setTrimVcalSuffix(Form("%d", fParVcal)); 
+  saveDacs();
+  saveTrimBits();
+  
+  // -- summary printout
+  LOG(logINFO) << "PixTestTrim::trimBinary() done";
+  LOG(logINFO) << "vtrim:     " << vtrimString; 
+  LOG(logINFO) << "vthrcomp:  " << vthrcompString; 
+  LOG(logINFO) << "vcal mean: " << trimMeanString; 
+  LOG(logINFO) << "vcal RMS:  " << trimRmsString; 
+}
+
+
+// ----------------------------------------------------------------------
+vector<TH1*> PixTestTrim::trimThrMap(string name, vector<pixel> &thr, int margin) {
+  uint16_t FLAGS = FLAG_RISING_EDGE | FLAG_FORCE_MASKED; 
+
+  // -- without prior a coarse scan is done first, else only a window around the prior thresholds
+  vector<pixel> results; 
+  int cnt(0); 
+  bool done(false);
+  while (!done) {
+    try {
+      if (thr.empty()) {
+	results = fApi->getThresholdMapAdaptive("vcal", 1, 50, FLAGS, fParNtrig);
+      } else {
+	results = fApi->getThresholdMapAdaptive("vcal", 1, margin, 50, FLAGS, fParNtrig, thr);
+      }
+      done = true;
+    } catch(pxarException &e) {
+      LOG(logCRITICAL) << "pXar execption: "<< e.what(); 
+      ++cnt;
+    }
+    done = (cnt>5) || done;
+  }
+  if (results.size() > 0) thr = results; 
+
+  fDirectory->cd(); 
+  vector<TH1*> maps; 
+  TH2D *h2(0); 
+  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
+  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
+    h2 = bookTH2D(Form("thr_%s_vcal_C%d", name.c_str(), rocIds[iroc]), 
+		  Form("thr_%s_vcal_C%d", name.c_str(), rocIds[iroc]), 
+		  52, 0., 52., 80, 0., 80.); 
+    setTitles(h2, "col", "row"); 
+    fHistOptions.insert(make_pair(h2, "colz")); 
+    maps.push_back(h2); 
+    fHistList.push_back(h2); 
+  }
+
+  int idx(-1); 
+  for (unsigned int i = 0; i < results.size(); ++i) {
+    idx = getIdxFromId(results[i].roc_id);
+    if (idx < 0) continue;
+    ((TH2D*)maps[idx])->SetBinContent(results[i].column+1, results[i].row+1, results[i].getValue()); 
+  }
+  LOG(logDEBUG) << name << ": thresholds for " << results.size() << " pixels"; 
+
+  if (h2) {
+    fDisplayedHist = find(fHistList.begin(), fHistList.end(), h2);
+    h2->Draw("colz"); 
+  }
+  PixTest::update(); 
+  return maps; 
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestTrim::trimVthrCompVtrim(map<int, int> &rocVthrComp, map<int, int> &rocTrim) {
+
   double NSIGMA(2); 
 
 
@@ -155,7 +461,6 @@ void PixTestTrim::trimTest() {
   setTrimBits(15);  
   
   // -- determine minimal VthrComp 
-  map<int, int> rocVthrComp;
   print("VthrComp thr map (minimal VthrComp)"); 
   vector<TH1*> thr0 = scurveMaps("vthrcomp", "TrimThr0", fParNtrig, 0, 200, 1); 
   vector<int> minVthrComp = getMinimumVthrComp(thr0, 10, 2.); 
@@ -223,7 +528,6 @@ void PixTestTrim::trimTest() {
 
   TH1D *h = new TH1D("trimh", "trimh", 256, 0., 256.); 
   vector<int> rocDone;
-  map<int, int> rocTrim;
   int itrim(0), vcalHi(200); 
   do {
     if (rocDone.size() == rocIds.size()) break;
@@ -273,116 +577,6 @@ void PixTestTrim::trimTest() {
 
   } while(itrim < 256);
   delete h; 
-
-  fApi->_dut->testAllPixels(true);
-  fApi->_dut->maskAllPixels(false);
-
-  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
-    for (int ix = 0; ix < 52; ++ix) {
-      for (int iy = 0; iy < 80; ++iy) {
-	fTrimBits[iroc][ix][iy] = 7; 
-      }
-    }
-  }
-  setTrimBits();  
-
-  // -- set trim bits
-  int correction = 4;
-  int NTRIG(fParNtrig); 
-  vector<TH1*> thr2  = scurveMaps("vcal", "TrimThr2", fParNtrig, 0, 200, 1); 
-  vector<TH1*> thro = mapsWithString(thr2, "thr_");
-  double maxthr = getMaximumThreshold(thro);
-  double minthr = getMinimumThreshold(thro);
-  print(Form("TrimThr2 extremal thresholds: %f .. %f", minthr,  maxthr));
-  if (maxthr < 245) maxthr += 10; 
-  if (minthr > 10)  minthr -= 10; 
-  vector<TH1*> thr2a = trimStep("trimStepCorr4", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
-
-
-  correction = 2; 
-  vector<TH1*> thr3  = scurveMaps("vcal", "TrimThr3", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
-  thro.clear(); 
-  thro = mapsWithString(thr3, "thr_");
-  maxthr = getMaximumThreshold(thro);
-  minthr = getMinimumThreshold(thro);
-  print(Form("TrimThr3 extremal thresholds: %f .. %f", minthr,  maxthr));
-  if (maxthr < 245) maxthr += 10; 
-  if (minthr > 10)  minthr -= 10; 
-  vector<TH1*> thr3a = trimStep("trimStepCorr2", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
-  
-  correction = 1; 
-  vector<TH1*> thr4  = scurveMaps("vcal", "TrimThr4", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
-  thro.clear(); 
-  thro = mapsWithString(thr4, "thr_");
-  maxthr = getMaximumThreshold(thro);
-  minthr = getMinimumThreshold(thro);
-  print(Form("TrimThr4 extremal thresholds: %f .. %f", minthr,  maxthr));
-  if (maxthr < 245) maxthr += 10; 
-  if (minthr > 10)  minthr -= 10; 
-  vector<TH1*> thr4a = trimStep("trimStepCorr1a", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
-  
-  correction = 1; 
-  vector<TH1*> thr5  = scurveMaps("vcal", "TrimThr5", NTRIG, static_cast<int>(minthr), static_cast<int>(maxthr), 1); 
-  thro.clear(); 
-  thro = mapsWithString(thr5, "thr_");
-  maxthr = getMaximumThreshold(thro);
-  minthr = getMinimumThreshold(thro);
-  print(Form("TrimThr5 extremal thresholds: %f .. %f", minthr,  maxthr));
-  if (maxthr < 245) maxthr += 10; 
-  if (minthr > 10)  minthr -= 10; 
-  vector<TH1*> thr5a = trimStep("trimStepCorr1b", correction, thro, static_cast<int>(minthr), static_cast<int>(maxthr));
-
-  // -- create trimMap
-  for (unsigned int i = 0; i < thro.size(); ++i) {
-    h2 = bookTH2D(Form("TrimMap_C%d", i), 
-		  Form("TrimMap_C%d", i), 
-		  52, 0., 52., 80, 0., 80.);
-    for (int ix = 0; ix < 52; ++ix) {
-      for (int iy = 0; iy < 80; ++iy) {
-	h2->SetBinContent(ix+1, iy+1, fTrimBits[i][ix][iy]); 
-      }
-    }
-    
-    fHistList.push_back(h2); 
-    fHistOptions.insert(make_pair(h2, "colz"));
-
-    TH1* d1 = distribution(h2, 16, 0., 16.); 
-    fHistList.push_back(d1); 
-  }
-
-  vector<TH1*> thrF = scurveMaps("vcal", "TrimThrFinal", fParNtrig, fParVcal-20, fParVcal+20, 3); 
-  string trimMeanString, trimRmsString; 
-  for (unsigned int i = 0; i < thrF.size(); ++i) {
-    hname = thrF[i]->GetName();
-    // -- skip sig_ and thn_ histograms
-    if (string::npos == hname.find("dist_thr_")) continue;
-    trimMeanString += Form("%6.2f ", thrF[i]->GetMean()); 
-    trimRmsString += Form("%6.2f ", thrF[i]->GetRMS()); 
-  }
-
-  TH1 *h1 = (*fDisplayedHist); 
-  h1->Draw(getHistOption(h1).c_str());
-  PixTest::update(); 
-  restoreDacs();
-  string vtrimString, vthrcompString; 
-  for (unsigned int iroc = 0; iroc < rocIds.size(); ++iroc) {
-    fApi->setDAC("vtrim", rocTrim[rocIds[iroc]], rocIds[iroc]);
-    vtrimString += Form("%3d ", rocTrim[rocIds[iroc]]); 
-    fApi->setDAC("vthrcomp", rocVthrComp[rocIds[iroc]], rocIds[iroc]);
-    vthrcompString += Form("%3d ", rocVthrComp[rocIds[iroc]]); 
-  }
-
-  // -- save into files
-  fPixSetup->getConfigParameters()->setTrimVcalSuffix(Form("%d", fParVcal)); 
-  saveDacs();
-  saveTrimBits();
-  
-  // -- summary printout
-  LOG(logINFO) << "PixTestAlive::trimTest() done";
-  LOG(logINFO) << "vtrim:     " << vtrimString; 
-  LOG(logINFO) << "vthrcomp:  " << vthrcompString; 
-  LOG(logINFO) << "vcal mean: " << trimMeanString; 
-  LOG(logINFO) << "vcal RMS:  " << trimRmsString; 
 }
 
 
@@ -437,7 +631,13 @@ void PixTestTrim::trimBitTest() {
   fApi->setDAC("CtrlReg", 0); 
   fApi->setDAC("Vtrim", 0); 
   LOG(logDEBUG) << "trimBitTest determine threshold map without trims "; 
-  vector<TH1*> thr0 = mapsWithString(scurveMaps("Vcal", "TrimBitsThr0", fParNtrig, 0, 200, 1), "thr");
+  vector<pixel> prior; 
+  vector<TH1*> thr0;
+  if (fParBinary) {
+    thr0 = trimThrMap("TrimBitsThr0", prior, 0); 
+  } else {
+    thr0 = mapsWithString(scurveMaps("Vcal", "TrimBitsThr0", fParNtrig, 0, 200, 1), "thr");
+  }
   
   // -- now loop over all trim bits
   vector<TH1*> thr;
@@ -458,7 +658,11 @@ void PixTestTrim::trimBitTest() {
 
     fApi->setDAC("Vtrim", vtrim[iv]); 
     LOG(logDEBUG) << "trimBitTest threshold map with trim = " << btrim[iv]; 
-    thr = mapsWithString(scurveMaps("Vcal", Form("TrimThr_trim%d", btrim[iv]), fParNtrig, 0, static_cast<int>(maxThr)+10, 1), "thr");
+    if (fParBinary) {
+      thr = trimThrMap(Form("TrimThr_trim%d", btrim[iv]), prior, 20); 
+    } else {
+      thr = mapsWithString(scurveMaps("Vcal", Form("TrimThr_trim%d", btrim[iv]), fParNtrig, 0, static_cast<int>(maxThr)+10, 1), "thr");
+    }
     maxThr = getMaximumThreshold(thr); 
     if (maxThr > 245.) maxThr = 245.; 
     steps.push_back(thr); 
@@ -572,8 +776,10 @@ void PixTestTrim::setTrimBits(int itrim) {
       if (itrim > -1) {
 	fTrimBits[ir][pix[ipix].column][pix[ipix].row] = itrim;
       }
-      fApi->_dut->updateTrimBits(pix[ipix].column, pix[ipix].row, fTrimBits[ir][pix[ipix].column][pix[ipix].row], rocIds[ir]);
+      pix[ipix].trim = fTrimBits[ir][pix[ipix].column][pix[ipix].row];
     }
+    // -- one update per ROC
+    fApi->_dut->updateTrimBits(pix, rocIds[ir]);
   }
 }
 
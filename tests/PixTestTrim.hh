@@ -16,10 +16,13 @@ public:
   void runCommand(std::string); 
   void trimBitTest();
   void trimTest();
+  void trimBinary();
 
   int adjustVtrim(); 
   std::vector<TH1*> trimStep(std::string name, int corrections, std::vector<TH1*> calMapOld, int vcalMin, int vcalMax); 
   void setTrimBits(int itrim = -1); 
+  void trimVthrCompVtrim(std::map<int, int> &rocVthrComp, std::map<int, int> &rocTrim); 
+  std::vector<TH1*> trimThrMap(std::string name, std::vector<pxar::pixel> &thr, int margin); 
 
   void doTest(); 
   void output4moreweb();
@@ -27,6 +30,7 @@ public:
 private:
 
   int     fParVcal, fParNtrig; 
+  bool    fParBinary; 
   std::vector<std::pair<int, int> > fPIX; 
   int fTrimBits[16][52][80]; 
   
@@ -4,6 +4,8 @@
 #include <iostream>
 #include <fstream>
 #include "PixTestXray.hh"
+#include "PixHistEngine.hh"
+#include "PixHotPixels.hh"
 #include "log.h"
 
 
@@ -19,7 +21,8 @@ ClassImp(PixTestXray)
 // ----------------------------------------------------------------------
 PixTestXray::PixTestXray(PixSetup *a, std::string name) : PixTest(a, name), 
   fParSource("nada"), fParTriggerFrequency(0), fParRunSeconds(0), fParStepSeconds(0), 
-  fParVthrCompMin(0), fParVthrCompMax(0),  fParFillTree(false), fParDelayTBM(false) {
+  fParVthrCompMin(0), fParVthrCompMax(0),  fParFillTree(false), fParDelayTBM(false),
+  fHotPixels(0), fHistEngine(0), fHistFiller(0), fHistSynced(0) {
   PixTest::init();
   init(); 
   LOG(logDEBUG) << "PixTestXray ctor(PixSetup &a, string, TGTab *)";
@@ -31,7 +34,7 @@ PixTestXray::PixTestXray(PixSetup *a, std::string name) : PixTest(a, name),
 
 
 //----------------------------------------------------------
-PixTestXray::PixTestXray() : PixTest() {
+PixTestXray::PixTestXray() : PixTest(), fHotPixels(0), fHistEngine(0), fHistFiller(0), fHistSynced(0) {
   LOG(logDEBUG) << "PixTestXray ctor()";
   fTree = 0; 
 }
@@ -202,6 +205,9 @@ PixTestXray::~PixTestXray() {
   LOG(logDEBUG) << "PixTestXray dtor";
   fDirectory->cd();
   if (fTree && fParFillTree) fTree->Write(); 
+  delete fHistFiller;
+  delete fHistEngine;
+  delete fHotPixels;
 }
 
 
@@ -285,8 +291,19 @@ void PixTestXray::doPhRun() {
     copy(fQ.begin(), fQ.end(), back_inserter(fHistList));
     copy(fPHmap.begin(), fPHmap.end(), back_inserter(fHistList));
     copy(fPH.begin(), fPH.end(), back_inserter(fHistList));
+
+    // -- the DAQ loop hands the events to the filler thread, see syncOnlineHistos()
+    delete fHistFiller;
+    delete fHistEngine;
+    fHistEngine = new PixHistEngine(rocIds, fPH[0], fQ[0]);
+    fHistFiller = new PixHistFiller(fHistEngine, fPhCalOK ? &fPhCal : 0);
+    fHistFiller->start();
+    fHistSynced = 0;
   }
 
+  fHmap[0]->Draw("colz");
+  PixTest::update();
+
   fPg_setup.push_back(make_pair("resetroc", 0));
   uint16_t period = 28;
   fApi->setPatternGenerator(fPg_setup);
@@ -306,6 +323,29 @@ void PixTestXray::doPhRun() {
   fDaq_loop = true;
   fApi->daqStart();
   
+  // -- the readout runs on its own thread, this thread keeps the GUI alive
+  runReadout();
+
+  fApi->daqTriggerLoopHalt();
+  
+  fApi->daqStop();
+  processData(0);
+  fHistFiller->drain();
+  syncOnlineHistos();
+
+  finalCleanup();
+
+  fQ[0]->Draw();
+  fDisplayedHist = find(fHistList.begin(), fHistList.end(), fQ[0]);
+  PixTest::update();
+
+  LOG(logINFO) << "PixTestXray::doPhRun() done";
+
+}
+
+
+// ----------------------------------------------------------------------
+void PixTestXray::readoutLoop() {
   int finalPeriod = fApi->daqTriggerLoop(0);  //period is automatically set to the minimum by Api function
   LOG(logINFO) << "PixTestXray::doPhRun start TriggerLoop with period "  << finalPeriod 
 	       << " and duration " << fParRunSeconds << " seconds";
@@ -314,7 +354,6 @@ void PixTestXray::doPhRun() {
   timer t;
   while (fApi->daqStatus(perFull) && fDaq_loop) {
     LOG(logINFO) << "buffer not full, at " << (int) perFull << "%";
-    gSystem->ProcessEvents();
     processData();
     
     // Pause and drain the buffer if almost full.
@@ -331,20 +370,6 @@ void PixTestXray::doPhRun() {
       break;
     }
   }
-
-  fApi->daqTriggerLoopHalt();
-  
-  fApi->daqStop();
-  processData(0);
-
-  finalCleanup();
-
-  fQ[0]->Draw();
-  fDisplayedHist = find(fHistList.begin(), fHistList.end(), fQ[0]);
-  PixTest::update();
-
-  LOG(logINFO) << "PixTestXray::doPhRun() done";
-
 }
 
 
@@ -367,6 +392,9 @@ void PixTestXray::doRateScan() {
 
   fApi->_dut->testAllPixels(false);
   fApi->_dut->maskAllPixels(false);
+
+  delete fHotPixels;
+  fHotPixels = new PixHotPixels(fApi->_dut->getEnabledRocIDs());
   
   // -- setup DAQ for data taking
   fPg_setup.clear();
@@ -385,6 +413,7 @@ void PixTestXray::doRateScan() {
     for (unsigned i = 0; i < fHitMap.size(); ++i) {
       fHitMap[i]->Reset();
     }
+    fHotPixels->reset();
     timer t;
     uint8_t perFull;
     fApi->setDAC("vthrcomp", fVthrComp);
@@ -505,6 +534,7 @@ void PixTestXray::readData() {
     for (unsigned int ipix = 0; ipix < it->pixels.size(); ++ipix) {
       fHitMap[getIdxFromId(it->pixels[ipix].roc_id)]->Fill(it->pixels[ipix].column, it->pixels[ipix].row);
     }
+    if (fHotPixels) fHotPixels->fill(*it);
   }
   LOG(logDEBUG) << "Processing Data: " << daqdat.size() << " events with " << pixCnt << " pixels";
 }
@@ -515,12 +545,15 @@ void PixTestXray::analyzeData() {
   vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs();
   unsigned nrocs = rocIds.size(); 
 
-  int cnt(0); 
+  // -- mask the noisy pixels, then count the hits of the remaining ones
+  fHotPixels->maskHotPixels(fApi->_dut);
+  fHotPixels->analyze();
+
   for (unsigned int i = 0; i < nrocs; ++i) {
-    double cut = meanHit(fHitMap[i]); 
-    cut = noiseLevel(fHitMap[i]); 
-    cnt = countHitsAndMaskPixels(fHitMap[i], cut, rocIds[i]); 
-    fHits[i]->SetBinContent(fVthrComp+1, cnt); 
+    PixHotPixelStat &st = fHotPixels->getStat(i);
+    LOG(logINFO) << "ROC " << static_cast<int>(rocIds[i]) << " hits/pixel median = " << st.median 
+		 << " MAD = " << st.mad << " masked pixels: " << fHotPixels->getNMasked(i); 
+    fHits[i]->SetBinContent(fVthrComp+1, static_cast<double>(st.nHits)); 
     int mpix = fApi->_dut->getNMaskedPixels(rocIds[i]);
     fMpix[i]->SetBinContent(fVthrComp+1, mpix); 
   }
@@ -546,63 +579,6 @@ double PixTestXray::meanHit(TH2D *h2) {
   return mean; 
 }
 
-// ----------------------------------------------------------------------
-double PixTestXray::noiseLevel(TH2D *h2) {
-
-  TH1D *h1 = new TH1D("h1", "h1", 1000, 0., 1000.); 
-
-  for (int ix = 0; ix < h2->GetNbinsX(); ++ix) {
-    for (int iy = 0; iy < h2->GetNbinsY(); ++iy) {
-      h1->Fill(h2->GetBinContent(ix+1, iy+1)); 
-    }
-  }
-  
-  // -- skip bin for zero hits!
-  int noise(-1);
-  for (int ix = 1; ix < h1->GetNbinsX(); ++ix) {
-    if (h1->GetBinContent(ix+1) < 1) {
-      noise = ix; 
-      break;
-    }
-  }
-
-  int lastbin(1);
-  for (int ix = 1; ix < h1->GetNbinsX(); ++ix) {
-    if (h1->GetBinContent(ix+1) > 1) {
-      lastbin = ix; 
-    }
-  }
-
-
-  delete h1; 
-  LOG(logINFO) << "hist " << h2->GetName() 
-	       << " (maximum: " << h2->GetMaximum() << ") "
-	       << " noise level = " << noise << " last bin above 1: " << lastbin; 
-  return lastbin; 
-}
-
-
-// ----------------------------------------------------------------------
-int PixTestXray::countHitsAndMaskPixels(TH2D *h2, double noiseLevel, int iroc) {
-  
-  int cnt(0); 
-  double entries(0.); 
-  for (int ix = 0; ix < h2->GetNbinsX(); ++ix) {
-    for (int iy = 0; iy < h2->GetNbinsY(); ++iy) {
-      entries = h2->GetBinContent(ix+1, iy+1);
-      if (entries > noiseLevel) {
-	fApi->_dut->maskPixel(ix, iy, true, iroc); 
-	LOG(logINFO) << "ROC " << iroc << " masking pixel " << ix << "/" << iy 
-		     << " with #hits = " << entries << " (cut: " << noiseLevel << ")"; 
-      } else {
-	cnt += static_cast<int>(entries);
-      }
-    }
-  }
-  return cnt; 
-}
-
-
 // ----------------------------------------------------------------------
 void PixTestXray::pgToDefault(vector<pair<std::string, uint8_t> > /*pg_setup*/) {
   fPg_setup.clear();
@@ -623,17 +599,16 @@ void PixTestXray::finalCleanup() {
 
 // ----------------------------------------------------------------------
 void PixTestXray::processData(uint16_t numevents) {
-  vector<uint8_t> rocIds = fApi->_dut->getEnabledRocIDs(); 
   fDirectory->cd();
-  PixTest::update();
   
   int pixCnt(0);
   LOG(logDEBUG) << "Getting Event Buffer";
   vector<pxar::Event> daqdat;
    
   if (numevents > 0) {
+    pxar::Event evt;
     for (unsigned int i = 0; i < numevents ; i++) {
-      pxar::Event evt = fApi->daqGetEvent();
+      if (!fApi->daqGetEvent(evt)) break;
       //Check if event is empty?
       if(evt.pixels.size() > 0)
 	daqdat.push_back(evt);
@@ -645,21 +620,18 @@ void PixTestXray::processData(uint16_t numevents) {
 
   LOG(logDEBUG) << "Processing Data: " << daqdat.size() << " events.";
   
-  int idx(-1); 
   uint16_t q; 
   for (std::vector<pxar::Event>::iterator it = daqdat.begin(); it != daqdat.end(); ++it) {
     pixCnt += it->pixels.size(); 
-    
-    if (fParFillTree) {
-      fTreeEvent.header           = it->header; 
-      fTreeEvent.dac              = 0;
-      fTreeEvent.trailer          = it->trailer; 
-      fTreeEvent.numDecoderErrors = it->numDecoderErrors;
-      fTreeEvent.npix             = it->pixels.size();
-    }
+    if (!fParFillTree) continue;
+
+    fTreeEvent.header           = it->header; 
+    fTreeEvent.dac              = 0;
+    fTreeEvent.trailer          = it->trailer; 
+    fTreeEvent.numDecoderErrors = it->numDecoderErrors;
+    fTreeEvent.npix             = it->pixels.size();
 
     for (unsigned int ipix = 0; ipix < it->pixels.size(); ++ipix) {   
-      idx = getIdxFromId(it->pixels[ipix].roc_id);
 
       if (fPhCalOK) {
 	q = static_cast<uint16_t>(fPhCal.vcal(it->pixels[ipix].roc_id, 
@@ -669,29 +641,39 @@ void PixTestXray::processData(uint16_t numevents) {
       } else {
 	q = 0;
       }
-      fHmap[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row);
-      fQ[idx]->Fill(q);
-      fQmap[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row, q);
-
-      fPHmap[idx]->Fill(it->pixels[ipix].column, it->pixels[ipix].row, it->pixels[ipix].getValue());
-      fPH[idx]->Fill(it->pixels[ipix].getValue());
-	
-      if (fParFillTree) {
-	fTreeEvent.proc[ipix] = it->pixels[ipix].roc_id; 
-	fTreeEvent.pcol[ipix] = it->pixels[ipix].column; 
-	fTreeEvent.prow[ipix] = it->pixels[ipix].row; 
-	fTreeEvent.pval[ipix] = it->pixels[ipix].getValue(); 
-	fTreeEvent.pq[ipix]   = q;
-      }
+      fTreeEvent.proc[ipix] = it->pixels[ipix].roc_id; 
+      fTreeEvent.pcol[ipix] = it->pixels[ipix].column; 
+      fTreeEvent.prow[ipix] = it->pixels[ipix].row; 
+      fTreeEvent.pval[ipix] = it->pixels[ipix].getValue(); 
+      fTreeEvent.pq[ipix]   = q;
     }
     
-    if (fParFillTree) fTree->Fill();
+    fTree->Fill();
   }
   
-  LOG(logDEBUG) << Form(" # events read: %6ld, pixels seen in all events: %3d", daqdat.size(), pixCnt);
-  
-  fHmap[0]->Draw("colz");
-  PixTest::update();
+  LOG(logDEBUG) << " # events read: " << daqdat.size() << ", pixels seen in all events: " << pixCnt;
+
+  // -- the filler thread takes over the events, the GUI picks up the online histograms periodically
+  fHistFiller->push(daqdat);
+}
+
+// ----------------------------------------------------------------------
+bool PixTestXray::syncOnlineHistos() {
+  if (0 == fHistEngine) return false;
+
+  PixHistData data;
+  uint64_t nhits = fHistEngine->snapshot(data);
+  if (nhits == fHistSynced) return false;
+  fHistSynced = nhits;
+
+  for (unsigned int iroc = 0; iroc < fHmap.size(); ++iroc) {
+    data.fillHits(iroc, fHmap[iroc]);
+    data.fillQMap(iroc, fQmap[iroc]);
+    data.fillPhMap(iroc, fPHmap[iroc]);
+    data.fillQ(iroc, fQ[iroc]);
+    data.fillPh(iroc, fPH[iroc]);
+  }
+  return true;
 }
 
 
@@ -6,6 +6,9 @@
 
 #include <TProfile2D.h>
 
+class PixHistEngine;
+class PixHistFiller;
+class PixHotPixels;
 
 class DLLEXPORT PixTestXray: public PixTest {
 public:
@@ -30,10 +33,12 @@ public:
   void analyzeData();
 
   double meanHit(TH2D*); 
-  double noiseLevel(TH2D*); 
-  int   countHitsAndMaskPixels(TH2D*, double noiseLevel, int iroc); 
 
   void processData(uint16_t numevents = 1000);
+  virtual bool syncOnlineHistos();
+
+protected:
+  void readoutLoop();
 
 private:
 
@@ -59,6 +64,7 @@ private:
   // -- rateScan
   std::vector<TH1D*> fHits, fMpix;
   std::vector<TH2D*> fHitMap;
+  PixHotPixels      *fHotPixels; //! hit counts for the noise cut, filled in readData()
 
   // -- PhRun
   std::vector<TH1D*> fQ;
@@ -68,6 +74,10 @@ private:
   std::vector<TProfile2D*> fPHmap;
   std::vector<TH2D*> fHmap;
 
+  PixHistEngine *fHistEngine; //! online histograms of the PhRun
+  PixHistFiller *fHistFiller; //! fills fHistEngine on its own thread
+  uint64_t       fHistSynced; //! number of hits already copied into the ROOT histograms
+
 
   
   ClassDef(PixTestXray, 1)
@@ -0,0 +1,200 @@
+// Long-running DAQ soak test: repeats trigger/daqGetEventBuffer readouts and
+// checks that the resident memory of the process does not keep growing.
+// Runs against a DTB with a single ROC attached or "-b emulator", the setup
+// is hardcoded the same way as in pxardaq.
+
+#include "pxar.h"
+#include "timer.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// Resident set size of this process in kB, 0 if not available:
+long residentKB() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  long size = 0, resident = 0;
+  if(!(statm >> size >> resident)) return 0;
+  return resident*(sysconf(_SC_PAGESIZE)/1024);
+#else
+  return 0;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+
+  std::string board = "emulator";
+  std::string verbosity = "WARNING";
+  std::string roctype = "psi46digv21";
+  int readouts = 5000;
+  int triggers = 100;
+  int period = 200;
+  int npixels = 10;
+  long limit = 1024;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-b board        testboard name, default \"emulator\"" << std::endl;
+      std::cout << "-n readouts     number of daqGetEventBuffer readouts, default 5000" << std::endl;
+      std::cout << "-t triggers     triggers per readout, default 100" << std::endl;
+      std::cout << "-d period       trigger period in clock cycles, default 200" << std::endl;
+      std::cout << "-p pixels       number of enabled pixels, default 10" << std::endl;
+      std::cout << "-l limit        allowed growth of the resident memory in kB, default 1024" << std::endl;
+      std::cout << "-r roctype      ROC type, default psi46digv21" << std::endl;
+      std::cout << "-v verbosity    verbosity level, default WARNING" << std::endl;
+      return 0;
+    }
+    if (!strcmp(argv[i],"-b") && i+1 < argc) { board = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-n") && i+1 < argc) { readouts = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-t") && i+1 < argc) { triggers = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-d") && i+1 < argc) { period = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-p") && i+1 < argc) { npixels = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-l") && i+1 < argc) { limit = atol(argv[++i]); }
+    else if (!strcmp(argv[i],"-r") && i+1 < argc) { roctype = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-v") && i+1 < argc) { verbosity = std::string(argv[++i]); }
+    else {
+      std::cout << "Unrecognized command line option " << argv[i] << std::endl;
+    }
+  }
+  if(readouts < 10) readouts = 10;
+  if(triggers < 1) triggers = 1;
+  if(npixels < 0 || npixels > 4160) npixels = 4160;
+
+  std::vector<std::pair<std::string,uint8_t> > sig_delays;
+  sig_delays.push_back(std::make_pair("clk",2));
+  sig_delays.push_back(std::make_pair("ctr",2));
+  sig_delays.push_back(std::make_pair("sda",17));
+  sig_delays.push_back(std::make_pair("tin",7));
+  sig_delays.push_back(std::make_pair("deser160phase",4));
+
+  std::vector<std::pair<std::string,double> > power_settings;
+  power_settings.push_back(std::make_pair("va",1.9));
+  power_settings.push_back(std::make_pair("vd",2.6));
+  power_settings.push_back(std::make_pair("ia",1.190));
+  power_settings.push_back(std::make_pair("id",1.10));
+
+  std::vector<std::pair<std::string,uint8_t> > pg_setup;
+  pg_setup.push_back(std::make_pair("resetroc",25));
+  pg_setup.push_back(std::make_pair("calibrate",106));
+  pg_setup.push_back(std::make_pair("trigger",16));
+  pg_setup.push_back(std::make_pair("token",0));
+
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > tbmDACs;
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > rocDACs;
+  std::vector<std::pair<std::string,uint8_t> > dacs;
+  dacs.push_back(std::make_pair("Vdig",8));
+  dacs.push_back(std::make_pair("Vana",78));
+  dacs.push_back(std::make_pair("Vsf",80));
+  dacs.push_back(std::make_pair("Vcomp",12));
+  dacs.push_back(std::make_pair("VwllPr",150));
+  dacs.push_back(std::make_pair("VwllSh",150));
+  dacs.push_back(std::make_pair("VhldDel",117));
+  dacs.push_back(std::make_pair("Vtrim",152));
+  dacs.push_back(std::make_pair("VthrComp",89));
+  dacs.push_back(std::make_pair("VIBias_Bus",30));
+  dacs.push_back(std::make_pair("Vbias_sf",6));
+  dacs.push_back(std::make_pair("VoffsetOp",60));
+  dacs.push_back(std::make_pair("VOffsetRO",225));
+  dacs.push_back(std::make_pair("VIon",45));
+  dacs.push_back(std::make_pair("Vcomp_ADC",10));
+  dacs.push_back(std::make_pair("VIref_ADC",70));
+  dacs.push_back(std::make_pair("VIbias_roc",150));
+  dacs.push_back(std::make_pair("VIColOr",99));
+  dacs.push_back(std::make_pair("Vcal",199));
+  dacs.push_back(std::make_pair("CalDel",140));
+  dacs.push_back(std::make_pair("CtrlReg",0));
+  dacs.push_back(std::make_pair("WBC",100));
+  rocDACs.push_back(dacs);
+
+  std::vector<std::vector<pxar::pixelConfig> > rocPixels;
+  std::vector<pxar::pixelConfig> pixels;
+  for(int col = 0; col < 52; col++) {
+    for(int row = 0; row < 80; row++) {
+      pixels.push_back(pxar::pixelConfig(col,row,15));
+    }
+  }
+  rocPixels.push_back(pixels);
+
+  // The buffers reach their steady state during the first tenth of the
+  // readouts, the memory is compared to the size measured after that:
+  int warmup = readouts/10;
+  long baseline = 0, peak = 0;
+  size_t nevents = 0, nhits = 0;
+  int failed = 0;
+
+  try {
+    _api = new pxar::api(board,verbosity);
+
+    if(!_api->initTestboard(sig_delays, power_settings, pg_setup)) {
+      delete _api;
+      return -1;
+    }
+    if(!_api->initDUT(0,"tbm08",tbmDACs,roctype,rocDACs,rocPixels)) {
+      std::cout << " initDUT failed -> invalid configuration?! " << std::endl;
+      delete _api;
+      return -2;
+    }
+
+    // Enable the first npixels pixels, column by column:
+    _api->_dut->testAllPixels(false);
+    _api->_dut->maskAllPixels(true);
+    for(int px = 0; px < npixels; px++) {
+      _api->_dut->testPixel(px/80,px%80,true);
+      _api->_dut->maskPixel(px/80,px%80,false);
+    }
+
+    pxar::timer t;
+    _api->daqStart();
+    for(int i = 0; i < readouts; i++) {
+      _api->daqTrigger(triggers,period);
+      std::vector<pxar::Event> data = _api->daqGetEventBuffer();
+
+      nevents += data.size();
+      for(size_t e = 0; e < data.size(); e++) { nhits += data[e].pixels.size(); }
+      if(data.size() != static_cast<size_t>(triggers)) {
+	if(failed++ < 10) {
+	  std::cout << "Readout " << i << ": " << data.size() << " events instead of " << triggers << std::endl;
+	}
+      }
+
+      long rss = residentKB();
+      if(i + 1 == warmup) baseline = rss;
+      if(rss > peak) peak = rss;
+      if((i + 1) % (readouts/10) == 0) {
+	std::cout << "Readout " << (i + 1) << "/" << readouts << ": " << nevents << " events, "
+		  << nhits << " hits, resident memory " << rss << " kB (" << t << "ms)" << std::endl;
+      }
+    }
+    _api->daqStop();
+  }
+  catch (...) {
+    std::cout << "pxar caught an exception from the board. Exiting." << std::endl;
+    delete _api;
+    return -1;
+  }
+
+  delete _api;
+
+  long growth = peak - baseline;
+  std::cout << "Resident memory after warm-up " << baseline << " kB, peak " << peak << " kB, growth "
+	    << growth << " kB (limit " << limit << " kB)" << std::endl;
+  if(baseline == 0) { std::cout << "Resident memory not available on this platform, not checked." << std::endl; }
+
+  if(failed > 0) {
+    std::cout << "FAILED: " << failed << " incomplete readouts." << std::endl;
+    return 1;
+  }
+  if(baseline > 0 && growth > limit) {
+    std::cout << "FAILED: resident memory grew by " << growth << " kB." << std::endl;
+    return 1;
+  }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
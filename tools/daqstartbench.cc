@@ -0,0 +1,145 @@
+// Latency of daqStart()/daqStop() as a function of the number of enabled
+// pixels. Needs a DTB with a single ROC attached (or "-b emulator"), the
+// setup is hardcoded the same way as in pxardaq.
+
+#include "pxar.h"
+#include "timer.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+int main(int argc, char* argv[]) {
+
+  std::string board = "*";
+  std::string verbosity = "WARNING";
+  std::string roctype = "psi46digv21";
+  int repetitions = 10;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-b board        testboard name, \"emulator[:latency_us[:bandwidth_Bps]]\" for the DTB emulation" << std::endl;
+      std::cout << "-r repetitions  daqStart/daqStop cycles per point, default 10" << std::endl;
+      std::cout << "-t roctype      ROC type, default psi46digv21" << std::endl;
+      std::cout << "-v verbosity    verbosity level, default WARNING" << std::endl;
+      return 0;
+    }
+    if (!strcmp(argv[i],"-b") && i+1 < argc) { board = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-r") && i+1 < argc) { repetitions = atoi(argv[++i]); }
+    else if (!strcmp(argv[i],"-t") && i+1 < argc) { roctype = std::string(argv[++i]); }
+    else if (!strcmp(argv[i],"-v") && i+1 < argc) { verbosity = std::string(argv[++i]); }
+    else {
+      std::cout << "Unrecognized command line option " << argv[i] << std::endl;
+    }
+  }
+  if(repetitions < 1) repetitions = 1;
+
+  std::vector<std::pair<std::string,uint8_t> > sig_delays;
+  sig_delays.push_back(std::make_pair("clk",2));
+  sig_delays.push_back(std::make_pair("ctr",2));
+  sig_delays.push_back(std::make_pair("sda",17));
+  sig_delays.push_back(std::make_pair("tin",7));
+  sig_delays.push_back(std::make_pair("deser160phase",4));
+
+  std::vector<std::pair<std::string,double> > power_settings;
+  power_settings.push_back(std::make_pair("va",1.9));
+  power_settings.push_back(std::make_pair("vd",2.6));
+  power_settings.push_back(std::make_pair("ia",1.190));
+  power_settings.push_back(std::make_pair("id",1.10));
+
+  std::vector<std::pair<std::string,uint8_t> > pg_setup;
+  pg_setup.push_back(std::make_pair("resetroc",25));
+  pg_setup.push_back(std::make_pair("calibrate",106));
+  pg_setup.push_back(std::make_pair("trigger",16));
+  pg_setup.push_back(std::make_pair("token",0));
+
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > tbmDACs;
+  std::vector<std::vector<std::pair<std::string,uint8_t> > > rocDACs;
+  std::vector<std::pair<std::string,uint8_t> > dacs;
+  dacs.push_back(std::make_pair("Vdig",8));
+  dacs.push_back(std::make_pair("Vana",78));
+  dacs.push_back(std::make_pair("Vsf",80));
+  dacs.push_back(std::make_pair("Vcomp",12));
+  dacs.push_back(std::make_pair("VwllPr",150));
+  dacs.push_back(std::make_pair("VwllSh",150));
+  dacs.push_back(std::make_pair("VhldDel",117));
+  dacs.push_back(std::make_pair("Vtrim",152));
+  dacs.push_back(std::make_pair("VthrComp",89));
+  dacs.push_back(std::make_pair("VIBias_Bus",30));
+  dacs.push_back(std::make_pair("Vbias_sf",6));
+  dacs.push_back(std::make_pair("VoffsetOp",60));
+  dacs.push_back(std::make_pair("VOffsetRO",225));
+  dacs.push_back(std::make_pair("VIon",45));
+  dacs.push_back(std::make_pair("Vcomp_ADC",10));
+  dacs.push_back(std::make_pair("VIref_ADC",70));
+  dacs.push_back(std::make_pair("VIbias_roc",150));
+  dacs.push_back(std::make_pair("VIColOr",99));
+  dacs.push_back(std::make_pair("Vcal",199));
+  dacs.push_back(std::make_pair("CalDel",140));
+  dacs.push_back(std::make_pair("CtrlReg",0));
+  dacs.push_back(std::make_pair("WBC",100));
+  rocDACs.push_back(dacs);
+
+  std::vector<std::vector<pxar::pixelConfig> > rocPixels;
+  std::vector<pxar::pixelConfig> pixels;
+  for(int col = 0; col < 52; col++) {
+    for(int row = 0; row < 80; row++) {
+      pixels.push_back(pxar::pixelConfig(col,row,15));
+    }
+  }
+  rocPixels.push_back(pixels);
+
+  // Numbers of enabled pixels to measure, up to the full ROC:
+  int npoints[] = {0, 1, 10, 100, 520, 1000, 2080, 4160};
+
+  try {
+    _api = new pxar::api(board,verbosity);
+
+    if(!_api->initTestboard(sig_delays, power_settings, pg_setup)) {
+      delete _api;
+      return -1;
+    }
+    if(!_api->initDUT(0,"tbm08",tbmDACs,roctype,rocDACs,rocPixels)) {
+      std::cout << " initDUT failed -> invalid configuration?! " << std::endl;
+      delete _api;
+      return -2;
+    }
+
+    std::cout << std::setw(8) << "pixels" << std::setw(14) << "daqStart [ms]" << std::setw(14) << "daqStop [ms]" << std::endl;
+
+    for(size_t i = 0; i < sizeof(npoints)/sizeof(npoints[0]); i++) {
+      // Enable the first npoints[i] pixels, column by column:
+      _api->_dut->testAllPixels(false);
+      _api->_dut->maskAllPixels(true);
+      for(int px = 0; px < npoints[i]; px++) {
+	_api->_dut->testPixel(px/80,px%80,true);
+	_api->_dut->maskPixel(px/80,px%80,false);
+      }
+
+      uint64_t tstart = 0, tstop = 0;
+      for(int r = 0; r < repetitions; r++) {
+	pxar::timer t0;
+	_api->daqStart();
+	tstart += t0.get();
+	pxar::timer t1;
+	_api->daqStop();
+	tstop += t1.get();
+      }
+
+      std::cout << std::setw(8) << npoints[i]
+		<< std::setw(14) << std::fixed << std::setprecision(2) << static_cast<double>(tstart)/repetitions
+		<< std::setw(14) << static_cast<double>(tstop)/repetitions << std::endl;
+    }
+  }
+  catch (...) {
+    std::cout << "pxar caught an exception from the board. Exiting." << std::endl;
+    delete _api;
+    return -1;
+  }
+
+  delete _api;
+  return 0;
+}
@@ -0,0 +1,157 @@
+// Decoding throughput of the DTB data pipes, measured on generated data
+// without any hardware: the runtime chain (dtbEventSplitter >> dtbEventDecoder
+// connected with operator >>) against the compile-time dtbPipeline.
+
+#include "datapipe.h"
+#include "constants.h"
+#include "timer.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+// In-memory replacement for the dtbSource, handing out the data in DTB sized blocks
+class memSource : public pxar::dataSource<uint16_t> {
+  const std::vector<uint16_t> & data;
+  bool module;
+  size_t end, pos;
+  uint16_t last;
+
+  void NextBlock() {
+    if(end >= data.size()) throw pxar::dsBufferEmpty();
+    pos = end;
+    end = std::min(data.size(), end + DTB_SOURCE_BLOCK_SIZE);
+  }
+
+  uint16_t Read() { return Get(); }
+  uint16_t ReadLast() { return GetLast(); }
+  size_t ReadBlock(const uint16_t* &block) { return GetBlock(block); }
+  void ReadSkip(size_t n) { Skip(n); }
+  bool ReadState() { return module; }
+  uint8_t ReadChannel() { return 0; }
+  uint8_t ReadDeviceType() { return ROC_PSI46DIGV21; }
+
+public:
+  memSource(const std::vector<uint16_t> & samples, bool tbm) : data(samples), module(tbm), end(0), pos(0), last(0x4000) {}
+
+  uint16_t Get() {
+    if(pos >= end) NextBlock();
+    return last = data[pos++];
+  }
+  uint16_t GetLast() { return last; }
+  size_t GetBlock(const uint16_t* &block) {
+    if(pos >= end) { block = 0; return 0; }
+    block = &data[pos];
+    return end - pos;
+  }
+  void Skip(size_t n) {
+    if(n == 0) return;
+    pos += n;
+    last = data[pos-1];
+  }
+};
+
+// Raw pixel address and pulse height as sent by the digital ROCs:
+uint32_t encodePixel(int column, int row, int ph) {
+  int c = column/2;
+  int r = 2*(80 - row) + (column&1);
+  return ((c/6) << 21) | ((c%6) << 18) | ((r/36) << 15) | (((r/6)%6) << 12) | ((r%6) << 9)
+    | ((ph & 0xf0) << 1) | (ph & 0x0f);
+}
+
+// Generate nEvents Events with up to maxHits hits per ROC:
+std::vector<uint16_t> generate(bool module, size_t nEvents, int nRocs, int maxHits) {
+  std::vector<uint16_t> data;
+  for(size_t evt = 0; evt < nEvents; evt++) {
+    if(module) {
+      data.push_back(0xa000 | (evt & 0xff));
+      data.push_back(0x8000);
+    }
+    for(int roc = 0; roc < (module ? nRocs : 1); roc++) {
+      int nhits = rand() % (maxHits + 1);
+      if(module) { data.push_back(0x4000 | 0x7f8); }
+      else { data.push_back((nhits > 0 ? 0x8000 : 0xc000) | 0x7f8); }
+      for(int hit = 0; hit < nhits; hit++) {
+	uint32_t raw = encodePixel(rand() % ROC_NUMCOLS, rand() % ROC_NUMROWS, rand() % 256);
+	if(module) {
+	  data.push_back(0x0000 | ((raw >> 12) & 0x0fff));
+	  data.push_back(0x2000 | (raw & 0x0fff));
+	}
+	else {
+	  data.push_back((raw >> 12) & 0x0fff);
+	  data.push_back((raw & 0x0fff) | (hit == nhits - 1 ? 0x4000 : 0));
+	}
+      }
+    }
+    if(module) {
+      data.push_back(0xe000);
+      data.push_back(0xc000);
+    }
+  }
+  return data;
+}
+
+void report(const char * name, size_t words, size_t events, size_t hits, uint64_t ms) {
+  double s = (ms > 0 ? ms : 1)/1000.;
+  std::cout << std::setw(22) << std::left << name << std::right
+	    << std::setw(10) << events << " events " << std::setw(10) << hits << " hits "
+	    << std::setw(8) << ms << " ms " << std::setw(8) << std::fixed << std::setprecision(1)
+	    << words/s/1e6 << " Mwords/s" << std::endl;
+}
+
+void benchmark(bool module, size_t nEvents) {
+  std::vector<uint16_t> data = generate(module, nEvents, 8, 4);
+  std::cout << (module ? "DESER400, 8 ROCs: " : "DESER160, single ROC: ")
+	    << data.size() << " words" << std::endl;
+
+  // Runtime chain, every sample through the virtual dataSource interface:
+  {
+    memSource src(data, module);
+    pxar::dtbEventSplitter splitter;
+    pxar::dtbEventDecoder decoder;
+    pxar::dataSink<pxar::Event*> pump;
+    src >> splitter >> decoder >> pump;
+
+    size_t events = 0, hits = 0;
+    pxar::timer t;
+    try {
+      while(true) { hits += pump.Get()->pixels.size(); events++; }
+    }
+    catch(pxar::dsBufferEmpty &) {}
+    report("  operator >> chain", data.size(), events, hits, t.get());
+  }
+
+  // Compile-time composed pipeline:
+  {
+    memSource src(data, module);
+    pxar::dtbPipeline<memSource> pipe;
+    pipe.Connect(&src, module, ROC_PSI46DIGV21, 0);
+
+    size_t events = 0, hits = 0;
+    pxar::timer t;
+    try {
+      while(true) { hits += pipe.GetEvent()->pixels.size(); events++; }
+    }
+    catch(pxar::dsBufferEmpty &) {}
+    report("  dtbPipeline", data.size(), events, hits, t.get());
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  size_t nEvents = 1000000;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i],"-h")) {
+      std::cout << "Help:" << std::endl;
+      std::cout << "-n events    number of generated events per format (default 1000000)" << std::endl;
+      return 0;
+    }
+    if (!strcmp(argv[i],"-n") && i+1 < argc) { nEvents = atoi(argv[++i]); }
+  }
+
+  srand(42);
+  benchmark(false, nEvents);
+  benchmark(true, nEvents);
+  return 0;
+}
@@ -4,8 +4,6 @@
 #include <stdlib.h>  // atof, atoi
 #include <algorithm> // std::find
 
-#include <TStopwatch.h>
-
 #include "PixTestDacScanCurrent.hh"
 #include "log.h"
 
@@ -130,7 +128,6 @@ void PixTestDacScanCurrent::doTest()
 
   TH1D *hia(0);
   TH1D *hid(0);
-  TStopwatch sw;
 
   size_t nRocs = fPixSetup->getConfigParameters()->getNrocs();
 
@@ -147,24 +144,20 @@ void PixTestDacScanCurrent::doTest()
 
       fApi->setDAC( fParDAC, 0, roc ); // start at zero
 
-      // delay:
-
-      sw.Start(kTRUE); // reset stopwatch
-      do {
-	sw.Start(kFALSE); // continue
-	fApi->getTBia();
-      }
-      while( sw.RealTime() < 0.1 ); // [s]
+      // wait for the currents to settle, from the telemetry samples:
 
-      // loop over DAC:
+      fApi->waitTelemetrySettled( "ia", 2E-4, 3, 1000 );
+      fApi->waitTelemetrySettled( "id", 2E-4, 3, 1000 );
 
-      for( uint32_t idac = 0; idac <= maxDac; ++idac ) {
+      // sweep DAC in one pipelined sequence, with adaptive settling:
 
-	fApi->setDAC( fParDAC, idac, roc );
-	// delay?
-	hia->SetBinContent( idac+1, fApi->getTBia()*1E3 );
-	hid->SetBinContent( idac+1, fApi->getTBid()*1E3 );
+      std::vector<std::pair<uint8_t, std::pair<double, double> > >
+	currents = fApi->getCurrentVsDAC( fParDAC, 1, 0, maxDac, roc, 0, true );
 
+      for( unsigned int i = 0; i < currents.size(); ++i ) {
+	int idac = currents[i].first;
+	hia->SetBinContent( idac+1, currents[i].second.first*1E3 );
+	hid->SetBinContent( idac+1, currents[i].second.second*1E3 );
       }
 
       fApi->setDAC( fParDAC, dacval, roc ); // restore
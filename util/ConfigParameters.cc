@@ -6,7 +6,9 @@
 #include <bitset>
 
 #include <cstdlib>
+#include <cstring>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "log.h"
 #include "dictionaries.h"
@@ -16,6 +18,140 @@
 using namespace std;
 using namespace pxar;
 
+namespace {
+
+  const char SNAPSHOTMAGIC[] = "PXARCFG1"; 
+  const int MAXTOKENS(8);
+
+  // ----------------------------------------------------------------------
+  // -- read a complete file with one read
+  bool readWholeFile(const string &fname, string &buf) {
+    ifstream is(fname.c_str(), ios::in | ios::binary);
+    if (!is.is_open()) return false;
+    is.seekg(0, ios::end);
+    streamoff len = is.tellg();
+    is.seekg(0, ios::beg);
+    buf.resize(len > 0 ? static_cast<size_t>(len) : 0);
+    if (len > 0) is.read(&buf[0], len);
+    is.close();
+    return true;
+  }
+
+  // ----------------------------------------------------------------------
+  // -- split the line starting at p into blank/tab separated tokens (at most MAXTOKENS are stored), 
+  //    move p to the start of the next line and return the number of tokens found.
+  //    With skipPix, "Pix" is treated as separator (as in "15 Pix  0  0").
+  bool isSeparator(const char *p, const char *end, bool skipPix) {
+    if (*p == ' ' || *p == '\t' || *p == '\r') return true;
+    return (skipPix && end - p >= 3 && p[0] == 'P' && p[1] == 'i' && p[2] == 'x');
+  }
+
+  int nextLine(const char *&p, const char *end, const char **tok, int *len, bool skipPix) {
+    int ntok(0);
+    while (p < end && *p != '\n') {
+      if (isSeparator(p, end, skipPix)) {
+	p += (*p == 'P' ? 3 : 1);
+	continue;
+      }
+      const char *start = p;
+      while (p < end && *p != '\n' && !isSeparator(p, end, skipPix)) ++p;
+      if (ntok < MAXTOKENS) {
+	tok[ntok] = start;
+	len[ntok] = static_cast<int>(p - start);
+      }
+      ++ntok;
+    }
+    if (p < end) ++p;
+    return ntok;
+  }
+
+  // ----------------------------------------------------------------------
+  // -- decimal or hexadecimal (0x..) integer; the token is followed by a separator or the terminating zero of the buffer
+  int tokenValue(const char *tok, int len) {
+    for (int i = 0; i+1 < len; ++i) {
+      if (tok[i] == '0' && tok[i+1] == 'x') return static_cast<int>(strtol(tok+i, 0, 16));
+    }
+    return atoi(tok);
+  }
+
+  // ----------------------------------------------------------------------
+  void fileStat(const string &fname, int64_t &mtime, int64_t &size) {
+    struct stat st;
+    if (0 != stat(fname.c_str(), &st)) {
+      mtime = 0; 
+      size = -1; 
+      return;
+    }
+    mtime = static_cast<int64_t>(st.st_mtime);
+    size = static_cast<int64_t>(st.st_size);
+  }
+
+  // ----------------------------------------------------------------------
+  // -- serialization helpers for the binary snapshot (native byte order, it never leaves the machine)
+  template <typename T> void putValue(string &s, T v) {
+    s.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+
+  void putString(string &s, const string &v) {
+    putValue<uint32_t>(s, static_cast<uint32_t>(v.size()));
+    s.append(v);
+  }
+
+  void putDacs(string &s, const vector<vector<pair<string, uint8_t> > > &v) {
+    putValue<uint32_t>(s, static_cast<uint32_t>(v.size()));
+    for (unsigned int i = 0; i < v.size(); ++i) {
+      putValue<uint32_t>(s, static_cast<uint32_t>(v[i].size()));
+      for (unsigned int j = 0; j < v[i].size(); ++j) {
+	putString(s, v[i][j].first);
+	putValue<uint8_t>(s, v[i][j].second);
+      }
+    }
+  }
+
+  class snapshotReader {
+  public:
+    snapshotReader(const string &buf, size_t pos = 0) : fBuf(buf), fPos(pos), fOk(true) {}
+    template <typename T> T get() {
+      T v = T();
+      if (!fOk || fPos + sizeof(T) > fBuf.size()) {
+	fOk = false;
+	return v;
+      }
+      memcpy(&v, fBuf.data() + fPos, sizeof(T));
+      fPos += sizeof(T);
+      return v;
+    }
+    string getString() {
+      uint32_t n = get<uint32_t>();
+      if (!fOk || fPos + n > fBuf.size()) {
+	fOk = false;
+	return string();
+      }
+      string v(fBuf, fPos, n);
+      fPos += n;
+      return v;
+    }
+    vector<vector<pair<string, uint8_t> > > getDacs() {
+      vector<vector<pair<string, uint8_t> > > v(get<uint32_t>());
+      for (unsigned int i = 0; fOk && i < v.size(); ++i) {
+	uint32_t n = get<uint32_t>();
+	for (unsigned int j = 0; fOk && j < n; ++j) {
+	  string name = getString();
+	  v[i].push_back(make_pair(name, get<uint8_t>()));
+	}
+      }
+      return v;
+    }
+    bool ok() {return fOk;}
+    bool atEnd() {return fOk && fPos == fBuf.size();}
+  private:
+    const string &fBuf;
+    size_t fPos;
+    bool fOk;
+  };
+
+}
+
 
 ConfigParameters * ConfigParameters::fInstance = 0;
 
@@ -35,6 +171,8 @@ ConfigParameters::ConfigParameters(string filename) {
 // ----------------------------------------------------------------------
 void ConfigParameters::initialize() {
   fReadTbParameters = fReadTbmParameters = fReadDacParameters = fReadRocPixelConfig = false; 
+  fUseSnapshot = fSnapshotRead = false;
+  fSnapshotFileName = "configSnapshot.bin";
   fnCol = 52; 
   fnRow = 80; 
   fnRocs = 16;
@@ -155,6 +293,7 @@ bool ConfigParameters::readConfigParameterFile(string file) {
       else if (0 == _name.compare("rootFileName")) { setRootFileName(_value); }
       else if (0 == _name.compare("trimParameters")) { setTrimParameterFileName(_value); }
       else if (0 == _name.compare("maskFile")) { setMaskFileName(_value); }
+      else if (0 == _name.compare("configSnapshot")) { setUseSnapshot(_ivalue > 0); }
 
       else if (0 == _name.compare("nModules")) { fnModules                  = _ivalue; }
       else if (0 == _name.compare("nRocs")) { fnRocs                     = _ivalue; }
@@ -206,52 +345,21 @@ vector<pair<string, uint8_t> > ConfigParameters::readDacFile(string fname) {
   vector<pair<string, uint8_t> > rocDacs; 
 
   // -- read in file
-  vector<string> lines; 
-  char  buffer[5000];
+  string buffer;
   LOG(logINFO) << "      reading " << fname;
-  ifstream is(fname.c_str());
-  while (is.getline(buffer, 200, '\n')) {
-    lines.push_back(string(buffer));
-  }
-  is.close();
-
-  // -- parse lines
-  unsigned int ival(0); 
-  uint8_t uval(0); 
-  //  unsigned char uval(0); 
-  
-  string::size_type s1, s2; 
-  string str1, str2, str3;
-  for (unsigned int i = 0; i < lines.size(); ++i) {
-    //    cout << lines[i] << endl;   
-    // -- remove tabs, adjacent spaces, leading and trailing spaces
-    replaceAll(lines[i], "\t", " "); 
-    string::iterator new_end = unique(lines[i].begin(), lines[i].end(), ConfigParameters::bothAreSpaces);
-    lines[i].erase(new_end, lines[i].end()); 
-    if (lines[i].length() < 2) continue;
-    if (lines[i].substr(0, 1) == string(" ")) lines[i].erase(0, 1); 
-    if (lines[i].substr(lines[i].length()-1, 1) == string(" ")) lines[i].erase(lines[i].length()-1, 1); 
-    s1 = lines[i].find(" "); 
-    s2 = lines[i].rfind(" "); 
-    if (s1 != s2) {
-      // -- with register number 
-      str1 = lines[i].substr(0, s1); 
-      str2 = lines[i].substr(s1+1, s2-s1-1); 
-      str3 = lines[i].substr(s2+1); 
-    } else {
-      // -- without register number 
-      str2 = lines[i].substr(0, s1); 
-      str3 = lines[i].substr(s1+1); 
-    }
-    
-    if (string::npos != str3.find("0x")) {
-      sscanf(str3.c_str(), "%x", &ival);  
-    } else {
-      ival = atoi(str3.c_str()); 
-    }
-    uval = ival;
-    rocDacs.push_back(make_pair(str2, uval)); 
-
+  readWholeFile(fname, buffer);
+
+  // -- parse lines: "[register] name value", value decimal or hexadecimal
+  const char *tok[MAXTOKENS];
+  int len[MAXTOKENS];
+  const char *p = buffer.c_str(), *end = p + buffer.size();
+  while (p < end) {
+    int ntok = nextLine(p, end, tok, len, false);
+    if (ntok < 2) continue;
+    int iname = (ntok > 2 ? 1 : 0);
+    int ival = (ntok > MAXTOKENS ? MAXTOKENS : ntok) - 1;
+    uint8_t uval = static_cast<uint8_t>(tokenValue(tok[ival], len[ival])); 
+    rocDacs.push_back(make_pair(string(tok[iname], len[iname]), uval)); 
   }
 
   return rocDacs; 
@@ -269,10 +377,13 @@ vector<pair<string, uint8_t> >  ConfigParameters::getTbParameters() {
 // ----------------------------------------------------------------------
 void ConfigParameters::readTbParameters() {
   if (!fReadTbParameters) {
-    string filename = fDirectory + "/" + fTBParametersFileName; 
-    fTbParameters = readDacFile(filename); 
+    if (!restoreSection("tb")) {
+      string filename = fDirectory + "/" + fTBParametersFileName; 
+      fTbParameters = readDacFile(filename); 
+      fReadTbParameters = true; 
+      storeSection("tb");
+    }
     LOG(logDEBUG) << dumpParameters(fTbParameters);
-    fReadTbParameters = true; 
   }
 }
 
@@ -348,41 +459,31 @@ vector<pxar::pixelConfig> ConfigParameters::getRocPixelConfig(int i) {
 
 // ----------------------------------------------------------------------
 void ConfigParameters::readRocPixelConfig() {
-  string filename; 
+  if (restoreSection("trim")) return;
+
   // -- read one mask file containing entire DUT mask
-  filename = fDirectory + "/" + fMaskFileName; 
-  vector<bool> rocmasked; 
-  for (unsigned int i = 0; i < fnRocs; ++i) rocmasked.push_back(false); 
-  
+  string filename = fDirectory + "/" + fMaskFileName; 
   vector<vector<pair<int, int> > > vmask = readMaskFile(filename); 
-  for (unsigned int i = 0; i < vmask.size(); ++i) {
-    vector<pair<int, int> > v = vmask[i]; 
-    if (v.size() > 0) {
-      rocmasked[i] = true; 
-      for (unsigned int j = 0; j < v.size(); ++j) {
-	LOG(logINFO) << "MASKED Roc " << i << " col/row: " << v[j].first << " " << v[j].second;
-      }
-    }
-  }
   
   // -- read all trim files and create pixelconfig vector
   for (unsigned int i = 0; i < fnRocs; ++i) {
+    vector<bool> masked(fnCol*fnRow, false); 
+    for (unsigned int j = 0; j < vmask[i].size(); ++j) {
+      LOG(logINFO) << "MASKED Roc " << i << " col/row: " << vmask[i][j].first << " " << vmask[i][j].second;
+      masked[vmask[i][j].first*fnRow + vmask[i][j].second] = true; 
+    }
+
     vector<pxar::pixelConfig> v;
+    v.reserve(fnCol*fnRow); 
     for (uint8_t ic = 0; ic < fnCol; ++ic) {
       for (uint8_t ir = 0; ir < fnRow; ++ir) {
 	pxar::pixelConfig a; 
 	a.column = ic; 
 	a.row = ir; 
 	a.trim = 0;
-	a.mask = false;
-	if (rocmasked[i]) {
-	  vector<pair<int, int> > v = vmask[i]; 
-	  for (unsigned int j = 0; j < v.size(); ++j) {
-	    if (v[j].first == ic && v[j].second == ir) {
-	      LOG(logINFO) << "  masking Roc " << i << " col/row: " << v[j].first << " " << v[j].second;
-	      a.mask = true;
-	    }
-	  }
+	a.mask = masked[ic*fnRow + ir];
+	if (a.mask) {
+	  LOG(logINFO) << "  masking Roc " << i << " col/row: " << static_cast<int>(ic) << " " << static_cast<int>(ir);
 	}
 	a.enable = true;
 	v.push_back(a); 
@@ -395,6 +496,7 @@ void ConfigParameters::readRocPixelConfig() {
   }
   
   fReadRocPixelConfig = true; 
+  storeSection("trim");
 }
 
 
@@ -402,97 +504,61 @@ void ConfigParameters::readRocPixelConfig() {
 void ConfigParameters::readTrimFile(string fname, vector<pxar::pixelConfig> &v) {
   
   // -- read in file
-  vector<string> lines; 
-  char  buffer[5000];
+  string buffer;
   LOG(logINFO) << "      reading " << fname;
-  ifstream is(fname.c_str());
-  while (is.getline(buffer, 200, '\n')) {
-    lines.push_back(string(buffer));
-  }
-  is.close();
-  
-  // -- parse lines
-  unsigned int ival(0), irow(0), icol(0); 
-  uint8_t uval(0); 
+  readWholeFile(fname, buffer);
   
-  string::size_type s1, s2; 
-  string str1, str2, str3;
-  for (unsigned int i = 0; i < lines.size(); ++i) {
-    // -- remove tabs, adjacent spaces, leading and trailing spaces
-    replaceAll(lines[i], "\t", " "); 
-    replaceAll(lines[i], "Pix", " "); 
-    string::iterator new_end = unique(lines[i].begin(), lines[i].end(), ConfigParameters::bothAreSpaces);
-    lines[i].erase(new_end, lines[i].end()); 
-    if (0 == lines[i].length()) continue;
-    if (lines[i].substr(0, 1) == string(" ")) lines[i].erase(0, 1); 
-    if (lines[i].substr(lines[i].length()-1, 1) == string(" ")) lines[i].erase(lines[i].length()-1, 1); 
-    s1 = lines[i].find(" "); 
-    s2 = lines[i].rfind(" "); 
-    if (s1 != s2) {
-      str1 = lines[i].substr(0, s1); 
-      str2 = lines[i].substr(s1+1, s2-s1); 
-      str3 = lines[i].substr(s2+1); 
-    } else {
-      LOG(logINFO) << "could not read line -->" << lines[i] << "<--";
+  // -- parse lines: "trim Pix col row"
+  const char *tok[MAXTOKENS];
+  int len[MAXTOKENS];
+  const char *p = buffer.c_str(), *end = p + buffer.size();
+  while (p < end) {
+    const char *line = p;
+    int ntok = nextLine(p, end, tok, len, true);
+    if (0 == ntok) continue;
+    if (ntok < 3) {
+      LOG(logINFO) << "could not read line -->" << string(line, p - line) << "<--";
+      continue;
     }
-    
-    ival = atoi(str1.c_str()); 
-    icol = atoi(str2.c_str()); 
-    irow = atoi(str3.c_str()); 
-    uval = ival;
-    unsigned int index = icol*80+irow; 
-    if (index <= v.size()) {
-      v[index].trim = uval; 
+    int irow = (ntok > MAXTOKENS ? MAXTOKENS : ntok) - 1;
+    unsigned int ival = atoi(tok[0]); 
+    unsigned int icol = atoi(tok[1]); 
+    unsigned int row = atoi(tok[irow]); 
+    unsigned int index = icol*fnRow + row; 
+    if (row < fnRow && index < v.size()) {
+      v[index].trim = static_cast<uint8_t>(ival); 
     } else {
-      LOG(logINFO) << " not matching entry in trim vector found for row/col = " << irow << "/" << icol;
+      LOG(logINFO) << " not matching entry in trim vector found for row/col = " << row << "/" << icol;
     }
   }
 
-
 }
 
 
 // ----------------------------------------------------------------------
 vector<vector<pair<int, int> > > ConfigParameters::readMaskFile(string fname) {
 
-  vector<vector<pair<int, int> > > v; 
-  vector<pair<int, int> > a; 
-  for (unsigned int i = 0; i < fnRocs; ++i) {
-    v.push_back(a); 
-  }
+  vector<vector<pair<int, int> > > v(fnRocs); 
 
   // -- read in file
-  vector<string> lines; 
-  char  buffer[5000];
+  string buffer;
   LOG(logINFO) << "      reading " << fname;
-  ifstream is(fname.c_str());
-  while (is.getline(buffer, 200, '\n')) {
-    lines.push_back(string(buffer));
-  }
-  is.close();
+  readWholeFile(fname, buffer);
   
-  // -- parse lines
+  // -- parse lines: "roc iroc", "row iroc irow", "col iroc icol" or "pix iroc icol irow"
+  const char *tok[MAXTOKENS];
+  int len[MAXTOKENS];
   unsigned int iroc(0), irow(0), icol(0); 
-  
-  string::size_type s1, s2, s3; 
-  string str1, str2, str3;
-  for (unsigned int i = 0; i < lines.size(); ++i) {
-    //    cout << lines[i] << endl;   
-    if (lines[i].substr(0, 1) == string("#")) continue;
-    // -- remove tabs, adjacent spaces, leading and trailing spaces
-    replaceAll(lines[i], "\t", " "); 
-    replaceAll(lines[i], "Pix", " "); 
-    string::iterator new_end = unique(lines[i].begin(), lines[i].end(), ConfigParameters::bothAreSpaces);
-    lines[i].erase(new_end, lines[i].end()); 
-    if (lines[i].substr(0, 1) == string(" ")) lines[i].erase(0, 1); 
-    if (0 == lines[i].length()) continue;
-    if (lines[i].substr(lines[i].length()-1, 1) == string(" ")) lines[i].erase(lines[i].length()-1, 1); 
-
-    s1 = lines[i].find("roc"); 
-    if (string::npos != s1) {
-      str3 = lines[i].substr(s1+1); 
-      iroc = atoi(str3.c_str()); 
-      //      cout << "masking all pixels for ROC " << iroc << endl;
+  const char *p = buffer.c_str(), *end = p + buffer.size();
+  for (unsigned int i = 0; p < end; ++i) {
+    const char *line = p;
+    int ntok = nextLine(p, end, tok, len, true);
+    if (0 == ntok || '#' == tok[0][0]) continue;
+    if (3 != len[0]) continue;
+    string key(tok[0], 3);
+
+    if (key == "roc" && ntok > 1) {
+      iroc = atoi(tok[1]); 
       if (iroc < fnRocs) {
 	for (uint8_t ic = 0; ic < fnCol; ++ic) {
 	  for (uint8_t ir = 0; ir < fnRow; ++ir) {
@@ -500,58 +566,45 @@ vector<vector<pair<int, int> > > ConfigParameters::readMaskFile(string fname) {
 	  }
 	}  
       } else {
-	LOG(logINFO) << "illegal ROC coordinates in line " << i << ": " << lines[i];
+	LOG(logINFO) << "illegal ROC coordinates in line " << i << ": " << string(line, p - line);
       }
       continue;
     }
     
-    s1 = lines[i].find("row"); 
-    if (string::npos != s1) {
-      s1 += 4; 
-      s2 = lines[i].find(" ", s1) + 1; 
-      iroc = atoi(lines[i].substr(s1, s2-s1-1).c_str()); 
-      irow = atoi(lines[i].substr(s2).c_str()); 
-      //      cout << "-> MASKING ROC " << iroc << " row " << irow << endl;
+    if (key == "row" && ntok > 2) {
+      iroc = atoi(tok[1]); 
+      irow = atoi(tok[2]); 
       if (iroc < fnRocs && irow < fnRow) {
 	for (unsigned int ic = 0; ic < fnCol; ++ic) {
 	  v[iroc].push_back(make_pair(ic, irow)); 
 	}  
       } else {
-	LOG(logINFO) << "illegal ROC/row coordinates in line " << i << ": " << lines[i];
+	LOG(logINFO) << "illegal ROC/row coordinates in line " << i << ": " << string(line, p - line);
       }
       continue;
     }
 
-    s1 = lines[i].find("col"); 
-    if (string::npos != s1) {
-      s1 += 4; 
-      s2 = lines[i].find(" ", s1) + 1; 
-      iroc = atoi(lines[i].substr(s1, s2-s1-1).c_str()); 
-      icol = atoi(lines[i].substr(s2).c_str()); 
-      //      cout << "-> MASKING ROC " << iroc << " col " << icol << endl;
+    if (key == "col" && ntok > 2) {
+      iroc = atoi(tok[1]); 
+      icol = atoi(tok[2]); 
       if (iroc < fnRocs && icol < fnCol) {
 	for (unsigned int ir = 0; ir < fnRow; ++ir) {
 	  v[iroc].push_back(make_pair(icol, ir)); 
 	}  
       } else {
-	LOG(logINFO) << "illegal ROC/col coordinates in line " << i << ": " << lines[i];
+	LOG(logINFO) << "illegal ROC/col coordinates in line " << i << ": " << string(line, p - line);
       }
       continue;
     }
 
-    s1 = lines[i].find("pix"); 
-    if (string::npos != s1) {
-      s1 += 4; 
-      s2 = lines[i].find(" ", s1) + 1; 
-      s3 = lines[i].find(" ", s2) + 1; 
-      iroc = atoi(lines[i].substr(s1, s2-s1-1).c_str()); 
-      icol = atoi(lines[i].substr(s2, s3-s2-1).c_str()); 
-      irow = atoi(lines[i].substr(s3).c_str()); 
-      //      cout << "-> MASKING ROC " << iroc << " col " << icol << " row " << irow << endl;
+    if (key == "pix" && ntok > 3) {
+      iroc = atoi(tok[1]); 
+      icol = atoi(tok[2]); 
+      irow = atoi(tok[3]); 
       if (iroc < fnRocs && icol < fnCol && irow < fnRow) {
 	v[iroc].push_back(make_pair(icol, irow)); 
       } else {
-	LOG(logINFO) << "illegal ROC/row/col coordinates in line " << i << ": " << lines[i];
+	LOG(logINFO) << "illegal ROC/row/col coordinates in line " << i << ": " << string(line, p - line);
       }
       continue;
     }
@@ -587,7 +640,7 @@ vector<string> ConfigParameters::getDacs() {
 
 // ----------------------------------------------------------------------
 void ConfigParameters::readRocDacs() {
-  if (!fReadDacParameters) {
+  if (!fReadDacParameters && !restoreSection("dac")) {
     for (unsigned int i = 0; i < fnRocs; ++i) {
       std::stringstream filename;
       filename << fDirectory << "/" << fDACParametersFileName << fTrimVcalSuffix << "_C" << i << ".dat"; 
@@ -595,6 +648,7 @@ void ConfigParameters::readRocDacs() {
       fDacParameters.push_back(rocDacs); 
     }
     fReadDacParameters = true; 
+    storeSection("dac");
   }
 }
 
@@ -609,7 +663,7 @@ vector<vector<pair<string, uint8_t> > > ConfigParameters::getTbmDacs() {
 
 // ----------------------------------------------------------------------
 void ConfigParameters::readTbmDacs() {
-  if (!fReadTbmParameters) {
+  if (!fReadTbmParameters && !restoreSection("tbm")) {
     string filename; 
     for (unsigned int i = 0; i < fnTbms; ++i) {
       filename = fDirectory + "/" + fTbmParametersFileName; 
@@ -617,6 +671,7 @@ void ConfigParameters::readTbmDacs() {
       fTbmParameters.push_back(rocDacs); 
     }
     fReadTbmParameters = true; 
+    storeSection("tbm");
   }
 }
 
@@ -881,41 +936,33 @@ void ConfigParameters::readGainPedestalParameters() {
   string bname = getGainPedestalParameterFileName(); 
 
   fGainPedestalParameters.clear();
+  if (restoreSection("gainped")) return;
 
-  // -- read in file
-  vector<string> lines; 
-  char  buffer[5000];
-  ifstream is;
+  string buffer;
+  const char *tok[MAXTOKENS];
+  int len[MAXTOKENS];
   for (unsigned int iroc = 0; iroc < fnRocs; ++iroc) {
     vector<gainPedestalParameters> rocPar; 
+    rocPar.reserve(fnCol*fnRow); 
     std::stringstream fname;
-    fname.str(std::string());
     fname << fDirectory << "/" << bname << fTrimVcalSuffix << "_C" << iroc << ".dat"; 
     LOG(logINFO) << "      reading " << (fname.str());
-    is.open((fname.str()).c_str());
-    if (!is.is_open()) {
+    if (!readWholeFile(fname.str(), buffer)) {
       LOG(logERROR) << "cannot open " << (fname.str()) << " for reading PH calibration constants"; 
       return;
     } 
 
-    while (is.getline(buffer, 200, '\n')) {
-      lines.push_back(string(buffer));
-    }
-    is.close();
-
-    // -- parse lines
-    double p0, p1, p2, p3;  
-    int icol, irow; 
-    string pix; 
-
-    for (unsigned int i = 3; i < lines.size(); ++i) {
-      istringstream istring(lines[i]);
-      istring >> p0 >> p1 >> p2 >> p3 >> pix >> icol >> irow; 
-      gainPedestalParameters a = {p0, p1, p2, p3};
+    // -- parse lines (after the three header lines): "p0 p1 p2 p3 Pix col row"
+    const char *p = buffer.c_str(), *end = p + buffer.size();
+    for (unsigned int i = 0; p < end; ++i) {
+      int ntok = nextLine(p, end, tok, len, true);
+      if (i < 3 || ntok < 4) continue;
+      gainPedestalParameters a = {strtod(tok[0], 0), strtod(tok[1], 0), strtod(tok[2], 0), strtod(tok[3], 0)};
       rocPar.push_back(a); 
     }
     fGainPedestalParameters.push_back(rocPar); 
   }
+  storeSection("gainped");
 }
 
 // ----------------------------------------------------------------------
@@ -996,6 +1043,220 @@ std::string ConfigParameters::getProbe(std::string probe) {
 
 
 
+// ----------------------------------------------------------------------
+vector<string> ConfigParameters::getSectionFiles(const string &section) {
+  vector<string> files; 
+  if ("tb" == section) {
+    files.push_back(fDirectory + "/" + fTBParametersFileName);
+  } else if ("tbm" == section) {
+    files.push_back(fDirectory + "/" + fTbmParametersFileName);
+  } else if ("trim" == section) {
+    files.push_back(fDirectory + "/" + fMaskFileName);
+  }
+
+  string bname; 
+  if ("dac" == section) bname = fDACParametersFileName; 
+  if ("trim" == section) bname = fTrimParametersFileName; 
+  if ("gainped" == section) bname = fGainPedestalParameterFileName; 
+  if (bname.size() > 0) {
+    for (unsigned int i = 0; i < fnRocs; ++i) {
+      std::stringstream fname;
+      fname << fDirectory << "/" << bname << fTrimVcalSuffix << "_C" << i << ".dat"; 
+      files.push_back(fname.str());
+    }
+  }
+  return files;
+}
+
+
+// ----------------------------------------------------------------------
+void ConfigParameters::readSnapshot() {
+  fSnapshotRead = true; 
+  fSnapshotSections.clear();
+
+  string fname = fDirectory + "/" + fSnapshotFileName; 
+  string buffer;
+  if (!readWholeFile(fname, buffer)) return;
+
+  size_t nmagic = strlen(SNAPSHOTMAGIC);
+  if (buffer.size() < nmagic || buffer.compare(0, nmagic, SNAPSHOTMAGIC)) {
+    LOG(logWARNING) << "ignoring " << fname << ", not a configuration snapshot of this version";
+    return;
+  }
+
+  snapshotReader r(buffer, nmagic);
+  uint32_t nsections = r.get<uint32_t>();
+  for (unsigned int i = 0; r.ok() && i < nsections; ++i) {
+    string section = r.getString();
+    string data = r.getString();
+    if (r.ok()) fSnapshotSections.insert(make_pair(section, data));
+  }
+  LOG(logDEBUG) << "read " << fSnapshotSections.size() << " sections from " << fname;
+}
+
+
+// ----------------------------------------------------------------------
+void ConfigParameters::writeSnapshot() {
+  string buffer(SNAPSHOTMAGIC);
+  putValue<uint32_t>(buffer, static_cast<uint32_t>(fSnapshotSections.size()));
+  for (map<string, string>::iterator it = fSnapshotSections.begin(); it != fSnapshotSections.end(); ++it) {
+    putString(buffer, it->first);
+    putString(buffer, it->second);
+  }
+
+  // -- write to a temporary file first, so that a concurrent reader never sees a partial snapshot
+  string fname = fDirectory + "/" + fSnapshotFileName; 
+  string tmpname = fname + ".tmp"; 
+  ofstream os(tmpname.c_str(), ios::out | ios::binary | ios::trunc);
+  if (!os.is_open()) {
+    LOG(logWARNING) << "cannot write configuration snapshot " << fname;
+    return;
+  }
+  os.write(buffer.data(), buffer.size());
+  os.close();
+  remove(fname.c_str());
+  if (0 != rename(tmpname.c_str(), fname.c_str())) {
+    LOG(logWARNING) << "cannot write configuration snapshot " << fname;
+  }
+}
+
+
+// ----------------------------------------------------------------------
+bool ConfigParameters::restoreSection(const string &section) {
+  if (!fUseSnapshot) return false;
+  if (!fSnapshotRead) readSnapshot();
+
+  map<string, string>::iterator it = fSnapshotSections.find(section);
+  if (it == fSnapshotSections.end()) return false;
+
+  // -- the section is only valid if it was made from exactly the files we would read now
+  snapshotReader r(it->second);
+  vector<string> files = getSectionFiles(section);
+  bool valid = (r.get<uint32_t>() == files.size()); 
+  int64_t mtime, size; 
+  for (unsigned int i = 0; valid && i < files.size(); ++i) {
+    string name = r.getString();
+    int64_t smtime = r.get<int64_t>(); 
+    int64_t ssize = r.get<int64_t>(); 
+    fileStat(files[i], mtime, size); 
+    valid = r.ok() && (name == files[i]) && (smtime == mtime) && (ssize == size);
+  }
+
+  if (valid) {
+    if ("tb" == section || "tbm" == section || "dac" == section) {
+      vector<vector<pair<string, uint8_t> > > v = r.getDacs(); 
+      unsigned int nexpected = ("tb" == section ? 1 : ("tbm" == section ? fnTbms : fnRocs)); 
+      valid = r.atEnd() && (v.size() == nexpected); 
+      if (valid && "tb" == section) {
+	fTbParameters = v[0]; 
+	fReadTbParameters = true; 
+      } else if (valid && "tbm" == section) {
+	fTbmParameters = v; 
+	fReadTbmParameters = true; 
+      } else if (valid) {
+	fDacParameters = v; 
+	fReadDacParameters = true; 
+      }
+    } else if ("trim" == section) {
+      vector<vector<pxar::pixelConfig> > v(r.get<uint32_t>()); 
+      for (unsigned int i = 0; r.ok() && i < v.size(); ++i) {
+	v[i].resize(r.get<uint32_t>());
+	for (unsigned int j = 0; r.ok() && j < v[i].size(); ++j) {
+	  v[i][j].column = r.get<uint8_t>();
+	  v[i][j].row    = r.get<uint8_t>();
+	  v[i][j].trim   = r.get<uint8_t>();
+	  v[i][j].mask   = (r.get<uint8_t>() > 0);
+	  v[i][j].enable = (r.get<uint8_t>() > 0);
+	}
+      }
+      valid = r.atEnd() && (v.size() == fnRocs); 
+      if (valid) {
+	fRocPixelConfigs = v; 
+	fReadRocPixelConfig = true; 
+      }
+    } else if ("gainped" == section) {
+      vector<vector<gainPedestalParameters> > v(r.get<uint32_t>()); 
+      for (unsigned int i = 0; r.ok() && i < v.size(); ++i) {
+	v[i].resize(r.get<uint32_t>());
+	for (unsigned int j = 0; r.ok() && j < v[i].size(); ++j) {
+	  v[i][j].p0 = r.get<double>();
+	  v[i][j].p1 = r.get<double>();
+	  v[i][j].p2 = r.get<double>();
+	  v[i][j].p3 = r.get<double>();
+	}
+      }
+      valid = r.atEnd() && (v.size() == fnRocs); 
+      if (valid) fGainPedestalParameters = v; 
+    } else {
+      valid = false;
+    }
+  }
+
+  if (!valid) {
+    LOG(logDEBUG) << "snapshot section " << section << " is outdated";
+    fSnapshotSections.erase(it); 
+    return false;
+  }
+  
+  LOG(logINFO) << "      restored " << section << " parameters from " << fDirectory << "/" << fSnapshotFileName;
+  return true;
+}
+
+
+// ----------------------------------------------------------------------
+void ConfigParameters::storeSection(const string &section) {
+  if (!fUseSnapshot) return;
+  if (!fSnapshotRead) readSnapshot();
+  
+  string data; 
+  vector<string> files = getSectionFiles(section);
+  putValue<uint32_t>(data, static_cast<uint32_t>(files.size()));
+  int64_t mtime, size; 
+  for (unsigned int i = 0; i < files.size(); ++i) {
+    fileStat(files[i], mtime, size); 
+    putString(data, files[i]);
+    putValue<int64_t>(data, mtime);
+    putValue<int64_t>(data, size);
+  }
+
+  if ("tb" == section) {
+    putDacs(data, vector<vector<pair<string, uint8_t> > >(1, fTbParameters)); 
+  } else if ("tbm" == section) {
+    putDacs(data, fTbmParameters); 
+  } else if ("dac" == section) {
+    putDacs(data, fDacParameters); 
+  } else if ("trim" == section) {
+    putValue<uint32_t>(data, static_cast<uint32_t>(fRocPixelConfigs.size()));
+    for (unsigned int i = 0; i < fRocPixelConfigs.size(); ++i) {
+      putValue<uint32_t>(data, static_cast<uint32_t>(fRocPixelConfigs[i].size()));
+      for (unsigned int j = 0; j < fRocPixelConfigs[i].size(); ++j) {
+	putValue<uint8_t>(data, fRocPixelConfigs[i][j].column);
+	putValue<uint8_t>(data, fRocPixelConfigs[i][j].row);
+	putValue<uint8_t>(data, fRocPixelConfigs[i][j].trim);
+	putValue<uint8_t>(data, fRocPixelConfigs[i][j].mask ? 1 : 0);
+	putValue<uint8_t>(data, fRocPixelConfigs[i][j].enable ? 1 : 0);
+      }
+    }
+  } else if ("gainped" == section) {
+    putValue<uint32_t>(data, static_cast<uint32_t>(fGainPedestalParameters.size()));
+    for (unsigned int i = 0; i < fGainPedestalParameters.size(); ++i) {
+      putValue<uint32_t>(data, static_cast<uint32_t>(fGainPedestalParameters[i].size()));
+      for (unsigned int j = 0; j < fGainPedestalParameters[i].size(); ++j) {
+	putValue<double>(data, fGainPedestalParameters[i][j].p0);
+	putValue<double>(data, fGainPedestalParameters[i][j].p1);
+	putValue<double>(data, fGainPedestalParameters[i][j].p2);
+	putValue<double>(data, fGainPedestalParameters[i][j].p3);
+      }
+    }
+  } else {
+    return;
+  }
+
+  fSnapshotSections[section] = data; 
+  writeSnapshot();
+}
+
+
 // ----------------------------------------------------------------------
 bool ConfigParameters::bothAreSpaces(char lhs, char rhs) { 
   return (lhs == rhs) && (lhs == ' '); 
@@ -23,6 +23,7 @@ typedef char int8_t;
 #include <string>
 #include <sstream>
 #include <vector>
+#include <map>
 
 #include "api.h"
 
@@ -72,6 +73,7 @@ public:
   std::string getDirectory()              {return fDirectory;}
   std::string getRocType()                {return fRocType;}
   std::string getTbmType()                {return fTbmType;}
+  std::string getSnapshotFileName()       {return fSnapshotFileName;}
 
   std::vector<std::pair<std::string,uint8_t> >  getTbParameters();
   std::vector<std::pair<std::string,double> >  getTbPowerSettings();
@@ -106,6 +108,9 @@ public:
   void setDebugFileName(std::string filename) {fMaskFileName = filename;}
   void setMaskFileName(std::string filename) {fDebugFileName = filename;}
   void setDirectory(std::string dirname) {fDirectory = dirname;}
+  void setSnapshotFileName(std::string filename) {fSnapshotFileName = filename;}
+  // -- keep a binary snapshot of the parsed DAC, trim, mask and gain/pedestal files in the module directory
+  void setUseSnapshot(bool a) {fUseSnapshot = a;}
 
   void setGuiMode(bool a) {fGuiMode = a;}
 
@@ -134,6 +139,18 @@ public:
 
 private:
 
+  // -- binary snapshot cache: one serialized section per group of text files, 
+  //    valid as long as all file names, mtimes and sizes match
+  void readSnapshot();
+  void writeSnapshot();
+  bool restoreSection(const std::string &section);
+  void storeSection(const std::string &section);
+  std::vector<std::string> getSectionFiles(const std::string &section);
+
+  bool fUseSnapshot, fSnapshotRead;
+  std::string fSnapshotFileName;
+  std::map<std::string, std::string> fSnapshotSections;
+
   bool fReadTbParameters, fReadTbmParameters, fReadDacParameters, fReadRocPixelConfig;
   std::vector<std::pair<std::string, uint8_t> > fTbParameters;
   std::vector<std::pair<std::string, double> > fTbPowerSettings;